@@ -7,6 +7,23 @@
 #include <unicode/unistr.h>
 #include <unicode/normalizer2.h>
 #include <unicode/errorcode.h>
+#include <unicode/bytestream.h>
+#include <unicode/uvernum.h>
+
+// Optional codecs for compressed NDJSON input.
+#ifdef FELIX_WITH_ZLIB
+  #include <zlib.h>
+#endif
+#ifdef FELIX_WITH_ZSTD
+  #include <zstd.h>
+#endif
+
+// POSIX: memory-mapped segment and run files, store locking.
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 // JSON dependency: nlohmann/json (header-only). Prefer system install, fall back to local json.hpp.
 #if __has_include(<nlohmann/json.hpp>)
@@ -20,21 +37,41 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cctype>
+#include <charconv>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
 #include <cmath>
 #include <cstdint>
 #include <cstddef>
+#include <cstdlib>
 #include <cstring>
+#include <deque>
 #include <exception>
+#include <filesystem>
 #include <fstream>
 #include <functional>
+#include <future>
 #include <iostream>
+#include <iterator>
 #include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <optional>
+#include <queue>
+#include <random>
 #include <sstream>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 //#include <span>
@@ -49,51 +86,253 @@ using json = nlohmann::json;
 // - ICU NFC canonicalization for text
 // ------------------------------------------------------------
 
-static inline std::string trim_copy(std::string_view sv) {
+// ------------------------------------------------------------
+// Ingest instrumentation
+//
+// Process-wide per-stage timers for the ingest path. Off by default; when
+// off a StageTimer costs one relaxed atomic load. When on, each stage keeps
+// a count, a total and a coarse latency histogram (x4 buckets from 1 us),
+// all lock-free so pipeline worker threads can record directly.
+// Nested stages overlap: canonicalize includes nfc.
+// ------------------------------------------------------------
+
+enum class IngestStage : uint8_t {
+  Parse, Canonicalize, Nfc, Hash, Resolve, GetCurrent, InsertFact, UpsertCurrent, Commit
+};
+static constexpr size_t kIngestStages = 9;
+static constexpr const char* kIngestStageNames[kIngestStages] = {
+  "parse", "canonicalize", "nfc", "sha256", "resolve", "get_current", "insert_fact", "upsert_current", "commit"
+};
+
+// Bucket b holds samples <= 1us * 4^b; the last bucket is unbounded.
+static constexpr size_t kStatBuckets = 12;
+
+struct StageCounters {
+  std::atomic<uint64_t> count{0};
+  std::atomic<uint64_t> ns{0};
+  std::atomic<uint64_t> buckets[kStatBuckets]{};
+};
+
+struct IngestStats {
+  std::atomic<bool> enabled{false};
+  StageCounters stages[kIngestStages];
+  std::atomic<uint64_t> updates{0};     // record updates applied (incl. retried batches)
+  std::atomic<uint64_t> facts{0};       // facts written (incl. retried batches)
+  std::atomic<uint64_t> suppressed{0};  // event mode: value unchanged, no fact
+
+  void record(IngestStage s, uint64_t ns_) {
+    StageCounters& c = stages[(size_t)s];
+    c.count.fetch_add(1, std::memory_order_relaxed);
+    c.ns.fetch_add(ns_, std::memory_order_relaxed);
+    size_t b = 0;
+    for (uint64_t lim = 1000; b + 1 < kStatBuckets && ns_ > lim; lim *= 4) b++;
+    c.buckets[b].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void bump(std::atomic<uint64_t>& n) {
+    if (enabled.load(std::memory_order_relaxed)) n.fetch_add(1, std::memory_order_relaxed);
+  }
+};
+
+static IngestStats g_ingest_stats;
+
+static inline double stat_bucket_le_us(size_t b) {
+  double us = 1;
+  for (size_t i = 0; i < b; i++) us *= 4;
+  return us;
+}
+
+class StageTimer {
+public:
+  explicit StageTimer(IngestStage s) : stage_(s), on_(g_ingest_stats.enabled.load(std::memory_order_relaxed)) {
+    if (on_) t0_ = std::chrono::steady_clock::now();
+  }
+  ~StageTimer() {
+    if (!on_) return;
+    auto d = std::chrono::steady_clock::now() - t0_;
+    g_ingest_stats.record(stage_, (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+  }
+  StageTimer(const StageTimer&) = delete;
+  StageTimer& operator=(const StageTimer&) = delete;
+
+private:
+  IngestStage stage_;
+  bool on_;
+  std::chrono::steady_clock::time_point t0_{};
+};
+
+// Upper bound of the bucket holding quantile q.
+static double stage_quantile_le_us(const uint64_t (&b)[kStatBuckets], uint64_t count, double q) {
+  uint64_t want = (uint64_t)std::ceil(q * (double)count), seen = 0;
+  for (size_t i = 0; i < kStatBuckets; i++) {
+    seen += b[i];
+    if (seen >= want && seen > 0) return stat_bucket_le_us(i);
+  }
+  return stat_bucket_le_us(kStatBuckets - 1);
+}
+
+static json ingest_stats_json() {
+  json stages = json::object();
+  for (size_t s = 0; s < kIngestStages; s++) {
+    const StageCounters& c = g_ingest_stats.stages[s];
+    uint64_t n = c.count.load(std::memory_order_relaxed);
+    if (n == 0) continue;
+    uint64_t b[kStatBuckets];
+    for (size_t i = 0; i < kStatBuckets; i++) b[i] = c.buckets[i].load(std::memory_order_relaxed);
+    double total_us = (double)c.ns.load(std::memory_order_relaxed) / 1e3;
+    stages[kIngestStageNames[s]] = json{
+      {"count", n},
+      {"total_us", total_us},
+      {"mean_us", total_us / (double)n},
+      {"p50_le_us", stage_quantile_le_us(b, n, 0.50)},
+      {"p99_le_us", stage_quantile_le_us(b, n, 0.99)}
+    };
+  }
+  return json{
+    {"updates", g_ingest_stats.updates.load(std::memory_order_relaxed)},
+    {"facts_written", g_ingest_stats.facts.load(std::memory_order_relaxed)},
+    {"facts_suppressed", g_ingest_stats.suppressed.load(std::memory_order_relaxed)},
+    {"stages", stages}
+  };
+}
+
+// Prometheus text exposition (format 0.0.4) of the same counters.
+static std::string ingest_stats_prometheus() {
+  std::ostringstream o;
+  o.precision(10);
+  o << "# TYPE felix_ingest_updates_total counter\n"
+    << "felix_ingest_updates_total " << g_ingest_stats.updates.load(std::memory_order_relaxed) << "\n"
+    << "# TYPE felix_ingest_facts_written_total counter\n"
+    << "felix_ingest_facts_written_total " << g_ingest_stats.facts.load(std::memory_order_relaxed) << "\n"
+    << "# TYPE felix_ingest_facts_suppressed_total counter\n"
+    << "felix_ingest_facts_suppressed_total " << g_ingest_stats.suppressed.load(std::memory_order_relaxed) << "\n"
+    << "# TYPE felix_ingest_stage_seconds histogram\n";
+  for (size_t s = 0; s < kIngestStages; s++) {
+    const StageCounters& c = g_ingest_stats.stages[s];
+    const char* name = kIngestStageNames[s];
+    uint64_t cum = 0;
+    for (size_t i = 0; i + 1 < kStatBuckets; i++) {
+      cum += c.buckets[i].load(std::memory_order_relaxed);
+      o << "felix_ingest_stage_seconds_bucket{stage=\"" << name << "\",le=\"" << stat_bucket_le_us(i) / 1e6
+        << "\"} " << cum << "\n";
+    }
+    cum += c.buckets[kStatBuckets - 1].load(std::memory_order_relaxed);
+    o << "felix_ingest_stage_seconds_bucket{stage=\"" << name << "\",le=\"+Inf\"} " << cum << "\n"
+      << "felix_ingest_stage_seconds_sum{stage=\"" << name << "\"} "
+      << (double)c.ns.load(std::memory_order_relaxed) / 1e9 << "\n"
+      << "felix_ingest_stage_seconds_count{stage=\"" << name << "\"} "
+      << c.count.load(std::memory_order_relaxed) << "\n";
+  }
+  return o.str();
+}
+
+static inline std::string_view trim_view(std::string_view sv) {
   size_t b = 0;
   while (b < sv.size() && std::isspace(static_cast<unsigned char>(sv[b]))) b++;
   size_t e = sv.size();
   while (e > b && std::isspace(static_cast<unsigned char>(sv[e - 1]))) e--;
-  return std::string(sv.substr(b, e - b));
+  return sv.substr(b, e - b);
+}
+
+static inline std::string trim_copy(std::string_view sv) { return std::string(trim_view(sv)); }
+
+// Length of the leading pure-ASCII prefix, scanning eight bytes at a time.
+static inline size_t ascii_prefix_len(std::string_view s) {
+  size_t i = 0;
+  const size_t n = s.size();
+  for (; i + 8 <= n; i += 8) {
+    uint64_t w;
+    std::memcpy(&w, s.data() + i, sizeof(w));
+    if (w & 0x8080808080808080ULL) break;
+  }
+  while (i < n && static_cast<unsigned char>(s[i]) < 0x80) i++;
+  return i;
+}
+
+static inline bool is_ascii(std::string_view s) { return ascii_prefix_len(s) == s.size(); }
+
+// Strict UTF-8 well-formedness (Unicode Table 3-7): no overlongs, no
+// surrogates, nothing above U+10FFFF. This accepts exactly the inputs that
+// survive an ICU UTF-8 -> UTF-16 -> UTF-8 round-trip unchanged.
+static inline bool is_valid_utf8(std::string_view sv) {
+  const auto* p = reinterpret_cast<const unsigned char*>(sv.data());
+  const size_t n = sv.size();
+  size_t i = ascii_prefix_len(sv);
+  auto cont = [&](size_t k, unsigned char lo = 0x80, unsigned char hi = 0xBF) {
+    return i + k < n && p[i + k] >= lo && p[i + k] <= hi;
+  };
+  while (i < n) {
+    unsigned char c = p[i];
+    if (c < 0x80) {
+      i += ascii_prefix_len(sv.substr(i));
+      continue;
+    }
+    if (c >= 0xC2 && c <= 0xDF) {
+      if (!cont(1)) return false;
+      i += 2;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+      unsigned char lo = (c == 0xE0) ? 0xA0 : 0x80;
+      unsigned char hi = (c == 0xED) ? 0x9F : 0xBF;
+      if (!cont(1, lo, hi) || !cont(2)) return false;
+      i += 3;
+    } else if (c >= 0xF0 && c <= 0xF4) {
+      unsigned char lo = (c == 0xF0) ? 0x90 : 0x80;
+      unsigned char hi = (c == 0xF4) ? 0x8F : 0xBF;
+      if (!cont(1, lo, hi) || !cont(2) || !cont(3)) return false;
+      i += 4;
+    } else {
+      return false;
+    }
+  }
+  return true;
 }
 
 static inline void require_utf8(std::string_view s, const char* what) {
-  icu::UnicodeString u = icu::UnicodeString::fromUTF8(icu::StringPiece(s.data(), (int)s.size()));
-  std::string round;
-  u.toUTF8String(round);
-  if (round.size() != s.size() || round != std::string(s)) {
+  if (!is_valid_utf8(s)) {
     throw std::runtime_error(std::string("invalid UTF-8 in ") + what);
   }
 }
 
-static inline std::vector<uint8_t> base64_decode_strict(const std::string& b64) {
-  std::string s;
-  s.reserve(b64.size());
-  for (unsigned char c : b64) {
-    if (c == ' ' || c == '\t' || c == '\r' || c == '\n') continue;
-    s.push_back((char)c);
+// Upper bound of base64_decode_into's output for b64.
+static inline size_t base64_decoded_max(std::string_view b64) { return (b64.size() * 3) / 4 + 4; }
+
+// Decodes strict base64 (ASCII whitespace is skipped) into out, which must
+// hold base64_decoded_max(b64) bytes, and returns the decoded length. Only
+// input with whitespace is compacted into a temporary first.
+static inline size_t base64_decode_into(std::string_view b64, uint8_t* out) {
+  auto is_ws = [](char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; };
+  std::string compact;
+  std::string_view s = b64;
+  if (std::any_of(b64.begin(), b64.end(), is_ws)) {
+    compact.reserve(b64.size());
+    for (char c : b64) {
+      if (!is_ws(c)) compact.push_back(c);
+    }
+    s = compact;
   }
-  if (s.empty()) return {};
+  if (s.empty()) return 0;
 
-  std::vector<uint8_t> out((s.size() * 3) / 4 + 4);
-  int n = EVP_DecodeBlock(out.data(),
+  int n = EVP_DecodeBlock(out,
                           reinterpret_cast<const unsigned char*>(s.data()),
                           (int)s.size());
   if (n < 0) throw std::runtime_error("invalid base64 for bytes");
-  out.resize((size_t)n);
 
   size_t pad = 0;
-  if (!s.empty() && s.back() == '=') pad++;
+  if (s.back() == '=') pad++;
   if (s.size() >= 2 && s[s.size() - 2] == '=') pad++;
-  if (pad) {
-    if (out.size() < pad) throw std::runtime_error("invalid base64 padding for bytes");
-    out.resize(out.size() - pad);
-  }
+  if ((size_t)n < pad) throw std::runtime_error("invalid base64 padding for bytes");
+  return (size_t)n - pad;
+}
+
+static inline std::vector<uint8_t> base64_decode_strict(std::string_view b64) {
+  std::vector<uint8_t> out(base64_decoded_max(b64));
+  out.resize(base64_decode_into(b64, out.data()));
   return out;
 }
 
-static inline std::string canonicalize_uuid(std::string_view in) {
-  std::string s = trim_copy(in);
+// Writes the canonical (lowercase) form of a uuid to out[0..36).
+static inline void canonicalize_uuid_into(std::string_view in, char* out) {
+  std::string_view s = trim_view(in);
   if (s.size() != 36) throw std::runtime_error("invalid uuid length");
   auto is_hex = [](char c) {
     return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
@@ -102,15 +341,25 @@ static inline std::string canonicalize_uuid(std::string_view in) {
     char c = s[i];
     if (i == 8 || i == 13 || i == 18 || i == 23) {
       if (c != '-') throw std::runtime_error("invalid uuid format");
+      out[i] = c;
       continue;
     }
     if (!is_hex(c)) throw std::runtime_error("invalid uuid format");
-    s[i] = (char)std::tolower((unsigned char)c);
+    out[i] = (char)std::tolower((unsigned char)c);
   }
+}
+
+static inline std::string canonicalize_uuid(std::string_view in) {
+  std::string s(36, '\0');
+  canonicalize_uuid_into(in, s.data());
   return s;
 }
 
 static inline std::string nfc_normalize_utf8(std::string_view utf8_in) {
+  // ASCII is always in NFC.
+  if (is_ascii(utf8_in)) return std::string(utf8_in);
+  StageTimer timer(IngestStage::Nfc);
+
   // ICU NFC normalization
   UErrorCode status = U_ZERO_ERROR;
   const icu::Normalizer2* norm = icu::Normalizer2::getNFCInstance(status);
@@ -118,6 +367,20 @@ static inline std::string nfc_normalize_utf8(std::string_view utf8_in) {
     throw std::runtime_error("ICU: failed to get NFC normalizer");
   }
 
+#if U_ICU_VERSION_MAJOR_NUM >= 60
+  // Work on UTF-8 directly: check first, and only normalize when needed.
+  const icu::StringPiece sp(utf8_in.data(), (int)utf8_in.size());
+  if (norm->isNormalizedUTF8(sp, status) && U_SUCCESS(status)) return std::string(utf8_in);
+
+  std::string utf8_out;
+  icu::StringByteSink<std::string> sink(&utf8_out, (int32_t)utf8_in.size());
+  status = U_ZERO_ERROR;
+  norm->normalizeUTF8(0, sp, sink, nullptr, status);
+  if (U_FAILURE(status)) {
+    throw std::runtime_error("ICU: NFC normalize failed");
+  }
+  return utf8_out;
+#else
   icu::UnicodeString u = icu::UnicodeString::fromUTF8(icu::StringPiece(utf8_in.data(), (int)utf8_in.size()));
   icu::UnicodeString out;
   status = U_ZERO_ERROR;
@@ -129,28 +392,59 @@ static inline std::string nfc_normalize_utf8(std::string_view utf8_in) {
   std::string utf8_out;
   out.toUTF8String(utf8_out);
   return utf8_out;
+#endif
 }
 
-static inline std::array<uint8_t, 32> sha256_bytes(const uint8_t* data, size_t len) {
-  std::array<uint8_t, 32> out{};
+// Reusable SHA-256 hasher. The EVP_MD is fetched once per process and each
+// thread keeps one EVP_MD_CTX that is re-initialized per digest, so hashing
+// never allocates. Input can be streamed in pieces without concatenation.
+class Sha256 {
+public:
+  Sha256() : ctx_(EVP_MD_CTX_new()) {
+    if (!ctx_) throw std::runtime_error("OpenSSL: EVP_MD_CTX_new failed");
+  }
+  Sha256(const Sha256&) = delete;
+  Sha256& operator=(const Sha256&) = delete;
+  ~Sha256() { EVP_MD_CTX_free(ctx_); }
+
+  static Sha256& local() {
+    thread_local Sha256 h;
+    return h;
+  }
 
-  // EVP digest calculation
-  EVP_MD_CTX* ctx = EVP_MD_CTX_new();
-  if (!ctx) throw std::runtime_error("OpenSSL: EVP_MD_CTX_new failed");
+  Sha256& init() {
+    if (EVP_DigestInit_ex(ctx_, md(), nullptr) != 1) throw std::runtime_error("OpenSSL: EVP sha256 digest failed");
+    return *this;
+  }
 
-  unsigned int out_len = 0;
-  if (EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr) != 1 ||
-      EVP_DigestUpdate(ctx, data, len) != 1 ||
-      EVP_DigestFinal_ex(ctx, out.data(), &out_len) != 1) {
-    EVP_MD_CTX_free(ctx);
-    throw std::runtime_error("OpenSSL: EVP sha256 digest failed");
+  Sha256& update(const void* data, size_t len) {
+    if (len && EVP_DigestUpdate(ctx_, data, len) != 1) throw std::runtime_error("OpenSSL: EVP sha256 digest failed");
+    return *this;
   }
 
-  EVP_MD_CTX_free(ctx);
-  if (out_len != out.size()) {
-    throw std::runtime_error("OpenSSL: unexpected SHA-256 digest length");
+  std::array<uint8_t, 32> final() {
+    std::array<uint8_t, 32> out{};
+    unsigned int out_len = 0;
+    if (EVP_DigestFinal_ex(ctx_, out.data(), &out_len) != 1) throw std::runtime_error("OpenSSL: EVP sha256 digest failed");
+    if (out_len != out.size()) throw std::runtime_error("OpenSSL: unexpected SHA-256 digest length");
+    return out;
   }
-  return out;
+
+private:
+  EVP_MD_CTX* ctx_;
+
+  static const EVP_MD* md() {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    // Explicit fetch avoids the implicit provider lookup EVP_sha256() costs on every init.
+    static const std::unique_ptr<EVP_MD, decltype(&EVP_MD_free)> fetched(EVP_MD_fetch(nullptr, "SHA256", nullptr), &EVP_MD_free);
+    if (fetched) return fetched.get();
+#endif
+    return EVP_sha256();
+  }
+};
+
+static inline std::array<uint8_t, 32> sha256_bytes(const uint8_t* data, size_t len) {
+  return Sha256::local().init().update(data, len).final();
 }
 
 // Type tags and versioning for hashing/tag mapping.
@@ -178,13 +472,10 @@ static inline std::array<uint8_t, 32> sha256_typed(TagMapVersion tagmap,
                                                          LogicalType logical_type,
                                                          const uint8_t* canon_bytes,
                                                          size_t canon_len) {
-  const uint8_t tag = type_tag_byte(tagmap, logical_type);
-  std::vector<uint8_t> buf;
-  buf.reserve(1 + (hfmt == HashFormatVersion::FelixV03Sep ? 1 : 0) + canon_len);
-  buf.push_back(tag);
-  if (hfmt == HashFormatVersion::FelixV03Sep) buf.push_back(0x00);
-  buf.insert(buf.end(), canon_bytes, canon_bytes + canon_len);
-  return sha256_bytes(buf.data(), buf.size());
+  StageTimer timer(IngestStage::Hash);
+  const uint8_t head[2] = {type_tag_byte(tagmap, logical_type), 0x00};
+  const size_t head_len = (hfmt == HashFormatVersion::FelixV03Sep) ? 2 : 1;
+  return Sha256::local().init().update(head, head_len).update(canon_bytes, canon_len).final();
 }
 
 
@@ -292,7 +583,7 @@ static inline std::string type_to_string(LogicalType t) {
 }
 
 static inline LogicalType parse_type(std::string_view s) {
-  LogicalType t = logical_type_from_string(trim_copy(s));
+  LogicalType t = logical_type_from_string(trim_view(s));
   if (t == LogicalType::JsonReserved) {
     throw std::runtime_error("type json is reserved in Felix v0.3 and is not accepted by this implementation");
   }
@@ -304,91 +595,251 @@ struct CanonValue {
   // Exactly one of canon_text or canon_blob is used depending on logical_type.
   std::string canon_text;                 // for text, int, float, bool, null, uuid
   std::vector<uint8_t> canon_blob;        // for bytes
-  std::array<uint8_t, 32> hash{};         // computed at insertion time based on DB format
+  std::array<uint8_t, 32> hash{};         // identity hash under the DB's tag map / hash format
+  bool hashed{false};                     // hash already computed (e.g. by an import worker)
+  TagMapVersion hash_tagmap{};            // format the hash was computed under
+  HashFormatVersion hash_format{};
 };
 
+// Non-owning form of CanonValue carried by ingest items: canon is the
+// canonical text, or the raw bytes for LogicalType::Bytes.
+struct CanonView {
+  LogicalType logical_type{};
+  std::string_view canon;
+  std::array<uint8_t, 32> hash{};
+  bool hashed{false};
+  TagMapVersion hash_tagmap{};
+  HashFormatVersion hash_format{};
+};
 
-static inline std::string canonicalize_float64(double d) {
+static inline CanonView canon_view_of(const CanonValue& cv) {
+  CanonView v{};
+  v.logical_type = cv.logical_type;
+  v.canon = cv.logical_type == LogicalType::Bytes
+              ? std::string_view(reinterpret_cast<const char*>(cv.canon_blob.data()), cv.canon_blob.size())
+              : std::string_view(cv.canon_text);
+  v.hash = cv.hash;
+  v.hashed = cv.hashed;
+  v.hash_tagmap = cv.hash_tagmap;
+  v.hash_format = cv.hash_format;
+  return v;
+}
+
+static inline CanonValue canon_value_of(const CanonView& v) {
+  CanonValue cv{};
+  cv.logical_type = v.logical_type;
+  if (v.logical_type == LogicalType::Bytes) cv.canon_blob.assign(v.canon.begin(), v.canon.end());
+  else cv.canon_text = std::string(v.canon);
+  cv.hash = v.hash;
+  cv.hashed = v.hashed;
+  cv.hash_tagmap = v.hash_tagmap;
+  cv.hash_format = v.hash_format;
+  return cv;
+}
+
+// Bump allocator behind one chunk of parsed ingest records. Field names,
+// canonical values and item arrays are carved out of a few blocks and freed
+// together with the arena, so parsing a line does not touch malloc per
+// item. Only trivially destructible objects live here; an arena is filled
+// by one thread and read-only once its records are handed on.
+class IngestArena {
+public:
+  IngestArena() = default;
+  IngestArena(const IngestArena&) = delete;
+  IngestArena& operator=(const IngestArena&) = delete;
+
+  char* alloc(size_t n, size_t align = 1) {
+    size_t pad = padding(align);
+    if (n + pad > (size_t)(end_ - p_)) {
+      grow(n + align);
+      pad = padding(align);
+    }
+    char* at = p_ + pad;
+    p_ = at + n;
+    return at;
+  }
+
+  std::string_view copy(std::string_view s) {
+    if (s.empty()) return {};
+    char* at = alloc(s.size());
+    std::memcpy(at, s.data(), s.size());
+    return {at, s.size()};
+  }
+
+  // A copy of cv whose canonical bytes live in the arena.
+  CanonView copy(const CanonValue& cv) {
+    CanonView v = canon_view_of(cv);
+    v.canon = copy(v.canon);
+    return v;
+  }
+
+  template <class T>
+  T* make_array(size_t n) {
+    static_assert(std::is_trivially_destructible_v<T>, "arena objects are never destroyed");
+    T* at = reinterpret_cast<T*>(alloc(n * sizeof(T), alignof(T)));
+    for (size_t i = 0; i < n; i++) new (at + i) T();
+    return at;
+  }
+
+private:
+  static constexpr size_t kFirstBlock = 4096;
+  static constexpr size_t kMaxBlock = 1u << 20;
+
+  std::vector<std::unique_ptr<char[]>> blocks_;
+  char* p_{nullptr};
+  char* end_{nullptr};
+  size_t next_block_{kFirstBlock};
+
+  size_t padding(size_t align) const { return (align - ((uintptr_t)p_ & (align - 1))) & (align - 1); }
+
+  // Oversized requests (large text or bytes) get a block of their own.
+  void grow(size_t need) {
+    const size_t size = std::max(need, next_block_);
+    next_block_ = std::min(next_block_ * 2, kMaxBlock);
+    blocks_.emplace_back(new char[size]);
+    p_ = blocks_.back().get();
+    end_ = p_ + size;
+  }
+};
+
+// NFC form of s, written to arena. ASCII is always in NFC and copied as is.
+static inline std::string_view nfc_normalize_into(std::string_view s, IngestArena& arena) {
+  return is_ascii(s) ? arena.copy(s) : arena.copy(nfc_normalize_utf8(s));
+}
+
+// Size of the buffer canonicalize_float64_into writes to.
+static constexpr size_t kFloatCanonMax = 128;
+
+// Canonical text of d in buf; returns its length.
+static inline size_t canonicalize_float64_into(double d, char (&buf)[kFloatCanonMax]) {
+  auto put = [&](std::string_view lit) {
+    std::memcpy(buf, lit.data(), lit.size());
+    return lit.size();
+  };
   if (std::isnan(d)) throw std::runtime_error("NaN is not allowed for float");
-  if (std::isinf(d)) return std::signbit(d) ? "-inf" : "inf";
-  if (d == 0.0) return "0"; // normalizes -0 to 0
+  if (std::isinf(d)) return put(std::signbit(d) ? "-inf" : "inf");
+  if (d == 0.0) return put("0"); // normalizes -0 to 0
 
   // Use nlohmann::detail::to_chars for broad libstdc++ compatibility.
-  char buf[128];
-  char* end = nlohmann::detail::to_chars(buf, buf + sizeof(buf), d);
+  char* end = nlohmann::detail::to_chars(buf, buf + kFloatCanonMax, d);
   if (end == nullptr) throw std::runtime_error("float canonicalization failed");
-  std::string s(buf, end);
+  size_t len = (size_t)(end - buf);
 
   // Lowercase exponent marker if present.
-  for (char& c : s) if (c == 'E') c = 'e';
+  size_t epos = len;
+  for (size_t i = 0; i < len; i++) {
+    if (buf[i] == 'E') buf[i] = 'e';
+    if (buf[i] == 'e' && epos == len) epos = i;
+  }
 
   // Trim trailing zeros after decimal point in mantissa.
-  auto epos = s.find('e');
-  std::string mant = (epos == std::string::npos) ? s : s.substr(0, epos);
-  std::string exp  = (epos == std::string::npos) ? "" : s.substr(epos);
-
-  auto dot = mant.find('.');
-  if (dot != std::string::npos) {
-    while (!mant.empty() && mant.back() == '0') mant.pop_back();
-    if (!mant.empty() && mant.back() == '.') mant.pop_back();
+  size_t mant = epos;
+  if (std::memchr(buf, '.', epos)) {
+    while (mant > 0 && buf[mant - 1] == '0') mant--;
+    if (mant > 0 && buf[mant - 1] == '.') mant--;
   }
+  std::memmove(buf + mant, buf + epos, len - epos);
+  len = mant + (len - epos);
 
-  s = mant + exp;
-  if (s == "-0") s = "0";
-  return s;
+  if (std::string_view(buf, len) == "-0") return put("0");
+  return len;
 }
 
-static inline CanonValue canonicalize_typed_value(LogicalType t, const json& v) {
-  CanonValue cv{};
+static inline std::string canonicalize_float64(double d) {
+  char buf[kFloatCanonMax];
+  return std::string(buf, canonicalize_float64_into(d, buf));
+}
+
+// A JSON scalar as the typed canonicalizer sees it. Integers carry both
+// their int64 value (unsigned values wrap, as json::get<int64_t> does) and
+// their double value. s views a decoded string owned by the caller.
+struct JsonScalar {
+  enum class Kind : uint8_t { Null, Bool, Integer, Float, String, Other };
+  Kind kind{Kind::Null};
+  bool b{false};
+  int64_t i{0};
+  double d{0};
+  std::string_view s;
+};
+
+static inline JsonScalar json_scalar_of(const json& v) {
+  JsonScalar x{};
+  if (v.is_null()) {
+    x.kind = JsonScalar::Kind::Null;
+  } else if (v.is_boolean()) {
+    x.kind = JsonScalar::Kind::Bool;
+    x.b = v.get<bool>();
+  } else if (v.is_number_integer()) {
+    x.kind = JsonScalar::Kind::Integer;
+    x.i = v.get<int64_t>();
+    x.d = v.get<double>();
+  } else if (v.is_number()) {
+    x.kind = JsonScalar::Kind::Float;
+    x.d = v.get<double>();
+  } else if (v.is_string()) {
+    x.kind = JsonScalar::Kind::String;
+    x.s = v.get_ref<const std::string&>();
+  } else {
+    x.kind = JsonScalar::Kind::Other;
+  }
+  return x;
+}
+
+// Canonicalizes v for ingest: the fixed literals stay static, every other
+// canonical form is written to arena.
+static inline CanonView canonicalize_typed_value(LogicalType t, const JsonScalar& v, IngestArena& arena) {
+  StageTimer timer(IngestStage::Canonicalize);
+  using Kind = JsonScalar::Kind;
+  CanonView cv{};
   cv.logical_type = t;
 
   if (t == LogicalType::Null) {
-    cv.canon_text = "null";
+    cv.canon = "null";
     return cv;
   }
 
   if (t == LogicalType::Bool) {
-    if (!v.is_boolean()) throw std::runtime_error("bool value must be JSON boolean");
-    cv.canon_text = v.get<bool>() ? "true" : "false";
+    if (v.kind != Kind::Bool) throw std::runtime_error("bool value must be JSON boolean");
+    cv.canon = v.b ? "true" : "false";
     return cv;
   }
 
   if (t == LogicalType::Int) {
-    if (!v.is_number_integer()) throw std::runtime_error("int value must be JSON integer");
-    int64_t x = v.get<int64_t>();
-    cv.canon_text = std::to_string(x);
+    if (v.kind != Kind::Integer) throw std::runtime_error("int value must be JSON integer");
+    char buf[24];
+    auto r = std::to_chars(buf, buf + sizeof(buf), v.i);
+    cv.canon = arena.copy(std::string_view(buf, (size_t)(r.ptr - buf)));
     return cv;
   }
 
   if (t == LogicalType::Float) {
-    if (!v.is_number()) throw std::runtime_error("float value must be JSON number");
-    double d = v.get<double>();
-    cv.canon_text = canonicalize_float64(d);
+    if (v.kind != Kind::Integer && v.kind != Kind::Float) throw std::runtime_error("float value must be JSON number");
+    char buf[kFloatCanonMax];
+    cv.canon = arena.copy(std::string_view(buf, canonicalize_float64_into(v.d, buf)));
     return cv;
   }
 
   if (t == LogicalType::Text) {
-    if (!v.is_string()) throw std::runtime_error("text value must be JSON string");
-    std::string raw = v.get<std::string>();
-    require_utf8(raw, "text");
-    std::string s = trim_copy(raw);
-    cv.canon_text = nfc_normalize_utf8(s);
+    if (v.kind != Kind::String) throw std::runtime_error("text value must be JSON string");
+    require_utf8(v.s, "text");
+    cv.canon = nfc_normalize_into(trim_view(v.s), arena);
     return cv;
   }
 
   if (t == LogicalType::Uuid) {
-    if (!v.is_string()) throw std::runtime_error("uuid value must be JSON string");
-    std::string raw = v.get<std::string>();
-    require_utf8(raw, "uuid");
-    cv.canon_text = canonicalize_uuid(raw);
+    if (v.kind != Kind::String) throw std::runtime_error("uuid value must be JSON string");
+    require_utf8(v.s, "uuid");
+    char* out = arena.alloc(36);
+    canonicalize_uuid_into(v.s, out);
+    cv.canon = std::string_view(out, 36);
     return cv;
   }
 
   if (t == LogicalType::Bytes) {
-    if (!v.is_string()) throw std::runtime_error("bytes value must be base64 string");
-    std::string b64 = v.get<std::string>();
-    require_utf8(b64, "bytes-base64");
-    cv.canon_blob = base64_decode_strict(b64);
+    if (v.kind != Kind::String) throw std::runtime_error("bytes value must be base64 string");
+    require_utf8(v.s, "bytes-base64");
+    char* out = arena.alloc(base64_decoded_max(v.s));
+    cv.canon = std::string_view(out, base64_decode_into(v.s, reinterpret_cast<uint8_t*>(out)));
     return cv;
   }
 
@@ -399,11 +850,21 @@ static inline CanonValue canonicalize_typed_value(LogicalType t, const json& v)
   throw std::runtime_error("unsupported type");
 }
 
+static inline CanonValue canonicalize_typed_value(LogicalType t, const JsonScalar& v) {
+  IngestArena scratch;
+  return canon_value_of(canonicalize_typed_value(t, v, scratch));
+}
+
+static inline CanonValue canonicalize_typed_value(LogicalType t, const json& v) {
+  return canonicalize_typed_value(t, json_scalar_of(v));
+}
+
 static inline CanonValue canonicalize_typed_value(LogicalType t, std::string_view raw_value_text) {
+  StageTimer timer(IngestStage::Canonicalize);
   CanonValue cv{};
   cv.logical_type = t;
 
-  std::string raw = std::string(raw_value_text);
+  const std::string_view raw = raw_value_text;
 
   if (t == LogicalType::Null) {
     cv.canon_text = "null";
@@ -411,9 +872,9 @@ static inline CanonValue canonicalize_typed_value(LogicalType t, std::string_vie
   }
 
   if (t == LogicalType::Bool) {
-    std::string s = trim_copy(raw);
+    std::string_view s = trim_view(raw);
     if (s != "true" && s != "false") throw std::runtime_error("bool must be true or false");
-    cv.canon_text = s;
+    cv.canon_text = std::string(s);
     return cv;
   }
 
@@ -447,8 +908,7 @@ static inline CanonValue canonicalize_typed_value(LogicalType t, std::string_vie
 
   if (t == LogicalType::Text) {
     require_utf8(raw, "text");
-    std::string s = trim_copy(raw);
-    cv.canon_text = nfc_normalize_utf8(s);
+    cv.canon_text = nfc_normalize_utf8(trim_view(raw));
     return cv;
   }
 
@@ -460,7 +920,7 @@ static inline CanonValue canonicalize_typed_value(LogicalType t, std::string_vie
 
   if (t == LogicalType::Bytes) {
     require_utf8(raw, "bytes-base64");
-    cv.canon_blob = base64_decode_strict(std::string(raw));
+    cv.canon_blob = base64_decode_strict(raw);
     return cv;
   }
 
@@ -471,14 +931,52 @@ static inline CanonValue canonicalize_typed_value(LogicalType t, std::string_vie
   throw std::runtime_error("unsupported type");
 }
 
+// Hash of an already canonical (trimmed, NFC) field name.
+static inline std::array<uint8_t, 32> field_hash_of_canon(std::string_view canon) {
+  // Field hashing is implementation-internal; keep stable within this implementation.
+  // The prefix has always been the 5 bytes "field": the literal's NUL was
+  // never part of the std::string it was built from.
+  static constexpr char kPrefix[] = "field";
+  return Sha256::local().init().update(kPrefix, sizeof(kPrefix) - 1).update(canon.data(), canon.size()).final();
+}
+
 static inline std::array<uint8_t, 32> canonicalize_field_hash(std::string_view field_name) {
   // fields: trim + NFC normalization, case-sensitive
-  std::string canon = nfc_normalize_utf8(trim_copy(field_name));
-  // Field hashing is implementation-internal; keep stable within this implementation.
-  std::string prefix = "field\0";
-  std::vector<uint8_t> buf(prefix.begin(), prefix.end());
-  buf.insert(buf.end(), canon.begin(), canon.end());
-  return sha256_bytes(reinterpret_cast<const uint8_t*>(buf.data()), buf.size());
+  return field_hash_of_canon(nfc_normalize_utf8(trim_copy(field_name)));
+}
+
+static inline void hash_canon_value(TagMapVersion tagmap, HashFormatVersion hfmt, CanonValue& cv) {
+  const uint8_t* canon_ptr = nullptr;
+  size_t canon_len = 0;
+  if (cv.logical_type == LogicalType::Bytes) {
+    canon_ptr = cv.canon_blob.data();
+    canon_len = cv.canon_blob.size();
+  } else {
+    canon_ptr = reinterpret_cast<const uint8_t*>(cv.canon_text.data());
+    canon_len = cv.canon_text.size();
+  }
+  cv.hash = sha256_typed(tagmap, hfmt, cv.logical_type, canon_ptr, canon_len);
+  cv.hashed = true;
+  cv.hash_tagmap = tagmap;
+  cv.hash_format = hfmt;
+}
+
+static inline std::array<uint8_t, 32> canon_view_hash(TagMapVersion tagmap, HashFormatVersion hfmt, const CanonView& cv) {
+  return sha256_typed(tagmap, hfmt, cv.logical_type, reinterpret_cast<const uint8_t*>(cv.canon.data()), cv.canon.size());
+}
+
+static inline void hash_canon_value(TagMapVersion tagmap, HashFormatVersion hfmt, CanonView& cv) {
+  cv.hash = canon_view_hash(tagmap, hfmt, cv);
+  cv.hashed = true;
+  cv.hash_tagmap = tagmap;
+  cv.hash_format = hfmt;
+}
+
+// A precomputed hash is only usable when it was taken under the store's
+// current format; a migration may have landed since the item was prepared.
+template <class V>
+static inline bool hashed_under(const V& cv, TagMapVersion tagmap, HashFormatVersion hfmt) {
+  return cv.hashed && cv.hash_tagmap == tagmap && cv.hash_format == hfmt;
 }
 
 // ------------------------------------------------------------
@@ -490,6 +988,109 @@ struct Stmt {
   ~Stmt() { if (s) sqlite3_finalize(s); }
 };
 
+static inline void check_sql(int rc, sqlite3* db, const char* what);
+
+// Transparent string hashing so lookups by string_view do not allocate.
+struct StringHash {
+  using is_transparent = void;
+  size_t operator()(std::string_view sv) const { return std::hash<std::string_view>{}(sv); }
+};
+
+// Per-statement counters reported by StmtCache::stats().
+struct StmtStats {
+  std::string sql;
+  uint64_t prepares{0};
+  uint64_t steps{0};
+};
+
+// Persistent prepared-statement registry owned by a store connection.
+// Each distinct SQL text is compiled once; callers borrow it through a
+// ScopedStmt, which resets and clears bindings when it goes out of scope.
+class StmtCache {
+public:
+  struct Entry {
+    sqlite3_stmt* s{nullptr};
+    bool in_use{false};
+    StmtStats stats;
+  };
+
+  class ScopedStmt {
+  public:
+    sqlite3_stmt* s{nullptr};
+
+    ScopedStmt(Entry* e, sqlite3_stmt* s_, bool owned) : s(s_), e_(e), owned_(owned) {}
+    ScopedStmt(const ScopedStmt&) = delete;
+    ScopedStmt& operator=(const ScopedStmt&) = delete;
+    ~ScopedStmt() {
+      if (owned_) {
+        sqlite3_finalize(s);
+        return;
+      }
+      sqlite3_reset(s);
+      sqlite3_clear_bindings(s);
+      e_->in_use = false;
+    }
+
+    int step() {
+      e_->stats.steps++;
+      return sqlite3_step(s);
+    }
+
+  private:
+    Entry* e_;
+    bool owned_;
+  };
+
+  StmtCache() = default;
+  StmtCache(const StmtCache&) = delete;
+  StmtCache& operator=(const StmtCache&) = delete;
+  ~StmtCache() { clear(); }
+
+  void attach(sqlite3* db) { db_ = db; }
+
+  ScopedStmt get(const char* sql, const char* what) {
+    auto it = entries_.find(std::string_view(sql));
+    if (it == entries_.end()) {
+      auto e = std::make_unique<Entry>();
+      e->stats.sql = sql;
+      it = entries_.emplace(e->stats.sql, std::move(e)).first;
+    }
+    Entry* e = it->second.get();
+
+    // Re-entrant use of the same statement (e.g. a lookup issued while an
+    // outer scan of the same SQL is still stepping) gets a one-off handle.
+    if (e->in_use || e->s == nullptr) {
+      sqlite3_stmt* s = nullptr;
+      check_sql(sqlite3_prepare_v3(db_, sql, -1, SQLITE_PREPARE_PERSISTENT, &s, nullptr), db_, what);
+      e->stats.prepares++;
+      if (e->in_use) return ScopedStmt(e, s, true);
+      e->s = s;
+    }
+    e->in_use = true;
+    return ScopedStmt(e, e->s, false);
+  }
+
+  std::vector<StmtStats> stats() const {
+    std::vector<StmtStats> out;
+    out.reserve(entries_.size());
+    for (const auto& kv : entries_) out.push_back(kv.second->stats);
+    std::sort(out.begin(), out.end(), [](const StmtStats& a, const StmtStats& b) { return a.sql < b.sql; });
+    return out;
+  }
+
+  void clear() {
+    for (auto& kv : entries_) {
+      if (kv.second->s) sqlite3_finalize(kv.second->s);
+      kv.second->s = nullptr;
+    }
+    entries_.clear();
+  }
+
+private:
+  sqlite3* db_{nullptr};
+  std::unordered_map<std::string, std::unique_ptr<Entry>, StringHash, std::equal_to<>> entries_;
+};
+
 static inline void check_sql(int rc, sqlite3* db, const char* what) {
   if (rc != SQLITE_OK && rc != SQLITE_DONE && rc != SQLITE_ROW) {
     std::ostringstream oss;
@@ -508,6 +1109,146 @@ static inline void exec_sql(sqlite3* db, const char* sql) {
   }
 }
 
+// Bounded in-memory key -> row id map for identity lookups.
+// Entries added while a transaction is open are tracked as pending and
+// dropped again if that transaction rolls back, so the cache never refers
+// to rows that do not exist. On overflow the whole map is cleared.
+template <class K, class V, class Hash = std::hash<K>, class Eq = std::equal_to<K>>
+class IdCache {
+public:
+  explicit IdCache(size_t capacity) : capacity_(capacity) {}
+
+  template <class Q>
+  std::optional<V> find(const Q& key) {
+    auto it = map_.find(key);
+    if (it == map_.end()) { misses_++; return std::nullopt; }
+    hits_++;
+    return it->second;
+  }
+
+  void put(K key, V v, bool pending) {
+    if (capacity_ == 0) return;
+    if (map_.size() >= capacity_) {
+      map_.clear();
+      pending_.clear();
+    }
+    auto [it, inserted] = map_.emplace(std::move(key), v);
+    if (inserted && pending) pending_.push_back(it->first);
+  }
+
+  void commit() { pending_.clear(); }
+
+  void rollback() {
+    for (const auto& k : pending_) map_.erase(k);
+    pending_.clear();
+  }
+
+  void clear() {
+    map_.clear();
+    pending_.clear();
+  }
+
+  size_t size() const { return map_.size(); }
+  uint64_t hits() const { return hits_; }
+  uint64_t misses() const { return misses_; }
+
+private:
+  size_t capacity_;
+  std::unordered_map<K, V, Hash, Eq> map_;
+  std::vector<K> pending_;
+  uint64_t hits_{0};
+  uint64_t misses_{0};
+};
+
+// Write-back cache of current_facts rows keyed by (record_id, field_id). An
+// entry can also record that a field has no current row. Entries changed in
+// a write transaction stay dirty until flush() hands them to the caller,
+// which must happen before that transaction commits.
+class CurrentStateCache {
+public:
+  struct Entry {
+    uint64_t value_id{0};
+    int64_t ts{0};
+    bool present{false};
+    bool dirty{false};
+  };
+
+  explicit CurrentStateCache(size_t capacity) : capacity_(capacity) {}
+
+  Entry* find(uint64_t record_id, uint32_t field_id) {
+    auto it = map_.find(Key{record_id, field_id});
+    return it == map_.end() ? nullptr : &it->second;
+  }
+
+  // The caller flushes and clears a full cache before adding to it.
+  Entry& put(uint64_t record_id, uint32_t field_id, Entry e) { return map_[Key{record_id, field_id}] = e; }
+
+  void set(uint64_t record_id, uint32_t field_id, Entry& e, uint64_t value_id, int64_t ts) {
+    e.value_id = value_id;
+    e.ts = ts;
+    e.present = true;
+    if (!e.dirty) dirty_.push_back(Key{record_id, field_id});
+    e.dirty = true;
+  }
+
+  // fn(record_id, field_id, entry) for every dirty entry, which is then clean.
+  template <class Fn>
+  void flush(Fn&& fn) {
+    for (const Key& k : dirty_) {
+      Entry& e = map_.at(k);
+      fn(k.record_id, k.field_id, e);
+      e.dirty = false;
+    }
+    dirty_.clear();
+  }
+
+  bool full() const { return map_.size() >= capacity_; }
+  bool has_dirty() const { return !dirty_.empty(); }
+
+  void clear() {
+    map_.clear();
+    dirty_.clear();
+  }
+
+private:
+  struct Key {
+    uint64_t record_id;
+    uint32_t field_id;
+    bool operator==(const Key& o) const { return record_id == o.record_id && field_id == o.field_id; }
+  };
+  struct KeyHash {
+    size_t operator()(const Key& k) const { return (size_t)((k.record_id * 0x9E3779B97F4A7C15ull) ^ k.field_id); }
+  };
+
+  size_t capacity_;
+  std::unordered_map<Key, Entry, KeyHash> map_;
+  std::vector<Key> dirty_;
+};
+
+// Identity hashes are SHA-256 output, so any 8 bytes are already uniform.
+struct DigestHash {
+  size_t operator()(const std::array<uint8_t, 32>& h) const {
+    uint64_t x;
+    std::memcpy(&x, h.data(), sizeof(x));
+    return (size_t)x;
+  }
+};
+
+// Owning handle for an auxiliary connection (read-only workers, etc.).
+struct SqliteConn {
+  sqlite3* db{nullptr};
+  SqliteConn() = default;
+  SqliteConn(const SqliteConn&) = delete;
+  SqliteConn& operator=(const SqliteConn&) = delete;
+  ~SqliteConn() { if (db) sqlite3_close(db); }
+};
+
+static inline void open_readonly(const std::string& path, SqliteConn& c) {
+  int rc = sqlite3_open_v2(path.c_str(), &c.db, SQLITE_OPEN_READONLY, nullptr);
+  if (rc != SQLITE_OK) throw std::runtime_error("failed to open sqlite db read-only");
+  sqlite3_busy_timeout(c.db, 5000);
+}
+
 static inline void begin_tx(sqlite3* db) { exec_sql(db, "BEGIN IMMEDIATE;"); }
 static inline void commit_tx(sqlite3* db){ exec_sql(db, "COMMIT;"); }
 static inline void rollback_tx(sqlite3* db){ exec_sql(db, "ROLLBACK;"); }
@@ -523,671 +1264,7970 @@ struct FactRow {
   int64_t ts_ms{};
 };
 
+// Inclusive record_id range, compared in SQLite's signed integer order.
+struct RecordRange {
+  int64_t lo{};
+  int64_t hi{};
+};
+
 struct FieldRow {
   uint32_t field_id{};
   std::string name_canon{};
 };
 
+class MappedBlob;
+
+// An int, float or bool value as stored in f_values.num: i holds ints and
+// bools (0/1), d holds floats and, for convenience, ints as double.
+struct NumericValue {
+  int64_t i{0};
+  double d{0};
+};
+
 struct ValueRow {
   uint64_t value_id{};
   LogicalType type{};
   std::string canon_text{};
+  std::string canon_bytes{};               // payload of a bytes value stored inline
+  std::shared_ptr<const MappedBlob> blob;  // set for values kept in the blob store
+  std::optional<NumericValue> num;         // set when the backend stores numbers natively
+
+  // Canonical text form, read from the blob store when the value lives there.
+  // Bytes values have none. Valid while this row (or a copy) is alive.
+  std::string_view canon() const;
+  // Payload of a bytes value, inline or from the blob store.
+  std::string_view bytes() const;
 };
 
-class FelixSqlite {
-public:
-  explicit FelixSqlite(const std::string& path) {
-    int rc = sqlite3_open(path.c_str(), &db_);
-    if (rc != SQLITE_OK) throw std::runtime_error("failed to open sqlite db");
-
-    exec_sql(db_, "PRAGMA foreign_keys = ON;");
-    exec_sql(db_, "PRAGMA journal_mode = WAL;");
-    exec_sql(db_, "PRAGMA synchronous = NORMAL;");
-    ensure_meta_table();
-    load_format_defaults();
-  }
+// An f_values row with the exact bytes its hash covers, for migrate_format.
+struct StoredValue {
+  uint64_t value_id{};
+  LogicalType type{};
+  std::string canon;                       // canonical text, or the bytes of a Bytes value
+  std::shared_ptr<const MappedBlob> blob;  // set for values kept in the blob store
+  uint64_t blob_size{0};
+  std::array<uint8_t, 32> hash{};          // as stored
 
-  ~FelixSqlite() {
-    if (db_) sqlite3_close(db_);
-  }
+  std::string_view bytes() const;
+};
 
-  void init_schema() {
-    exec_sql(db_, R"SQL(
-      CREATE TABLE IF NOT EXISTS fields (
-        field_id    INTEGER PRIMARY KEY,
-        name_canon  TEXT NOT NULL,
-        hash        BLOB NOT NULL UNIQUE
-      );
+// A fact with its field name and value decoded. The views point into the
+// current SQLite row and are only valid inside the callback that receives it.
+struct FactView {
+  FactRow fact;
+  std::string_view field_name;
+  LogicalType type{};
+  std::string_view canon;
+  std::optional<NumericValue> num;  // as in ValueRow; readers fall back to parsing canon
+};
 
-      CREATE TABLE IF NOT EXISTS f_values (
-        value_id    INTEGER PRIMARY KEY,
-        type_tag    INTEGER NOT NULL,
-        canon_text  TEXT,
-        canon_blob  BLOB,
-        hash        BLOB NOT NULL UNIQUE
-      );
+// Keyset position for paging through facts_window: rows strictly after
+// (ts_ms, record_id, field_id) in output order.
+struct FactsWindowCursor {
+  int64_t ts_ms{};
+  int64_t record_id{};
+  uint32_t field_id{};
+};
 
-      CREATE TABLE IF NOT EXISTS records (
-        record_id   INTEGER PRIMARY KEY,
-        created_ts  INTEGER NOT NULL
-      );
+struct FactsWindowQuery {
+  int64_t t1{};
+  int64_t t2{};
+  std::optional<uint64_t> record_id;
+  std::optional<FactsWindowCursor> after;
+  std::optional<uint64_t> limit;
+};
 
-      CREATE TABLE IF NOT EXISTS facts (
-        record_id  INTEGER NOT NULL,
-        field_id   INTEGER NOT NULL,
-        value_id   INTEGER NOT NULL,
-        ts         INTEGER NOT NULL,
-        PRIMARY KEY (record_id, field_id, ts),
-        FOREIGN KEY (record_id) REFERENCES records(record_id),
-        FOREIGN KEY (field_id)  REFERENCES fields(field_id),
-        FOREIGN KEY (value_id)  REFERENCES f_values(value_id)
-      );
+// One record's facts in (field_id, ts) order, or fully reversed (fields
+// descending, newest first). limit applies per field, so reverse + limit N
+// gives the last N facts of every field.
+struct HistoryQuery {
+  uint64_t record_id{};
+  std::vector<uint32_t> field_ids;       // empty: every field
+  int64_t t1{std::numeric_limits<int64_t>::min()};
+  int64_t t2{std::numeric_limits<int64_t>::max()};
+  std::optional<uint64_t> limit;
+  bool reverse{false};
+};
 
-      CREATE TABLE IF NOT EXISTS current_facts (
-        record_id  INTEGER NOT NULL,
-        field_id   INTEGER NOT NULL,
-        value_id   INTEGER NOT NULL,
-        ts         INTEGER NOT NULL,
-        PRIMARY KEY (record_id, field_id),
-        FOREIGN KEY (record_id) REFERENCES records(record_id),
-        FOREIGN KEY (field_id)  REFERENCES fields(field_id),
-        FOREIGN KEY (value_id)  REFERENCES f_values(value_id)
-      );
+// A range predicate for current_range / ever_range. Int and float bounds
+// match int and float values, compared by number; text bounds match text
+// values in codepoint order (byte order of the NFC UTF-8). A missing bound
+// is open, but at least one must be set.
+struct ValueBound {
+  CanonValue value;
+  bool inclusive{true};
+};
 
-      CREATE INDEX IF NOT EXISTS facts_by_value ON facts(value_id);
-      CREATE INDEX IF NOT EXISTS facts_by_field_value ON facts(field_id, value_id);
-      CREATE INDEX IF NOT EXISTS facts_by_record_field_ts ON facts(record_id, field_id, ts);
-      CREATE INDEX IF NOT EXISTS current_by_field_value ON current_facts(field_id, value_id);
-      CREATE INDEX IF NOT EXISTS facts_by_ts ON facts(ts);
-    )SQL");
+struct ValueRange {
+  std::optional<ValueBound> lo, hi;
 
-    // Declare this database as Felix v0.3 format for new DBs.
-    meta_set("felix_spec", "0.3");
-    meta_set("tag_map", "felix_v03");
-    meta_set("hash_format", "felix_v03_sep");
-    load_format_defaults();
+  bool numeric() const {
+    const auto& b = lo ? lo : hi;
+    return b && b->value.logical_type != LogicalType::Text;
+  }
+};
 
-    ensure_null_value();
+static void check_value_range(const ValueRange& r) {
+  if (!r.lo && !r.hi) throw std::runtime_error("range query needs a lower or upper bound");
+  auto numeric = [](LogicalType t) { return t == LogicalType::Int || t == LogicalType::Float; };
+  for (const auto* b : {&r.lo, &r.hi}) {
+    if (!*b) continue;
+    LogicalType t = (*b)->value.logical_type;
+    if (!numeric(t) && t != LogicalType::Text) throw std::runtime_error("range bounds must be int, float or text");
+    if (numeric(t) != r.numeric()) throw std::runtime_error("range bounds must both be numbers or both be text");
   }
+}
 
-  void with_tx(const std::function<void()>& fn) {
-    begin_tx(db_);
-    try {
-      fn();
-      commit_tx(db_);
-    } catch (...) {
-      rollback_tx(db_);
-      throw;
+// Numeric value of an int or float, from the native column when the backend
+// has one and from the canonical text otherwise.
+static NumericValue numeric_of(LogicalType t, std::string_view canon, const std::optional<NumericValue>& num) {
+  if (num) return *num;
+  NumericValue n{};
+  if (t == LogicalType::Int) {
+    std::from_chars(canon.data(), canon.data() + canon.size(), n.i);
+    n.d = (double)n.i;
+  } else {
+    std::from_chars(canon.data(), canon.data() + canon.size(), n.d);  // also reads "inf" / "-inf"
+  }
+  return n;
+}
+
+// Compares two numbers exactly, as SQLite does for INTEGER against REAL.
+static int compare_numeric(LogicalType at, const NumericValue& a, LogicalType bt, const NumericValue& b) {
+  if (at == LogicalType::Int && bt == LogicalType::Int) return a.i < b.i ? -1 : a.i > b.i;
+  long double x = at == LogicalType::Int ? (long double)a.i : (long double)a.d;
+  long double y = bt == LogicalType::Int ? (long double)b.i : (long double)b.d;
+  return x < y ? -1 : x > y;
+}
+
+// Evaluates the range against one value, for backends and values that the
+// ordered value indexes do not cover.
+static bool value_in_range(const ValueRange& r, LogicalType t, std::string_view canon,
+                           const std::optional<NumericValue>& num) {
+  if (r.numeric() ? (t != LogicalType::Int && t != LogicalType::Float) : t != LogicalType::Text) return false;
+  auto cmp = [&](const ValueBound& b) {
+    if (!r.numeric()) {
+      int c = canon.compare(b.value.canon_text);
+      return c < 0 ? -1 : c > 0;
     }
+    return compare_numeric(t, numeric_of(t, canon, num),
+                           b.value.logical_type, numeric_of(b.value.logical_type, b.value.canon_text, std::nullopt));
+  };
+  if (r.lo) {
+    int c = cmp(*r.lo);
+    if (c < 0 || (c == 0 && !r.lo->inclusive)) return false;
   }
+  if (r.hi) {
+    int c = cmp(*r.hi);
+    if (c > 0 || (c == 0 && !r.hi->inclusive)) return false;
+  }
+  return true;
+}
 
-  void ensure_record(uint64_t record_id, int64_t created_ts_ms) {
-    Stmt st;
-    check_sql(sqlite3_prepare_v2(db_, "INSERT OR IGNORE INTO records(record_id, created_ts) VALUES(?,?);", -1, &st.s, nullptr),
-              db_, "prepare ensure_record");
-    sqlite3_bind_int64(st.s, 1, (sqlite3_int64)record_id);
-    sqlite3_bind_int64(st.s, 2, (sqlite3_int64)created_ts_ms);
-    check_sql(sqlite3_step(st.s), db_, "ensure_record step");
+static inline std::string_view column_view(sqlite3_stmt* s, int col) {
+  const unsigned char* p = sqlite3_column_text(s, col);
+  if (!p) return {};
+  return std::string_view(reinterpret_cast<const char*>(p), (size_t)sqlite3_column_bytes(s, col));
+}
+
+// Reads (record_id, field_id, value_id, ts) from result columns 0..3.
+static inline FactRow fact_row_at(sqlite3_stmt* s) {
+  FactRow f{};
+  f.record_id = (uint64_t)sqlite3_column_int64(s, 0);
+  f.field_id  = (uint32_t)sqlite3_column_int(s, 1);
+  f.value_id  = (uint64_t)sqlite3_column_int64(s, 2);
+  f.ts_ms     = (int64_t)sqlite3_column_int64(s, 3);
+  return f;
+}
+
+// ------------------------------------------------------------
+// Sealed fact segments
+//
+// `seal` moves facts older than a horizon out of SQLite into immutable
+// segment files next to the database (<db>.segments/seg-<id>.fxs). A segment
+// holds its rows in facts primary-key order (record_id, field_id, ts) as
+// separate columns:
+//
+//   header       magic "FLXSEG01", counts, ts bounds, code widths
+//   record_ids   int64[records]          sorted, binary searched
+//   row_start    uint64[records + 1]     first row of each record
+//   ts_start     uint64[records + 1]     byte offset of each record's ts run
+//   field_dict   uint32[fields]          sorted distinct field_ids
+//   value_dict   uint64[values]          sorted distinct value_ids
+//   field_codes  1/2/4-byte index into field_dict, per row
+//   value_codes  1/2/4-byte index into value_dict, per row
+//   ts           zigzag varint deltas, per record starting from min_ts
+//
+// Files are memory-mapped read-only and shared between connections. The
+// fact_segments table lists the live ones; meta.segments_rev changes with
+// every seal so other connections notice and reload.
+// ------------------------------------------------------------
+
+static constexpr const char* kSegmentsRevKey = "segments_rev";
+// Highest change-feed seq among sealed facts; the feed cannot replay past it.
+static constexpr const char* kFeedSealedKey = "feed_sealed_seq";
+
+static inline void put_varint(std::string& out, uint64_t v) {
+  while (v >= 0x80) {
+    out.push_back((char)(uint8_t)(v | 0x80));
+    v >>= 7;
   }
+  out.push_back((char)(uint8_t)v);
+}
 
-  uint32_t get_or_create_field(std::string_view field_name) {
-    if (field_name.size() > 256) throw std::runtime_error("field name exceeds 256 bytes");
-    require_utf8(field_name, "field name");
+static inline uint64_t get_varint(const uint8_t*& p, const uint8_t* end) {
+  uint64_t v = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (p == end) throw std::runtime_error("segment ts column truncated");
+    uint8_t b = *p++;
+    v |= (uint64_t)(b & 0x7f) << shift;
+    if ((b & 0x80) == 0) return v;
+  }
+  throw std::runtime_error("segment ts column corrupt");
+}
 
-    std::string canon = nfc_normalize_utf8(trim_copy(field_name));
-    auto h = canonicalize_field_hash(canon);
+static inline uint64_t zigzag(int64_t v) { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+static inline int64_t unzigzag(uint64_t v) { return (int64_t)(v >> 1) ^ -(int64_t)(v & 1); }
 
-    {
-      Stmt st;
-      check_sql(sqlite3_prepare_v2(db_, "INSERT OR IGNORE INTO fields(name_canon, hash) VALUES(?,?);", -1, &st.s, nullptr),
-                db_, "prepare field insert");
-      sqlite3_bind_text(st.s, 1, canon.c_str(), -1, SQLITE_TRANSIENT);
-      sqlite3_bind_blob(st.s, 2, h.data(), (int)h.size(), SQLITE_TRANSIENT);
-      check_sql(sqlite3_step(st.s), db_, "field insert step");
-    }
+static inline uint32_t code_width(size_t distinct) {
+  return distinct <= 0x100 ? 1u : distinct <= 0x10000 ? 2u : 4u;
+}
 
-    {
-      Stmt st;
-      check_sql(sqlite3_prepare_v2(db_, "SELECT field_id FROM fields WHERE hash=?;", -1, &st.s, nullptr),
-                db_, "prepare field select");
-      sqlite3_bind_blob(st.s, 1, h.data(), (int)h.size(), SQLITE_TRANSIENT);
-      int rc = sqlite3_step(st.s);
-      check_sql(rc, db_, "field select step");
-      if (rc == SQLITE_ROW) return (uint32_t)sqlite3_column_int(st.s, 0);
+struct SegmentHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t field_width;
+  uint32_t value_width;
+  uint32_t reserved;
+  uint64_t rows;
+  uint64_t records;
+  uint64_t fields;
+  uint64_t values;
+  int64_t min_ts;
+  int64_t max_ts;
+  uint64_t ts_bytes;
+};
+
+static constexpr char kSegmentMagic[8] = {'F', 'L', 'X', 'S', 'E', 'G', '0', '1'};
+
+static inline size_t align8(size_t n) { return (n + 7) & ~(size_t)7; }
+
+// facts_window output order: (ts, record_id, field_id), record ids signed.
+static bool fact_window_less(const FactRow& a, const FactRow& b) {
+  if (a.ts_ms != b.ts_ms) return a.ts_ms < b.ts_ms;
+  if (a.record_id != b.record_id) return (int64_t)a.record_id < (int64_t)b.record_id;
+  return a.field_id < b.field_id;
+}
+
+class FactSegment {
+public:
+  FactSegment(int64_t seg_id, const std::string& path) : seg_id_(seg_id), path_(path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("cannot open segment " + path);
+    struct stat sb{};
+    if (::fstat(fd, &sb) != 0) {
+      ::close(fd);
+      throw std::runtime_error("cannot stat segment " + path);
+    }
+    size_ = (size_t)sb.st_size;
+    if (size_ < sizeof(SegmentHeader)) {
+      ::close(fd);
+      throw std::runtime_error("segment too small: " + path);
+    }
+    void* p = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) throw std::runtime_error("cannot map segment " + path);
+    base_ = static_cast<const uint8_t*>(p);
+
+    std::memcpy(&h_, base_, sizeof(h_));
+    if (std::memcmp(h_.magic, kSegmentMagic, sizeof(kSegmentMagic)) != 0 || h_.version != 1) {
+      unmap();
+      throw std::runtime_error("not a felix segment: " + path);
+    }
+    size_t off = align8(sizeof(SegmentHeader));
+    auto take = [&](size_t bytes) {
+      size_t at = off;
+      off = align8(off + bytes);
+      return at;
+    };
+    record_ids_ = take(h_.records * 8);
+    row_start_ = take((h_.records + 1) * 8);
+    ts_start_ = take((h_.records + 1) * 8);
+    field_dict_ = take(h_.fields * 4);
+    value_dict_ = take(h_.values * 8);
+    field_codes_ = take(h_.rows * h_.field_width);
+    value_codes_ = take(h_.rows * h_.value_width);
+    ts_ = take(h_.ts_bytes);
+    if (off > align8(size_)) {
+      unmap();
+      throw std::runtime_error("segment truncated: " + path);
     }
+  }
 
-    throw std::runtime_error("field insert/select failed unexpectedly");
+  FactSegment(const FactSegment&) = delete;
+  FactSegment& operator=(const FactSegment&) = delete;
+  ~FactSegment() { unmap(); }
+
+  int64_t id() const { return seg_id_; }
+  uint64_t rows() const { return h_.rows; }
+  uint64_t records() const { return h_.records; }
+  int64_t min_ts() const { return h_.min_ts; }
+  int64_t max_ts() const { return h_.max_ts; }
+
+  int64_t record_id_at(size_t i) const { return load<int64_t>(record_ids_, i); }
+
+  // Index of the first record with id >= rid.
+  size_t record_lower_bound(int64_t rid) const {
+    size_t lo = 0, hi = (size_t)h_.records;
+    while (lo < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+      if (record_id_at(mid) < rid) lo = mid + 1;
+      else hi = mid;
+    }
+    return lo;
   }
 
-  uint64_t get_or_create_value(const CanonValue& cv_in) {
-    CanonValue cv = cv_in;
+  std::optional<size_t> find_record(int64_t rid) const {
+    size_t i = record_lower_bound(rid);
+    if (i < h_.records && record_id_at(i) == rid) return i;
+    return std::nullopt;
+  }
 
-    // Resource limits (spec recommended defaults).
-    if (cv.logical_type == LogicalType::Text && cv.canon_text.size() > (1u * 1024u * 1024u)) throw std::runtime_error("text value exceeds 1 MiB");
-    if (cv.logical_type == LogicalType::Bytes && cv.canon_blob.size() > (4u * 1024u * 1024u)) throw std::runtime_error("bytes value exceeds 4 MiB");
+  // Appends record i's rows in (field_id, ts) order.
+  void read_record(size_t i, std::vector<FactRow>& out) const {
+    const uint64_t b = load<uint64_t>(row_start_, i), e = load<uint64_t>(row_start_, i + 1);
+    const uint8_t* p = base_ + ts_ + load<uint64_t>(ts_start_, i);
+    const uint8_t* end = base_ + ts_ + h_.ts_bytes;
+    const uint64_t rid = (uint64_t)record_id_at(i);
+    int64_t ts = h_.min_ts;
+    for (uint64_t r = b; r < e; r++) {
+      ts += unzigzag(get_varint(p, end));
+      out.push_back(FactRow{rid, field_at(r), value_at(r), ts});
+    }
+  }
 
-    const uint8_t* canon_ptr = nullptr;
-    size_t canon_len = 0;
-    if (cv.logical_type == LogicalType::Bytes) {
-      canon_ptr = cv.canon_blob.data();
-      canon_len = cv.canon_blob.size();
-    } else {
-      canon_ptr = reinterpret_cast<const uint8_t*>(cv.canon_text.data());
-      canon_len = cv.canon_text.size();
+  // Whether record i has a row for field_id at ts. Only the ts column is
+  // walked, and only up to the end of the field's rows.
+  bool has_row(size_t i, uint32_t field_id, int64_t ts) const {
+    auto fc = dict_code<uint32_t>(field_dict_, h_.fields, field_id);
+    if (!fc) return false;
+    const uint64_t b = load<uint64_t>(row_start_, i), e = load<uint64_t>(row_start_, i + 1);
+    const uint8_t* p = base_ + ts_ + load<uint64_t>(ts_start_, i);
+    const uint8_t* end = base_ + ts_ + h_.ts_bytes;
+    int64_t t = h_.min_ts;
+    for (uint64_t r = b; r < e; r++) {
+      t += unzigzag(get_varint(p, end));
+      const uint32_t c = code_at(field_codes_, h_.field_width, r);
+      if (c > *fc || (c == *fc && t > ts)) return false;
+      if (c == *fc && t == ts) return true;
     }
+    return false;
+  }
 
-    cv.hash = sha256_typed(tagmap_, hashfmt_, cv.logical_type, canon_ptr, canon_len);
+  // ---- window order ----
+  // Rows in (ts, record_id, field_id) order through an index of (ts, row)
+  // pairs, decoded from the ts column on first use and kept for the
+  // segment's lifetime. Rows are stored by (record_id, field_id, ts), so a
+  // stable sort on ts alone gives window order.
 
-    {
-      Stmt st;
-      check_sql(sqlite3_prepare_v2(db_,
-                                  "INSERT OR IGNORE INTO f_values(type_tag, canon_text, canon_blob, hash) VALUES(?,?,?,?);",
-                                  -1, &st.s, nullptr),
-                db_, "prepare value insert");
+  // First window position whose ts is >= t.
+  size_t window_seek(int64_t t) const {
+    const auto& idx = window_index();
+    return (size_t)(std::partition_point(idx.begin(), idx.end(), [&](const WindowEntry& w) { return w.ts < t; }) - idx.begin());
+  }
 
-      sqlite3_bind_int(st.s, 1, (int)type_tag_byte(tagmap_, cv.logical_type));
+  // First window position ordered after key.
+  size_t window_seek_after(const FactRow& key) const {
+    const auto& idx = window_index();
+    return (size_t)(std::partition_point(idx.begin(), idx.end(), [&](const WindowEntry& w) {
+                      return !fact_window_less(key, window_row(w));
+                    }) - idx.begin());
+  }
 
-      if (cv.logical_type == LogicalType::Bytes) {
-        sqlite3_bind_null(st.s, 2);
-        sqlite3_bind_blob(st.s, 3,
-                          cv.canon_blob.empty() ? "" : (const void*)cv.canon_blob.data(),
-                          (int)cv.canon_blob.size(),
-                          SQLITE_TRANSIENT);
-      } else {
-        sqlite3_bind_text(st.s, 2, cv.canon_text.c_str(), -1, SQLITE_TRANSIENT);
-        sqlite3_bind_null(st.s, 3);
+  FactRow window_row_at(size_t pos) const { return window_row(window_index()[pos]); }
+
+  // Calls fn(record_index) for every record that has a row with this field
+  // and value. Both ids are looked up in the dictionaries first, so segments
+  // without them are skipped without a scan.
+  void records_with(uint32_t field_id, uint64_t value_id, const std::function<void(size_t)>& fn) const {
+    auto fc = dict_code<uint32_t>(field_dict_, h_.fields, field_id);
+    auto vc = dict_code<uint64_t>(value_dict_, h_.values, value_id);
+    if (!fc || !vc) return;
+    for (size_t i = 0; i < h_.records; i++) {
+      const uint64_t b = load<uint64_t>(row_start_, i), e = load<uint64_t>(row_start_, i + 1);
+      for (uint64_t r = b; r < e; r++) {
+        if (code_at(field_codes_, h_.field_width, r) == *fc && code_at(value_codes_, h_.value_width, r) == *vc) {
+          fn(i);
+          break;
+        }
       }
+    }
+  }
 
-      sqlite3_bind_blob(st.s, 4, cv.hash.data(), (int)cv.hash.size(), SQLITE_TRANSIENT);
-      check_sql(sqlite3_step(st.s), db_, "value insert step");
+  // Like records_with, for a set of values (a range query's matches).
+  void records_with_any(uint32_t field_id, const std::unordered_set<uint64_t>& value_ids,
+                        const std::function<void(size_t)>& fn) const {
+    auto fc = dict_code<uint32_t>(field_dict_, h_.fields, field_id);
+    if (!fc) return;
+    std::vector<bool> hit((size_t)h_.values, false);
+    bool any = false;
+    for (uint64_t c = 0; c < h_.values; c++) {
+      if (value_ids.count(load<uint64_t>(value_dict_, c))) hit[c] = any = true;
+    }
+    if (!any) return;
+    for (size_t i = 0; i < h_.records; i++) {
+      const uint64_t b = load<uint64_t>(row_start_, i), e = load<uint64_t>(row_start_, i + 1);
+      for (uint64_t r = b; r < e; r++) {
+        if (code_at(field_codes_, h_.field_width, r) == *fc && hit[code_at(value_codes_, h_.value_width, r)]) {
+          fn(i);
+          break;
+        }
+      }
     }
+  }
 
-    {
-      Stmt st;
-      check_sql(sqlite3_prepare_v2(db_, "SELECT value_id FROM f_values WHERE hash=?;", -1, &st.s, nullptr),
-                db_, "prepare value select");
-      sqlite3_bind_blob(st.s, 1, cv.hash.data(), (int)cv.hash.size(), SQLITE_TRANSIENT);
-      int rc = sqlite3_step(st.s);
-      check_sql(rc, db_, "value select step");
-      if (rc == SQLITE_ROW) return (uint64_t)sqlite3_column_int64(st.s, 0);
+private:
+  struct WindowEntry {
+    int64_t ts;
+    uint64_t row;
+  };
+
+  int64_t seg_id_;
+  std::string path_;
+  const uint8_t* base_{nullptr};
+  size_t size_{0};
+  SegmentHeader h_{};
+  size_t record_ids_{0}, row_start_{0}, ts_start_{0}, field_dict_{0}, value_dict_{0};
+  size_t field_codes_{0}, value_codes_{0}, ts_{0};
+  mutable std::once_flag indexed_;
+  mutable std::vector<WindowEntry> window_;
+
+  const std::vector<WindowEntry>& window_index() const {
+    std::call_once(indexed_, [this] {
+      std::vector<WindowEntry> idx;
+      idx.reserve((size_t)h_.rows);
+      const uint8_t* p = base_ + ts_;
+      const uint8_t* end = base_ + ts_ + h_.ts_bytes;
+      for (size_t i = 0; i < h_.records; i++) {
+        const uint64_t b = load<uint64_t>(row_start_, i), e = load<uint64_t>(row_start_, i + 1);
+        int64_t ts = h_.min_ts;
+        for (uint64_t r = b; r < e; r++) {
+          ts += unzigzag(get_varint(p, end));
+          idx.push_back(WindowEntry{ts, r});
+        }
+      }
+      std::stable_sort(idx.begin(), idx.end(), [](const WindowEntry& a, const WindowEntry& b) { return a.ts < b.ts; });
+      window_ = std::move(idx);
+    });
+    return window_;
+  }
+
+  // Index of the record that holds row r.
+  size_t record_of_row(uint64_t r) const {
+    size_t lo = 0, hi = (size_t)h_.records;
+    while (lo + 1 < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+      if (load<uint64_t>(row_start_, mid) <= r) lo = mid;
+      else hi = mid;
     }
+    return lo;
+  }
 
-    throw std::runtime_error("value insert/select failed unexpectedly");
+  FactRow window_row(const WindowEntry& w) const {
+    return FactRow{(uint64_t)record_id_at(record_of_row(w.row)), field_at(w.row), value_at(w.row), w.ts};
   }
 
-  std::optional<std::pair<uint64_t, int64_t>> get_current(uint64_t record_id, uint32_t field_id) {
-    Stmt st;
-    check_sql(sqlite3_prepare_v2(db_, "SELECT value_id, ts FROM current_facts WHERE record_id=? AND field_id=?;",
-                                 -1, &st.s, nullptr),
-              db_, "prepare get_current");
-    sqlite3_bind_int64(st.s, 1, (sqlite3_int64)record_id);
-    sqlite3_bind_int(st.s, 2, (int)field_id);
-    int rc = sqlite3_step(st.s);
-    check_sql(rc, db_, "get_current step");
-    if (rc == SQLITE_ROW) {
-      uint64_t vid = (uint64_t)sqlite3_column_int64(st.s, 0);
-      int64_t ts = (int64_t)sqlite3_column_int64(st.s, 1);
-      return std::make_pair(vid, ts);
+  void unmap() {
+    if (base_) ::munmap(const_cast<uint8_t*>(base_), size_);
+    base_ = nullptr;
+  }
+
+  template <class T>
+  T load(size_t section, size_t i) const {
+    T v;
+    std::memcpy(&v, base_ + section + i * sizeof(T), sizeof(T));
+    return v;
+  }
+
+  uint32_t code_at(size_t section, uint32_t width, uint64_t row) const {
+    const uint8_t* p = base_ + section + row * width;
+    if (width == 1) return *p;
+    if (width == 2) { uint16_t v; std::memcpy(&v, p, 2); return v; }
+    uint32_t v;
+    std::memcpy(&v, p, 4);
+    return v;
+  }
+
+  template <class T>
+  std::optional<uint32_t> dict_code(size_t section, uint64_t n, T id) const {
+    size_t lo = 0, hi = (size_t)n;
+    while (lo < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+      if (load<T>(section, mid) < id) lo = mid + 1;
+      else hi = mid;
     }
+    if (lo < n && load<T>(section, lo) == id) return (uint32_t)lo;
     return std::nullopt;
   }
 
-  void insert_fact(const FactRow& f) {
-    Stmt st;
-    check_sql(sqlite3_prepare_v2(db_, "INSERT INTO facts(record_id, field_id, value_id, ts) VALUES(?,?,?,?);",
-                                 -1, &st.s, nullptr),
-              db_, "prepare insert_fact");
-    sqlite3_bind_int64(st.s, 1, (sqlite3_int64)f.record_id);
-    sqlite3_bind_int(st.s, 2, (int)f.field_id);
-    sqlite3_bind_int64(st.s, 3, (sqlite3_int64)f.value_id);
-    sqlite3_bind_int64(st.s, 4, (sqlite3_int64)f.ts_ms);
-    check_sql(sqlite3_step(st.s), db_, "insert_fact step");
-  }
+  uint32_t field_at(uint64_t row) const { return load<uint32_t>(field_dict_, code_at(field_codes_, h_.field_width, row)); }
+  uint64_t value_at(uint64_t row) const { return load<uint64_t>(value_dict_, code_at(value_codes_, h_.value_width, row)); }
+};
 
-  void upsert_current_if_newer(const FactRow& f) {
-    Stmt st;
-    check_sql(sqlite3_prepare_v2(db_,
-      "INSERT INTO current_facts(record_id, field_id, value_id, ts) "
-      "VALUES(?,?,?,?) "
-      "ON CONFLICT(record_id, field_id) DO UPDATE SET "
-      "value_id=excluded.value_id, ts=excluded.ts "
-      "WHERE excluded.ts >= current_facts.ts;",
-      -1, &st.s, nullptr),
-      db_, "prepare upsert_current_if_newer");
+struct SegmentFileInfo {
+  uint64_t rows{0};
+  uint64_t records{0};
+  int64_t min_ts{0};
+  int64_t max_ts{0};
+  uint64_t bytes{0};
+};
 
-    sqlite3_bind_int64(st.s, 1, (sqlite3_int64)f.record_id);
-    sqlite3_bind_int(st.s, 2, (int)f.field_id);
-    sqlite3_bind_int64(st.s, 3, (sqlite3_int64)f.value_id);
-    sqlite3_bind_int64(st.s, 4, (sqlite3_int64)f.ts_ms);
-    check_sql(sqlite3_step(st.s), db_, "upsert_current_if_newer step");
+static void write_all(int fd, const void* p, size_t n, const std::string& path) {
+  const char* c = static_cast<const char*>(p);
+  while (n > 0) {
+    ssize_t w = ::write(fd, c, n);
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      throw std::runtime_error("write failed: " + path);
+    }
+    c += w;
+    n -= (size_t)w;
   }
+}
 
-  std::vector<uint64_t> query_current_eq(uint32_t field_id, uint64_t value_id) {
-    Stmt st;
-    check_sql(sqlite3_prepare_v2(db_, "SELECT record_id FROM current_facts WHERE field_id=? AND value_id=?;",
-                                 -1, &st.s, nullptr),
-              db_, "prepare query_current_eq");
-    sqlite3_bind_int(st.s, 1, (int)field_id);
-    sqlite3_bind_int64(st.s, 2, (sqlite3_int64)value_id);
+// Writes rows (sorted by record_id, field_id, ts and non-empty) as a segment
+// at path. The file is written under a temporary name, synced and renamed, so
+// a crash never leaves a partial segment behind under its final name.
+static SegmentFileInfo write_fact_segment(const std::string& path, const std::vector<FactRow>& rows) {
+  SegmentFileInfo info{};
+  info.rows = rows.size();
+  info.min_ts = rows.front().ts_ms;
+  info.max_ts = rows.front().ts_ms;
+
+  std::vector<uint32_t> fields;
+  std::vector<uint64_t> values;
+  fields.reserve(rows.size());
+  values.reserve(rows.size());
+  for (const auto& f : rows) {
+    info.min_ts = std::min(info.min_ts, f.ts_ms);
+    info.max_ts = std::max(info.max_ts, f.ts_ms);
+    fields.push_back(f.field_id);
+    values.push_back(f.value_id);
+  }
+  std::sort(fields.begin(), fields.end());
+  fields.erase(std::unique(fields.begin(), fields.end()), fields.end());
+  std::sort(values.begin(), values.end());
+  values.erase(std::unique(values.begin(), values.end()), values.end());
+  const uint32_t fw = code_width(fields.size()), vw = code_width(values.size());
+
+  std::vector<int64_t> record_ids;
+  std::vector<uint64_t> row_start, ts_start;
+  std::string fcodes, vcodes, ts;
+  fcodes.reserve(rows.size() * fw);
+  vcodes.reserve(rows.size() * vw);
+  auto put_code = [](std::string& out, uint32_t width, uint32_t code) {
+    char b[4];
+    std::memcpy(b, &code, 4);
+    out.append(b, width);
+  };
+  int64_t prev = 0;
+  for (size_t r = 0; r < rows.size(); r++) {
+    const FactRow& f = rows[r];
+    if (r == 0 || (int64_t)f.record_id != record_ids.back()) {
+      record_ids.push_back((int64_t)f.record_id);
+      row_start.push_back(r);
+      ts_start.push_back(ts.size());
+      prev = info.min_ts;
+    }
+    put_code(fcodes, fw, (uint32_t)(std::lower_bound(fields.begin(), fields.end(), f.field_id) - fields.begin()));
+    put_code(vcodes, vw, (uint32_t)(std::lower_bound(values.begin(), values.end(), f.value_id) - values.begin()));
+    put_varint(ts, zigzag(f.ts_ms - prev));
+    prev = f.ts_ms;
+  }
+  row_start.push_back(rows.size());
+  ts_start.push_back(ts.size());
+  info.records = record_ids.size();
+
+  SegmentHeader h{};
+  std::memcpy(h.magic, kSegmentMagic, sizeof(kSegmentMagic));
+  h.version = 1;
+  h.field_width = fw;
+  h.value_width = vw;
+  h.rows = rows.size();
+  h.records = record_ids.size();
+  h.fields = fields.size();
+  h.values = values.size();
+  h.min_ts = info.min_ts;
+  h.max_ts = info.max_ts;
+  h.ts_bytes = ts.size();
+
+  const std::string tmp = path + ".tmp";
+  int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) throw std::runtime_error("cannot create segment " + tmp);
+  try {
+    uint64_t written = 0;
+    auto section = [&](const void* p, size_t n) {
+      static const char zeros[8] = {};
+      write_all(fd, p, n, tmp);
+      written += n;
+      size_t pad = align8((size_t)written) - (size_t)written;
+      write_all(fd, zeros, pad, tmp);
+      written += pad;
+    };
+    section(&h, sizeof(h));
+    section(record_ids.data(), record_ids.size() * 8);
+    section(row_start.data(), row_start.size() * 8);
+    section(ts_start.data(), ts_start.size() * 8);
+    section(fields.data(), fields.size() * 4);
+    section(values.data(), values.size() * 8);
+    section(fcodes.data(), fcodes.size());
+    section(vcodes.data(), vcodes.size());
+    section(ts.data(), ts.size());
+    info.bytes = written;
+    if (::fsync(fd) != 0) throw std::runtime_error("fsync failed: " + tmp);
+  } catch (...) {
+    ::close(fd);
+    ::unlink(tmp.c_str());
+    throw;
+  }
+  ::close(fd);
+  if (::rename(tmp.c_str(), path.c_str()) != 0) {
+    ::unlink(tmp.c_str());
+    throw std::runtime_error("cannot rename segment into place: " + path);
+  }
+  return info;
+}
 
-    std::vector<uint64_t> out;
-    for (;;) {
-      int rc = sqlite3_step(st.s);
-      if (rc == SQLITE_DONE) break;
-      check_sql(rc, db_, "query_current_eq step");
-      out.push_back((uint64_t)sqlite3_column_int64(st.s, 0));
+// The set of live segments as one connection last loaded it. Immutable once
+// built, so parallel readers can share it.
+struct SealedFacts {
+  std::string rev;
+  std::vector<std::shared_ptr<const FactSegment>> segments;
+  int64_t max_ts{std::numeric_limits<int64_t>::min()};
+
+  bool empty() const { return segments.empty(); }
+
+  // Rows of one record across all segments, in no particular order.
+  void record_rows(int64_t rid, std::vector<FactRow>& out) const {
+    for (const auto& s : segments) {
+      if (auto i = s->find_record(rid)) s->read_record(*i, out);
     }
-    return out;
   }
 
-  std::vector<uint64_t> query_ever_eq(uint32_t field_id, uint64_t value_id) {
-    Stmt st;
-    check_sql(sqlite3_prepare_v2(db_, "SELECT DISTINCT record_id FROM facts WHERE field_id=? AND value_id=?;",
-                                 -1, &st.s, nullptr),
-              db_, "prepare query_ever_eq");
-    sqlite3_bind_int(st.s, 1, (int)field_id);
-    sqlite3_bind_int64(st.s, 2, (sqlite3_int64)value_id);
+  // Rows of all records in r, in no particular order.
+  void range_rows(RecordRange r, std::vector<FactRow>& out) const {
+    for (const auto& s : segments) {
+      for (size_t i = s->record_lower_bound(r.lo); i < s->records() && s->record_id_at(i) <= r.hi; i++) {
+        s->read_record(i, out);
+      }
+    }
+  }
 
-    std::vector<uint64_t> out;
-    for (;;) {
-      int rc = sqlite3_step(st.s);
-      if (rc == SQLITE_DONE) break;
-      check_sql(rc, db_, "query_ever_eq step");
-      out.push_back((uint64_t)sqlite3_column_int64(st.s, 0));
+  bool contains(const FactRow& f) const {
+    if (f.ts_ms > max_ts) return false;
+    for (const auto& s : segments) {
+      if (f.ts_ms < s->min_ts() || f.ts_ms > s->max_ts()) continue;
+      auto i = s->find_record((int64_t)f.record_id);
+      if (i && s->has_row(*i, f.field_id, f.ts_ms)) return true;
     }
-    return out;
+    return false;
   }
+};
 
-  std::vector<FactRow> query_facts_window(int64_t t1, int64_t t2, std::optional<uint64_t> record_filter) {
-    std::vector<FactRow> out;
-    Stmt st;
+// Sealed rows of a facts window in output order, produced as they are
+// consumed. A single record's rows are read and sorted up front; otherwise
+// every overlapping segment contributes a cursor over its window index and
+// the cursors are merged through a heap.
+class SealedWindow {
+public:
+  SealedWindow(const SealedFacts& sealed, const FactsWindowQuery& q) {
+    auto in_window = [&](const FactRow& f) {
+      if (f.ts_ms < q.t1 || f.ts_ms > q.t2) return false;
+      if (!q.after) return true;
+      const FactRow cur{(uint64_t)q.after->record_id, q.after->field_id, 0, q.after->ts_ms};
+      return fact_window_less(cur, f);
+    };
+    for (const auto& seg : sealed.segments) {
+      if (seg->max_ts() < q.t1 || seg->min_ts() > q.t2) continue;
+      if (q.record_id) {
+        if (auto i = seg->find_record((int64_t)*q.record_id)) seg->read_record(*i, rows_);
+        continue;
+      }
+      Cursor c{seg.get(), seg->window_seek(q.t1), q.t2 == std::numeric_limits<int64_t>::max() ? seg->rows() : seg->window_seek(q.t2 + 1), {}};
+      if (q.after) c.pos = std::max(c.pos, seg->window_seek_after(FactRow{(uint64_t)q.after->record_id, q.after->field_id, 0, q.after->ts_ms}));
+      if (c.pos >= c.end) continue;
+      c.row = seg->window_row_at(c.pos);
+      heap_.push_back(c);
+    }
+    if (q.record_id) {
+      rows_.erase(std::remove_if(rows_.begin(), rows_.end(), [&](const FactRow& f) { return !in_window(f); }), rows_.end());
+      std::sort(rows_.begin(), rows_.end(), fact_window_less);
+    }
+    std::make_heap(heap_.begin(), heap_.end(), later);
+  }
+
+  // The next row, or null once the window's sealed rows are exhausted.
+  const FactRow* peek() const {
+    if (!heap_.empty()) return &heap_.front().row;
+    return ri_ < rows_.size() ? &rows_[ri_] : nullptr;
+  }
 
-    if (record_filter) {
-      check_sql(sqlite3_prepare_v2(db_,
-        "SELECT record_id, field_id, value_id, ts "
-        "FROM facts WHERE ts BETWEEN ? AND ? AND record_id=? ORDER BY ts;",
-        -1, &st.s, nullptr),
-        db_, "prepare query_facts_window(record)");
-      sqlite3_bind_int64(st.s, 1, (sqlite3_int64)t1);
-      sqlite3_bind_int64(st.s, 2, (sqlite3_int64)t2);
-      sqlite3_bind_int64(st.s, 3, (sqlite3_int64)*record_filter);
+  void next() {
+    if (heap_.empty()) {
+      ri_++;
+      return;
+    }
+    std::pop_heap(heap_.begin(), heap_.end(), later);
+    Cursor& c = heap_.back();
+    if (++c.pos < c.end) {
+      c.row = c.seg->window_row_at(c.pos);
+      std::push_heap(heap_.begin(), heap_.end(), later);
     } else {
-      check_sql(sqlite3_prepare_v2(db_,
-        "SELECT record_id, field_id, value_id, ts "
-        "FROM facts WHERE ts BETWEEN ? AND ? ORDER BY ts;",
-        -1, &st.s, nullptr),
-        db_, "prepare query_facts_window");
-      sqlite3_bind_int64(st.s, 1, (sqlite3_int64)t1);
-      sqlite3_bind_int64(st.s, 2, (sqlite3_int64)t2);
+      heap_.pop_back();
     }
+  }
 
-    for (;;) {
-      int rc = sqlite3_step(st.s);
-      if (rc == SQLITE_DONE) break;
-      check_sql(rc, db_, "query_facts_window step");
-      FactRow f{};
-      f.record_id = (uint64_t)sqlite3_column_int64(st.s, 0);
-      f.field_id  = (uint32_t)sqlite3_column_int(st.s, 1);
-      f.value_id  = (uint64_t)sqlite3_column_int64(st.s, 2);
-      f.ts_ms     = (int64_t)sqlite3_column_int64(st.s, 3);
-      out.push_back(f);
+private:
+  struct Cursor {
+    const FactSegment* seg;
+    size_t pos, end;
+    FactRow row;
+  };
+
+  static bool later(const Cursor& a, const Cursor& b) { return fact_window_less(b.row, a.row); }
+
+  std::vector<FactRow> rows_;
+  size_t ri_{0};
+  std::vector<Cursor> heap_;
+};
+
+// Folds rows into state (one row per field, sorted by field_id), keeping the
+// latest row at or before t for each field.
+static void fold_latest(std::vector<FactRow>& state, const std::vector<FactRow>& rows, int64_t t) {
+  for (const auto& f : rows) {
+    if (f.ts_ms > t) continue;
+    auto it = std::lower_bound(state.begin(), state.end(), f.field_id,
+                               [](const FactRow& a, uint32_t fid) { return a.field_id < fid; });
+    if (it != state.end() && it->field_id == f.field_id) {
+      if (f.ts_ms > it->ts_ms) *it = f;
+    } else {
+      state.insert(it, f);
     }
-    return out;
   }
+}
 
-  std::vector<FactRow> snapshot_at(uint64_t record_id, int64_t t) {
-    // Latest per field where ts <= t
-    Stmt st;
-    check_sql(sqlite3_prepare_v2(db_,
-      "SELECT f.record_id, f.field_id, f.value_id, f.ts "
-      "FROM facts f "
-      "JOIN ("
-      "  SELECT field_id, MAX(ts) AS max_ts "
-      "  FROM facts "
-      "  WHERE record_id=? AND ts <= ? "
-      "  GROUP BY field_id"
-      ") latest "
-      "ON latest.field_id = f.field_id AND latest.max_ts = f.ts "
-      "WHERE f.record_id=?;",
-      -1, &st.s, nullptr),
-      db_, "prepare snapshot_at");
+// ------------------------------------------------------------
+// Blob store
+//
+// Text and bytes values longer than the database's blob threshold are kept
+// out of SQLite, in content-addressed files next to the database
+// (<db>.blobs/<hh>/<rest of the hex identity hash>). Their f_values row keeps
+// the hash and size (blob_size) with both canon columns NULL, so the small
+// value rows and the indexes stay dense. A blob is written, synced and
+// renamed into place before the row that refers to it, and is mapped
+// read-only the first time a reader looks at it.
+// ------------------------------------------------------------
 
-    sqlite3_bind_int64(st.s, 1, (sqlite3_int64)record_id);
-    sqlite3_bind_int64(st.s, 2, (sqlite3_int64)t);
-    sqlite3_bind_int64(st.s, 3, (sqlite3_int64)record_id);
+static constexpr const char* kBlobThresholdKey = "blob_threshold_bytes";
+static constexpr uint64_t kDefaultBlobThreshold = 64 * 1024;
 
-    std::vector<FactRow> out;
-    for (;;) {
-      int rc = sqlite3_step(st.s);
-      if (rc == SQLITE_DONE) break;
-      check_sql(rc, db_, "snapshot_at step");
-      FactRow f{};
-      f.record_id = (uint64_t)sqlite3_column_int64(st.s, 0);
-      f.field_id  = (uint32_t)sqlite3_column_int(st.s, 1);
-      f.value_id  = (uint64_t)sqlite3_column_int64(st.s, 2);
-      f.ts_ms     = (int64_t)sqlite3_column_int64(st.s, 3);
-      out.push_back(f);
-    }
-    return out;
+static std::string hex_lower(const uint8_t* p, size_t n) {
+  static constexpr char kHex[] = "0123456789abcdef";
+  std::string s;
+  s.reserve(n * 2);
+  for (size_t i = 0; i < n; i++) {
+    s.push_back(kHex[p[i] >> 4]);
+    s.push_back(kHex[p[i] & 0xF]);
   }
+  return s;
+}
 
-  FieldRow get_field(uint32_t field_id) {
-    Stmt st;
-    check_sql(sqlite3_prepare_v2(db_, "SELECT field_id, name_canon FROM fields WHERE field_id=?;", -1, &st.s, nullptr),
-              db_, "prepare get_field");
-    sqlite3_bind_int(st.s, 1, (int)field_id);
-    int rc = sqlite3_step(st.s);
-    check_sql(rc, db_, "get_field step");
-    if (rc != SQLITE_ROW) throw std::runtime_error("unknown field_id");
-    FieldRow fr{};
-    fr.field_id = (uint32_t)sqlite3_column_int(st.s, 0);
-    fr.name_canon = (const char*)sqlite3_column_text(st.s, 1);
-    return fr;
+// One stored value. The file is mapped on the first view() and unmapped with
+// the last reference.
+class MappedBlob {
+public:
+  MappedBlob(std::string path, size_t size) : path_(std::move(path)), size_(size) {}
+  MappedBlob(const MappedBlob&) = delete;
+  MappedBlob& operator=(const MappedBlob&) = delete;
+  ~MappedBlob() {
+    if (base_) ::munmap(const_cast<char*>(base_), size_);
   }
 
-  ValueRow get_value(uint64_t value_id) {
-    Stmt st;
-    check_sql(sqlite3_prepare_v2(db_, "SELECT value_id, type_tag, canon_text FROM f_values WHERE value_id=?;", -1, &st.s, nullptr),
-              db_, "prepare get_value");
-    sqlite3_bind_int64(st.s, 1, (sqlite3_int64)value_id);
-    int rc = sqlite3_step(st.s);
-    check_sql(rc, db_, "get_value step");
-    if (rc != SQLITE_ROW) throw std::runtime_error("unknown value_id");
-    ValueRow vr{};
-    vr.value_id = (uint64_t)sqlite3_column_int64(st.s, 0);
-    uint8_t tag = (uint8_t)sqlite3_column_int(st.s, 1);
-    vr.type = logical_type_from_tag(tagmap_, tag);
-    const unsigned char* txt = sqlite3_column_text(st.s, 2);
-    vr.canon_text = txt ? (const char*)txt : "";
-    return vr;
+  std::string_view view() const {
+    std::call_once(mapped_, [this] { map(); });
+    return std::string_view(base_, size_);
   }
 
-  void rebuild_current_facts() {
-    exec_sql(db_, "DELETE FROM current_facts;");
-    exec_sql(db_, R"SQL(
-      INSERT INTO current_facts(record_id, field_id, value_id, ts)
-      SELECT f.record_id, f.field_id, f.value_id, f.ts
-      FROM facts f
-      JOIN (
-        SELECT record_id, field_id, MAX(ts) AS max_ts
-        FROM facts
-        GROUP BY record_id, field_id
-      ) latest
-      ON latest.record_id = f.record_id
-      AND latest.field_id  = f.field_id
-      AND latest.max_ts    = f.ts;
-    )SQL");
+private:
+  void map() const {
+    int fd = ::open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) throw std::runtime_error("missing blob " + path_);
+    struct stat sb{};
+    if (::fstat(fd, &sb) != 0 || (size_t)sb.st_size != size_) {
+      ::close(fd);
+      throw std::runtime_error("blob has the wrong size: " + path_);
+    }
+    void* p = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) throw std::runtime_error("cannot map blob " + path_);
+    base_ = static_cast<const char*>(p);
   }
 
-  uint64_t null_value_id() const { return null_value_id_; }
+  std::string path_;
+  size_t size_;
+  mutable std::once_flag mapped_;
+  mutable const char* base_{nullptr};
+};
+
+inline std::string_view ValueRow::canon() const { return blob && type != LogicalType::Bytes ? blob->view() : canon_text; }
+inline std::string_view ValueRow::bytes() const { return blob ? blob->view() : std::string_view(canon_bytes); }
+inline std::string_view StoredValue::bytes() const { return blob ? blob->view() : canon; }
+
+class BlobStore {
+public:
+  explicit BlobStore(std::string dir) : dir_(std::move(dir)) {}
+
+  const std::string& dir() const { return dir_; }
+
+  std::string path_for(const std::array<uint8_t, 32>& hash) const {
+    const std::string hex = hex_lower(hash.data(), hash.size());
+    return dir_ + "/" + hex.substr(0, 2) + "/" + hex.substr(2);
+  }
+
+  // Idempotent: a blob that is already present is left alone.
+  void put(const std::array<uint8_t, 32>& hash, const void* data, size_t n) const {
+    const std::string path = path_for(hash);
+    struct stat sb{};
+    if (::stat(path.c_str(), &sb) == 0 && (size_t)sb.st_size == n) return;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path());
+    const std::string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) throw std::runtime_error("cannot create blob " + tmp);
+    try {
+      write_all(fd, data, n, tmp);
+      if (::fsync(fd) != 0) throw std::runtime_error("fsync failed: " + tmp);
+    } catch (...) {
+      ::close(fd);
+      ::unlink(tmp.c_str());
+      throw;
+    }
+    ::close(fd);
+    if (::rename(tmp.c_str(), path.c_str()) != 0) {
+      ::unlink(tmp.c_str());
+      throw std::runtime_error("cannot rename blob into place: " + path);
+    }
+  }
+
+  std::shared_ptr<const MappedBlob> get(const std::array<uint8_t, 32>& hash, size_t n) const {
+    return std::make_shared<const MappedBlob>(path_for(hash), n);
+  }
+
+  // Makes the blob stored under from available under to as well, as a hard
+  // link where the filesystem allows it. Idempotent like put().
+  void link(const std::array<uint8_t, 32>& from, const std::array<uint8_t, 32>& to, size_t n) const {
+    const std::string dst = path_for(to);
+    struct stat sb{};
+    if (::stat(dst.c_str(), &sb) == 0 && (size_t)sb.st_size == n) return;
+    std::filesystem::create_directories(std::filesystem::path(dst).parent_path());
+    std::error_code ec;
+    std::filesystem::remove(dst, ec);
+    std::filesystem::create_hard_link(path_for(from), dst, ec);
+    if (!ec) return;
+    MappedBlob src(path_for(from), n);
+    put(to, src.view().data(), n);
+  }
+
+private:
+  std::string dir_;
+};
+
+static constexpr const char* kCheckpointIntervalKey = "checkpoint_interval_ms";
+static constexpr const char* kCheckpointMinFactsKey = "checkpoint_min_facts";
+static constexpr const char* kBulkLoadKey = "bulk_load";
+static constexpr const char* kFormatMigrateKey = "format_migrate_next";
+
+// ------------------------------------------------------------
+// Storage interface
+//
+// Everything ingest, NDJSON import, the query helpers and JSON output need
+// from a store. FelixSqlite is the reference backend; FelixLsm keeps the same
+// facts in an embedded LSM key-value store. Maintenance (rebuild,
+// checkpoints, seal, bulk load) and server mode are SQLite-only.
+// ------------------------------------------------------------
+
+class FactStore {
+public:
+  virtual ~FactStore() = default;
+
+  // Runs fn as one atomic unit; any exception rolls everything back.
+  virtual void with_tx(const std::function<void()>& fn) = 0;
+
+  virtual void ensure_record(uint64_t record_id, int64_t created_ts_ms) = 0;
+  virtual uint32_t get_or_create_field(std::string_view field_name) = 0;
+  virtual uint64_t get_or_create_value(const CanonView& cv) = 0;
+  virtual std::optional<uint32_t> find_field_id(std::string_view field_name) = 0;
+  virtual std::optional<uint64_t> find_value_id(CanonValue cv) = 0;
+  virtual std::optional<std::pair<uint64_t, int64_t>> get_current(uint64_t record_id, uint32_t field_id) = 0;
+  virtual void insert_fact(const FactRow& f) = 0;
+  virtual void upsert_current_if_newer(const FactRow& f) = 0;
+  // Event mode: inserts f and advances current state unless the field
+  // already held f.value_id as of f.ts_ms (the current value for a fact at
+  // or after the current ts, the value in force then for a late one).
+  // Returns whether f was inserted.
+  virtual bool insert_fact_if_changed(const FactRow& f) = 0;
+
+  virtual std::vector<uint64_t> query_current_eq(uint32_t field_id, uint64_t value_id) = 0;
+  virtual std::vector<uint64_t> query_ever_eq(uint32_t field_id, uint64_t value_id) = 0;
+  virtual std::vector<uint64_t> query_current_range(uint32_t field_id, const ValueRange& r) = 0;
+  virtual std::vector<uint64_t> query_ever_range(uint32_t field_id, const ValueRange& r) = 0;
+  virtual void query_facts_window(const FactsWindowQuery& q, const std::function<bool(const FactView&)>& fn) = 0;
+  virtual void query_history(const HistoryQuery& q, const std::function<bool(const FactView&)>& fn) = 0;
+  virtual std::vector<FactRow> snapshot_at(uint64_t record_id, int64_t t) = 0;
+  virtual void snapshot_range(RecordRange r, int64_t t,
+                              const std::function<void(uint64_t, const std::vector<FactRow>&)>& fn) = 0;
+
+  virtual FieldRow get_field(uint32_t field_id) = 0;
+  virtual ValueRow get_value(uint64_t value_id) = 0;
+  virtual TagMapVersion tag_map() const = 0;
+  virtual HashFormatVersion hash_format() const = 0;
+};
+
+// Validated canonical field name and its identity hash.
+static std::pair<std::string, std::array<uint8_t, 32>> canonical_field(std::string_view field_name) {
+  if (field_name.size() > 256) throw std::runtime_error("field name exceeds 256 bytes");
+  require_utf8(field_name, "field name");
+  std::string canon = nfc_normalize_utf8(trim_copy(field_name));
+  auto h = field_hash_of_canon(canon);
+  return {std::move(canon), h};
+}
+
+// Resource limits (spec recommended defaults).
+static void check_value_limits(const CanonView& cv) {
+  if (cv.logical_type == LogicalType::Text && cv.canon.size() > (1u * 1024u * 1024u)) throw std::runtime_error("text value exceeds 1 MiB");
+  if (cv.logical_type == LogicalType::Bytes && cv.canon.size() > (4u * 1024u * 1024u)) throw std::runtime_error("bytes value exceeds 4 MiB");
+}
+
+class FelixSqlite final : public FactStore {
+public:
+  // ReadOnly connections never write (not even schema or meta) and can run
+  // next to a WAL writer; write paths fail on them with SQLITE_READONLY.
+  enum class OpenMode { ReadWrite, ReadOnly };
+
+  explicit FelixSqlite(const std::string& path, OpenMode mode = OpenMode::ReadWrite)
+    : path_(path), read_only_(mode == OpenMode::ReadOnly) {
+    int flags = read_only_ ? SQLITE_OPEN_READONLY : (SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
+    int rc = sqlite3_open_v2(path.c_str(), &db_, flags, nullptr);
+    if (rc != SQLITE_OK) {
+      sqlite3_close(db_);
+      db_ = nullptr;
+      throw std::runtime_error(read_only_ ? "failed to open sqlite db read-only" : "failed to open sqlite db");
+    }
+    stmts_.attach(db_);
+
+    if (read_only_) {
+      sqlite3_busy_timeout(db_, 5000);
+    } else {
+      exec_sql(db_, "PRAGMA foreign_keys = ON;");
+      exec_sql(db_, "PRAGMA journal_mode = WAL;");
+      exec_sql(db_, "PRAGMA synchronous = NORMAL;");
+      ensure_meta_table();
+    }
+    load_format_defaults();
+    checkpoints_enabled_ = meta_get(kCheckpointIntervalKey).has_value();
+    blob_column_ = table_has_column("f_values", "blob_size");
+    num_column_ = table_has_column("f_values", "num");
+    seq_column_ = table_has_column("facts", "seq");
+    if (auto v = meta_get(kBlobThresholdKey)) blob_threshold_ = std::stoull(*v);
+  }
+
+  ~FelixSqlite() {
+    stmts_.clear();
+    if (db_) sqlite3_close(db_);
+  }
+
+  static constexpr const char* kMigrationPendingError =
+    "database is halfway through a format migration; run migrate_format to finish it";
+
+  // Bumped whenever init_schema creates or drops objects.
+  static constexpr const char* kSchemaRev = "7";
+
+  // Prepares the connection for normal commands. A DB whose schema is
+  // already at kSchemaRev is only read from; otherwise init_schema runs once.
+  void open_schema() {
+    if (format_migration_pending()) throw std::runtime_error(kMigrationPendingError);
+    auto rev = meta_get("schema_rev");
+    if (read_only_ || (rev && *rev == kSchemaRev)) {
+      auto nv = find_value_id(null_canon_value());
+      if (!nv && !read_only_) {
+        ensure_null_value();
+        return;
+      }
+      null_value_id_ = nv.value_or(0);
+      return;
+    }
+    init_schema();
+  }
+
+  void init_schema() {
+    // New databases are declared Felix v0.3. A database that already records
+    // its format, or holds values without recording one (legacy), keeps it.
+    const bool fresh = !meta_get("tag_map").has_value() && !meta_get("hash_format").has_value() &&
+                       (!table_exists("f_values") || !table_has_rows("f_values"));
+
+    exec_sql(db_, R"SQL(
+      CREATE TABLE IF NOT EXISTS fields (
+        field_id    INTEGER PRIMARY KEY,
+        name_canon  TEXT NOT NULL,
+        hash        BLOB NOT NULL UNIQUE
+      );
+
+      CREATE TABLE IF NOT EXISTS f_values (
+        value_id    INTEGER PRIMARY KEY,
+        type_tag    INTEGER NOT NULL,
+        canon_text  TEXT,
+        canon_blob  BLOB,
+        hash        BLOB NOT NULL UNIQUE,
+        blob_size   INTEGER,          -- set when the value lives in the blob store
+        num                           -- int/float/bool value; no affinity, so ints stay exact
+      );
+
+      CREATE TABLE IF NOT EXISTS records (
+        record_id   INTEGER PRIMARY KEY,
+        created_ts  INTEGER NOT NULL
+      );
+
+      CREATE TABLE IF NOT EXISTS facts (
+        record_id  INTEGER NOT NULL,
+        field_id   INTEGER NOT NULL,
+        value_id   INTEGER NOT NULL,
+        ts         INTEGER NOT NULL,
+        seq        INTEGER,            -- ingest order; the change feed position
+        PRIMARY KEY (record_id, field_id, ts),
+        FOREIGN KEY (record_id) REFERENCES records(record_id),
+        FOREIGN KEY (field_id)  REFERENCES fields(field_id),
+        FOREIGN KEY (value_id)  REFERENCES f_values(value_id)
+      );
+
+      CREATE TABLE IF NOT EXISTS current_facts (
+        record_id  INTEGER NOT NULL,
+        field_id   INTEGER NOT NULL,
+        value_id   INTEGER NOT NULL,
+        ts         INTEGER NOT NULL,
+        PRIMARY KEY (record_id, field_id),
+        FOREIGN KEY (record_id) REFERENCES records(record_id),
+        FOREIGN KEY (field_id)  REFERENCES fields(field_id),
+        FOREIGN KEY (value_id)  REFERENCES f_values(value_id)
+      );
+
+      CREATE TABLE IF NOT EXISTS fact_segments (
+        seg_id      INTEGER PRIMARY KEY,
+        file        TEXT NOT NULL,
+        rows        INTEGER NOT NULL,
+        records     INTEGER NOT NULL,
+        min_ts      INTEGER NOT NULL,
+        max_ts      INTEGER NOT NULL,
+        bytes       INTEGER NOT NULL
+      );
+
+      -- Same order as the facts primary key; kept off new schemas.
+      DROP INDEX IF EXISTS facts_by_record_field_ts;
+    )SQL");
+    if (!table_has_column("f_values", "blob_size")) exec_sql(db_, "ALTER TABLE f_values ADD COLUMN blob_size INTEGER;");
+    blob_column_ = true;
+    if (!table_has_column("f_values", "num")) {
+      begin_tx(db_);
+      try {
+        exec_sql(db_, "ALTER TABLE f_values ADD COLUMN num;");
+        backfill_numeric_values();
+        commit_tx(db_);
+      } catch (...) {
+        rollback_tx(db_);
+        throw;
+      }
+    }
+    num_column_ = true;
+    if (!table_has_column("facts", "seq")) {
+      // Existing facts keep their insertion order.
+      begin_tx(db_);
+      try {
+        exec_sql(db_, "ALTER TABLE facts ADD COLUMN seq INTEGER;");
+        exec_sql(db_, "UPDATE facts SET seq = rowid;");
+        commit_tx(db_);
+      } catch (...) {
+        rollback_tx(db_);
+        throw;
+      }
+    }
+    // Not a secondary index: new seqs append at its right edge, and every
+    // write transaction reads its maximum, bulk loads included.
+    exec_sql(db_, "CREATE UNIQUE INDEX IF NOT EXISTS facts_by_seq ON facts(seq);");
+    seq_column_ = true;
+    if (!bulk_load_pending()) create_secondary_indexes();
+
+    // Declare this database as Felix v0.3 format for new DBs.
+    if (fresh) declare_felix_v03();
+    meta_set("schema_rev", kSchemaRev);
+    load_format_defaults();
+
+    ensure_null_value();
+  }
+
+  void with_tx(const std::function<void()>& fn) override {
+    begin_tx(db_);
+    in_tx_ = true;
+    next_seq_.reset();
+    try {
+      sync_segments();
+      sync_data_version();
+      if (migration_pending_ && !migrating_) throw std::runtime_error(kMigrationPendingError);
+      fn();
+      flush_current();
+      StageTimer timer(IngestStage::Commit);
+      commit_tx(db_);
+    } catch (...) {
+      in_tx_ = false;
+      field_ids_.rollback();
+      value_ids_.rollback();
+      current_.clear();
+      rollback_tx(db_);
+      throw;
+    }
+    in_tx_ = false;
+    field_ids_.commit();
+    value_ids_.commit();
+  }
+
+  // Runs fn inside one read transaction (or the one already open), so the
+  // segment list and the live facts it is combined with are one state.
+  void with_read_snapshot(const std::function<void()>& fn) {
+    if (!sqlite3_get_autocommit(db_)) {
+      fn();
+      return;
+    }
+    exec_sql(db_, "BEGIN;");
+    try {
+      sync_segments();
+      sync_data_version();
+      fn();
+      commit_tx(db_);
+    } catch (...) {
+      rollback_tx(db_);
+      throw;
+    }
+  }
+
+  void ensure_record(uint64_t record_id, int64_t created_ts_ms) override {
+    auto st = stmts_.get("INSERT OR IGNORE INTO records(record_id, created_ts) VALUES(?,?);",
+                         "prepare ensure_record");
+    sqlite3_bind_int64(st.s, 1, (sqlite3_int64)record_id);
+    sqlite3_bind_int64(st.s, 2, (sqlite3_int64)created_ts_ms);
+    check_sql(st.step(), db_, "ensure_record step");
+  }
+
+  uint32_t get_or_create_field(std::string_view field_name) override {
+    if (auto hit = field_ids_.find(field_name)) return *hit;
+    auto [canon, h] = canonical_field(field_name);
+
+    {
+      auto st = stmts_.get("INSERT OR IGNORE INTO fields(name_canon, hash) VALUES(?,?);",
+                           "prepare field insert");
+      sqlite3_bind_text(st.s, 1, canon.c_str(), -1, SQLITE_TRANSIENT);
+      sqlite3_bind_blob(st.s, 2, h.data(), (int)h.size(), SQLITE_TRANSIENT);
+      check_sql(st.step(), db_, "field insert step");
+    }
+
+    {
+      auto st = stmts_.get("SELECT field_id FROM fields WHERE hash=?;",
+                           "prepare field select");
+      sqlite3_bind_blob(st.s, 1, h.data(), (int)h.size(), SQLITE_TRANSIENT);
+      int rc = st.step();
+      check_sql(rc, db_, "field select step");
+      if (rc == SQLITE_ROW) {
+        uint32_t fid = (uint32_t)sqlite3_column_int(st.s, 0);
+        field_ids_.put(std::string(field_name), fid, in_tx_);
+        return fid;
+      }
+    }
+
+    throw std::runtime_error("field insert/select failed unexpectedly");
+  }
+
+  uint64_t get_or_create_value(const CanonView& cv) override {
+    check_value_limits(cv);
+
+    const std::array<uint8_t, 32> hash = hashed_under(cv, tagmap_, hashfmt_) ? cv.hash : canon_view_hash(tagmap_, hashfmt_, cv);
+    if (auto hit = value_ids_.find(hash)) return *hit;
+
+    const bool bytes = cv.logical_type == LogicalType::Bytes;
+    const size_t size = cv.canon.size();
+    if ((bytes || cv.logical_type == LogicalType::Text) && blob_threshold_ > 0 && size > blob_threshold_) {
+      {
+        auto st = stmts_.get("SELECT value_id FROM f_values WHERE hash=?;", "prepare value select");
+        sqlite3_bind_blob(st.s, 1, hash.data(), (int)hash.size(), SQLITE_TRANSIENT);
+        int rc = st.step();
+        check_sql(rc, db_, "value select step");
+        if (rc == SQLITE_ROW) {
+          uint64_t vid = (uint64_t)sqlite3_column_int64(st.s, 0);
+          value_ids_.put(hash, vid, in_tx_);
+          return vid;
+        }
+      }
+      blobs_.put(hash, cv.canon.data(), size);
+      auto st = stmts_.get("INSERT INTO f_values(type_tag, hash, blob_size) VALUES(?,?,?);", "prepare blob value insert");
+      sqlite3_bind_int(st.s, 1, (int)type_tag_byte(tagmap_, cv.logical_type));
+      sqlite3_bind_blob(st.s, 2, hash.data(), (int)hash.size(), SQLITE_TRANSIENT);
+      sqlite3_bind_int64(st.s, 3, (sqlite3_int64)size);
+      check_sql(st.step(), db_, "blob value insert step");
+      uint64_t vid = (uint64_t)sqlite3_last_insert_rowid(db_);
+      value_ids_.put(hash, vid, in_tx_);
+      return vid;
+    }
+
+    const bool numeric = cv.logical_type == LogicalType::Int || cv.logical_type == LogicalType::Float ||
+                         cv.logical_type == LogicalType::Bool;
+    if (numeric) {
+      // Numbers keep only the native value; canon text is rebuilt on read.
+      auto st = stmts_.get("INSERT OR IGNORE INTO f_values(type_tag, hash, num) VALUES(?,?,?);",
+                           "prepare numeric value insert");
+      sqlite3_bind_int(st.s, 1, (int)type_tag_byte(tagmap_, cv.logical_type));
+      sqlite3_bind_blob(st.s, 2, hash.data(), (int)hash.size(), SQLITE_TRANSIENT);
+      if (cv.logical_type == LogicalType::Float) {
+        sqlite3_bind_double(st.s, 3, numeric_of(cv.logical_type, cv.canon, std::nullopt).d);
+      } else if (cv.logical_type == LogicalType::Bool) {
+        sqlite3_bind_int(st.s, 3, cv.canon == "true" ? 1 : 0);
+      } else {
+        sqlite3_bind_int64(st.s, 3, (sqlite3_int64)numeric_of(cv.logical_type, cv.canon, std::nullopt).i);
+      }
+      check_sql(st.step(), db_, "numeric value insert step");
+    } else {
+      auto st = stmts_.get("INSERT OR IGNORE INTO f_values(type_tag, canon_text, canon_blob, hash) VALUES(?,?,?,?);",
+                           "prepare value insert");
+
+      sqlite3_bind_int(st.s, 1, (int)type_tag_byte(tagmap_, cv.logical_type));
+
+      // An empty view may carry a null pointer, which SQLite would bind as NULL.
+      const char* data = cv.canon.empty() ? "" : cv.canon.data();
+      if (bytes) {
+        sqlite3_bind_null(st.s, 2);
+        sqlite3_bind_blob(st.s, 3, data, (int)size, SQLITE_TRANSIENT);
+      } else {
+        sqlite3_bind_text(st.s, 2, data, (int)size, SQLITE_TRANSIENT);
+        sqlite3_bind_null(st.s, 3);
+      }
+
+      sqlite3_bind_blob(st.s, 4, hash.data(), (int)hash.size(), SQLITE_TRANSIENT);
+      check_sql(st.step(), db_, "value insert step");
+    }
+
+    {
+      auto st = stmts_.get("SELECT value_id FROM f_values WHERE hash=?;",
+                           "prepare value select");
+      sqlite3_bind_blob(st.s, 1, hash.data(), (int)hash.size(), SQLITE_TRANSIENT);
+      int rc = st.step();
+      check_sql(rc, db_, "value select step");
+      if (rc == SQLITE_ROW) {
+        uint64_t vid = (uint64_t)sqlite3_column_int64(st.s, 0);
+        value_ids_.put(hash, vid, in_tx_);
+        return vid;
+      }
+    }
+
+    throw std::runtime_error("value insert/select failed unexpectedly");
+  }
+
+  // Lookup-only counterparts of get_or_create_*: an unknown name or value
+  // yields nullopt and nothing is written, so they work on ReadOnly
+  // connections.
+  std::optional<uint32_t> find_field_id(std::string_view field_name) override {
+    if (!in_tx_) sync_data_version();
+    if (auto hit = field_ids_.find(field_name)) return *hit;
+    if (field_name.size() > 256) return std::nullopt;
+    auto h = canonical_field(field_name).second;
+    auto st = stmts_.get("SELECT field_id FROM fields WHERE hash=?;",
+                         "prepare field select");
+    sqlite3_bind_blob(st.s, 1, h.data(), (int)h.size(), SQLITE_TRANSIENT);
+    int rc = st.step();
+    check_sql(rc, db_, "field select step");
+    if (rc != SQLITE_ROW) return std::nullopt;
+    uint32_t fid = (uint32_t)sqlite3_column_int(st.s, 0);
+    field_ids_.put(std::string(field_name), fid, in_tx_);
+    return fid;
+  }
+
+  std::optional<uint64_t> find_value_id(CanonValue cv) override {
+    if (!in_tx_) sync_data_version();
+    if (!hashed_under(cv, tagmap_, hashfmt_)) hash_canon_value(tagmap_, hashfmt_, cv);
+    if (auto hit = value_ids_.find(cv.hash)) return *hit;
+    auto st = stmts_.get("SELECT value_id FROM f_values WHERE hash=?;",
+                         "prepare value select");
+    sqlite3_bind_blob(st.s, 1, cv.hash.data(), (int)cv.hash.size(), SQLITE_TRANSIENT);
+    int rc = st.step();
+    check_sql(rc, db_, "value select step");
+    if (rc != SQLITE_ROW) return std::nullopt;
+    uint64_t vid = (uint64_t)sqlite3_column_int64(st.s, 0);
+    value_ids_.put(cv.hash, vid, in_tx_);
+    return vid;
+  }
+
+  std::optional<std::pair<uint64_t, int64_t>> get_current(uint64_t record_id, uint32_t field_id) override {
+    const CurrentStateCache::Entry e = in_tx_ ? current_entry(record_id, field_id) : load_current(record_id, field_id);
+    if (!e.present) return std::nullopt;
+    return std::make_pair(e.value_id, e.ts);
+  }
+
+  void insert_fact(const FactRow& f) override {
+    // The facts primary key no longer sees sealed rows; keep it unique.
+    if (!sealed_->empty() && sealed_->contains(f)) {
+      throw std::runtime_error("insert_fact failed: fact (record_id, field_id, ts) is already sealed");
+    }
+    if (!in_tx_ || !next_seq_) next_seq_ = feed_head() + 1;
+    auto st = stmts_.get("INSERT INTO facts(record_id, field_id, value_id, ts, seq) VALUES(?,?,?,?,?);",
+                         "prepare insert_fact");
+    sqlite3_bind_int64(st.s, 1, (sqlite3_int64)f.record_id);
+    sqlite3_bind_int(st.s, 2, (int)f.field_id);
+    sqlite3_bind_int64(st.s, 3, (sqlite3_int64)f.value_id);
+    sqlite3_bind_int64(st.s, 4, (sqlite3_int64)f.ts_ms);
+    sqlite3_bind_int64(st.s, 5, (sqlite3_int64)(*next_seq_)++);
+    check_sql(st.step(), db_, "insert_fact step");
+    if (checkpoints_enabled_) invalidate_checkpoints(f.record_id, f.ts_ms);
+  }
+
+  void upsert_current_if_newer(const FactRow& f) override {
+    if (in_tx_) {
+      StageTimer timer(IngestStage::UpsertCurrent);
+      CurrentStateCache::Entry& e = current_entry(f.record_id, f.field_id);
+      if (!e.present || f.ts_ms >= e.ts) current_.set(f.record_id, f.field_id, e, f.value_id, f.ts_ms);
+      return;
+    }
+    current_.clear();
+    auto st = stmts_.get(
+      "INSERT INTO current_facts(record_id, field_id, value_id, ts) "
+      "VALUES(?,?,?,?) "
+      "ON CONFLICT(record_id, field_id) DO UPDATE SET "
+      "value_id=excluded.value_id, ts=excluded.ts "
+      "WHERE excluded.ts >= current_facts.ts;",
+      "prepare upsert_current_if_newer");
+
+    sqlite3_bind_int64(st.s, 1, (sqlite3_int64)f.record_id);
+    sqlite3_bind_int(st.s, 2, (int)f.field_id);
+    sqlite3_bind_int64(st.s, 3, (sqlite3_int64)f.value_id);
+    sqlite3_bind_int64(st.s, 4, (sqlite3_int64)f.ts_ms);
+    check_sql(st.step(), db_, "upsert_current_if_newer step");
+  }
+
+  bool insert_fact_if_changed(const FactRow& f) override {
+    if (!in_tx_) {
+      bool inserted = false;
+      with_tx([&]{ inserted = insert_fact_if_changed(f); });
+      return inserted;
+    }
+    CurrentStateCache::Entry* e = nullptr;
+    {
+      StageTimer timer(IngestStage::GetCurrent);
+      e = &current_entry(f.record_id, f.field_id);
+      if (e->present) {
+        std::optional<uint64_t> prev = e->value_id;
+        if (f.ts_ms < e->ts) prev = value_as_of(f.record_id, f.field_id, f.ts_ms);
+        if (prev == f.value_id) return false;
+      }
+    }
+    {
+      StageTimer timer(IngestStage::InsertFact);
+      insert_fact(f);
+    }
+    if (!e->present || f.ts_ms >= e->ts) current_.set(f.record_id, f.field_id, *e, f.value_id, f.ts_ms);
+    return true;
+  }
+
+  std::vector<uint64_t> query_current_eq(uint32_t field_id, uint64_t value_id) override {
+    auto st = stmts_.get("SELECT record_id FROM current_facts WHERE field_id=? AND value_id=?;",
+                         "prepare query_current_eq");
+    sqlite3_bind_int(st.s, 1, (int)field_id);
+    sqlite3_bind_int64(st.s, 2, (sqlite3_int64)value_id);
+
+    std::vector<uint64_t> out;
+    for (;;) {
+      int rc = st.step();
+      if (rc == SQLITE_DONE) break;
+      check_sql(rc, db_, "query_current_eq step");
+      out.push_back((uint64_t)sqlite3_column_int64(st.s, 0));
+    }
+    return out;
+  }
+
+  std::vector<uint64_t> query_ever_eq(uint32_t field_id, uint64_t value_id) override {
+    std::vector<uint64_t> out;
+    with_read_snapshot([&]{
+      auto st = stmts_.get("SELECT DISTINCT record_id FROM facts WHERE field_id=? AND value_id=?;",
+                           "prepare query_ever_eq");
+      sqlite3_bind_int(st.s, 1, (int)field_id);
+      sqlite3_bind_int64(st.s, 2, (sqlite3_int64)value_id);
+
+      for (;;) {
+        int rc = st.step();
+        if (rc == SQLITE_DONE) break;
+        check_sql(rc, db_, "query_ever_eq step");
+        out.push_back((uint64_t)sqlite3_column_int64(st.s, 0));
+      }
+      if (sealed_->empty()) return;
+
+      for (const auto& seg : sealed_->segments) {
+        seg->records_with(field_id, value_id, [&](size_t i) { out.push_back((uint64_t)seg->record_id_at(i)); });
+      }
+      std::sort(out.begin(), out.end(), [](uint64_t a, uint64_t b) { return (int64_t)a < (int64_t)b; });
+      out.erase(std::unique(out.begin(), out.end()), out.end());
+    });
+    return out;
+  }
+
+  // Range queries walk the ordered value indexes (values_by_num,
+  // values_by_text) and join each matching value to the fact table through
+  // its (field_id, value_id) index. Record ids come back sorted and distinct.
+  std::vector<uint64_t> query_current_range(uint32_t field_id, const ValueRange& r) override {
+    std::vector<uint64_t> out;
+    with_read_snapshot([&]{ range_records("current_facts", field_id, r, out); });
+    return sorted_records(std::move(out));
+  }
+
+  std::vector<uint64_t> query_ever_range(uint32_t field_id, const ValueRange& r) override {
+    std::vector<uint64_t> out;
+    with_read_snapshot([&]{
+      range_records("facts", field_id, r, out);
+      if (sealed_->empty()) return;
+      std::unordered_set<uint64_t> vids;
+      range_value_ids(r, [&](uint64_t vid) { vids.insert(vid); });
+      for (const auto& seg : sealed_->segments) {
+        seg->records_with_any(field_id, vids, [&](size_t i) { out.push_back((uint64_t)seg->record_id_at(i)); });
+      }
+    });
+    return sorted_records(std::move(out));
+  }
+
+  // Streams facts with t1 <= ts <= t2 in (ts, record_id, field_id) order as
+  // SQLite steps them; nothing is buffered. Field names and values come from
+  // the same statement via joins. fn returns false to stop early. Sealed rows
+  // in the window are collected and sorted up front, then merged in order.
+  void query_facts_window(const FactsWindowQuery& q, const std::function<bool(const FactView&)>& fn) override {
+    with_read_snapshot([&]{
+      std::string sql =
+        "SELECT f.record_id, f.field_id, f.value_id, f.ts, fl.name_canon, v.type_tag, " + value_columns("v.") + " "
+        "FROM facts f "
+        "JOIN fields fl ON fl.field_id = f.field_id "
+        "JOIN f_values v ON v.value_id = f.value_id "
+        "WHERE f.ts BETWEEN ? AND ?";
+      if (q.record_id) sql += " AND f.record_id = ?";
+      if (q.after) sql += " AND (f.ts, f.record_id, f.field_id) > (?, ?, ?)";
+      sql += " ORDER BY f.ts, f.record_id, f.field_id LIMIT ?;";
+
+      auto st = stmts_.get(sql.c_str(), "prepare query_facts_window");
+      int i = 1;
+      sqlite3_bind_int64(st.s, i++, (sqlite3_int64)q.t1);
+      sqlite3_bind_int64(st.s, i++, (sqlite3_int64)q.t2);
+      if (q.record_id) sqlite3_bind_int64(st.s, i++, (sqlite3_int64)*q.record_id);
+      if (q.after) {
+        sqlite3_bind_int64(st.s, i++, (sqlite3_int64)q.after->ts_ms);
+        sqlite3_bind_int64(st.s, i++, (sqlite3_int64)q.after->record_id);
+        sqlite3_bind_int64(st.s, i++, (sqlite3_int64)q.after->field_id);
+      }
+      sqlite3_bind_int64(st.s, i++, q.limit ? (sqlite3_int64)*q.limit : (sqlite3_int64)-1);
+
+      SealedWindow sealed(*sealed_, q);
+      uint64_t left = q.limit ? *q.limit : std::numeric_limits<uint64_t>::max();
+      std::unordered_map<uint32_t, FieldRow> names;
+      std::unordered_map<uint64_t, ValueRow> values;
+      std::string num_text;
+      // Emits sealed rows that sort before next (all of them if null).
+      auto emit_sealed = [&](const FactRow* next) {
+        for (const FactRow* p; left > 0 && (p = sealed.peek()) && (!next || fact_window_less(*p, *next)); sealed.next()) {
+          const FactRow f = *p;
+          auto fi = names.find(f.field_id);
+          if (fi == names.end()) fi = names.emplace(f.field_id, get_field(f.field_id)).first;
+          auto vi = values.find(f.value_id);
+          if (vi == values.end()) vi = values.emplace(f.value_id, get_value(f.value_id)).first;
+          left--;
+          if (!fn(FactView{f, fi->second.name_canon, vi->second.type, vi->second.canon(), vi->second.num})) return false;
+        }
+        return true;
+      };
+
+      for (;;) {
+        int rc = st.step();
+        if (rc == SQLITE_DONE) break;
+        check_sql(rc, db_, "query_facts_window step");
+        FactRow f = fact_row_at(st.s);
+        if (!emit_sealed(&f) || left == 0) return;
+        FactView v{};
+        v.fact = f;
+        v.field_name = column_view(st.s, 4);
+        v.type = logical_type_from_tag(tagmap_, (uint8_t)sqlite3_column_int(st.s, 5));
+        if (sqlite3_column_type(st.s, 7) == SQLITE_NULL) {
+          v.num = read_value_columns(st.s, 6, v.type, num_text);
+          v.canon = v.num && sqlite3_column_type(st.s, 6) == SQLITE_NULL ? std::string_view(num_text) : column_view(st.s, 6);
+        } else {
+          auto vi = values.find(f.value_id);
+          if (vi == values.end()) vi = values.emplace(f.value_id, get_value(f.value_id)).first;
+          v.canon = vi->second.canon();
+        }
+        left--;
+        if (!fn(v)) return;
+      }
+      emit_sealed(nullptr);
+    });
+  }
+
+  // Walks the facts primary key one field at a time; each field is a single
+  // range read that joins f_values, so names and values arrive with the rows.
+  // Sealed rows of the record are merged in per field.
+  void query_history(const HistoryQuery& q, const std::function<bool(const FactView&)>& fn) override {
+    with_read_snapshot([&]{
+      const int64_t rid = (int64_t)q.record_id;
+      std::vector<FactRow> sealed;
+      if (!sealed_->empty()) {
+        std::vector<FactRow> rows;
+        sealed_->record_rows(rid, rows);
+        for (const auto& f : rows) {
+          if (f.ts_ms < q.t1 || f.ts_ms > q.t2) continue;
+          if (!q.field_ids.empty() && !std::binary_search(q.field_ids.begin(), q.field_ids.end(), f.field_id)) continue;
+          sealed.push_back(f);
+        }
+        std::sort(sealed.begin(), sealed.end(), [&](const FactRow& a, const FactRow& b) {
+          const auto ka = std::make_pair(a.field_id, a.ts_ms), kb = std::make_pair(b.field_id, b.ts_ms);
+          return q.reverse ? kb < ka : ka < kb;
+        });
+      }
+
+      std::vector<uint32_t> fields = q.field_ids;
+      if (fields.empty()) {
+        // Skip-scan: one primary-key seek per distinct field.
+        auto st = stmts_.get("SELECT MIN(field_id) FROM facts WHERE record_id=? AND field_id>?;",
+                             "prepare history fields");
+        int64_t after = -1;
+        for (;;) {
+          sqlite3_reset(st.s);
+          sqlite3_bind_int64(st.s, 1, (sqlite3_int64)rid);
+          sqlite3_bind_int64(st.s, 2, (sqlite3_int64)after);
+          int rc = st.step();
+          check_sql(rc, db_, "history fields step");
+          if (rc != SQLITE_ROW || sqlite3_column_type(st.s, 0) == SQLITE_NULL) break;
+          after = sqlite3_column_int64(st.s, 0);
+          fields.push_back((uint32_t)after);
+        }
+        for (const auto& f : sealed) fields.push_back(f.field_id);
+        std::sort(fields.begin(), fields.end());
+        fields.erase(std::unique(fields.begin(), fields.end()), fields.end());
+      }
+      if (q.reverse) std::reverse(fields.begin(), fields.end());
+
+      std::string sql =
+        "SELECT f.value_id, f.ts, v.type_tag, " + value_columns("v.") + " ";
+      sql += "FROM facts f JOIN f_values v ON v.value_id = f.value_id "
+             "WHERE f.record_id=? AND f.field_id=? AND f.ts BETWEEN ? AND ? ";
+      sql += q.reverse ? "ORDER BY f.ts DESC LIMIT ?;" : "ORDER BY f.ts LIMIT ?;";
+      auto st = stmts_.get(sql.c_str(), "prepare query_history");
+
+      std::unordered_map<uint64_t, ValueRow> values;
+      auto value = [&](uint64_t vid) -> const ValueRow& {
+        auto it = values.find(vid);
+        if (it != values.end()) return it->second;
+        if (values.size() >= kValueCacheCapacity) values.clear();
+        return values.emplace(vid, get_value(vid)).first->second;
+      };
+
+      size_t si = 0;
+      std::string num_text;
+      for (uint32_t fid : fields) {
+        const FieldRow name = get_field(fid);
+        uint64_t left = q.limit ? *q.limit : std::numeric_limits<uint64_t>::max();
+        // Sealed rows of this field; sealed is ordered like fields.
+        while (si < sealed.size() && (q.reverse ? sealed[si].field_id > fid : sealed[si].field_id < fid)) si++;
+        auto sealed_first = [&](int64_t ts) {
+          return si < sealed.size() && sealed[si].field_id == fid && (q.reverse ? sealed[si].ts_ms > ts : sealed[si].ts_ms < ts);
+        };
+        auto emit_sealed = [&](const FactRow& f) {
+          const ValueRow& vr = value(f.value_id);
+          left--;
+          return fn(FactView{f, name.name_canon, vr.type, vr.canon(), vr.num});
+        };
+
+        sqlite3_reset(st.s);
+        sqlite3_bind_int64(st.s, 1, (sqlite3_int64)rid);
+        sqlite3_bind_int64(st.s, 2, (sqlite3_int64)fid);
+        sqlite3_bind_int64(st.s, 3, (sqlite3_int64)q.t1);
+        sqlite3_bind_int64(st.s, 4, (sqlite3_int64)q.t2);
+        sqlite3_bind_int64(st.s, 5, q.limit ? (sqlite3_int64)*q.limit : (sqlite3_int64)-1);
+        while (left > 0) {
+          int rc = st.step();
+          if (rc == SQLITE_DONE) break;
+          check_sql(rc, db_, "query_history step");
+          FactRow f{q.record_id, fid, (uint64_t)sqlite3_column_int64(st.s, 0), (int64_t)sqlite3_column_int64(st.s, 1)};
+          while (left > 0 && sealed_first(f.ts_ms)) {
+            if (!emit_sealed(sealed[si++])) return;
+          }
+          if (left == 0) break;
+          FactView v{};
+          v.fact = f;
+          v.field_name = name.name_canon;
+          v.type = logical_type_from_tag(tagmap_, (uint8_t)sqlite3_column_int(st.s, 2));
+          if (sqlite3_column_type(st.s, 4) == SQLITE_NULL) {
+            v.num = read_value_columns(st.s, 3, v.type, num_text);
+            v.canon = v.num && sqlite3_column_type(st.s, 3) == SQLITE_NULL ? std::string_view(num_text) : column_view(st.s, 3);
+          } else {
+            v.canon = value(f.value_id).canon();
+          }
+          left--;
+          if (!fn(v)) return;
+        }
+        while (left > 0 && si < sealed.size() && sealed[si].field_id == fid) {
+          if (!emit_sealed(sealed[si++])) return;
+        }
+      }
+    });
+  }
+
+  // Change feed. facts.seq numbers facts in commit order: one writer holds
+  // the write lock per transaction and hands out max+1 onward, so a reader
+  // never sees a seq appear below one it has already seen. A consumer that
+  // saves the last seq it handled resumes exactly after it, late facts
+  // (ts behind others) included.
+
+  // Last seq handed out, live or sealed; 0 on an empty database.
+  int64_t feed_head() {
+    require_feed();
+    auto st = stmts_.get("SELECT COALESCE(MAX(seq), 0) FROM facts;", "prepare feed head");
+    check_sql(st.step(), db_, "feed head step");
+    return std::max((int64_t)sqlite3_column_int64(st.s, 0), feed_sealed_through());
+  }
+
+  bool has_seq_column() const { return seq_column_; }
+
+  int64_t feed_sealed_through() {
+    auto v = meta_get(kFeedSealedKey);
+    return v ? std::stoll(*v) : 0;
+  }
+
+  // Streams facts with seq > after in seq order, at most limit of them;
+  // fn returns false to stop. Returns the last seq delivered, or after.
+  // Positions behind sealed history fail: those facts are only in segments
+  // now and could not all be replayed.
+  int64_t read_feed(int64_t after, uint64_t limit, const std::function<bool(int64_t, const FactView&)>& fn) {
+    require_feed();
+    if (after < 0) throw std::runtime_error("feed position must be 0 or more");
+    const int64_t sealed = feed_sealed_through();
+    if (after < sealed) {
+      throw std::runtime_error("feed position " + std::to_string(after) + " is behind sealed history (sealed through seq " +
+                               std::to_string(sealed) + ")");
+    }
+    const std::string sql =
+      "SELECT f.record_id, f.field_id, f.value_id, f.ts, fl.name_canon, v.type_tag, " + value_columns("v.") + ", f.seq "
+      "FROM facts f "
+      "JOIN fields fl ON fl.field_id = f.field_id "
+      "JOIN f_values v ON v.value_id = f.value_id "
+      "WHERE f.seq > ? ORDER BY f.seq LIMIT ?;";
+    auto st = stmts_.get(sql.c_str(), "prepare read_feed");
+    sqlite3_bind_int64(st.s, 1, (sqlite3_int64)after);
+    sqlite3_bind_int64(st.s, 2, limit > (uint64_t)std::numeric_limits<int64_t>::max() ? -1 : (sqlite3_int64)limit);
+    std::string num_text;
+    for (;;) {
+      int rc = st.step();
+      if (rc == SQLITE_DONE) break;
+      check_sql(rc, db_, "read_feed step");
+      FactView v{};
+      v.fact = fact_row_at(st.s);
+      v.field_name = column_view(st.s, 4);
+      v.type = logical_type_from_tag(tagmap_, (uint8_t)sqlite3_column_int(st.s, 5));
+      ValueRow blob_row;
+      if (sqlite3_column_type(st.s, 7) == SQLITE_NULL) {
+        v.num = read_value_columns(st.s, 6, v.type, num_text);
+        v.canon = v.num && sqlite3_column_type(st.s, 6) == SQLITE_NULL ? std::string_view(num_text) : column_view(st.s, 6);
+      } else {
+        blob_row = get_value(v.fact.value_id);
+        v.canon = blob_row.canon();
+      }
+      after = (int64_t)sqlite3_column_int64(st.s, 9);
+      if (!fn(after, v)) break;
+    }
+    return after;
+  }
+
+  std::vector<FactRow> snapshot_at(uint64_t record_id, int64_t t) override {
+    std::vector<FactRow> out;
+    with_read_snapshot([&]{
+      if (checkpoints_enabled_) {
+        if (auto cp = latest_checkpoint(record_id, t)) {
+          out = snapshot_from_checkpoint(record_id, *cp, t);
+          return;
+        }
+      }
+      out = snapshot_from_facts(record_id, t);
+    });
+    return out;
+  }
+
+  std::vector<FactRow> snapshot_from_facts(uint64_t record_id, int64_t t) {
+    // Latest per field where ts <= t. SQLite takes the bare columns from the
+    // MAX(ts) row, so this is one pass over the facts primary key.
+    auto st = stmts_.get(
+      "SELECT record_id, field_id, value_id, MAX(ts) "
+      "FROM facts WHERE record_id=? AND ts <= ? "
+      "GROUP BY field_id;",
+      "prepare snapshot_at");
+
+    sqlite3_bind_int64(st.s, 1, (sqlite3_int64)record_id);
+    sqlite3_bind_int64(st.s, 2, (sqlite3_int64)t);
+
+    std::vector<FactRow> out;
+    for (;;) {
+      int rc = st.step();
+      if (rc == SQLITE_DONE) break;
+      check_sql(rc, db_, "snapshot_at step");
+      out.push_back(fact_row_at(st.s));
+    }
+    if (!sealed_->empty()) {
+      std::vector<FactRow> rows;
+      sealed_->record_rows((int64_t)record_id, rows);
+      fold_latest(out, rows, t);
+    }
+    return out;
+  }
+
+  // ---- State checkpoints (optional) ----
+  //
+  // state_checkpoints holds the derived per-field state of a record as of
+  // cp_ts (all facts with ts <= cp_ts). A snapshot at t starts from the
+  // newest checkpoint at or before t and folds in only the facts in
+  // (cp_ts, t], found through facts_by_record_ts. Inserting a fact at ts
+  // drops that record's checkpoints with cp_ts >= ts, so late facts never
+  // leave a stale checkpoint behind.
+
+  bool checkpoints_enabled() const { return checkpoints_enabled_; }
+
+  std::optional<int64_t> checkpoint_interval() {
+    auto v = meta_get(kCheckpointIntervalKey);
+    if (!v) return std::nullopt;
+    return std::stoll(*v);
+  }
+
+  std::optional<uint64_t> checkpoint_min_facts() {
+    auto v = meta_get(kCheckpointMinFactsKey);
+    if (!v) return std::nullopt;
+    return std::stoull(*v);
+  }
+
+  void enable_checkpoints(int64_t interval_ms) {
+    if (interval_ms <= 0) throw std::runtime_error("checkpoint interval must be positive");
+    exec_sql(db_, R"SQL(
+      CREATE TABLE IF NOT EXISTS state_checkpoints (
+        record_id  INTEGER NOT NULL,
+        cp_ts      INTEGER NOT NULL,
+        field_id   INTEGER NOT NULL,
+        value_id   INTEGER NOT NULL,
+        ts         INTEGER NOT NULL,
+        PRIMARY KEY (record_id, cp_ts, field_id)
+      );
+
+      CREATE INDEX IF NOT EXISTS facts_by_record_ts ON facts(record_id, ts);
+    )SQL");
+    meta_set(kCheckpointIntervalKey, std::to_string(interval_ms));
+    checkpoints_enabled_ = true;
+  }
+
+  void drop_checkpoints() {
+    stmts_.clear();
+    exec_sql(db_, "DROP TABLE IF EXISTS state_checkpoints; DROP INDEX IF EXISTS facts_by_record_ts;");
+    meta_delete(kCheckpointIntervalKey);
+    meta_delete(kCheckpointMinFactsKey);
+    checkpoints_enabled_ = false;
+  }
+
+  // ---- bulk load ----
+  //
+  // Ingest needs only the primary keys. A bulk load drops the secondary
+  // indexes, so each insert maintains only the primary-key B-trees, and
+  // finish_bulk_load rebuilds every index with one sorted pass. The meta
+  // marker keeps the database flagged as unusable until that has succeeded.
+
+  bool bulk_load_pending() {
+    return meta_get(kBulkLoadKey).has_value();
+  }
+
+  void begin_bulk_load() {
+    if (read_only_) throw std::runtime_error("bulk load needs a writable connection");
+    stmts_.clear();
+    with_tx([&]{
+      meta_set(kBulkLoadKey, "1");
+      for (const auto& ix : secondary_indexes()) {
+        exec_sql(db_, ("DROP INDEX IF EXISTS " + std::string(ix.name) + ";").c_str());
+      }
+    });
+  }
+
+  void finish_bulk_load() {
+    stmts_.clear();
+    create_secondary_indexes();
+    auto problems = integrity_problems();
+    if (!problems.empty()) {
+      throw std::runtime_error("integrity check failed after bulk load: " + problems.front() +
+                               (problems.size() > 1 ? " (and " + std::to_string(problems.size() - 1) + " more)" : ""));
+    }
+    exec_sql(db_, "ANALYZE;");
+    meta_delete(kBulkLoadKey);
+  }
+
+  std::vector<std::string> integrity_problems() {
+    Stmt st;
+    check_sql(sqlite3_prepare_v2(db_, "PRAGMA integrity_check;", -1, &st.s, nullptr), db_, "prepare integrity_check");
+    std::vector<std::string> out;
+    int rc;
+    while ((rc = sqlite3_step(st.s)) == SQLITE_ROW) {
+      std::string line(column_view(st.s, 0));
+      if (line != "ok") out.push_back(std::move(line));
+    }
+    check_sql(rc, db_, "integrity_check step");
+    return out;
+  }
+
+  std::optional<int64_t> latest_checkpoint(uint64_t record_id, int64_t at_or_before) {
+    auto st = stmts_.get("SELECT MAX(cp_ts) FROM state_checkpoints WHERE record_id=? AND cp_ts <= ?;",
+                         "prepare latest_checkpoint");
+    sqlite3_bind_int64(st.s, 1, (sqlite3_int64)record_id);
+    sqlite3_bind_int64(st.s, 2, (sqlite3_int64)at_or_before);
+    int rc = st.step();
+    check_sql(rc, db_, "latest_checkpoint step");
+    if (rc != SQLITE_ROW || sqlite3_column_type(st.s, 0) == SQLITE_NULL) return std::nullopt;
+    return (int64_t)sqlite3_column_int64(st.s, 0);
+  }
+
+  std::vector<int64_t> checkpoint_times(uint64_t record_id) {
+    auto st = stmts_.get("SELECT DISTINCT cp_ts FROM state_checkpoints WHERE record_id=? ORDER BY cp_ts;",
+                         "prepare checkpoint_times");
+    sqlite3_bind_int64(st.s, 1, (sqlite3_int64)record_id);
+    std::vector<int64_t> out;
+    for (;;) {
+      int rc = st.step();
+      if (rc == SQLITE_DONE) break;
+      check_sql(rc, db_, "checkpoint_times step");
+      out.push_back((int64_t)sqlite3_column_int64(st.s, 0));
+    }
+    return out;
+  }
+
+  std::vector<FactRow> checkpoint_rows(uint64_t record_id, int64_t cp_ts) {
+    auto st = stmts_.get("SELECT record_id, field_id, value_id, ts FROM state_checkpoints "
+                         "WHERE record_id=? AND cp_ts=? ORDER BY field_id;",
+                         "prepare checkpoint_rows");
+    sqlite3_bind_int64(st.s, 1, (sqlite3_int64)record_id);
+    sqlite3_bind_int64(st.s, 2, (sqlite3_int64)cp_ts);
+    std::vector<FactRow> out;
+    for (;;) {
+      int rc = st.step();
+      if (rc == SQLITE_DONE) break;
+      check_sql(rc, db_, "checkpoint_rows step");
+      out.push_back(fact_row_at(st.s));
+    }
+    return out;
+  }
+
+  void write_checkpoint(uint64_t record_id, int64_t cp_ts, const std::vector<FactRow>& state) {
+    auto st = stmts_.get("INSERT OR REPLACE INTO state_checkpoints(record_id, cp_ts, field_id, value_id, ts) "
+                         "VALUES(?,?,?,?,?);",
+                         "prepare write_checkpoint");
+    for (const auto& f : state) {
+      sqlite3_bind_int64(st.s, 1, (sqlite3_int64)record_id);
+      sqlite3_bind_int64(st.s, 2, (sqlite3_int64)cp_ts);
+      sqlite3_bind_int(st.s, 3, (int)f.field_id);
+      sqlite3_bind_int64(st.s, 4, (sqlite3_int64)f.value_id);
+      sqlite3_bind_int64(st.s, 5, (sqlite3_int64)f.ts_ms);
+      check_sql(st.step(), db_, "write_checkpoint step");
+      sqlite3_reset(st.s);
+    }
+  }
+
+  void invalidate_checkpoints(uint64_t record_id, int64_t from_ts) {
+    auto st = stmts_.get("DELETE FROM state_checkpoints WHERE record_id=? AND cp_ts >= ?;",
+                         "prepare invalidate_checkpoints");
+    sqlite3_bind_int64(st.s, 1, (sqlite3_int64)record_id);
+    sqlite3_bind_int64(st.s, 2, (sqlite3_int64)from_ts);
+    check_sql(st.step(), db_, "invalidate_checkpoints step");
+  }
+
+  // Facts of one record with after < ts <= upto, in (ts, field_id) order.
+  void facts_between(uint64_t record_id, int64_t after, int64_t upto,
+                     const std::function<void(const FactRow&)>& fn) {
+    auto st = stmts_.get("SELECT record_id, field_id, value_id, ts FROM facts "
+                         "WHERE record_id=? AND ts > ? AND ts <= ? ORDER BY ts, field_id;",
+                         "prepare facts_between");
+    sqlite3_bind_int64(st.s, 1, (sqlite3_int64)record_id);
+    sqlite3_bind_int64(st.s, 2, (sqlite3_int64)after);
+    sqlite3_bind_int64(st.s, 3, (sqlite3_int64)upto);
+    if (sealed_->empty()) {
+      for (;;) {
+        int rc = st.step();
+        if (rc == SQLITE_DONE) break;
+        check_sql(rc, db_, "facts_between step");
+        fn(fact_row_at(st.s));
+      }
+      return;
+    }
+
+    std::vector<FactRow> rows, sealed;
+    for (;;) {
+      int rc = st.step();
+      if (rc == SQLITE_DONE) break;
+      check_sql(rc, db_, "facts_between step");
+      rows.push_back(fact_row_at(st.s));
+    }
+    sealed_->record_rows((int64_t)record_id, sealed);
+    for (const auto& f : sealed) {
+      if (f.ts_ms > after && f.ts_ms <= upto) rows.push_back(f);
+    }
+    std::sort(rows.begin(), rows.end(), [](const FactRow& a, const FactRow& b) {
+      return a.ts_ms != b.ts_ms ? a.ts_ms < b.ts_ms : a.field_id < b.field_id;
+    });
+    for (const auto& f : rows) fn(f);
+  }
+
+  std::vector<FactRow> snapshot_from_checkpoint(uint64_t record_id, int64_t cp_ts, int64_t t) {
+    std::vector<FactRow> state = checkpoint_rows(record_id, cp_ts);
+    std::unordered_map<uint32_t, size_t> at;
+    at.reserve(state.size());
+    for (size_t i = 0; i < state.size(); i++) at.emplace(state[i].field_id, i);
+    facts_between(record_id, cp_ts, t, [&](const FactRow& f) {
+      auto [it, inserted] = at.emplace(f.field_id, state.size());
+      if (inserted) state.push_back(f);
+      else state[it->second] = f;
+    });
+    std::sort(state.begin(), state.end(), [](const FactRow& a, const FactRow& b) { return a.field_id < b.field_id; });
+    return state;
+  }
+
+  // Snapshots at t of every record in r that has a fact at or before t,
+  // streamed to fn one record at a time in record_id order. The range is read
+  // in a single ordered walk of the facts primary key. With sealed segments
+  // the range is processed in chunks of records, merging both sources.
+  void snapshot_range(RecordRange r, int64_t t,
+                      const std::function<void(uint64_t, const std::vector<FactRow>&)>& fn) override {
+    with_read_snapshot([&]{
+      if (sealed_->empty()) {
+        snapshot_live_range(r, t, fn);
+        return;
+      }
+      for (RecordRange c : record_ranges(r.lo, 1000)) {
+        if (c.lo > r.hi) break;
+        c.hi = std::min(c.hi, r.hi);
+        std::vector<std::pair<uint64_t, std::vector<FactRow>>> recs;
+        snapshot_live_range(c, t, [&](uint64_t rid, const std::vector<FactRow>& rows) {
+          recs.emplace_back(rid, rows);
+        });
+        std::vector<FactRow> sealed;
+        sealed_->range_rows(c, sealed);
+        std::sort(sealed.begin(), sealed.end(), [](const FactRow& a, const FactRow& b) {
+          return (int64_t)a.record_id < (int64_t)b.record_id;
+        });
+        size_t k = 0;
+        std::vector<std::pair<uint64_t, std::vector<FactRow>>> merged;
+        for (size_t i = 0; i < sealed.size();) {
+          size_t j = i;
+          while (j < sealed.size() && sealed[j].record_id == sealed[i].record_id) j++;
+          const int64_t rid = (int64_t)sealed[i].record_id;
+          while (k < recs.size() && (int64_t)recs[k].first < rid) merged.push_back(std::move(recs[k++]));
+          std::vector<FactRow> state;
+          if (k < recs.size() && (int64_t)recs[k].first == rid) state = std::move(recs[k++].second);
+          fold_latest(state, std::vector<FactRow>(sealed.begin() + (ptrdiff_t)i, sealed.begin() + (ptrdiff_t)j), t);
+          if (!state.empty()) merged.emplace_back((uint64_t)rid, std::move(state));
+          i = j;
+        }
+        while (k < recs.size()) merged.push_back(std::move(recs[k++]));
+        for (const auto& [rid, rows] : merged) fn(rid, rows);
+      }
+    });
+  }
+
+  void snapshot_live_range(RecordRange r, int64_t t,
+                           const std::function<void(uint64_t, const std::vector<FactRow>&)>& fn) {
+    auto st = stmts_.get(
+      "SELECT record_id, field_id, value_id, MAX(ts) "
+      "FROM facts WHERE record_id BETWEEN ? AND ? AND ts <= ? "
+      "GROUP BY record_id, field_id ORDER BY record_id, field_id;",
+      "prepare snapshot_range");
+    sqlite3_bind_int64(st.s, 1, (sqlite3_int64)r.lo);
+    sqlite3_bind_int64(st.s, 2, (sqlite3_int64)r.hi);
+    sqlite3_bind_int64(st.s, 3, (sqlite3_int64)t);
+
+    std::vector<FactRow> rows;
+    for (;;) {
+      int rc = st.step();
+      if (rc == SQLITE_DONE) break;
+      check_sql(rc, db_, "snapshot_range step");
+      FactRow f = fact_row_at(st.s);
+      if (!rows.empty() && rows.front().record_id != f.record_id) {
+        fn(rows.front().record_id, rows);
+        rows.clear();
+      }
+      rows.push_back(f);
+    }
+    if (!rows.empty()) fn(rows.front().record_id, rows);
+  }
+
+  FieldRow get_field(uint32_t field_id) override {
+    auto st = stmts_.get("SELECT field_id, name_canon FROM fields WHERE field_id=?;",
+                         "prepare get_field");
+    sqlite3_bind_int(st.s, 1, (int)field_id);
+    int rc = st.step();
+    check_sql(rc, db_, "get_field step");
+    if (rc != SQLITE_ROW) throw std::runtime_error("unknown field_id");
+    FieldRow fr{};
+    fr.field_id = (uint32_t)sqlite3_column_int(st.s, 0);
+    fr.name_canon = (const char*)sqlite3_column_text(st.s, 1);
+    return fr;
+  }
+
+  ValueRow get_value(uint64_t value_id) override {
+    const std::string sql = "SELECT value_id, type_tag, " + value_columns("") + ", hash, canon_blob FROM f_values WHERE value_id=?;";
+    auto st = stmts_.get(sql.c_str(), "prepare get_value");
+    sqlite3_bind_int64(st.s, 1, (sqlite3_int64)value_id);
+    int rc = st.step();
+    check_sql(rc, db_, "get_value step");
+    if (rc != SQLITE_ROW) throw std::runtime_error("unknown value_id");
+    ValueRow vr{};
+    vr.value_id = (uint64_t)sqlite3_column_int64(st.s, 0);
+    uint8_t tag = (uint8_t)sqlite3_column_int(st.s, 1);
+    vr.type = logical_type_from_tag(tagmap_, tag);
+    std::string num_text;
+    vr.num = read_value_columns(st.s, 2, vr.type, num_text);
+    if (vr.num && sqlite3_column_type(st.s, 2) == SQLITE_NULL) {
+      vr.canon_text = std::move(num_text);
+    } else {
+      const unsigned char* txt = sqlite3_column_text(st.s, 2);
+      vr.canon_text = txt ? (const char*)txt : "";
+    }
+    if (sqlite3_column_type(st.s, 3) != SQLITE_NULL) {
+      std::array<uint8_t, 32> h{};
+      if (sqlite3_column_bytes(st.s, 5) != (int)h.size()) throw std::runtime_error("value hash has the wrong size");
+      std::memcpy(h.data(), sqlite3_column_blob(st.s, 5), h.size());
+      vr.blob = blobs_.get(h, (size_t)sqlite3_column_int64(st.s, 3));
+    } else if (vr.type == LogicalType::Bytes) {
+      const void* b = sqlite3_column_blob(st.s, 6);
+      vr.canon_bytes.assign(static_cast<const char*>(b), b ? (size_t)sqlite3_column_bytes(st.s, 6) : 0);
+    }
+    return vr;
+  }
+
+  // Record ranges for range-at-a-time maintenance, in SQLite integer order.
+  // Each range holds up to per_range records; the last one is open-ended so
+  // records created while the ranges are processed are still covered.
+  std::vector<RecordRange> record_ranges(int64_t from, uint64_t per_range) {
+    per_range = std::max<uint64_t>(1, per_range);
+    std::vector<RecordRange> out;
+    int64_t lo = from;
+    for (;;) {
+      auto st = stmts_.get("SELECT record_id FROM records WHERE record_id >= ? ORDER BY record_id LIMIT 1 OFFSET ?;",
+                           "prepare record_ranges");
+      sqlite3_bind_int64(st.s, 1, (sqlite3_int64)lo);
+      sqlite3_bind_int64(st.s, 2, (sqlite3_int64)(per_range - 1));
+      int rc = st.step();
+      check_sql(rc, db_, "record_ranges step");
+      if (rc != SQLITE_ROW) break;
+      int64_t hi = (int64_t)sqlite3_column_int64(st.s, 0);
+      if (hi == std::numeric_limits<int64_t>::max()) break;
+      out.push_back({lo, hi});
+      lo = hi + 1;
+    }
+    out.push_back({lo, std::numeric_limits<int64_t>::max()});
+    return out;
+  }
+
+  // Replaces current_facts for one record range. Must run inside a transaction.
+  void replace_current_range(RecordRange r, const std::vector<FactRow>& rows) {
+    flush_current();
+    current_.clear();
+    {
+      auto st = stmts_.get("DELETE FROM current_facts WHERE record_id BETWEEN ? AND ?;",
+                           "prepare replace_current_range delete");
+      sqlite3_bind_int64(st.s, 1, (sqlite3_int64)r.lo);
+      sqlite3_bind_int64(st.s, 2, (sqlite3_int64)r.hi);
+      check_sql(st.step(), db_, "replace_current_range delete step");
+    }
+    auto st = stmts_.get("INSERT INTO current_facts(record_id, field_id, value_id, ts) VALUES(?,?,?,?);",
+                         "prepare replace_current_range insert");
+    for (const auto& f : rows) {
+      sqlite3_bind_int64(st.s, 1, (sqlite3_int64)f.record_id);
+      sqlite3_bind_int(st.s, 2, (int)f.field_id);
+      sqlite3_bind_int64(st.s, 3, (sqlite3_int64)f.value_id);
+      sqlite3_bind_int64(st.s, 4, (sqlite3_int64)f.ts_ms);
+      check_sql(st.step(), db_, "replace_current_range insert step");
+      sqlite3_reset(st.s);
+    }
+  }
+
+  std::optional<std::string> meta_get(std::string_view k) {
+    Stmt st;
+    check_sql(sqlite3_prepare_v2(db_, "SELECT v FROM meta WHERE k=?;", -1, &st.s, nullptr), db_, "prepare meta_get");
+    sqlite3_bind_text(st.s, 1, std::string(k).c_str(), -1, SQLITE_TRANSIENT);
+    int rc = sqlite3_step(st.s);
+    if (rc == SQLITE_ROW) {
+      const unsigned char* t = sqlite3_column_text(st.s, 0);
+      return t ? std::optional<std::string>((const char*)t) : std::optional<std::string>("");
+    }
+    check_sql(rc, db_, "meta_get step");
+    return std::nullopt;
+  }
+
+  void meta_set(std::string_view k, std::string_view v) {
+    Stmt st;
+    check_sql(sqlite3_prepare_v2(db_,
+                                "INSERT INTO meta(k,v) VALUES(?,?) ON CONFLICT(k) DO UPDATE SET v=excluded.v;",
+                                -1, &st.s, nullptr),
+              db_, "prepare meta_set");
+    sqlite3_bind_text(st.s, 1, std::string(k).c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(st.s, 2, std::string(v).c_str(), -1, SQLITE_TRANSIENT);
+    check_sql(sqlite3_step(st.s), db_, "meta_set step");
+  }
+
+  void meta_delete(std::string_view k) {
+    Stmt st;
+    check_sql(sqlite3_prepare_v2(db_, "DELETE FROM meta WHERE k=?;", -1, &st.s, nullptr), db_, "prepare meta_delete");
+    sqlite3_bind_text(st.s, 1, std::string(k).c_str(), -1, SQLITE_TRANSIENT);
+    check_sql(sqlite3_step(st.s), db_, "meta_delete step");
+  }
+
+  uint64_t null_value_id() const { return null_value_id_; }
+  sqlite3* handle() const { return db_; }
+  bool read_only() const { return read_only_; }
+  const std::string& path() const { return path_; }
+  TagMapVersion tag_map() const override { return tagmap_; }
+  HashFormatVersion hash_format() const override { return hashfmt_; }
+
+  // ---- sealed segments ----
+
+  std::shared_ptr<const SealedFacts> sealed_facts() const { return sealed_; }
+  std::string segment_dir() const { return path_ + ".segments"; }
+  const std::string& blob_dir() const { return blobs_.dir(); }
+
+  uint64_t blob_threshold() const { return blob_threshold_; }
+  bool has_blob_column() const { return blob_column_; }
+
+  // Values longer than bytes (0: none) go to the blob store from now on;
+  // values already stored stay where they are.
+  void set_blob_threshold(uint64_t bytes) {
+    meta_set(kBlobThresholdKey, std::to_string(bytes));
+    blob_threshold_ = bytes;
+  }
+
+  // Reloads the segment list if it changed since this connection last looked.
+  // with_tx and with_read_snapshot call it at the start of their transaction.
+  void sync_segments() {
+    std::string rev;
+    {
+      auto st = stmts_.get("SELECT v FROM meta WHERE k=?;", "prepare segments_rev");
+      sqlite3_bind_text(st.s, 1, kSegmentsRevKey, -1, SQLITE_STATIC);
+      int rc = st.step();
+      check_sql(rc, db_, "segments_rev step");
+      if (rc == SQLITE_ROW) rev = std::string(column_view(st.s, 0));
+    }
+    if (rev == sealed_->rev) return;
+
+    auto next = std::make_shared<SealedFacts>();
+    next->rev = rev;
+    auto st = stmts_.get("SELECT seg_id, file FROM fact_segments ORDER BY seg_id;", "prepare fact_segments");
+    for (;;) {
+      int rc = st.step();
+      if (rc == SQLITE_DONE) break;
+      check_sql(rc, db_, "fact_segments step");
+      int64_t id = (int64_t)sqlite3_column_int64(st.s, 0);
+      std::shared_ptr<const FactSegment> seg;
+      for (const auto& old : sealed_->segments) {
+        if (old->id() == id) seg = old;
+      }
+      if (!seg) seg = std::make_shared<FactSegment>(id, segment_dir() + "/" + std::string(column_view(st.s, 1)));
+      next->max_ts = std::max(next->max_ts, seg->max_ts());
+      next->segments.push_back(std::move(seg));
+    }
+    sealed_ = std::move(next);
+  }
+
+  // Moves the facts of records in r with ts < horizon into a new segment
+  // file. Must run inside a write transaction; returns nullopt if r had no
+  // such facts.
+  std::optional<SegmentFileInfo> seal_range(RecordRange r, int64_t horizon) {
+    std::vector<FactRow> rows;
+    {
+      auto st = stmts_.get("SELECT record_id, field_id, value_id, ts FROM facts "
+                           "WHERE record_id BETWEEN ? AND ? AND ts < ? ORDER BY record_id, field_id, ts;",
+                           "prepare seal select");
+      sqlite3_bind_int64(st.s, 1, (sqlite3_int64)r.lo);
+      sqlite3_bind_int64(st.s, 2, (sqlite3_int64)r.hi);
+      sqlite3_bind_int64(st.s, 3, (sqlite3_int64)horizon);
+      for (;;) {
+        int rc = st.step();
+        if (rc == SQLITE_DONE) break;
+        check_sql(rc, db_, "seal select step");
+        rows.push_back(fact_row_at(st.s));
+      }
+    }
+    if (rows.empty()) return std::nullopt;
+
+    int64_t seg_id = 1;
+    {
+      auto st = stmts_.get("SELECT COALESCE(MAX(seg_id), 0) + 1 FROM fact_segments;", "prepare seal next id");
+      check_sql(st.step(), db_, "seal next id step");
+      seg_id = (int64_t)sqlite3_column_int64(st.s, 0);
+    }
+    const std::string file = "seg-" + std::to_string(seg_id) + ".fxs";
+    std::filesystem::create_directories(segment_dir());
+    SegmentFileInfo info = write_fact_segment(segment_dir() + "/" + file, rows);
+    {
+      auto st = stmts_.get("INSERT INTO fact_segments(seg_id, file, rows, records, min_ts, max_ts, bytes) "
+                           "VALUES(?,?,?,?,?,?,?);",
+                           "prepare seal register");
+      sqlite3_bind_int64(st.s, 1, (sqlite3_int64)seg_id);
+      sqlite3_bind_text(st.s, 2, file.c_str(), -1, SQLITE_TRANSIENT);
+      sqlite3_bind_int64(st.s, 3, (sqlite3_int64)info.rows);
+      sqlite3_bind_int64(st.s, 4, (sqlite3_int64)info.records);
+      sqlite3_bind_int64(st.s, 5, (sqlite3_int64)info.min_ts);
+      sqlite3_bind_int64(st.s, 6, (sqlite3_int64)info.max_ts);
+      sqlite3_bind_int64(st.s, 7, (sqlite3_int64)info.bytes);
+      check_sql(st.step(), db_, "seal register step");
+    }
+    {
+      // The feed can no longer serve these rows; remember how far they go.
+      auto st = stmts_.get("SELECT MAX(seq) FROM facts WHERE record_id BETWEEN ? AND ? AND ts < ?;",
+                           "prepare seal feed seq");
+      sqlite3_bind_int64(st.s, 1, (sqlite3_int64)r.lo);
+      sqlite3_bind_int64(st.s, 2, (sqlite3_int64)r.hi);
+      sqlite3_bind_int64(st.s, 3, (sqlite3_int64)horizon);
+      check_sql(st.step(), db_, "seal feed seq step");
+      const int64_t sealed_seq = (int64_t)sqlite3_column_int64(st.s, 0);
+      if (sealed_seq > feed_sealed_through()) meta_set(kFeedSealedKey, std::to_string(sealed_seq));
+    }
+    {
+      auto st = stmts_.get("DELETE FROM facts WHERE record_id BETWEEN ? AND ? AND ts < ?;",
+                           "prepare seal delete");
+      sqlite3_bind_int64(st.s, 1, (sqlite3_int64)r.lo);
+      sqlite3_bind_int64(st.s, 2, (sqlite3_int64)r.hi);
+      sqlite3_bind_int64(st.s, 3, (sqlite3_int64)horizon);
+      check_sql(st.step(), db_, "seal delete step");
+    }
+    meta_set(kSegmentsRevKey, std::to_string(seg_id));
+    sync_segments();
+    return info;
+  }
+
+  // File names of every registered segment.
+  std::vector<std::string> segment_files() {
+    std::vector<std::string> out;
+    auto st = stmts_.get("SELECT file FROM fact_segments;", "prepare segment_files");
+    for (;;) {
+      int rc = st.step();
+      if (rc == SQLITE_DONE) break;
+      check_sql(rc, db_, "segment_files step");
+      out.emplace_back(column_view(st.s, 0));
+    }
+    return out;
+  }
+
+  // ---- format migration ----
+
+  bool format_migration_pending() { return meta_get(kFormatMigrateKey).has_value(); }
+
+  // Marks this connection as the one running migrate_format, whose own
+  // writes go ahead while the migration is pending.
+  void set_migrating(bool on) { migrating_ = on; }
+
+  // Up to limit f_values rows from value_id from on, in value_id order, with
+  // types decoded under tagmap. A batch also ends once its values reach
+  // max_bytes. Blob files are mapped only when their bytes are read.
+  std::vector<StoredValue> stored_values(uint64_t from, size_t limit, size_t max_bytes, TagMapVersion tagmap) {
+    const std::string sql = "SELECT value_id, type_tag, " + value_columns("") +
+                            ", canon_blob, hash FROM f_values WHERE value_id >= ? ORDER BY value_id LIMIT ?;";
+    auto st = stmts_.get(sql.c_str(), "prepare stored_values");
+    sqlite3_bind_int64(st.s, 1, (sqlite3_int64)from);
+    sqlite3_bind_int64(st.s, 2, (sqlite3_int64)limit);
+    std::vector<StoredValue> out;
+    size_t bytes = 0;
+    while (bytes < max_bytes) {
+      int rc = st.step();
+      if (rc == SQLITE_DONE) break;
+      check_sql(rc, db_, "stored_values step");
+      StoredValue v{};
+      v.value_id = (uint64_t)sqlite3_column_int64(st.s, 0);
+      try {
+        v.type = logical_type_from_tag(tagmap, (uint8_t)sqlite3_column_int(st.s, 1));
+      } catch (const std::exception& e) {
+        throw std::runtime_error("value " + std::to_string(v.value_id) + ": " + e.what());
+      }
+      if (sqlite3_column_bytes(st.s, 6) != (int)v.hash.size()) throw std::runtime_error("value hash has the wrong size");
+      std::memcpy(v.hash.data(), sqlite3_column_blob(st.s, 6), v.hash.size());
+      if (sqlite3_column_type(st.s, 3) != SQLITE_NULL) {
+        v.blob_size = (uint64_t)sqlite3_column_int64(st.s, 3);
+        v.blob = blobs_.get(v.hash, (size_t)v.blob_size);
+      } else if (v.type == LogicalType::Bytes) {
+        const void* b = sqlite3_column_blob(st.s, 5);
+        v.canon.assign(static_cast<const char*>(b), b ? (size_t)sqlite3_column_bytes(st.s, 5) : 0);
+      } else if (!read_value_columns(st.s, 2, v.type, v.canon) || sqlite3_column_type(st.s, 2) != SQLITE_NULL) {
+        v.canon = std::string(column_view(st.s, 2));
+      }
+      bytes += v.canon.size() + v.blob_size;
+      out.push_back(std::move(v));
+    }
+    return out;
+  }
+
+  // Gives a value the type tag and hash of another format; a blob file is
+  // linked under its new name. Must run inside a write transaction.
+  void rehash_value(const StoredValue& v, uint8_t type_tag, const std::array<uint8_t, 32>& hash) {
+    if (v.blob) blobs_.link(v.hash, hash, (size_t)v.blob_size);
+    auto st = stmts_.get("UPDATE f_values SET type_tag=?, hash=? WHERE value_id=?;", "prepare rehash_value");
+    sqlite3_bind_int(st.s, 1, (int)type_tag);
+    sqlite3_bind_blob(st.s, 2, hash.data(), (int)hash.size(), SQLITE_TRANSIENT);
+    sqlite3_bind_int64(st.s, 3, (sqlite3_int64)v.value_id);
+    check_sql(st.step(), db_, "rehash_value step");
+  }
+
+  // Records the Felix v0.3 tag map and hash format. Cached value ids are
+  // keyed by hash, so they are dropped.
+  void declare_felix_v03() {
+    meta_set("felix_spec", "0.3");
+    meta_set("tag_map", "felix_v03");
+    meta_set("hash_format", "felix_v03_sep");
+    load_format_defaults();
+    value_ids_.clear();
+  }
+
+  // Prepare/step counters for every statement this connection has cached.
+  std::vector<StmtStats> statement_stats() const { return stmts_.stats(); }
+
+  // Session-lifetime identity caches (field name -> field_id, value hash -> value_id).
+  static constexpr size_t kFieldCacheCapacity = 4096;
+  static constexpr size_t kValueCacheCapacity = 65536;
+  const IdCache<std::string, uint32_t, StringHash, std::equal_to<>>& field_cache() const { return field_ids_; }
+  const IdCache<std::array<uint8_t, 32>, uint64_t, DigestHash>& value_cache() const { return value_ids_; }
+
+  // (record, field) -> current state, kept across write transactions while
+  // no other connection commits.
+  static constexpr size_t kCurrentCacheCapacity = 1 << 18;
+
+private:
+  sqlite3* db_{nullptr};
+  std::string path_;
+  bool read_only_{false};
+  StmtCache stmts_;
+  bool in_tx_{false};
+  bool checkpoints_enabled_{false};
+  BlobStore blobs_{path_ + ".blobs"};
+  bool blob_column_{false};  // f_values.blob_size exists (schema rev 4+)
+  bool num_column_{false};   // f_values.num exists (schema rev 5+)
+  bool seq_column_{false};   // facts.seq exists (schema rev 7+)
+  std::optional<int64_t> next_seq_;  // next change-feed seq in the open write transaction
+  uint64_t blob_threshold_{kDefaultBlobThreshold};
+  IdCache<std::string, uint32_t, StringHash, std::equal_to<>> field_ids_{kFieldCacheCapacity};
+  IdCache<std::array<uint8_t, 32>, uint64_t, DigestHash> value_ids_{kValueCacheCapacity};
+  CurrentStateCache current_{kCurrentCacheCapacity};
+  int64_t data_version_{-1};  // PRAGMA data_version the cached state was last valid for
+  bool migration_pending_{false};  // another process's migrate_format is unfinished
+  bool migrating_{false};          // this connection runs migrate_format
+  TagMapVersion tagmap_{TagMapVersion::LegacyV02};
+  HashFormatVersion hashfmt_{HashFormatVersion::LegacyNoSep};
+  uint64_t null_value_id_{0};
+  std::shared_ptr<const SealedFacts> sealed_{std::make_shared<SealedFacts>()};
+
+  // ---- current state cache ----
+
+  // Another connection's commit may have moved current state under the
+  // cache, enabled or dropped checkpoints, or be part of a format migration;
+  // data_version only changes for those. with_tx and with_read_snapshot call
+  // it when their transaction opens; key lookups outside one call it first.
+  void sync_data_version() {
+    int64_t v;
+    {
+      auto st = stmts_.get("PRAGMA data_version;", "prepare data_version");
+      check_sql(st.step(), db_, "data_version step");
+      v = (int64_t)sqlite3_column_int64(st.s, 0);
+    }
+    if (v == data_version_) return;
+    data_version_ = v;
+    current_.clear();
+    const bool checkpoints = meta_get(kCheckpointIntervalKey).has_value();
+    if (checkpoints != checkpoints_enabled_) {
+      // state_checkpoints and facts_by_record_ts came or went.
+      stmts_.clear();
+      checkpoints_enabled_ = checkpoints;
+    }
+    // migrate_format rehashes values in place and declares the new format
+    // last; identities cached under the old one are void from then on.
+    migration_pending_ = format_migration_pending();
+    const TagMapVersion tagmap = tagmap_;
+    const HashFormatVersion hashfmt = hashfmt_;
+    load_format_defaults();
+    if (tagmap_ != tagmap || hashfmt_ != hashfmt) {
+      field_ids_.clear();
+      value_ids_.clear();
+    }
+  }
+
+  CurrentStateCache::Entry load_current(uint64_t record_id, uint32_t field_id) {
+    auto st = stmts_.get("SELECT value_id, ts FROM current_facts WHERE record_id=? AND field_id=?;",
+                         "prepare get_current");
+    sqlite3_bind_int64(st.s, 1, (sqlite3_int64)record_id);
+    sqlite3_bind_int(st.s, 2, (int)field_id);
+    int rc = st.step();
+    check_sql(rc, db_, "get_current step");
+    CurrentStateCache::Entry e{};
+    if (rc == SQLITE_ROW) {
+      e.value_id = (uint64_t)sqlite3_column_int64(st.s, 0);
+      e.ts = (int64_t)sqlite3_column_int64(st.s, 1);
+      e.present = true;
+    }
+    return e;
+  }
+
+  // Cached entry, loaded from current_facts on a miss. Inside a write
+  // transaction only.
+  CurrentStateCache::Entry& current_entry(uint64_t record_id, uint32_t field_id) {
+    if (auto* e = current_.find(record_id, field_id)) return *e;
+    if (current_.full()) {
+      flush_current();
+      current_.clear();
+    }
+    return current_.put(record_id, field_id, load_current(record_id, field_id));
+  }
+
+  // Writes dirty cache entries; each is already the newest state of its field.
+  void flush_current() {
+    if (!current_.has_dirty()) return;
+    StageTimer timer(IngestStage::UpsertCurrent);
+    auto st = stmts_.get(
+      "INSERT INTO current_facts(record_id, field_id, value_id, ts) VALUES(?,?,?,?) "
+      "ON CONFLICT(record_id, field_id) DO UPDATE SET value_id=excluded.value_id, ts=excluded.ts;",
+      "prepare flush_current");
+    current_.flush([&](uint64_t record_id, uint32_t field_id, const CurrentStateCache::Entry& e) {
+      sqlite3_bind_int64(st.s, 1, (sqlite3_int64)record_id);
+      sqlite3_bind_int(st.s, 2, (int)field_id);
+      sqlite3_bind_int64(st.s, 3, (sqlite3_int64)e.value_id);
+      sqlite3_bind_int64(st.s, 4, (sqlite3_int64)e.ts);
+      check_sql(st.step(), db_, "flush_current step");
+      sqlite3_reset(st.s);
+    });
+  }
+
+  // Value of one field as of t (the latest fact with ts <= t), live or sealed.
+  std::optional<uint64_t> value_as_of(uint64_t record_id, uint32_t field_id, int64_t t) {
+    std::optional<FactRow> best;
+    {
+      auto st = stmts_.get("SELECT record_id, field_id, value_id, ts FROM facts "
+                           "WHERE record_id=? AND field_id=? AND ts <= ? ORDER BY ts DESC LIMIT 1;",
+                           "prepare value_as_of");
+      sqlite3_bind_int64(st.s, 1, (sqlite3_int64)record_id);
+      sqlite3_bind_int(st.s, 2, (int)field_id);
+      sqlite3_bind_int64(st.s, 3, (sqlite3_int64)t);
+      int rc = st.step();
+      check_sql(rc, db_, "value_as_of step");
+      if (rc == SQLITE_ROW) best = fact_row_at(st.s);
+    }
+    if (!sealed_->empty()) {
+      std::vector<FactRow> rows;
+      sealed_->record_rows((int64_t)record_id, rows);
+      for (const auto& r : rows) {
+        if (r.field_id == field_id && r.ts_ms <= t && (!best || r.ts_ms > best->ts_ms)) best = r;
+      }
+    }
+    if (!best) return std::nullopt;
+    return best->value_id;
+  }
+
+  // The value columns every read selects after type_tag: canon_text,
+  // blob_size, num. Columns an older schema lacks read as NULL.
+  std::string value_columns(const char* prefix) const {
+    const std::string p = prefix;
+    return p + "canon_text, " + (blob_column_ ? p + "blob_size" : std::string("NULL")) + ", " +
+           (num_column_ ? p + "num" : std::string("NULL"));
+  }
+
+  // Reads the num column of value_columns starting at col. A numeric row
+  // written since schema rev 5 has no canon_text; its canonical text is
+  // rebuilt into text, byte for byte what ingest hashed.
+  static std::optional<NumericValue> read_value_columns(sqlite3_stmt* s, int col, LogicalType t, std::string& text) {
+    if (sqlite3_column_type(s, col + 2) == SQLITE_NULL) return std::nullopt;
+    NumericValue n{};
+    if (t == LogicalType::Float) {
+      n.d = sqlite3_column_double(s, col + 2);
+    } else {
+      n.i = (int64_t)sqlite3_column_int64(s, col + 2);
+      n.d = (double)n.i;
+    }
+    if (sqlite3_column_type(s, col) == SQLITE_NULL) {
+      switch (t) {
+        case LogicalType::Int: text = std::to_string(n.i); break;
+        case LogicalType::Float: text = canonicalize_float64(n.d); break;
+        case LogicalType::Bool: text = n.i ? "true" : "false"; break;
+        default: throw std::runtime_error("numeric value row has a non-numeric type");
+      }
+    }
+    return n;
+  }
+
+  // WHERE terms on f_values v for a range, and their bindings from index i
+  // on. Numbers compare across INTEGER and REAL exactly; text under BINARY
+  // collation, which is codepoint order for UTF-8.
+  std::string range_where(const ValueRange& r) const {
+    std::string w = r.numeric() ? "v.type_tag IN (?,?)" : "v.type_tag=?";
+    const char* col = r.numeric() ? "v.num" : "v.canon_text";
+    if (r.lo) w += std::string(" AND ") + col + (r.lo->inclusive ? ">=?" : ">?");
+    if (r.hi) w += std::string(" AND ") + col + (r.hi->inclusive ? "<=?" : "<?");
+    return w;
+  }
+
+  void bind_range(sqlite3_stmt* s, int i, const ValueRange& r) const {
+    if (r.numeric()) {
+      sqlite3_bind_int(s, i++, (int)type_tag_byte(tagmap_, LogicalType::Int));
+      sqlite3_bind_int(s, i++, (int)type_tag_byte(tagmap_, LogicalType::Float));
+    } else {
+      sqlite3_bind_int(s, i++, (int)type_tag_byte(tagmap_, LogicalType::Text));
+    }
+    for (const auto* b : {&r.lo, &r.hi}) {
+      if (!*b) continue;
+      const CanonValue& cv = (*b)->value;
+      if (cv.logical_type == LogicalType::Text) {
+        sqlite3_bind_text(s, i++, cv.canon_text.data(), (int)cv.canon_text.size(), SQLITE_STATIC);
+      } else if (cv.logical_type == LogicalType::Int) {
+        sqlite3_bind_int64(s, i++, (sqlite3_int64)numeric_of(cv.logical_type, cv.canon_text, std::nullopt).i);
+      } else {
+        sqlite3_bind_double(s, i++, numeric_of(cv.logical_type, cv.canon_text, std::nullopt).d);
+      }
+    }
+  }
+
+  // Text values kept in the blob store have no canon_text to index; the
+  // few there are get checked one by one.
+  void blob_text_values_in(const ValueRange& r, const std::function<void(uint64_t)>& fn) {
+    if (r.numeric() || !blob_column_) return;
+    std::vector<uint64_t> vids;
+    {
+      auto st = stmts_.get("SELECT value_id FROM f_values WHERE type_tag=? AND blob_size IS NOT NULL;",
+                           "prepare blob text values");
+      sqlite3_bind_int(st.s, 1, (int)type_tag_byte(tagmap_, LogicalType::Text));
+      for (;;) {
+        int rc = st.step();
+        if (rc == SQLITE_DONE) break;
+        check_sql(rc, db_, "blob text values step");
+        vids.push_back((uint64_t)sqlite3_column_int64(st.s, 0));
+      }
+    }
+    for (uint64_t vid : vids) {
+      ValueRow vr = get_value(vid);
+      if (value_in_range(r, vr.type, vr.canon(), vr.num)) fn(vid);
+    }
+  }
+
+  void range_value_ids(const ValueRange& r, const std::function<void(uint64_t)>& fn) {
+    const std::string sql = "SELECT v.value_id FROM f_values v WHERE " + range_where(r) + ";";
+    auto st = stmts_.get(sql.c_str(), "prepare range values");
+    bind_range(st.s, 1, r);
+    for (;;) {
+      int rc = st.step();
+      if (rc == SQLITE_DONE) break;
+      check_sql(rc, db_, "range values step");
+      fn((uint64_t)sqlite3_column_int64(st.s, 0));
+    }
+    blob_text_values_in(r, fn);
+  }
+
+  // Appends the record ids in table (facts or current_facts) that have a
+  // fact for field_id whose value is in the range.
+  void range_records(const char* table, uint32_t field_id, const ValueRange& r, std::vector<uint64_t>& out) {
+    if (!num_column_) {
+      throw std::runtime_error("range queries need schema rev 5; open the database read-write once to upgrade it");
+    }
+    // CROSS JOIN keeps f_values outermost, so the ordered value index drives
+    // the query: without ANALYZE statistics the planner would rather scan
+    // every fact of the field.
+    const std::string sql = std::string("SELECT f.record_id FROM f_values v CROSS JOIN ") + table +
+                            " f ON f.field_id=? AND f.value_id=v.value_id WHERE " + range_where(r) + ";";
+    {
+      auto st = stmts_.get(sql.c_str(), "prepare range query");
+      sqlite3_bind_int(st.s, 1, (int)field_id);
+      bind_range(st.s, 2, r);
+      for (;;) {
+        int rc = st.step();
+        if (rc == SQLITE_DONE) break;
+        check_sql(rc, db_, "range query step");
+        out.push_back((uint64_t)sqlite3_column_int64(st.s, 0));
+      }
+    }
+    const std::string eq = std::string("SELECT record_id FROM ") + table + " WHERE field_id=? AND value_id=?;";
+    blob_text_values_in(r, [&](uint64_t vid) {
+      auto st = stmts_.get(eq.c_str(), "prepare range blob lookup");
+      sqlite3_bind_int(st.s, 1, (int)field_id);
+      sqlite3_bind_int64(st.s, 2, (sqlite3_int64)vid);
+      for (;;) {
+        int rc = st.step();
+        if (rc == SQLITE_DONE) break;
+        check_sql(rc, db_, "range blob lookup step");
+        out.push_back((uint64_t)sqlite3_column_int64(st.s, 0));
+      }
+    });
+  }
+
+  void require_feed() const {
+    if (!seq_column_) {
+      throw std::runtime_error("the change feed needs schema rev 7; open the database read-write once to upgrade it");
+    }
+  }
+
+  static std::vector<uint64_t> sorted_records(std::vector<uint64_t> out) {
+    std::sort(out.begin(), out.end(), [](uint64_t a, uint64_t b) { return (int64_t)a < (int64_t)b; });
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+    return out;
+  }
+
+  void ensure_meta_table() {
+    exec_sql(db_, "CREATE TABLE IF NOT EXISTS meta (k TEXT PRIMARY KEY, v TEXT NOT NULL);");
+  }
+
+  void load_format_defaults() {
+    auto hv = meta_get("hash_format");
+    auto tv = meta_get("tag_map");
+    if (!hv.has_value() || !tv.has_value()) {
+      tagmap_ = TagMapVersion::LegacyV02;
+      hashfmt_ = HashFormatVersion::LegacyNoSep;
+      return;
+    }
+    tagmap_ = (*tv == "felix_v03") ? TagMapVersion::FelixV03 : TagMapVersion::LegacyV02;
+    hashfmt_ = (*hv == "felix_v03_sep") ? HashFormatVersion::FelixV03Sep : HashFormatVersion::LegacyNoSep;
+  }
+
+  static CanonValue null_canon_value() {
+    CanonValue cv{};
+    cv.logical_type = LogicalType::Null;
+    cv.canon_text = "null";
+    return cv;
+  }
+
+  void ensure_null_value() {
+    null_value_id_ = get_or_create_value(canon_view_of(null_canon_value()));
+  }
+
+  struct IndexDef {
+    const char* name;
+    const char* ddl;
+  };
+
+  std::vector<IndexDef> secondary_indexes() const {
+    std::vector<IndexDef> out = {
+      {"facts_by_value", "CREATE INDEX IF NOT EXISTS facts_by_value ON facts(value_id);"},
+      {"facts_by_field_value", "CREATE INDEX IF NOT EXISTS facts_by_field_value ON facts(field_id, value_id);"},
+      {"current_by_field_value", "CREATE INDEX IF NOT EXISTS current_by_field_value ON current_facts(field_id, value_id);"},
+      {"facts_by_ts", "CREATE INDEX IF NOT EXISTS facts_by_ts ON facts(ts);"},
+      // Ordered typed values for range queries.
+      {"values_by_num", "CREATE INDEX IF NOT EXISTS values_by_num ON f_values(type_tag, num) WHERE num IS NOT NULL;"},
+      {"values_by_text", "CREATE INDEX IF NOT EXISTS values_by_text ON f_values(type_tag, canon_text) "
+                         "WHERE canon_text IS NOT NULL;"},
+      {"values_in_blobs", "CREATE INDEX IF NOT EXISTS values_in_blobs ON f_values(type_tag) WHERE blob_size IS NOT NULL;"},
+    };
+    if (checkpoints_enabled_) {
+      out.push_back({"facts_by_record_ts", "CREATE INDEX IF NOT EXISTS facts_by_record_ts ON facts(record_id, ts);"});
+    }
+    return out;
+  }
+
+  void create_secondary_indexes() {
+    for (const auto& ix : secondary_indexes()) exec_sql(db_, ix.ddl);
+  }
+
+  bool table_exists(const char* name) {
+    Stmt st;
+    check_sql(sqlite3_prepare_v2(db_, "SELECT 1 FROM sqlite_master WHERE type='table' AND name=?;", -1, &st.s, nullptr),
+              db_, "prepare table_exists");
+    sqlite3_bind_text(st.s, 1, name, -1, SQLITE_TRANSIENT);
+    int rc = sqlite3_step(st.s);
+    check_sql(rc, db_, "table_exists step");
+    return rc == SQLITE_ROW;
+  }
+
+  // Fills f_values.num for numeric rows written before schema rev 5. Their
+  // canon_text stays, so nothing that was hashed changes.
+  void backfill_numeric_values() {
+    Stmt sel, upd;
+    check_sql(sqlite3_prepare_v2(db_, "SELECT value_id, type_tag, canon_text FROM f_values "
+                                      "WHERE type_tag IN (?,?,?) AND num IS NULL;", -1, &sel.s, nullptr),
+              db_, "prepare numeric backfill");
+    check_sql(sqlite3_prepare_v2(db_, "UPDATE f_values SET num=? WHERE value_id=?;", -1, &upd.s, nullptr),
+              db_, "prepare numeric backfill update");
+    sqlite3_bind_int(sel.s, 1, (int)type_tag_byte(tagmap_, LogicalType::Int));
+    sqlite3_bind_int(sel.s, 2, (int)type_tag_byte(tagmap_, LogicalType::Float));
+    sqlite3_bind_int(sel.s, 3, (int)type_tag_byte(tagmap_, LogicalType::Bool));
+    for (;;) {
+      int rc = sqlite3_step(sel.s);
+      if (rc == SQLITE_DONE) break;
+      check_sql(rc, db_, "numeric backfill step");
+      const LogicalType t = logical_type_from_tag(tagmap_, (uint8_t)sqlite3_column_int(sel.s, 1));
+      const char* txt = (const char*)sqlite3_column_text(sel.s, 2);
+      if (!txt) continue;
+      const std::string_view canon(txt);
+      sqlite3_reset(upd.s);
+      if (t == LogicalType::Float) {
+        sqlite3_bind_double(upd.s, 1, std::strtod(txt, nullptr));  // also reads "inf" / "-inf"
+      } else if (t == LogicalType::Bool) {
+        sqlite3_bind_int(upd.s, 1, canon == "true" ? 1 : 0);
+      } else {
+        int64_t i = 0;
+        std::from_chars(canon.data(), canon.data() + canon.size(), i);
+        sqlite3_bind_int64(upd.s, 1, (sqlite3_int64)i);
+      }
+      sqlite3_bind_int64(upd.s, 2, sqlite3_column_int64(sel.s, 0));
+      check_sql(sqlite3_step(upd.s), db_, "numeric backfill update step");
+    }
+  }
+
+  bool table_has_column(const char* table, const char* column) {
+    Stmt st;
+    check_sql(sqlite3_prepare_v2(db_, "SELECT 1 FROM pragma_table_info(?) WHERE name=?;", -1, &st.s, nullptr),
+              db_, "prepare table_has_column");
+    sqlite3_bind_text(st.s, 1, table, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(st.s, 2, column, -1, SQLITE_TRANSIENT);
+    int rc = sqlite3_step(st.s);
+    check_sql(rc, db_, "table_has_column step");
+    return rc == SQLITE_ROW;
+  }
+
+  bool table_has_rows(const std::string& name) {
+    Stmt st;
+    std::string sql = "SELECT 1 FROM " + name + " LIMIT 1;";
+    check_sql(sqlite3_prepare_v2(db_, sql.c_str(), -1, &st.s, nullptr), db_, "prepare table_has_rows");
+    int rc = sqlite3_step(st.s);
+    check_sql(rc, db_, "table_has_rows step");
+    return rc == SQLITE_ROW;
+  }
+};
+
+// ------------------------------------------------------------
+// Embedded LSM key-value store
+//
+// A directory holding:
+//   LOCK             flock()ed by the one process that has the store open
+//   wal.log          commits since the last flush, replayed on open
+//   run-<lo>-<hi>    immutable sorted runs, newest = highest <hi>
+// Commits append one checksummed record to the WAL and apply it to the
+// in-memory table; once that grows past a threshold it is written out as a
+// new run and the WAL restarts. When too many runs pile up they are merged
+// into one run-<lo>-<hi> that replaces (and, on open, shadows) every run
+// whose numbers it covers. Like SQLite with synchronous=NORMAL, commits
+// survive a process crash; the WAL is synced when a run is written.
+// ------------------------------------------------------------
+
+static inline uint64_t fnv1a64(const void* p, size_t n, uint64_t h = 1469598103934665603ull) {
+  const uint8_t* b = static_cast<const uint8_t*>(p);
+  for (size_t i = 0; i < n; i++) {
+    h ^= b[i];
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+// Fixed-width little-endian integers (LSM runs, the LSM WAL and the binary
+// ingest format), whatever the host byte order.
+template <class T>
+static inline void put_le(std::string& out, T v) {
+  static_assert(std::is_unsigned_v<T>);
+  for (size_t i = 0; i < sizeof(T); i++) out.push_back((char)(uint8_t)(v >> (i * 8)));
+}
+static inline void put_u16(std::string& out, uint16_t v) { put_le(out, v); }
+static inline void put_u32(std::string& out, uint32_t v) { put_le(out, v); }
+static inline void put_u64(std::string& out, uint64_t v) { put_le(out, v); }
+
+template <class T>
+static inline T load_le(const uint8_t* p) {
+  static_assert(std::is_integral_v<T>);
+  using U = std::make_unsigned_t<T>;
+  U v = 0;
+  for (size_t i = 0; i < sizeof(T); i++) v |= (U)((U)p[i] << (i * 8));
+  return (T)v;
+}
+
+static void write_file_atomically(const std::string& path, const std::string& bytes) {
+  const std::string tmp = path + ".tmp";
+  int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) throw std::runtime_error("cannot create " + tmp);
+  try {
+    write_all(fd, bytes.data(), bytes.size(), tmp);
+    if (::fsync(fd) != 0) throw std::runtime_error("fsync failed: " + tmp);
+  } catch (...) {
+    ::close(fd);
+    ::unlink(tmp.c_str());
+    throw;
+  }
+  ::close(fd);
+  if (::rename(tmp.c_str(), path.c_str()) != 0) {
+    ::unlink(tmp.c_str());
+    throw std::runtime_error("cannot rename into place: " + path);
+  }
+}
+
+// One immutable sorted run, memory-mapped. Entries are
+// [u32 klen][u32 vlen or kTombstone][key][value]; every kIndexEvery-th entry
+// is also listed in a sparse index so seeks touch one small block.
+class LsmRun {
+public:
+  static constexpr uint32_t kTombstone = 0xffffffffu;
+  static constexpr size_t kIndexEvery = 32;
+  static constexpr char kMagic[8] = {'F', 'L', 'X', 'R', 'U', 'N', '0', '1'};
+
+  LsmRun(uint64_t lo, uint64_t hi, const std::string& path) : lo_(lo), hi_(hi), path_(path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("cannot open run " + path);
+    struct stat sb{};
+    if (::fstat(fd, &sb) != 0 || (size_t)sb.st_size < 32) {
+      ::close(fd);
+      throw std::runtime_error("bad run file " + path);
+    }
+    size_ = (size_t)sb.st_size;
+    void* p = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) throw std::runtime_error("cannot map run " + path);
+    base_ = static_cast<const uint8_t*>(p);
+
+    const uint8_t* foot = base_ + size_ - 32;
+    if (std::memcmp(foot + 24, kMagic, 8) != 0) {
+      ::munmap(const_cast<uint8_t*>(base_), size_);
+      throw std::runtime_error("not a felix run: " + path);
+    }
+    const uint64_t index_off = load_le<uint64_t>(foot);
+    const uint64_t index_n = load_le<uint64_t>(foot + 8);
+    data_end_ = (size_t)index_off;
+    const uint8_t* q = base_ + index_off;
+    index_.reserve((size_t)index_n);
+    for (uint64_t i = 0; i < index_n; i++) {
+      uint32_t kl = load_le<uint32_t>(q);
+      std::string_view k(reinterpret_cast<const char*>(q + 4), kl);
+      uint64_t off = load_le<uint64_t>(q + 4 + kl);
+      index_.emplace_back(k, (size_t)off);
+      q += 4 + kl + 8;
+    }
+  }
+
+  LsmRun(const LsmRun&) = delete;
+  LsmRun& operator=(const LsmRun&) = delete;
+  ~LsmRun() { if (base_) ::munmap(const_cast<uint8_t*>(base_), size_); }
+
+  uint64_t lo() const { return lo_; }
+  uint64_t hi() const { return hi_; }
+  const std::string& path() const { return path_; }
+
+  struct Entry {
+    std::string_view key;
+    std::string_view value;
+    bool tombstone{false};
+    size_t next{0};
+  };
+
+  bool entry_at(size_t off, Entry& e) const {
+    if (off >= data_end_) return false;
+    const uint8_t* p = base_ + off;
+    uint32_t kl = load_le<uint32_t>(p), vl = load_le<uint32_t>(p + 4);
+    e.key = std::string_view(reinterpret_cast<const char*>(p + 8), kl);
+    e.tombstone = vl == kTombstone;
+    if (e.tombstone) vl = 0;
+    e.value = std::string_view(reinterpret_cast<const char*>(p + 8 + kl), vl);
+    e.next = off + 8 + kl + vl;
+    return true;
+  }
+
+  // Offset of the first entry with key >= k.
+  size_t seek(std::string_view k) const {
+    size_t off = block_for(k);
+    Entry e;
+    while (entry_at(off, e) && e.key < k) off = e.next;
+    return off;
+  }
+
+  // Greatest entry with key <= k, if any.
+  bool floor(std::string_view k, Entry& out) const {
+    size_t off = block_for(k);
+    Entry e;
+    bool found = false;
+    while (entry_at(off, e) && e.key <= k) {
+      out = e;
+      found = true;
+      off = e.next;
+    }
+    return found;
+  }
+
+  static std::string build(const std::vector<std::pair<std::string_view, std::optional<std::string_view>>>& entries) {
+    std::string out, index;
+    uint64_t index_n = 0;
+    for (size_t i = 0; i < entries.size(); i++) {
+      const auto& [k, v] = entries[i];
+      if (i % kIndexEvery == 0) {
+        put_u32(index, (uint32_t)k.size());
+        index.append(k);
+        put_u64(index, out.size());
+        index_n++;
+      }
+      put_u32(out, (uint32_t)k.size());
+      put_u32(out, v ? (uint32_t)v->size() : kTombstone);
+      out.append(k);
+      if (v) out.append(*v);
+    }
+    const uint64_t index_off = out.size();
+    out += index;
+    put_u64(out, index_off);
+    put_u64(out, index_n);
+    put_u64(out, entries.size());
+    out.append(kMagic, 8);
+    return out;
+  }
+
+private:
+  uint64_t lo_, hi_;
+  std::string path_;
+  const uint8_t* base_{nullptr};
+  size_t size_{0};
+  size_t data_end_{0};
+  std::vector<std::pair<std::string_view, size_t>> index_;
+
+  size_t block_for(std::string_view k) const {
+    auto it = std::upper_bound(index_.begin(), index_.end(), k,
+                               [](std::string_view a, const std::pair<std::string_view, size_t>& b) { return a < b.first; });
+    if (it == index_.begin()) return 0;
+    return std::prev(it)->second;
+  }
+};
+
+class LsmKv {
+public:
+  using Table = std::map<std::string, std::optional<std::string>, std::less<>>;
+  static constexpr size_t kFlushBytes = 32u * 1024u * 1024u;
+  static constexpr size_t kFlushOnCloseBytes = 1u * 1024u * 1024u;
+  static constexpr size_t kMaxRuns = 8;
+
+  explicit LsmKv(const std::string& dir, bool create) : dir_(dir) {
+    namespace fs = std::filesystem;
+    if (!fs::is_directory(dir_)) {
+      if (!create) throw std::runtime_error("no lsm store at " + dir_);
+      fs::create_directories(dir_);
+    }
+    lock_fd_ = ::open((dir_ + "/LOCK").c_str(), O_RDWR | O_CREAT, 0644);
+    if (lock_fd_ < 0 || ::flock(lock_fd_, LOCK_EX | LOCK_NB) != 0) {
+      if (lock_fd_ >= 0) ::close(lock_fd_);
+      throw std::runtime_error("lsm store is in use by another process: " + dir_);
+    }
+    load_runs();
+    replay_wal();
+    wal_fd_ = ::open(wal_path().c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (wal_fd_ < 0) throw std::runtime_error("cannot open " + wal_path());
+  }
+
+  LsmKv(const LsmKv&) = delete;
+  LsmKv& operator=(const LsmKv&) = delete;
+
+  ~LsmKv() {
+    // Spare the next open a long WAL replay.
+    if (!in_tx_ && mem_bytes_ >= kFlushOnCloseBytes) {
+      try { flush(); } catch (...) {}
+    }
+    if (wal_fd_ >= 0) ::close(wal_fd_);
+    if (lock_fd_ >= 0) ::close(lock_fd_);
+  }
+
+  // ---- transactions ----
+
+  // A full memtable is flushed here, before the transaction opens, so a
+  // failing flush fails the next transaction rather than one that is already
+  // durable in the WAL.
+  void begin() {
+    if (in_tx_) throw std::runtime_error("lsm transaction already open");
+    if (wal_broken_) throw std::runtime_error("lsm WAL could not be repaired after a failed append; reopen " + dir_);
+    if (mem_bytes_ >= kFlushBytes) flush();
+    in_tx_ = true;
+    tx_.clear();
+  }
+
+  // Durable once the WAL append completes; nothing after it can fail the
+  // transaction.
+  void commit() {
+    if (!tx_.empty()) {
+      std::string payload;
+      for (const auto& [k, v] : tx_) {
+        put_u32(payload, (uint32_t)k.size());
+        put_u32(payload, v ? (uint32_t)v->size() : LsmRun::kTombstone);
+        payload += k;
+        if (v) payload += *v;
+      }
+      std::string rec;
+      put_u32(rec, (uint32_t)payload.size());
+      put_u64(rec, fnv1a64(payload.data(), payload.size()));
+      rec += payload;
+      try {
+        write_all(wal_fd_, rec.data(), rec.size(), wal_path());
+      } catch (...) {
+        // Cut a torn record off again: replay stops at the first bad record,
+        // so later appends behind it would be lost.
+        if (::ftruncate(wal_fd_, (off_t)wal_bytes_) != 0) wal_broken_ = true;
+        throw;
+      }
+      wal_bytes_ += rec.size();
+      for (auto& [k, v] : tx_) {
+        mem_bytes_ += k.size() + (v ? v->size() : 0) + 16;
+        mem_[k] = std::move(v);
+      }
+    }
+    tx_.clear();
+    in_tx_ = false;
+  }
+
+  void rollback() {
+    tx_.clear();
+    in_tx_ = false;
+  }
+
+  void put(std::string_view k, std::string_view v) { tx_table()[std::string(k)] = std::string(v); }
+  void del(std::string_view k) { tx_table()[std::string(k)] = std::nullopt; }
+
+  // ---- reads (see the open transaction's own writes) ----
+
+  std::optional<std::string> get(std::string_view k) const {
+    for (const Table* t : tables()) {
+      auto it = t->find(k);
+      if (it != t->end()) return it->second;
+    }
+    for (auto r = runs_.rbegin(); r != runs_.rend(); ++r) {
+      LsmRun::Entry e;
+      if ((*r)->floor(k, e) && e.key == k) {
+        if (e.tombstone) return std::nullopt;
+        return std::string(e.value);
+      }
+    }
+    return std::nullopt;
+  }
+
+  // Live keys in [lo, hi) in key order; fn returns false to stop.
+  void scan(std::string_view lo, std::string_view hi,
+            const std::function<bool(std::string_view, std::string_view)>& fn) const {
+    struct Source {
+      const Table* t{nullptr};
+      Table::const_iterator it;
+      const LsmRun* run{nullptr};
+      LsmRun::Entry e;
+      size_t off{0};
+      bool valid{false};
+      std::string_view key() const { return t ? std::string_view(it->first) : e.key; }
+      bool tombstone() const { return t ? !it->second.has_value() : e.tombstone; }
+      std::string_view value() const { return t ? std::string_view(*it->second) : e.value; }
+    };
+    // Newest first, so ties resolve to the first source.
+    std::vector<Source> src;
+    for (const Table* t : tables()) {
+      Source s{};
+      s.t = t;
+      s.it = t->lower_bound(lo);
+      s.valid = s.it != t->end() && s.it->first < hi;
+      src.push_back(s);
+    }
+    for (auto r = runs_.rbegin(); r != runs_.rend(); ++r) {
+      Source s{};
+      s.run = r->get();
+      s.off = s.run->seek(lo);
+      s.valid = s.run->entry_at(s.off, s.e) && s.e.key < hi;
+      src.push_back(s);
+    }
+    auto advance = [&](Source& s) {
+      if (s.t) {
+        ++s.it;
+        s.valid = s.it != s.t->end() && s.it->first < hi;
+      } else {
+        s.off = s.e.next;
+        s.valid = s.run->entry_at(s.off, s.e) && s.e.key < hi;
+      }
+    };
+    for (;;) {
+      Source* best = nullptr;
+      for (auto& s : src) {
+        if (s.valid && (!best || s.key() < best->key())) best = &s;
+      }
+      if (!best) return;
+      const std::string key(best->key());
+      const bool live = !best->tombstone();
+      bool go = true;
+      if (live) go = fn(key, best->value());
+      for (auto& s : src) {
+        if (s.valid && s.key() == key) advance(s);
+      }
+      if (!go) return;
+    }
+  }
+
+  // Greatest live key k with lo <= k <= at, with its value.
+  std::optional<std::pair<std::string, std::string>> floor(std::string_view lo, std::string_view at) const {
+    std::optional<std::string_view> best_key;
+    std::optional<std::string_view> best_val;
+    bool best_tomb = false;
+    auto consider = [&](std::string_view k, std::optional<std::string_view> v) {
+      if (k < lo) return;
+      if (!best_key || k > *best_key) {
+        best_key = k;
+        best_val = v;
+        best_tomb = !v.has_value();
+      }
+    };
+    for (const Table* t : tables()) {
+      auto it = t->upper_bound(at);
+      if (it == t->begin()) continue;
+      --it;
+      consider(it->first, it->second ? std::optional<std::string_view>(*it->second) : std::nullopt);
+    }
+    for (auto r = runs_.rbegin(); r != runs_.rend(); ++r) {
+      LsmRun::Entry e;
+      if ((*r)->floor(at, e)) consider(e.key, e.tombstone ? std::nullopt : std::optional<std::string_view>(e.value));
+    }
+    if (!best_key) return std::nullopt;
+    if (!best_tomb) return std::make_pair(std::string(*best_key), std::string(*best_val));
+
+    // The newest version of the closest key is deleted: fall back to a scan.
+    std::optional<std::pair<std::string, std::string>> out;
+    std::string hi(at);
+    hi.push_back('\0');
+    scan(lo, hi, [&](std::string_view k, std::string_view v) {
+      out = std::make_pair(std::string(k), std::string(v));
+      return true;
+    });
+    return out;
+  }
+
+private:
+  std::string dir_;
+  int lock_fd_{-1};
+  int wal_fd_{-1};
+  uint64_t wal_bytes_{0};    // end of the last complete WAL record
+  bool wal_broken_{false};   // a torn append could not be truncated away
+  Table mem_;
+  size_t mem_bytes_{0};
+  Table tx_;
+  bool in_tx_{false};
+  std::vector<std::unique_ptr<LsmRun>> runs_;  // oldest first
+
+  std::string wal_path() const { return dir_ + "/wal.log"; }
+
+  Table& tx_table() {
+    if (!in_tx_) throw std::runtime_error("lsm write outside a transaction");
+    return tx_;
+  }
+
+  std::vector<const Table*> tables() const {
+    std::vector<const Table*> out;
+    if (in_tx_) out.push_back(&tx_);
+    out.push_back(&mem_);
+    return out;
+  }
+
+  std::string run_path(uint64_t lo, uint64_t hi) const {
+    return dir_ + "/run-" + std::to_string(lo) + "-" + std::to_string(hi);
+  }
+
+  void load_runs() {
+    namespace fs = std::filesystem;
+    std::vector<std::pair<uint64_t, uint64_t>> found;
+    for (const auto& e : fs::directory_iterator(dir_)) {
+      const std::string name = e.path().filename().string();
+      if (name.rfind("run-", 0) != 0) continue;
+      if (name.size() > 4 && name.compare(name.size() - 4, 4, ".tmp") == 0) {
+        fs::remove(e.path());
+        continue;
+      }
+      auto dash = name.find('-', 4);
+      if (dash == std::string::npos) continue;
+      found.emplace_back(std::stoull(name.substr(4, dash - 4)), std::stoull(name.substr(dash + 1)));
+    }
+    // A merged run supersedes every run whose numbers it covers.
+    std::sort(found.begin(), found.end(), [](const auto& a, const auto& b) {
+      return a.second != b.second ? a.second < b.second : a.first > b.first;
+    });
+    std::vector<std::pair<uint64_t, uint64_t>> keep;
+    for (const auto& f : found) {
+      bool covered = false;
+      for (const auto& g : found) {
+        if (&g != &f && g.first <= f.first && f.second <= g.second && (g.second - g.first) > (f.second - f.first)) covered = true;
+      }
+      if (covered) fs::remove(run_path(f.first, f.second));
+      else keep.push_back(f);
+    }
+    for (const auto& [lo, hi] : keep) runs_.push_back(std::make_unique<LsmRun>(lo, hi, run_path(lo, hi)));
+  }
+
+  void replay_wal() {
+    std::ifstream in(wal_path(), std::ios::binary);
+    if (!in) return;
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    size_t pos = 0, good = 0;
+    while (pos + 12 <= data.size()) {
+      uint32_t len = load_le<uint32_t>(reinterpret_cast<const uint8_t*>(data.data() + pos));
+      uint64_t sum = load_le<uint64_t>(reinterpret_cast<const uint8_t*>(data.data() + pos + 4));
+      if (pos + 12 + len > data.size()) break;
+      const char* p = data.data() + pos + 12;
+      if (fnv1a64(p, len) != sum) break;
+      const char* end = p + len;
+      while (p < end) {
+        uint32_t kl = load_le<uint32_t>(reinterpret_cast<const uint8_t*>(p));
+        uint32_t vl = load_le<uint32_t>(reinterpret_cast<const uint8_t*>(p + 4));
+        std::string k(p + 8, kl);
+        p += 8 + kl;
+        if (vl == LsmRun::kTombstone) {
+          mem_bytes_ += kl + 16;
+          mem_[std::move(k)] = std::nullopt;
+        } else {
+          mem_bytes_ += kl + vl + 16;
+          mem_[std::move(k)] = std::string(p, vl);
+          p += vl;
+        }
+      }
+      pos += 12 + len;
+      good = pos;
+    }
+    in.close();
+    // Drop a torn tail left by a crash mid-append.
+    if (good != data.size()) std::filesystem::resize_file(wal_path(), good);
+    wal_bytes_ = good;
+  }
+
+  uint64_t next_run_number() const { return runs_.empty() ? 1 : runs_.back()->hi() + 1; }
+
+  void flush() {
+    if (mem_.empty()) return;
+    std::vector<std::pair<std::string_view, std::optional<std::string_view>>> entries;
+    entries.reserve(mem_.size());
+    for (const auto& [k, v] : mem_) {
+      entries.emplace_back(k, v ? std::optional<std::string_view>(*v) : std::nullopt);
+    }
+    const uint64_t n = next_run_number();
+    write_file_atomically(run_path(n, n), LsmRun::build(entries));
+    runs_.push_back(std::make_unique<LsmRun>(n, n, run_path(n, n)));
+    mem_.clear();
+    mem_bytes_ = 0;
+    if (::ftruncate(wal_fd_, 0) != 0) throw std::runtime_error("cannot truncate " + wal_path());
+    wal_bytes_ = 0;
+    if (runs_.size() > kMaxRuns) compact();
+  }
+
+  // Merges every run into one. It covers the oldest run, so tombstones go.
+  void compact() {
+    std::vector<std::pair<std::string, std::optional<std::string>>> merged;
+    Table saved_mem;
+    std::swap(saved_mem, mem_);
+    const bool saved_tx = in_tx_;
+    in_tx_ = false;
+    scan(std::string_view(), std::string_view("\xff\xff\xff\xff", 4), [&](std::string_view k, std::string_view v) {
+      merged.emplace_back(std::string(k), std::string(v));
+      return true;
+    });
+    std::swap(saved_mem, mem_);
+    in_tx_ = saved_tx;
+
+    std::vector<std::pair<std::string_view, std::optional<std::string_view>>> entries;
+    entries.reserve(merged.size());
+    for (const auto& [k, v] : merged) entries.emplace_back(k, std::optional<std::string_view>(*v));
+    const uint64_t lo = runs_.front()->lo(), hi = runs_.back()->hi();
+    write_file_atomically(run_path(lo, hi), LsmRun::build(entries));
+    std::vector<std::string> old;
+    for (const auto& r : runs_) old.push_back(r->path());
+    runs_.clear();
+    for (const auto& p : old) std::filesystem::remove(p);
+    runs_.push_back(std::make_unique<LsmRun>(lo, hi, run_path(lo, hi)));
+  }
+};
+
+// ------------------------------------------------------------
+// LSM backend
+//
+// Key layout (integers big-endian; signed ones with the sign bit flipped, so
+// byte order equals SQLite's integer order):
+//   m <name>                      meta
+//   F <hash>  -> field_id         f <field_id> -> name_canon
+//   V <hash>  -> value_id         v <value_id> -> type_tag, canon (bytes: payload)
+//   R <rid>   -> created_ts
+//   H <rid> <fid> <ts> -> vid     history: as-of = floor seek
+//   C <rid> <fid> -> vid, ts      current: latest-per-field = prefix scan
+//   X <fid> <vid> <rid>           current equality index
+//   E <fid> <vid> <rid>           ever equality index
+//   T <ts> <rid> <fid> -> vid     time index for facts_window
+// ------------------------------------------------------------
+
+static inline void put_be32(std::string& out, uint32_t v) {
+  for (int i = 3; i >= 0; i--) out.push_back((char)(uint8_t)(v >> (i * 8)));
+}
+static inline void put_be64(std::string& out, uint64_t v) {
+  for (int i = 7; i >= 0; i--) out.push_back((char)(uint8_t)(v >> (i * 8)));
+}
+static inline void put_ordered_i64(std::string& out, int64_t v) { put_be64(out, (uint64_t)v ^ (1ull << 63)); }
+
+static inline uint32_t get_be32(std::string_view s, size_t at) {
+  uint32_t v = 0;
+  for (size_t i = 0; i < 4; i++) v = (v << 8) | (uint8_t)s[at + i];
+  return v;
+}
+static inline uint64_t get_be64(std::string_view s, size_t at) {
+  uint64_t v = 0;
+  for (size_t i = 0; i < 8; i++) v = (v << 8) | (uint8_t)s[at + i];
+  return v;
+}
+static inline int64_t get_ordered_i64(std::string_view s, size_t at) { return (int64_t)(get_be64(s, at) ^ (1ull << 63)); }
+
+// Smallest key greater than every key that starts with prefix.
+static inline std::string prefix_end(std::string prefix) {
+  while (!prefix.empty() && (uint8_t)prefix.back() == 0xff) prefix.pop_back();
+  if (!prefix.empty()) prefix.back() = (char)((uint8_t)prefix.back() + 1);
+  return prefix;
+}
+
+class FelixLsm final : public FactStore {
+public:
+  FelixLsm(const std::string& dir, bool create) : kv_(dir, create) {
+    load_format_defaults();
+  }
+
+  void init_schema() {
+    const bool fresh = !kv_.get(meta_key("tag_map")).has_value();
+    with_tx([&]{
+      if (fresh) {
+        meta_set("felix_spec", "0.3");
+        meta_set("tag_map", "felix_v03");
+        meta_set("hash_format", "felix_v03_sep");
+      }
+    });
+    load_format_defaults();
+    open_schema();
+  }
+
+  void open_schema() {
+    CanonValue cv{};
+    cv.logical_type = LogicalType::Null;
+    cv.canon_text = "null";
+    if (auto id = find_value_id(cv)) {
+      null_value_id_ = *id;
+      return;
+    }
+    with_tx([&]{ null_value_id_ = get_or_create_value(canon_view_of(cv)); });
+  }
+
+  void with_tx(const std::function<void()>& fn) override {
+    kv_.begin();
+    in_tx_ = true;
+    try {
+      fn();
+      StageTimer timer(IngestStage::Commit);
+      kv_.commit();
+    } catch (...) {
+      in_tx_ = false;
+      field_ids_.rollback();
+      value_ids_.rollback();
+      kv_.rollback();
+      throw;
+    }
+    in_tx_ = false;
+    field_ids_.commit();
+    value_ids_.commit();
+  }
+
+  void ensure_record(uint64_t record_id, int64_t created_ts_ms) override {
+    std::string k("R");
+    put_ordered_i64(k, (int64_t)record_id);
+    if (kv_.get(k)) return;
+    std::string v;
+    put_ordered_i64(v, created_ts_ms);
+    kv_.put(k, v);
+  }
+
+  uint32_t get_or_create_field(std::string_view field_name) override {
+    if (auto hit = field_ids_.find(field_name)) return *hit;
+    auto [canon, h] = canonical_field(field_name);
+    const std::string hk = "F" + std::string(reinterpret_cast<const char*>(h.data()), h.size());
+    uint32_t fid;
+    if (auto v = kv_.get(hk)) {
+      fid = get_be32(*v, 0);
+    } else {
+      fid = (uint32_t)next_id("next_field_id");
+      std::string idv;
+      put_be32(idv, fid);
+      kv_.put(hk, idv);
+      kv_.put(field_key(fid), canon);
+    }
+    field_ids_.put(std::string(field_name), fid, in_tx_);
+    return fid;
+  }
+
+  uint64_t get_or_create_value(const CanonView& cv) override {
+    check_value_limits(cv);
+    const std::array<uint8_t, 32> hash = hashed_under(cv, tagmap_, hashfmt_) ? cv.hash : canon_view_hash(tagmap_, hashfmt_, cv);
+    if (auto hit = value_ids_.find(hash)) return *hit;
+    const std::string hk = value_hash_key(hash);
+    uint64_t vid;
+    if (auto v = kv_.get(hk)) {
+      vid = get_be64(*v, 0);
+    } else {
+      vid = next_id("next_value_id");
+      std::string idv;
+      put_be64(idv, vid);
+      kv_.put(hk, idv);
+      std::string row(1, (char)type_tag_byte(tagmap_, cv.logical_type));
+      row += cv.canon;  // canonical text, or the payload of a bytes value
+      kv_.put(value_key(vid), row);
+    }
+    value_ids_.put(hash, vid, in_tx_);
+    return vid;
+  }
+
+  std::optional<uint32_t> find_field_id(std::string_view field_name) override {
+    if (auto hit = field_ids_.find(field_name)) return *hit;
+    if (field_name.size() > 256) return std::nullopt;
+    auto h = canonical_field(field_name).second;
+    auto v = kv_.get("F" + std::string(reinterpret_cast<const char*>(h.data()), h.size()));
+    if (!v) return std::nullopt;
+    uint32_t fid = get_be32(*v, 0);
+    field_ids_.put(std::string(field_name), fid, in_tx_);
+    return fid;
+  }
+
+  std::optional<uint64_t> find_value_id(CanonValue cv) override {
+    if (!hashed_under(cv, tagmap_, hashfmt_)) hash_canon_value(tagmap_, hashfmt_, cv);
+    if (auto hit = value_ids_.find(cv.hash)) return *hit;
+    auto v = kv_.get(value_hash_key(cv.hash));
+    if (!v) return std::nullopt;
+    uint64_t vid = get_be64(*v, 0);
+    value_ids_.put(cv.hash, vid, in_tx_);
+    return vid;
+  }
+
+  std::optional<std::pair<uint64_t, int64_t>> get_current(uint64_t record_id, uint32_t field_id) override {
+    auto v = kv_.get(current_key(record_id, field_id));
+    if (!v) return std::nullopt;
+    return std::make_pair(get_be64(*v, 0), get_ordered_i64(*v, 8));
+  }
+
+  void insert_fact(const FactRow& f) override {
+    const std::string hk = history_key(f.record_id, f.field_id, f.ts_ms);
+    if (kv_.get(hk)) throw std::runtime_error("insert_fact failed: fact (record_id, field_id, ts) already exists");
+    std::string vid;
+    put_be64(vid, f.value_id);
+    kv_.put(hk, vid);
+    kv_.put(eq_key('E', f.field_id, f.value_id, f.record_id), "");
+    std::string tk("T");
+    put_ordered_i64(tk, f.ts_ms);
+    put_ordered_i64(tk, (int64_t)f.record_id);
+    put_be32(tk, f.field_id);
+    kv_.put(tk, vid);
+  }
+
+  void upsert_current_if_newer(const FactRow& f) override {
+    set_current_if_newer(f, get_current(f.record_id, f.field_id));
+  }
+
+  bool insert_fact_if_changed(const FactRow& f) override {
+    std::optional<std::pair<uint64_t, int64_t>> cur;
+    {
+      StageTimer timer(IngestStage::GetCurrent);
+      cur = get_current(f.record_id, f.field_id);
+      if (cur) {
+        std::optional<uint64_t> prev = cur->first;
+        if (f.ts_ms < cur->second) {
+          prev.reset();
+          auto hit = kv_.floor(history_key(f.record_id, f.field_id, std::numeric_limits<int64_t>::min()),
+                               history_key(f.record_id, f.field_id, f.ts_ms));
+          if (hit) prev = get_be64(hit->second, 0);
+        }
+        if (prev == f.value_id) return false;
+      }
+    }
+    {
+      StageTimer timer(IngestStage::InsertFact);
+      insert_fact(f);
+    }
+    StageTimer timer(IngestStage::UpsertCurrent);
+    set_current_if_newer(f, cur);
+    return true;
+  }
+
+  std::vector<uint64_t> query_current_eq(uint32_t field_id, uint64_t value_id) override {
+    return eq_records('X', field_id, value_id);
+  }
+
+  std::vector<uint64_t> query_ever_eq(uint32_t field_id, uint64_t value_id) override {
+    return eq_records('E', field_id, value_id);
+  }
+
+  // No ordered value index here: the field's equality keys are walked once
+  // and each distinct value is tested against the range.
+  std::vector<uint64_t> query_current_range(uint32_t field_id, const ValueRange& r) override {
+    return range_records('X', field_id, r);
+  }
+
+  std::vector<uint64_t> query_ever_range(uint32_t field_id, const ValueRange& r) override {
+    return range_records('E', field_id, r);
+  }
+
+  void query_facts_window(const FactsWindowQuery& q, const std::function<bool(const FactView&)>& fn) override {
+    uint64_t left = q.limit ? *q.limit : std::numeric_limits<uint64_t>::max();
+    std::unordered_map<uint32_t, FieldRow> names;
+    std::unordered_map<uint64_t, ValueRow> values;
+    auto emit = [&](const FactRow& f) {
+      if (left == 0) return false;
+      auto fi = names.find(f.field_id);
+      if (fi == names.end()) fi = names.emplace(f.field_id, get_field(f.field_id)).first;
+      auto vi = values.find(f.value_id);
+      if (vi == values.end()) vi = values.emplace(f.value_id, get_value(f.value_id)).first;
+      left--;
+      return fn(FactView{f, fi->second.name_canon, vi->second.type, vi->second.canon(), vi->second.num});
+    };
+    auto after_cursor = [&](const FactRow& f) {
+      if (!q.after) return true;
+      if (f.ts_ms != q.after->ts_ms) return f.ts_ms > q.after->ts_ms;
+      if ((int64_t)f.record_id != q.after->record_id) return (int64_t)f.record_id > q.after->record_id;
+      return f.field_id > q.after->field_id;
+    };
+
+    if (q.record_id) {
+      // One record: its history prefix is small; order it by ts.
+      std::vector<FactRow> rows;
+      scan_history(*q.record_id, [&](const FactRow& f) {
+        if (f.ts_ms >= q.t1 && f.ts_ms <= q.t2 && after_cursor(f)) rows.push_back(f);
+      });
+      std::sort(rows.begin(), rows.end(), [](const FactRow& a, const FactRow& b) {
+        return a.ts_ms != b.ts_ms ? a.ts_ms < b.ts_ms : a.field_id < b.field_id;
+      });
+      for (const auto& f : rows) {
+        if (!emit(f)) return;
+      }
+      return;
+    }
+
+    std::string lo("T"), hi("T");
+    put_ordered_i64(lo, q.t1);
+    if (q.t2 == std::numeric_limits<int64_t>::max()) hi = prefix_end("T");
+    else put_ordered_i64(hi, q.t2 + 1);
+    kv_.scan(lo, hi, [&](std::string_view k, std::string_view v) {
+      FactRow f{(uint64_t)get_ordered_i64(k, 9), get_be32(k, 17), get_be64(v, 0), get_ordered_i64(k, 1)};
+      if (!after_cursor(f)) return true;
+      return emit(f);
+    });
+  }
+
+  // The H prefix of a record is already in (field_id, ts) order; a field
+  // filter narrows the scan to that field's prefix.
+  void query_history(const HistoryQuery& q, const std::function<bool(const FactView&)>& fn) override {
+    std::vector<FactRow> rows;
+    auto scan_prefix = [&](std::string lo) {
+      kv_.scan(lo, prefix_end(lo), [&](std::string_view k, std::string_view v) {
+        FactRow f{q.record_id, get_be32(k, 9), get_be64(v, 0), get_ordered_i64(k, 13)};
+        if (f.ts_ms >= q.t1 && f.ts_ms <= q.t2) rows.push_back(f);
+        return true;
+      });
+    };
+    std::string lo("H");
+    put_ordered_i64(lo, (int64_t)q.record_id);
+    if (q.field_ids.empty()) {
+      scan_prefix(lo);
+    } else {
+      for (uint32_t fid : q.field_ids) {
+        std::string flo = lo;
+        put_be32(flo, fid);
+        scan_prefix(flo);
+      }
+    }
+    if (q.reverse) std::reverse(rows.begin(), rows.end());
+
+    std::unordered_map<uint32_t, FieldRow> names;
+    std::unordered_map<uint64_t, ValueRow> values;
+    uint64_t left = 0;
+    std::optional<uint32_t> open;
+    for (const auto& f : rows) {
+      if (f.field_id != open) {
+        open = f.field_id;
+        left = q.limit ? *q.limit : std::numeric_limits<uint64_t>::max();
+      }
+      if (left == 0) continue;
+      left--;
+      auto fi = names.find(f.field_id);
+      if (fi == names.end()) fi = names.emplace(f.field_id, get_field(f.field_id)).first;
+      auto vi = values.find(f.value_id);
+      if (vi == values.end()) vi = values.emplace(f.value_id, get_value(f.value_id)).first;
+      if (!fn(FactView{f, fi->second.name_canon, vi->second.type, vi->second.canon(), vi->second.num})) return;
+    }
+  }
+
+  std::vector<FactRow> snapshot_at(uint64_t record_id, int64_t t) override {
+    std::vector<FactRow> out;
+    snapshot_range({(int64_t)record_id, (int64_t)record_id}, t, [&](uint64_t, const std::vector<FactRow>& rows) {
+      out = rows;
+    });
+    return out;
+  }
+
+  // Walks current state in (record, field) order. A field whose current
+  // value is newer than t is resolved with one floor seek into its history.
+  void snapshot_range(RecordRange r, int64_t t,
+                      const std::function<void(uint64_t, const std::vector<FactRow>&)>& fn) override {
+    std::string lo("C"), hi;
+    put_ordered_i64(lo, r.lo);
+    if (r.hi == std::numeric_limits<int64_t>::max()) {
+      hi = prefix_end("C");
+    } else {
+      hi = "C";
+      put_ordered_i64(hi, r.hi + 1);
+    }
+    std::vector<FactRow> rows;
+    uint64_t rid_open = 0;
+    auto flush = [&]{
+      if (!rows.empty()) fn(rid_open, rows);
+      rows.clear();
+    };
+    kv_.scan(lo, hi, [&](std::string_view k, std::string_view v) {
+      const uint64_t rid = (uint64_t)get_ordered_i64(k, 1);
+      const uint32_t fid = get_be32(k, 9);
+      if (rid != rid_open) {
+        flush();
+        rid_open = rid;
+      }
+      FactRow f{rid, fid, get_be64(v, 0), get_ordered_i64(v, 8)};
+      if (f.ts_ms > t) {
+        std::string at = history_key(rid, fid, t);
+        std::string floor_lo = history_key(rid, fid, std::numeric_limits<int64_t>::min());
+        auto hit = kv_.floor(floor_lo, at);
+        if (!hit) return true;
+        f.value_id = get_be64(hit->second, 0);
+        f.ts_ms = get_ordered_i64(hit->first, 13);
+      }
+      rows.push_back(f);
+      return true;
+    });
+    flush();
+  }
+
+  FieldRow get_field(uint32_t field_id) override {
+    auto v = kv_.get(field_key(field_id));
+    if (!v) throw std::runtime_error("unknown field_id");
+    return FieldRow{field_id, *v};
+  }
+
+  ValueRow get_value(uint64_t value_id) override {
+    auto v = kv_.get(value_key(value_id));
+    if (!v || v->empty()) throw std::runtime_error("unknown value_id");
+    ValueRow vr{};
+    vr.value_id = value_id;
+    vr.type = logical_type_from_tag(tagmap_, (uint8_t)(*v)[0]);
+    if (vr.type == LogicalType::Bytes) vr.canon_bytes = v->substr(1);
+    else vr.canon_text = v->substr(1);
+    return vr;
+  }
+
+  TagMapVersion tag_map() const override { return tagmap_; }
+  HashFormatVersion hash_format() const override { return hashfmt_; }
+  uint64_t null_value_id() const { return null_value_id_; }
+
+private:
+  LsmKv kv_;
+  bool in_tx_{false};
+  IdCache<std::string, uint32_t, StringHash, std::equal_to<>> field_ids_{FelixSqlite::kFieldCacheCapacity};
+  IdCache<std::array<uint8_t, 32>, uint64_t, DigestHash> value_ids_{FelixSqlite::kValueCacheCapacity};
+  TagMapVersion tagmap_{TagMapVersion::LegacyV02};
+  HashFormatVersion hashfmt_{HashFormatVersion::LegacyNoSep};
+  uint64_t null_value_id_{0};
+
+  static std::string meta_key(std::string_view k) { return "m" + std::string(k); }
+
+  void meta_set(std::string_view k, std::string_view v) { kv_.put(meta_key(k), v); }
+
+  void load_format_defaults() {
+    auto tv = kv_.get(meta_key("tag_map"));
+    auto hv = kv_.get(meta_key("hash_format"));
+    if (!tv || !hv) {
+      tagmap_ = TagMapVersion::LegacyV02;
+      hashfmt_ = HashFormatVersion::LegacyNoSep;
+      return;
+    }
+    tagmap_ = (*tv == "felix_v03") ? TagMapVersion::FelixV03 : TagMapVersion::LegacyV02;
+    hashfmt_ = (*hv == "felix_v03_sep") ? HashFormatVersion::FelixV03Sep : HashFormatVersion::LegacyNoSep;
+  }
+
+  uint64_t next_id(std::string_view counter) {
+    const std::string k = meta_key(counter);
+    auto v = kv_.get(k);
+    uint64_t id = v ? std::stoull(*v) : 1;
+    kv_.put(k, std::to_string(id + 1));
+    return id;
+  }
+
+  // cur: the field's current state before f.
+  void set_current_if_newer(const FactRow& f, const std::optional<std::pair<uint64_t, int64_t>>& cur) {
+    if (cur && f.ts_ms < cur->second) return;
+    if (cur) kv_.del(eq_key('X', f.field_id, cur->first, f.record_id));
+    std::string v;
+    put_be64(v, f.value_id);
+    put_ordered_i64(v, f.ts_ms);
+    kv_.put(current_key(f.record_id, f.field_id), v);
+    kv_.put(eq_key('X', f.field_id, f.value_id, f.record_id), "");
+  }
+
+  static std::string field_key(uint32_t fid) {
+    std::string k("f");
+    put_be32(k, fid);
+    return k;
+  }
+
+  static std::string value_key(uint64_t vid) {
+    std::string k("v");
+    put_be64(k, vid);
+    return k;
+  }
+
+  static std::string value_hash_key(const std::array<uint8_t, 32>& hash) {
+    return "V" + std::string(reinterpret_cast<const char*>(hash.data()), hash.size());
+  }
+
+  static std::string current_key(uint64_t rid, uint32_t fid) {
+    std::string k("C");
+    put_ordered_i64(k, (int64_t)rid);
+    put_be32(k, fid);
+    return k;
+  }
+
+  static std::string history_key(uint64_t rid, uint32_t fid, int64_t ts) {
+    std::string k("H");
+    put_ordered_i64(k, (int64_t)rid);
+    put_be32(k, fid);
+    put_ordered_i64(k, ts);
+    return k;
+  }
+
+  static std::string eq_key(char tag, uint32_t fid, uint64_t vid, uint64_t rid) {
+    std::string k(1, tag);
+    put_be32(k, fid);
+    put_be64(k, vid);
+    put_ordered_i64(k, (int64_t)rid);
+    return k;
+  }
+
+  std::vector<uint64_t> eq_records(char tag, uint32_t fid, uint64_t vid) {
+    std::string lo(1, tag);
+    put_be32(lo, fid);
+    put_be64(lo, vid);
+    std::vector<uint64_t> out;
+    kv_.scan(lo, prefix_end(lo), [&](std::string_view k, std::string_view) {
+      out.push_back((uint64_t)get_ordered_i64(k, 13));
+      return true;
+    });
+    return out;
+  }
+
+  std::vector<uint64_t> range_records(char tag, uint32_t fid, const ValueRange& r) {
+    std::string lo(1, tag);
+    put_be32(lo, fid);
+    std::unordered_map<uint64_t, bool> match;
+    std::vector<uint64_t> out;
+    kv_.scan(lo, prefix_end(lo), [&](std::string_view k, std::string_view) {
+      uint64_t vid = get_be64(k, 5);
+      auto it = match.find(vid);
+      if (it == match.end()) {
+        ValueRow vr = get_value(vid);
+        it = match.emplace(vid, value_in_range(r, vr.type, vr.canon(), vr.num)).first;
+      }
+      if (it->second) out.push_back((uint64_t)get_ordered_i64(k, 13));
+      return true;
+    });
+    std::sort(out.begin(), out.end(), [](uint64_t a, uint64_t b) { return (int64_t)a < (int64_t)b; });
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+    return out;
+  }
+
+  void scan_history(uint64_t rid, const std::function<void(const FactRow&)>& fn) {
+    std::string lo("H");
+    put_ordered_i64(lo, (int64_t)rid);
+    kv_.scan(lo, prefix_end(lo), [&](std::string_view k, std::string_view v) {
+      fn(FactRow{rid, get_be32(k, 9), get_be64(v, 0), get_ordered_i64(k, 13)});
+      return true;
+    });
+  }
+};
+
+// ------------------------------------------------------------
+// Engine: temporality policy + ingest
+// ------------------------------------------------------------
+
+enum class TemporalityMode { EventDriven, ObservationDriven };
+
+static inline TemporalityMode parse_mode(std::string_view s) {
+  if (s == "event") return TemporalityMode::EventDriven;
+  if (s == "observe") return TemporalityMode::ObservationDriven;
+  throw std::runtime_error("mode must be 'event' or 'observe'");
+}
+
+// One field update. Names and canonical bytes are views; NDJSON and binary
+// records keep them in the record's arena.
+struct IngestItem {
+  std::string_view field_name;
+  CanonView value;
+};
+
+// The items of one record update, owned by the caller (an arena array or a
+// local vector).
+struct IngestItems {
+  IngestItem* data{nullptr};
+  size_t count{0};
+
+  IngestItems() = default;
+  IngestItems(IngestItem* p, size_t n) : data(p), count(n) {}
+  IngestItems(std::vector<IngestItem>& v) : data(v.data()), count(v.size()) {}
+
+  IngestItem* begin() const { return data; }
+  IngestItem* end() const { return data + count; }
+  size_t size() const { return count; }
+};
+
+// Hashes every value of one ingest line that is not hashed yet. All digests
+// share the calling thread's Sha256 context; OpenSSL exposes no public
+// multi-buffer SHA-256, so the batch is hashed back to back.
+static inline void hash_ingest_items(TagMapVersion tagmap, HashFormatVersion hfmt, IngestItems items) {
+  for (auto& it : items) {
+    if (!hashed_under(it.value, tagmap, hfmt)) hash_canon_value(tagmap, hfmt, it.value);
+  }
+}
+
+static inline std::pair<std::string_view, std::string_view> split_once(std::string_view s, char c) {
+  auto pos = s.find(c);
+  if (pos == std::string_view::npos) return {s, {}};
+  return {s.substr(0, pos), s.substr(pos + 1)};
+}
+
+static inline IngestItem parse_typed_kv(std::string_view token, IngestArena& arena) {
+  // token: FieldName=type:value
+  auto eq = token.find('=');
+  if (eq == std::string_view::npos) throw std::runtime_error("expected Field=type:value");
+  auto [type_s, value_s] = split_once(token.substr(eq + 1), ':');
+  LogicalType t = parse_type(type_s);
+  return {arena.copy(trim_view(token.substr(0, eq))), arena.copy(canonicalize_typed_value(t, value_s))};
+}
+
+// Applies one record update inside the caller's transaction.
+static void apply_ingest_items(FactStore& store,
+                               uint64_t record_id,
+                               int64_t ts_ms,
+                               TemporalityMode mode,
+                               IngestItems items) {
+  store.ensure_record(record_id, ts_ms);
+  g_ingest_stats.bump(g_ingest_stats.updates);
+
+  if (items.size() > 256) throw std::runtime_error("fields per ingest exceeds 256");
+  for (const auto& it : items) {
+    uint32_t fid;
+    uint64_t vid;
+    {
+      StageTimer timer(IngestStage::Resolve);
+      fid = store.get_or_create_field(it.field_name);
+      vid = store.get_or_create_value(it.value);
+    }
+
+    FactRow f{};
+    f.record_id = record_id;
+    f.field_id = fid;
+    f.value_id = vid;
+    f.ts_ms = ts_ms;
+
+    if (mode == TemporalityMode::EventDriven) {
+      if (store.insert_fact_if_changed(f)) g_ingest_stats.bump(g_ingest_stats.facts);
+      else g_ingest_stats.bump(g_ingest_stats.suppressed);  // unchanged => no fact
+      continue;
+    }
+
+    {
+      StageTimer timer(IngestStage::InsertFact);
+      store.insert_fact(f);
+    }
+    {
+      StageTimer timer(IngestStage::UpsertCurrent);
+      store.upsert_current_if_newer(f);
+    }
+    g_ingest_stats.bump(g_ingest_stats.facts);
+  }
+}
+
+static void ingest_items(FactStore& store,
+                         uint64_t record_id,
+                         int64_t ts_ms,
+                         TemporalityMode mode,
+                         IngestItems items) {
+  store.with_tx([&]{
+    apply_ingest_items(store, record_id, ts_ms, mode, items);
+  });
+}
+
+// Equality lookups resolve their key lookup-only: a field or value that was
+// never ingested matches nothing, and the query writes nothing.
+enum class EqScope { Current, Ever };
+
+static std::vector<uint64_t> query_eq(FactStore& store, EqScope scope, std::string_view field, const CanonValue& cv) {
+  auto fid = store.find_field_id(field);
+  if (!fid) return {};
+  auto vid = store.find_value_id(cv);
+  if (!vid) return {};
+  return scope == EqScope::Current ? store.query_current_eq(*fid, *vid) : store.query_ever_eq(*fid, *vid);
+}
+
+// Range lookups resolve the field the same way; the bounds need not exist
+// as values.
+static std::vector<uint64_t> query_range(FactStore& store, EqScope scope, std::string_view field, const ValueRange& r) {
+  check_value_range(r);
+  auto fid = store.find_field_id(field);
+  if (!fid) return {};
+  return scope == EqScope::Current ? store.query_current_range(*fid, r) : store.query_ever_range(*fid, r);
+}
+
+// ------------------------------------------------------------
+// NDJSON ingestion format (strictly typed)
+// Each line is one record update:
+// {
+//   "record_id": 5001,
+//   "ts_ms": 1739539200000,
+//   "mode": "event",               // optional, default provided by CLI
+//   "fields": {
+//     "First Name": {"t":"text", "v":"Luke"},
+//     "Age": {"t":"int", "v":6},
+//     "Favorite Animal": {"t":"text", "v":"Sheep Dog"},
+//     "DeletedField": {"t":"null"}
+//   }
+// }
+// ------------------------------------------------------------
+
+static IngestItem item_from_field_json(const std::string& field_name, const json& j, IngestArena& arena) {
+  if (!j.is_object()) throw std::runtime_error("fields.<name> must be an object {t, v}");
+  if (!j.contains("t")) throw std::runtime_error("fields.<name>.t missing");
+  LogicalType t = parse_type(j.at("t").get<std::string>());
+
+  json v = json(nullptr);
+  if (t != LogicalType::Null) {
+    if (!j.contains("v")) throw std::runtime_error("fields.<name>.v missing for non-null");
+    v = j.at("v");
+  }
+
+  return {arena.copy(field_name), canonicalize_typed_value(t, json_scalar_of(v), arena)};
+}
+
+using IngestArenaPtr = std::shared_ptr<IngestArena>;
+
+// One NDJSON line, fully canonicalized and ready to apply. Its items live
+// in arena, which is shared by the records parsed from the same chunk of
+// input and freed once the last of them has been committed.
+struct NdjsonRecord {
+  uint64_t lineno{};
+  uint64_t record_id{};
+  int64_t ts_ms{};
+  TemporalityMode mode{};
+  IngestItems items;
+  IngestArenaPtr arena;
+};
+
+static NdjsonRecord record_from_json(const json& j, uint64_t lineno, TemporalityMode default_mode,
+                                     const IngestArenaPtr& arena) {
+  if (!j.contains("record_id") || !j.contains("ts_ms") || !j.contains("fields")) {
+    throw std::runtime_error("NDJSON line " + std::to_string(lineno) + " must contain record_id, ts_ms, fields");
+  }
+
+  NdjsonRecord rec{};
+  rec.lineno = lineno;
+  rec.record_id = j.at("record_id").get<uint64_t>();
+  rec.ts_ms = j.at("ts_ms").get<int64_t>();
+  rec.mode = default_mode;
+  if (j.contains("mode")) rec.mode = parse_mode(j.at("mode").get<std::string>());
+
+  const json& fields = j.at("fields");
+  if (!fields.is_object()) throw std::runtime_error("fields must be an object at line " + std::to_string(lineno));
+
+  rec.items = IngestItems(arena->make_array<IngestItem>(fields.size()), fields.size());
+  size_t i = 0;
+  for (auto it = fields.begin(); it != fields.end(); ++it) {
+    rec.items.data[i++] = item_from_field_json(it.key(), it.value(), *arena);
+  }
+  rec.arena = arena;
+  return rec;
+}
+
+// On-demand parser for the fixed line shape above. It scans the line once,
+// keeps string_views into it (decoding only strings that contain escapes)
+// and hands JsonScalars straight to the canonicalizer, so no JSON DOM is
+// built. It accepts a strict subset of what the DOM path accepts with the
+// same result: anything else (unknown keys, duplicate keys, nested values,
+// numbers json would store as float, malformed input) returns nullopt and
+// the line goes through the DOM path, which also produces the error text.
+// Each thread reuses one scanner; names, decoded strings and canonical
+// values of a parsed line are written to the record's arena.
+class NdjsonLineScanner {
+public:
+  static NdjsonLineScanner& local() {
+    thread_local NdjsonLineScanner scanner;
+    return scanner;
+  }
+
+  std::optional<NdjsonRecord> parse(std::string_view line, uint64_t lineno, TemporalityMode default_mode,
+                                    const IngestArenaPtr& arena) {
+    p_ = line.data();
+    end_ = line.data() + line.size();
+    arena_ = arena.get();
+    std::optional<uint64_t> record_id;
+    std::optional<int64_t> ts_ms;
+    std::optional<std::string_view> mode;
+    bool have_fields = false;
+    fields_.clear();
+
+    {
+      StageTimer timer(IngestStage::Parse);
+      if (!object([&](std::string_view key) {
+            if (key == "record_id") return !record_id && unsigned_int(record_id);
+            if (key == "ts_ms") return !ts_ms && signed_int(ts_ms);
+            if (key == "mode") {
+              std::string_view m;
+              if (mode || !string(m)) return false;
+              mode = m;
+              return true;
+            }
+            if (key == "fields") return !have_fields && (have_fields = true) && fields();
+            return false;
+          })) {
+        return std::nullopt;
+      }
+      ws();
+      if (p_ != end_ || !record_id || !ts_ms || !have_fields) return std::nullopt;
+    }
+
+    // The DOM keeps object keys sorted; apply fields in the same order.
+    std::sort(fields_.begin(), fields_.end(), [](const Field& a, const Field& b) { return a.name < b.name; });
+    for (size_t i = 1; i < fields_.size(); i++) {
+      if (fields_[i - 1].name == fields_[i].name) return std::nullopt;
+    }
+
+    NdjsonRecord rec{};
+    rec.lineno = lineno;
+    rec.record_id = *record_id;
+    rec.ts_ms = *ts_ms;
+    rec.mode = default_mode;
+    try {
+      if (mode) rec.mode = parse_mode(*mode);
+      rec.items = IngestItems(arena_->make_array<IngestItem>(fields_.size()), fields_.size());
+      for (size_t i = 0; i < fields_.size(); i++) {
+        const Field& f = fields_[i];
+        LogicalType t = parse_type(f.type);
+        if (t != LogicalType::Null && !f.has_value) return std::nullopt;
+        rec.items.data[i] = {arena_->copy(f.name), canonicalize_typed_value(t, f.value, *arena_)};
+      }
+    } catch (const std::exception&) {
+      return std::nullopt;
+    }
+    rec.arena = arena;
+    return rec;
+  }
+
+private:
+  struct Field {
+    std::string_view name;
+    std::string_view type;
+    JsonScalar value;
+    bool has_value{false};
+  };
+
+  const char* p_{nullptr};
+  const char* end_{nullptr};
+  IngestArena* arena_{nullptr};  // also holds strings that had escapes
+  std::vector<Field> fields_;
+
+  void ws() {
+    while (p_ != end_ && (*p_ == ' ' || *p_ == '\t' || *p_ == '\n' || *p_ == '\r')) p_++;
+  }
+
+  bool eat(char c) {
+    ws();
+    if (p_ == end_ || *p_ != c) return false;
+    p_++;
+    return true;
+  }
+
+  // {"key": <member(key)>, ...}; member consumes the value.
+  template <class F>
+  bool object(F&& member) {
+    if (!eat('{')) return false;
+    if (eat('}')) return true;
+    do {
+      std::string_view key;
+      ws();
+      if (!string(key) || !eat(':')) return false;
+      ws();
+      if (!member(key)) return false;
+    } while (eat(','));
+    return eat('}');
+  }
+
+  bool fields() {
+    return object([&](std::string_view name) {
+      Field f{};
+      f.name = name;
+      bool have_type = false;
+      bool ok = object([&](std::string_view key) {
+        if (key == "t") return !have_type && (have_type = true) && string(f.type);
+        if (key == "v") return !f.has_value && (f.has_value = true) && scalar(f.value);
+        return false;
+      });
+      if (!ok || !have_type) return false;
+      fields_.push_back(f);
+      return true;
+    });
+  }
+
+  bool scalar(JsonScalar& v) {
+    if (p_ == end_) return false;
+    if (*p_ == '"') {
+      v.kind = JsonScalar::Kind::String;
+      return string(v.s);
+    }
+    if (literal("true")) { v.kind = JsonScalar::Kind::Bool; v.b = true; return true; }
+    if (literal("false")) { v.kind = JsonScalar::Kind::Bool; v.b = false; return true; }
+    if (literal("null")) { v.kind = JsonScalar::Kind::Null; return true; }
+    return number(v);
+  }
+
+  bool literal(std::string_view lit) {
+    if ((size_t)(end_ - p_) < lit.size() || std::string_view(p_, lit.size()) != lit) return false;
+    p_ += lit.size();
+    return true;
+  }
+
+  // JSON number grammar. Integers that fit int64 or uint64 are json
+  // integers; everything else is a json float (via strtod, as json does).
+  bool number(JsonScalar& v) {
+    const char* b = p_;
+    bool integral = true;
+    if (p_ != end_ && *p_ == '-') p_++;
+    if (p_ == end_ || !std::isdigit((unsigned char)*p_)) return false;
+    if (*p_ == '0') p_++;
+    else while (p_ != end_ && std::isdigit((unsigned char)*p_)) p_++;
+    if (p_ != end_ && *p_ == '.') {
+      integral = false;
+      p_++;
+      if (p_ == end_ || !std::isdigit((unsigned char)*p_)) return false;
+      while (p_ != end_ && std::isdigit((unsigned char)*p_)) p_++;
+    }
+    if (p_ != end_ && (*p_ == 'e' || *p_ == 'E')) {
+      integral = false;
+      p_++;
+      if (p_ != end_ && (*p_ == '+' || *p_ == '-')) p_++;
+      if (p_ == end_ || !std::isdigit((unsigned char)*p_)) return false;
+      while (p_ != end_ && std::isdigit((unsigned char)*p_)) p_++;
+    }
+    std::string_view tok(b, (size_t)(p_ - b));
+
+    if (integral) {
+      int64_t i = 0;
+      auto r = std::from_chars(tok.data(), tok.data() + tok.size(), i);
+      if (r.ec == std::errc() && r.ptr == tok.data() + tok.size()) {
+        v.kind = JsonScalar::Kind::Integer;
+        v.i = i;
+        v.d = (double)i;
+        return true;
+      }
+      uint64_t u = 0;
+      r = std::from_chars(tok.data(), tok.data() + tok.size(), u);
+      if (r.ec == std::errc() && r.ptr == tok.data() + tok.size()) {
+        v.kind = JsonScalar::Kind::Integer;
+        v.i = (int64_t)u;
+        v.d = (double)u;
+        return true;
+      }
+      return false;
+    }
+
+    char buf[64];
+    if (tok.size() >= sizeof(buf)) return false;
+    std::memcpy(buf, tok.data(), tok.size());
+    buf[tok.size()] = '\0';
+    double d = std::strtod(buf, nullptr);
+    if (std::isinf(d)) return false;
+    v.kind = JsonScalar::Kind::Float;
+    v.d = d;
+    return true;
+  }
+
+  bool unsigned_int(std::optional<uint64_t>& out) {
+    JsonScalar v{};
+    if (p_ == end_ || *p_ == '-' || !number(v) || v.kind != JsonScalar::Kind::Integer) return false;
+    out = (uint64_t)v.i;
+    return true;
+  }
+
+  bool signed_int(std::optional<int64_t>& out) {
+    const char* b = p_;
+    JsonScalar v{};
+    if (!number(v) || v.kind != JsonScalar::Kind::Integer) return false;
+    // Reject values only representable as uint64 (json would wrap them).
+    if (*b != '-' && v.i < 0) return false;
+    out = v.i;
+    return true;
+  }
+
+  static int hex4(const char* p) {
+    int x = 0;
+    for (int k = 0; k < 4; k++) {
+      char c = p[k];
+      x <<= 4;
+      if (c >= '0' && c <= '9') x |= c - '0';
+      else if (c >= 'a' && c <= 'f') x |= c - 'a' + 10;
+      else if (c >= 'A' && c <= 'F') x |= c - 'A' + 10;
+      else return -1;
+    }
+    return x;
+  }
+
+  static void put_utf8(char*& out, uint32_t cp) {
+    if (cp < 0x80) {
+      *out++ = (char)cp;
+    } else if (cp < 0x800) {
+      *out++ = (char)(0xC0 | (cp >> 6));
+      *out++ = (char)(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+      *out++ = (char)(0xE0 | (cp >> 12));
+      *out++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+      *out++ = (char)(0x80 | (cp & 0x3F));
+    } else {
+      *out++ = (char)(0xF0 | (cp >> 18));
+      *out++ = (char)(0x80 | ((cp >> 12) & 0x3F));
+      *out++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+      *out++ = (char)(0x80 | (cp & 0x3F));
+    }
+  }
+
+  // A JSON string at p_; out views the line, or a decoded copy in the arena
+  // if the string has escapes (never longer than the raw text). Raw bytes
+  // must be valid UTF-8 without control chars.
+  bool string(std::string_view& out) {
+    if (p_ == end_ || *p_ != '"') return false;
+    const char* b = ++p_;
+    bool escaped = false;
+    while (p_ != end_ && *p_ != '"') {
+      unsigned char c = (unsigned char)*p_;
+      if (c < 0x20) return false;
+      if (c == '\\') {
+        escaped = true;
+        if (++p_ == end_) return false;
+      }
+      p_++;
+    }
+    if (p_ == end_) return false;
+    std::string_view raw(b, (size_t)(p_ - b));
+    p_++;
+    if (!is_valid_utf8(raw)) return false;
+    if (!escaped) {
+      out = raw;
+      return true;
+    }
+
+    char* const begin = arena_->alloc(raw.size());
+    char* w = begin;
+    for (size_t i = 0; i < raw.size(); i++) {
+      if (raw[i] != '\\') {
+        *w++ = raw[i];
+        continue;
+      }
+      char e = raw[++i];
+      switch (e) {
+        case '"': *w++ = '"'; break;
+        case '\\': *w++ = '\\'; break;
+        case '/': *w++ = '/'; break;
+        case 'b': *w++ = '\b'; break;
+        case 'f': *w++ = '\f'; break;
+        case 'n': *w++ = '\n'; break;
+        case 'r': *w++ = '\r'; break;
+        case 't': *w++ = '\t'; break;
+        case 'u': {
+          if (raw.size() - i - 1 < 4) return false;
+          int cp = hex4(raw.data() + i + 1);
+          if (cp < 0) return false;
+          i += 4;
+          if (cp >= 0xDC00 && cp <= 0xDFFF) return false;
+          if (cp >= 0xD800 && cp <= 0xDBFF) {
+            if (raw.size() - i - 1 < 6 || raw[i + 1] != '\\' || raw[i + 2] != 'u') return false;
+            int lo = hex4(raw.data() + i + 3);
+            if (lo < 0xDC00 || lo > 0xDFFF) return false;
+            i += 6;
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+          }
+          put_utf8(w, (uint32_t)cp);
+          break;
+        }
+        default: return false;
+      }
+    }
+    out = std::string_view(begin, (size_t)(w - begin));
+    return true;
+  }
+};
+
+static NdjsonRecord parse_ndjson_line(std::string_view trimmed, uint64_t lineno, TemporalityMode default_mode,
+                                      const IngestArenaPtr& arena) {
+  if (auto rec = NdjsonLineScanner::local().parse(trimmed, lineno, default_mode, arena)) return std::move(*rec);
+
+  json j;
+  try {
+    StageTimer timer(IngestStage::Parse);
+    j = json::parse(trimmed);
+  } catch (const std::exception& e) {
+    throw std::runtime_error("NDJSON parse error at line " + std::to_string(lineno) + ": " + e.what());
+  }
+  return record_from_json(j, lineno, default_mode, arena);
+}
+
+// What happens when a batch transaction fails:
+// - RejectBatch: roll the batch back and stop the import with an error.
+// - Bisect: retry each half of the batch in its own transaction until the
+//   failing lines are isolated; those are skipped and reported, all other
+//   lines are committed in their original order.
+enum class BatchErrorPolicy { RejectBatch, Bisect };
+
+static inline BatchErrorPolicy parse_batch_error_policy(std::string_view s) {
+  if (s == "reject") return BatchErrorPolicy::RejectBatch;
+  if (s == "bisect") return BatchErrorPolicy::Bisect;
+  throw std::runtime_error("on-error policy must be 'reject' or 'bisect'");
+}
+
+struct NdjsonImportOptions {
+  TemporalityMode default_mode{TemporalityMode::EventDriven};
+  size_t batch_lines{1};   // commit after this many lines (1 = one transaction per line)
+  int64_t batch_ms{0};     // also commit once the open batch is this old (0 = no time bound)
+  BatchErrorPolicy on_error{BatchErrorPolicy::RejectBatch};
+  unsigned threads{1};     // >1: parse/canonicalize/hash on a worker pool ahead of the writer
+  const char* format{"NDJSON"};  // error wording: "<format> <unit> N"
+  const char* unit{"line"};
+};
+
+struct NdjsonImportResult {
+  uint64_t lines{0};       // non-empty lines read
+  uint64_t ingested{0};    // lines committed
+  uint64_t batches{0};     // transactions committed
+  std::vector<std::pair<uint64_t, std::string>> rejected;  // (line, error), Bisect only
+};
+
+static void apply_ndjson_range(FactStore& store,
+                               const std::vector<NdjsonRecord>& batch,
+                               size_t begin,
+                               size_t end) {
+  store.with_tx([&]{
+    for (size_t i = begin; i < end; i++) {
+      const NdjsonRecord& r = batch[i];
+      apply_ingest_items(store, r.record_id, r.ts_ms, r.mode, r.items);
+    }
+  });
+}
+
+static void commit_ndjson_bisect(FactStore& store,
+                                 const std::vector<NdjsonRecord>& batch,
+                                 size_t begin,
+                                 size_t end,
+                                 NdjsonImportResult& result) {
+  if (begin >= end) return;
+  try {
+    apply_ndjson_range(store, batch, begin, end);
+    result.batches++;
+    result.ingested += end - begin;
+  } catch (const std::exception& e) {
+    if (end - begin == 1) {
+      result.rejected.emplace_back(batch[begin].lineno, e.what());
+      return;
+    }
+    size_t mid = begin + (end - begin) / 2;
+    commit_ndjson_bisect(store, batch, begin, mid, result);
+    commit_ndjson_bisect(store, batch, mid, end, result);
+  }
+}
+
+static void commit_ndjson_batch(FactStore& store,
+                                const std::vector<NdjsonRecord>& batch,
+                                const NdjsonImportOptions& opt,
+                                NdjsonImportResult& result) {
+  if (batch.empty()) return;
+  if (opt.on_error == BatchErrorPolicy::Bisect) {
+    commit_ndjson_bisect(store, batch, 0, batch.size(), result);
+    return;
+  }
+
+  try {
+    apply_ndjson_range(store, batch, 0, batch.size());
+  } catch (const std::exception& e) {
+    if (batch.size() == 1) {
+      throw std::runtime_error(std::string(opt.format) + " " + opt.unit + " " + std::to_string(batch.front().lineno) +
+                               ": " + e.what());
+    }
+    throw std::runtime_error(std::string(opt.format) + " batch of " + opt.unit + "s " +
+                             std::to_string(batch.front().lineno) + ".." + std::to_string(batch.back().lineno) +
+                             " rejected: " + e.what());
+  }
+  result.batches++;
+  result.ingested += batch.size();
+}
+
+// Accumulates parsed lines into transactions according to NdjsonImportOptions.
+// Lines must be fed in file order; the serial and pipelined readers share it
+// so both commit exactly the same batches.
+class NdjsonBatcher {
+public:
+  NdjsonBatcher(FactStore& store, const NdjsonImportOptions& opt)
+    : store_(store), opt_(opt), batch_lines_(std::max<size_t>(1, opt.batch_lines)) {
+    batch_.reserve(std::min<size_t>(batch_lines_, 4096));
+  }
+
+  void add(NdjsonRecord&& rec) {
+    note_line();
+    batch_.push_back(std::move(rec));
+    maybe_flush();
+  }
+
+  void reject(uint64_t lineno, const std::string& err) {
+    note_line();
+    if (opt_.on_error != BatchErrorPolicy::Bisect) throw std::runtime_error(err);
+    result_.rejected.emplace_back(lineno, err);
+    maybe_flush();
+  }
+
+  NdjsonImportResult finish() {
+    commit_ndjson_batch(store_, batch_, opt_, result_);
+    batch_.clear();
+    std::sort(result_.rejected.begin(), result_.rejected.end());
+    return std::move(result_);
+  }
+
+private:
+  FactStore& store_;
+  const NdjsonImportOptions& opt_;
+  size_t batch_lines_;
+  std::vector<NdjsonRecord> batch_;
+  std::chrono::steady_clock::time_point batch_opened_{};
+  NdjsonImportResult result_{};
+
+  void note_line() {
+    result_.lines++;
+    if (batch_.empty()) batch_opened_ = std::chrono::steady_clock::now();
+  }
+
+  void maybe_flush() {
+    bool full = batch_.size() >= batch_lines_;
+    if (!full && opt_.batch_ms > 0 && !batch_.empty()) {
+      auto age = std::chrono::steady_clock::now() - batch_opened_;
+      full = std::chrono::duration_cast<std::chrono::milliseconds>(age).count() >= opt_.batch_ms;
+    }
+    if (full) {
+      commit_ndjson_batch(store_, batch_, opt_, result_);
+      batch_.clear();
+    }
+  }
+};
+
+// Blocking FIFO with a fixed capacity. close() wakes all waiters: push then
+// fails, pop drains what is left and then returns nullopt.
+template <class T>
+class BoundedQueue {
+public:
+  explicit BoundedQueue(size_t capacity) : capacity_(std::max<size_t>(1, capacity)) {}
+
+  bool push(T v) {
+    std::unique_lock<std::mutex> lk(mu_);
+    not_full_.wait(lk, [&]{ return closed_ || q_.size() < capacity_; });
+    if (closed_) return false;
+    q_.push_back(std::move(v));
+    not_empty_.notify_one();
+    return true;
+  }
+
+  std::optional<T> pop() {
+    std::unique_lock<std::mutex> lk(mu_);
+    not_empty_.wait(lk, [&]{ return closed_ || !q_.empty(); });
+    if (q_.empty()) return std::nullopt;
+    T v = std::move(q_.front());
+    q_.pop_front();
+    not_full_.notify_one();
+    return v;
+  }
+
+  // Like pop, but also gives up (nullopt) after timeout; done() tells a
+  // timeout from the end of the queue.
+  template <class Rep, class Period>
+  std::optional<T> pop_for(const std::chrono::duration<Rep, Period>& timeout) {
+    std::unique_lock<std::mutex> lk(mu_);
+    if (!not_empty_.wait_for(lk, timeout, [&]{ return closed_ || !q_.empty(); })) return std::nullopt;
+    if (q_.empty()) return std::nullopt;
+    T v = std::move(q_.front());
+    q_.pop_front();
+    not_full_.notify_one();
+    return v;
+  }
+
+  bool done() {
+    std::lock_guard<std::mutex> lk(mu_);
+    return closed_ && q_.empty();
+  }
+
+  void close() {
+    std::lock_guard<std::mutex> lk(mu_);
+    closed_ = true;
+    not_full_.notify_all();
+    not_empty_.notify_all();
+  }
+
+private:
+  size_t capacity_;
+  std::mutex mu_;
+  std::condition_variable not_full_;
+  std::condition_variable not_empty_;
+  std::deque<T> q_;
+  bool closed_{false};
+};
+
+// Byte streams behind NdjsonLineReader's buffered mode. Compressed input is
+// recognized by its magic bytes, not its name, so pipes work too. gzip
+// needs a build with -DFELIX_WITH_ZLIB (-lz), zstd one with
+// -DFELIX_WITH_ZSTD (-lzstd).
+class ByteSource {
+public:
+  virtual ~ByteSource() = default;
+  // Reads up to n bytes; 0 means end of stream.
+  virtual size_t read(char* dst, size_t n) = 0;
+};
+
+class FdByteSource final : public ByteSource {
+public:
+  // prefix: bytes already consumed from fd (a sniffed header).
+  FdByteSource(int fd, std::string prefix) : fd_(fd), prefix_(std::move(prefix)) {}
+
+  size_t read(char* dst, size_t n) override {
+    if (pos_ < prefix_.size()) {
+      size_t k = std::min(n, prefix_.size() - pos_);
+      std::memcpy(dst, prefix_.data() + pos_, k);
+      pos_ += k;
+      return k;
+    }
+    ssize_t r;
+    do {
+      r = ::read(fd_, dst, n);
+    } while (r < 0 && errno == EINTR);
+    if (r < 0) throw std::runtime_error(std::string("ndjson read failed: ") + std::strerror(errno));
+    return (size_t)r;
+  }
+
+private:
+  int fd_;
+  std::string prefix_;
+  size_t pos_{0};
+};
+
+static constexpr size_t kInflateInBlock = 1u << 20;
+
+#ifdef FELIX_WITH_ZLIB
+// Concatenated gzip members are read back to back, like gzip -dc.
+class GzipByteSource final : public ByteSource {
+public:
+  explicit GzipByteSource(std::unique_ptr<ByteSource> in) : in_(std::move(in)), buf_(kInflateInBlock, '\0') {
+    if (inflateInit2(&z_, 15 + 16) != Z_OK) throw std::runtime_error("gzip: inflateInit failed");
+  }
+  ~GzipByteSource() override { inflateEnd(&z_); }
+
+  size_t read(char* dst, size_t n) override {
+    const uInt cap = (uInt)std::min<size_t>(n, std::numeric_limits<uInt>::max());
+    z_.next_out = reinterpret_cast<Bytef*>(dst);
+    z_.avail_out = cap;
+    while (z_.avail_out == cap) {
+      if (z_.avail_in == 0) {
+        size_t got = in_->read(buf_.data(), buf_.size());
+        if (got == 0) {
+          if (in_member_) throw std::runtime_error("gzip: truncated stream");
+          break;
+        }
+        z_.next_in = reinterpret_cast<Bytef*>(buf_.data());
+        z_.avail_in = (uInt)got;
+      }
+      in_member_ = true;
+      int rc = inflate(&z_, Z_NO_FLUSH);
+      if (rc == Z_STREAM_END) {
+        in_member_ = false;
+        if (inflateReset(&z_) != Z_OK) throw std::runtime_error("gzip: inflateReset failed");
+      } else if (rc != Z_OK && rc != Z_BUF_ERROR) {
+        throw std::runtime_error(std::string("gzip: ") + (z_.msg ? z_.msg : "corrupt stream"));
+      }
+    }
+    return cap - z_.avail_out;
+  }
+
+private:
+  std::unique_ptr<ByteSource> in_;
+  std::string buf_;
+  z_stream z_{};
+  bool in_member_{false};
+};
+#endif
+
+#ifdef FELIX_WITH_ZSTD
+class ZstdByteSource final : public ByteSource {
+public:
+  explicit ZstdByteSource(std::unique_ptr<ByteSource> src)
+    : src_(std::move(src)), buf_(ZSTD_DStreamInSize(), '\0'), ds_(ZSTD_createDStream()) {
+    if (!ds_) throw std::runtime_error("zstd: failed to create stream");
+  }
+  ~ZstdByteSource() override { ZSTD_freeDStream(ds_); }
+
+  size_t read(char* dst, size_t n) override {
+    ZSTD_outBuffer out{dst, n, 0};
+    for (;;) {
+      const size_t before = in_.pos;
+      size_t rc = ZSTD_decompressStream(ds_, &out, &in_);
+      if (ZSTD_isError(rc)) throw std::runtime_error(std::string("zstd: ") + ZSTD_getErrorName(rc));
+      if (rc == 0) mid_frame_ = false;
+      else if (in_.pos != before || out.pos != 0) mid_frame_ = true;
+      if (out.pos != 0) return out.pos;
+      if (in_.pos < in_.size) continue;
+      size_t got = src_->read(buf_.data(), buf_.size());
+      if (got == 0) {
+        if (mid_frame_) throw std::runtime_error("zstd: truncated stream");
+        return 0;
+      }
+      in_ = ZSTD_inBuffer{buf_.data(), got, 0};
+    }
+  }
+
+private:
+  std::unique_ptr<ByteSource> src_;
+  std::string buf_;
+  ZSTD_DStream* ds_;
+  ZSTD_inBuffer in_{nullptr, 0, 0};
+  bool mid_frame_{false};
+};
+#endif
+
+// Runs a (decompressing) source on its own thread, a few blocks ahead of
+// the reader.
+class PrefetchByteSource final : public ByteSource {
+public:
+  static constexpr size_t kBlock = 4u * 1024u * 1024u;
+
+  explicit PrefetchByteSource(std::unique_ptr<ByteSource> in) : in_(std::move(in)), blocks_(4) {
+    thread_ = std::thread([this] {
+      try {
+        for (;;) {
+          std::string b(kBlock, '\0');
+          size_t got = 0;
+          while (got < b.size()) {
+            size_t k = in_->read(b.data() + got, b.size() - got);
+            if (k == 0) break;
+            got += k;
+          }
+          b.resize(got);
+          if (!blocks_.push(std::move(b)) || got == 0) break;
+        }
+      } catch (...) {
+        error_ = std::current_exception();
+        blocks_.push(std::string());
+      }
+    });
+  }
+
+  ~PrefetchByteSource() override {
+    blocks_.close();
+    thread_.join();
+  }
+
+  size_t read(char* dst, size_t n) override {
+    if (pos_ == cur_.size()) {
+      if (done_) return 0;
+      auto b = blocks_.pop();
+      if (!b || b->empty()) {
+        done_ = true;
+        if (error_) std::rethrow_exception(error_);
+        return 0;
+      }
+      cur_ = std::move(*b);
+      pos_ = 0;
+    }
+    size_t k = std::min(n, cur_.size() - pos_);
+    std::memcpy(dst, cur_.data() + pos_, k);
+    pos_ += k;
+    return k;
+  }
+
+private:
+  std::unique_ptr<ByteSource> in_;
+  BoundedQueue<std::string> blocks_;
+  std::thread thread_;
+  std::exception_ptr error_;
+  std::string cur_;
+  size_t pos_{0};
+  bool done_{false};
+};
+
+enum class InputCodec { Plain, Gzip, Zstd };
+
+static InputCodec sniff_codec(std::string_view head) {
+  if (head.size() >= 2 && (uint8_t)head[0] == 0x1f && (uint8_t)head[1] == 0x8b) return InputCodec::Gzip;
+  if (head.size() >= 4 && (uint8_t)head[0] == 0x28 && (uint8_t)head[1] == 0xb5 &&
+      (uint8_t)head[2] == 0x2f && (uint8_t)head[3] == 0xfd) {
+    return InputCodec::Zstd;
+  }
+  return InputCodec::Plain;
+}
+
+static std::unique_ptr<ByteSource> decoding_source(InputCodec codec, std::unique_ptr<ByteSource> raw) {
+  switch (codec) {
+    case InputCodec::Plain:
+      return raw;
+    case InputCodec::Gzip:
+#ifdef FELIX_WITH_ZLIB
+      return std::make_unique<PrefetchByteSource>(std::make_unique<GzipByteSource>(std::move(raw)));
+#else
+      throw std::runtime_error("gzip input needs a build with -DFELIX_WITH_ZLIB");
+#endif
+    case InputCodec::Zstd:
+#ifdef FELIX_WITH_ZSTD
+      return std::make_unique<PrefetchByteSource>(std::make_unique<ZstdByteSource>(std::move(raw)));
+#else
+      throw std::runtime_error("zstd input needs a build with -DFELIX_WITH_ZSTD");
+#endif
+  }
+  return raw;
+}
+
+// Newline-delimited input as string_views. Uncompressed regular files are
+// mapped once and every line views the mapping. Everything else (stdin as
+// "-", pipes, compressed input) is read in large blocks; a block's lines
+// view a buffer that the block shares ownership of, so lines stay valid
+// while any block holding them is alive. Line numbering matches std::getline.
+struct NdjsonLineBlock {
+  std::shared_ptr<const std::string> storage;  // null when lines view the mapping
+  std::vector<std::pair<uint64_t, std::string_view>> lines;
+};
+
+class NdjsonLineReader {
+public:
+  static constexpr size_t kMaxLine = 2u * 1024u * 1024u;
+
+  explicit NdjsonLineReader(const std::string& path) {
+    if (path == "-") {
+      fd_ = STDIN_FILENO;
+    } else {
+      fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd_ < 0) throw std::runtime_error("failed to open ndjson file: " + path);
+      owns_fd_ = true;
+    }
+
+    // Sniff the codec from the first bytes; they are replayed to the source.
+    std::string head(4, '\0');
+    size_t have = 0;
+    while (have < head.size()) {
+      ssize_t r = ::read(fd_, head.data() + have, head.size() - have);
+      if (r < 0 && errno == EINTR) continue;
+      if (r < 0) throw std::runtime_error(std::string("ndjson read failed: ") + std::strerror(errno));
+      if (r == 0) break;
+      have += (size_t)r;
+    }
+    head.resize(have);
+    const InputCodec codec = sniff_codec(head);
+
+    struct stat st {};
+    if (codec == InputCodec::Plain && ::fstat(fd_, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+      void* m = ::mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd_, 0);
+      if (m != MAP_FAILED) {
+        map_ = static_cast<const char*>(m);
+        map_len_ = (size_t)st.st_size;
+        ::madvise(m, map_len_, MADV_SEQUENTIAL);
+        rest_ = std::string_view(map_, map_len_);
+        return;
+      }
+    }
+    src_ = decoding_source(codec, std::make_unique<FdByteSource>(fd_, std::move(head)));
+  }
+
+  ~NdjsonLineReader() {
+    src_.reset();
+    if (map_) ::munmap(const_cast<char*>(map_), map_len_);
+    if (owns_fd_) ::close(fd_);
+  }
+
+  NdjsonLineReader(const NdjsonLineReader&) = delete;
+  NdjsonLineReader& operator=(const NdjsonLineReader&) = delete;
+
+  // Replaces block with up to max_lines further lines; false once the
+  // input is exhausted. A line over kMaxLine throws once the lines before
+  // it have been handed out.
+  bool next_block(NdjsonLineBlock& block, size_t max_lines) {
+    block.lines.clear();
+    block.storage.reset();
+    if (!map_ && !refill()) return false;
+    block.storage = buf_;
+    while (block.lines.size() < max_lines) {
+      if (rest_.empty() && (map_ || eof_)) break;
+      size_t nl = rest_.find('\n');
+      if (nl == std::string_view::npos && !map_ && !eof_) break;  // partial line: needs the next read
+      std::string_view line = rest_.substr(0, nl);
+      if (line.size() > kMaxLine) {
+        if (!block.lines.empty()) return true;
+        throw std::runtime_error("NDJSON line exceeds 2 MiB");
+      }
+      rest_.remove_prefix(nl == std::string_view::npos ? rest_.size() : nl + 1);
+      block.lines.emplace_back(++lineno_, line);
+    }
+    return !block.lines.empty();
+  }
+
+private:
+  static constexpr size_t kReadBlock = 4u * 1024u * 1024u;
+
+  int fd_{-1};
+  bool owns_fd_{false};
+  std::unique_ptr<ByteSource> src_;
+  const char* map_{nullptr};
+  size_t map_len_{0};
+  std::shared_ptr<std::string> buf_;
+  std::string_view rest_;
+  bool eof_{false};
+  uint64_t lineno_{0};
+
+  // Buffered mode: once no complete line is left, moves the unread tail to
+  // a fresh buffer and reads more. False when nothing is left at all.
+  bool refill() {
+    while (!eof_ && rest_.find('\n') == std::string_view::npos) {
+      if (rest_.size() > kMaxLine) throw std::runtime_error("NDJSON line exceeds 2 MiB");
+      auto next = std::make_shared<std::string>(rest_);
+      const size_t have = next->size();
+      next->resize(have + kReadBlock);
+      size_t n = 0;
+      while (n < kReadBlock) {
+        size_t k = src_->read(next->data() + have + n, kReadBlock - n);
+        if (k == 0) {
+          eof_ = true;
+          break;
+        }
+        n += k;
+      }
+      next->resize(have + n);
+      buf_ = std::move(next);
+      rest_ = std::string_view(*buf_);
+    }
+    return !rest_.empty();
+  }
+};
+
+static NdjsonImportResult ingest_ndjson_serial(FactStore& store, NdjsonLineReader& in, const NdjsonImportOptions& opt) {
+  NdjsonBatcher batcher(store, opt);
+  const TagMapVersion tagmap = store.tag_map();
+  const HashFormatVersion hfmt = store.hash_format();
+
+  NdjsonLineBlock block;
+  while (in.next_block(block, 4096)) {
+    auto arena = std::make_shared<IngestArena>();
+    for (const auto& [lineno, line] : block.lines) {
+      std::string_view trimmed = trim_view(line);
+      if (trimmed.empty()) continue;
+
+      std::optional<NdjsonRecord> rec;
+      std::string err;
+      try {
+        rec = parse_ndjson_line(trimmed, lineno, opt.default_mode, arena);
+        hash_ingest_items(tagmap, hfmt, rec->items);
+      } catch (const std::exception& e) {
+        rec.reset();
+        err = e.what();
+      }
+      if (rec) batcher.add(std::move(*rec));
+      else batcher.reject(lineno, err);
+    }
+  }
+
+  return batcher.finish();
+}
+
+// Pipelined import: a reader thread splits the input into chunks of lines,
+// a worker pool parses, canonicalizes and hashes each chunk, and the calling
+// thread (the single SQLite writer) applies chunks strictly in file order.
+// The store only ever sees the same sequence of lines as the serial path.
+static NdjsonImportResult ingest_ndjson_pipelined(FactStore& store, NdjsonLineReader& in, const NdjsonImportOptions& opt) {
+  struct ParsedLine {
+    uint64_t lineno{};
+    std::optional<NdjsonRecord> rec;
+    std::string error;
+  };
+  struct Chunk {
+    NdjsonLineBlock raw;
+    std::vector<ParsedLine> parsed;
+    std::string fatal;  // reader-side error; the writer raises it after this chunk
+    std::promise<void> done;
+  };
+  using ChunkPtr = std::shared_ptr<Chunk>;
+  constexpr size_t kChunkLines = 256;
+
+  const unsigned nworkers = std::max(1u, opt.threads);
+  const TagMapVersion tagmap = store.tag_map();
+  const HashFormatVersion hfmt = store.hash_format();
+  const TemporalityMode default_mode = opt.default_mode;
+
+  BoundedQueue<ChunkPtr> work(nworkers * 2);
+  BoundedQueue<std::pair<ChunkPtr, std::shared_future<void>>> ordered(nworkers * 4);
+
+  std::thread reader([&]{
+    auto chunk = std::make_shared<Chunk>();
+    auto ship = [&]() -> bool {
+      std::shared_future<void> f = chunk->done.get_future().share();
+      if (!ordered.push({chunk, f})) return false;
+      if (!work.push(chunk)) return false;
+      chunk = std::make_shared<Chunk>();
+      return true;
+    };
+
+    bool ok = true;
+    try {
+      while (ok && in.next_block(chunk->raw, kChunkLines)) ok = ship();
+    } catch (const std::exception& e) {
+      chunk->fatal = e.what();
+      chunk->raw.lines.clear();
+      ship();
+    }
+    work.close();
+    ordered.close();
+  });
+
+  std::vector<std::thread> workers;
+  workers.reserve(nworkers);
+  for (unsigned w = 0; w < nworkers; w++) {
+    workers.emplace_back([&]{
+      while (auto chunk = work.pop()) {
+        Chunk& c = **chunk;
+        c.parsed.reserve(c.raw.lines.size());
+        auto arena = std::make_shared<IngestArena>();
+        for (const auto& [ln, raw] : c.raw.lines) {
+          std::string_view trimmed = trim_view(raw);
+          if (trimmed.empty()) continue;
+          ParsedLine pl{};
+          pl.lineno = ln;
+          try {
+            pl.rec = parse_ndjson_line(trimmed, ln, default_mode, arena);
+            hash_ingest_items(tagmap, hfmt, pl.rec->items);
+          } catch (const std::exception& e) {
+            pl.rec.reset();
+            pl.error = e.what();
+          }
+          c.parsed.push_back(std::move(pl));
+        }
+        c.raw = {};
+        c.done.set_value();
+      }
+    });
+  }
+
+  auto join_all = [&]{
+    work.close();
+    ordered.close();
+    // Let workers finish whatever was queued so no promise is left unset.
+    reader.join();
+    for (auto& t : workers) t.join();
+  };
+
+  try {
+    NdjsonBatcher batcher(store, opt);
+    while (auto next = ordered.pop()) {
+      next->second.wait();
+      Chunk& c = *next->first;
+      for (auto& pl : c.parsed) {
+        if (pl.rec) batcher.add(std::move(*pl.rec));
+        else batcher.reject(pl.lineno, pl.error);
+      }
+      if (!c.fatal.empty()) throw std::runtime_error(c.fatal);
+    }
+    NdjsonImportResult result = batcher.finish();
+    join_all();
+    return result;
+  } catch (...) {
+    join_all();
+    throw;
+  }
+}
+
+static NdjsonImportResult ingest_ndjson_file(FactStore& store, const std::string& path, const NdjsonImportOptions& opt) {
+  NdjsonLineReader in(path);
+  if (opt.threads > 1) return ingest_ndjson_pipelined(store, in, opt);
+  return ingest_ndjson_serial(store, in, opt);
+}
+
+// ------------------------------------------------------------
+// Binary ingest format
+//
+// A compact alternative to NDJSON for producers that already hold native
+// values. All integers are little-endian.
+//
+//   file    := "FLXBIN01" record*
+//   record  := u32 body_len, body
+//   body    := u64 record_id, i64 ts_ms, u8 mode (0 event, 1 observe,
+//              2 importer default), u16 nfields, field*
+//   field   := u8 type_tag (Felix v0.3 tags), u8 flags, u16 name_len,
+//              u32 value_len, name, value,
+//              [32-byte field hash if flags & 1],
+//              [32-byte value hash if flags & 2]
+//   value   := null: empty | bool: 1 byte 0/1 | int: int64 | float: IEEE
+//              double | text: UTF-8 | bytes: raw | uuid: 16 raw bytes
+//
+// Field hashes are sha256("field" || canonical name), value hashes the
+// identity hash under the target database's tag map and hash format. By
+// default every value is canonicalized as usual and a supplied hash must
+// match the computed one. Trusted mode (for producers that canonicalized
+// upstream) skips the field hash check, takes hashed text as already
+// NFC-normalized and stores supplied value hashes without recomputing them;
+// UTF-8, field names and the resource limits are still checked.
+// Like NDJSON input, the file may be gzip or zstd compressed.
+// ------------------------------------------------------------
+
+static constexpr char kBinaryMagic[8] = {'F', 'L', 'X', 'B', 'I', 'N', '0', '1'};
+static constexpr uint32_t kBinaryMaxRecord = 64u * 1024u * 1024u;
+
+enum BinaryFieldFlags : uint8_t { kBinFieldHash = 1, kBinValueHash = 2 };
+
+struct BinaryDecodeContext {
+  TagMapVersion tagmap{TagMapVersion::FelixV03};
+  HashFormatVersion hfmt{HashFormatVersion::FelixV03Sep};
+  bool trusted{false};
+  TemporalityMode default_mode{TemporalityMode::EventDriven};
+  // Field names whose supplied hash was already checked.
+  std::unordered_map<std::string, std::array<uint8_t, 32>, StringHash, std::equal_to<>> verified_fields;
+};
+
+// Writes the canonical text of 16 raw uuid bytes to out[0..36).
+static void format_uuid_into(const uint8_t* b, char* out) {
+  static constexpr char kHex[] = "0123456789abcdef";
+  for (int i = 0; i < 16; i++) {
+    if (i == 4 || i == 6 || i == 8 || i == 10) *out++ = '-';
+    *out++ = kHex[b[i] >> 4];
+    *out++ = kHex[b[i] & 0xF];
+  }
+}
+
+static CanonView canon_value_of_binary(LogicalType t, std::string_view v, bool trusted, IngestArena& arena) {
+  CanonView cv{};
+  cv.logical_type = t;
+  auto need = [&](size_t n, const char* what) {
+    if (v.size() != n) throw std::runtime_error(std::string(what) + " value must be " + std::to_string(n) + " bytes");
+  };
+  switch (t) {
+    case LogicalType::Null:
+      need(0, "null");
+      cv.canon = "null";
+      break;
+    case LogicalType::Bool:
+      need(1, "bool");
+      if ((uint8_t)v[0] > 1) throw std::runtime_error("bool value must be 0 or 1");
+      cv.canon = v[0] ? "true" : "false";
+      break;
+    case LogicalType::Int: {
+      need(8, "int");
+      char buf[24];
+      auto r = std::to_chars(buf, buf + sizeof(buf), load_le<int64_t>(reinterpret_cast<const uint8_t*>(v.data())));
+      cv.canon = arena.copy(std::string_view(buf, (size_t)(r.ptr - buf)));
+      break;
+    }
+    case LogicalType::Float: {
+      need(8, "float");
+      char buf[kFloatCanonMax];
+      const uint64_t bits = load_le<uint64_t>(reinterpret_cast<const uint8_t*>(v.data()));
+      double d;
+      std::memcpy(&d, &bits, 8);
+      cv.canon = arena.copy(std::string_view(buf, canonicalize_float64_into(d, buf)));
+      break;
+    }
+    case LogicalType::Text:
+      require_utf8(v, "text");
+      cv.canon = trusted ? arena.copy(v) : nfc_normalize_into(trim_view(v), arena);
+      break;
+    case LogicalType::Bytes:
+      cv.canon = arena.copy(v);
+      break;
+    case LogicalType::Uuid: {
+      need(16, "uuid");
+      char* out = arena.alloc(36);
+      format_uuid_into(reinterpret_cast<const uint8_t*>(v.data()), out);
+      cv.canon = std::string_view(out, 36);
+      break;
+    }
+    case LogicalType::JsonReserved:
+      throw std::runtime_error("type json is reserved in Felix v0.3");
+  }
+  return cv;
+}
+
+// Decodes one record body (without its length prefix) into a record ready
+// for ingest_items; values come back canonicalized and hashed.
+static NdjsonRecord decode_binary_record(std::string_view body, uint64_t index, BinaryDecodeContext& ctx,
+                                         const IngestArenaPtr& arena) {
+  StageTimer timer(IngestStage::Parse);
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(body.data());
+  const uint8_t* end = p + body.size();
+  auto take = [&](size_t n) {
+    if ((size_t)(end - p) < n) throw std::runtime_error("binary record truncated");
+    const uint8_t* at = p;
+    p += n;
+    return at;
+  };
+
+  NdjsonRecord rec{};
+  rec.lineno = index;
+  rec.record_id = load_le<uint64_t>(take(8));
+  rec.ts_ms = load_le<int64_t>(take(8));
+  uint8_t mode = *take(1);
+  if (mode > 2) throw std::runtime_error("binary record mode must be 0, 1 or 2");
+  rec.mode = mode == 0 ? TemporalityMode::EventDriven
+           : mode == 1 ? TemporalityMode::ObservationDriven : ctx.default_mode;
+  uint16_t nfields = load_le<uint16_t>(take(2));
+  rec.items = IngestItems(arena->make_array<IngestItem>(nfields), nfields);
+
+  for (uint16_t i = 0; i < nfields; i++) {
+    uint8_t tag = *take(1);
+    uint8_t flags = *take(1);
+    uint16_t name_len = load_le<uint16_t>(take(2));
+    uint32_t value_len = load_le<uint32_t>(take(4));
+    std::string_view name(reinterpret_cast<const char*>(take(name_len)), name_len);
+    std::string_view value(reinterpret_cast<const char*>(take(value_len)), value_len);
+    const uint8_t* field_hash = (flags & kBinFieldHash) ? take(32) : nullptr;
+    const uint8_t* value_hash = (flags & kBinValueHash) ? take(32) : nullptr;
+    if (flags & ~(kBinFieldHash | kBinValueHash)) throw std::runtime_error("binary field has unknown flags");
+
+    if (tag > 0x07) throw std::runtime_error("binary field has unknown type tag");
+    LogicalType t = logical_type_from_tag(TagMapVersion::FelixV03, tag);
+
+    if (field_hash && !ctx.trusted) {
+      auto it = ctx.verified_fields.find(name);
+      if (it == ctx.verified_fields.end()) it = ctx.verified_fields.emplace(std::string(name), canonical_field(name).second).first;
+      if (std::memcmp(it->second.data(), field_hash, 32) != 0) {
+        throw std::runtime_error("field hash does not match field '" + std::string(name) + "'");
+      }
+    }
+
+    CanonView cv = canon_value_of_binary(t, value, ctx.trusted && value_hash, *arena);
+    if (value_hash && ctx.trusted) {
+      std::memcpy(cv.hash.data(), value_hash, 32);
+      cv.hashed = true;
+      cv.hash_tagmap = ctx.tagmap;
+      cv.hash_format = ctx.hfmt;
+    } else {
+      hash_canon_value(ctx.tagmap, ctx.hfmt, cv);
+      if (value_hash && std::memcmp(cv.hash.data(), value_hash, 32) != 0) {
+        throw std::runtime_error("value hash does not match field '" + std::string(name) + "'");
+      }
+    }
+    rec.items.data[i] = {arena->copy(name), cv};
+  }
+  if (p != end) throw std::runtime_error("binary record has trailing bytes");
+  rec.arena = arena;
+  return rec;
+}
+
+// Reads n bytes unless the input ends first; returns how many were read.
+static size_t read_full(ByteSource& src, char* dst, size_t n) {
+  size_t got = 0;
+  while (got < n) {
+    size_t k = src.read(dst + got, n - got);
+    if (k == 0) break;
+    got += k;
+  }
+  return got;
+}
+
+// Imports a binary fact log with the NDJSON batching and error policies
+// (opt.threads is ignored); records are numbered from 1 like lines.
+static NdjsonImportResult ingest_binary_file(FactStore& store, const std::string& path, NdjsonImportOptions opt,
+                                             bool trusted) {
+  opt.format = "binary";
+  opt.unit = "record";
+  int fd = STDIN_FILENO;
+  if (path != "-") {
+    fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) throw std::runtime_error("failed to open binary file: " + path);
+  }
+  struct FdCloser {
+    int fd;
+    ~FdCloser() { if (fd != STDIN_FILENO) ::close(fd); }
+  } closer{fd};
+
+  std::string head(4, '\0');
+  auto raw = std::make_unique<FdByteSource>(fd, std::string());
+  size_t have = 0;
+  while (have < head.size()) {
+    size_t k = raw->read(head.data() + have, head.size() - have);
+    if (k == 0) break;
+    have += k;
+  }
+  head.resize(have);
+  const InputCodec codec = sniff_codec(head);
+  std::unique_ptr<ByteSource> src = decoding_source(codec, std::make_unique<FdByteSource>(fd, head));
+
+  char magic[sizeof(kBinaryMagic)];
+  if (read_full(*src, magic, sizeof(magic)) != sizeof(magic) || std::memcmp(magic, kBinaryMagic, sizeof(magic)) != 0) {
+    throw std::runtime_error("not a Felix binary fact log (missing FLXBIN01 header)");
+  }
+
+  BinaryDecodeContext ctx{};
+  ctx.tagmap = store.tag_map();
+  ctx.hfmt = store.hash_format();
+  ctx.trusted = trusted;
+  ctx.default_mode = opt.default_mode;
+
+  NdjsonBatcher batcher(store, opt);
+  std::string body;
+  uint64_t index = 0;
+  uint64_t offset = sizeof(kBinaryMagic);  // of the current length prefix, in the decoded stream
+  IngestArenaPtr arena;
+  for (;;) {
+    char len_bytes[4];
+    size_t got = read_full(*src, len_bytes, 4);
+    if (got == 0) break;
+    index++;
+    auto where = [&] { return "binary record " + std::to_string(index) + " at byte " + std::to_string(offset) + ": "; };
+    if (got < 4) throw std::runtime_error(where() + "input truncated in the length prefix");
+    uint32_t len = load_le<uint32_t>(reinterpret_cast<const uint8_t*>(len_bytes));
+    if (len > kBinaryMaxRecord) throw std::runtime_error(where() + "record exceeds 64 MiB");
+    body.resize(len);
+    got = read_full(*src, body.data(), len);
+    if (got < len) {
+      throw std::runtime_error(where() + "input truncated (" + std::to_string(got) + " of " + std::to_string(len) +
+                               " body bytes)");
+    }
+    if (index % 4096 == 1) arena = std::make_shared<IngestArena>();  // one arena per 4096 records, like a line block
+    std::optional<NdjsonRecord> rec;
+    std::string err;
+    try {
+      rec = decode_binary_record(body, index, ctx, arena);
+    } catch (const std::exception& e) {
+      rec.reset();
+      err = where() + e.what();
+    }
+    offset += 4 + len;
+    if (rec) batcher.add(std::move(*rec));
+    else batcher.reject(index, err);
+  }
+  return batcher.finish();
+}
+
+// Writer side of the format, used by ndjson_to_binary: appends one record
+// built from an NDJSON record, optionally with both hashes.
+static void append_binary_record(std::string& out, const NdjsonRecord& rec, bool with_hashes) {
+  std::string body;
+  put_u64(body, rec.record_id);
+  put_u64(body, (uint64_t)rec.ts_ms);
+  body.push_back(rec.mode == TemporalityMode::EventDriven ? 0 : 1);
+  put_u16(body, (uint16_t)rec.items.size());
+  for (const IngestItem& it : rec.items) {
+    const CanonView& cv = it.value;
+    std::string value;
+    switch (cv.logical_type) {
+      case LogicalType::Null: break;
+      case LogicalType::Bool: value.push_back(cv.canon == "true" ? 1 : 0); break;
+      case LogicalType::Int: put_u64(value, (uint64_t)numeric_of(cv.logical_type, cv.canon, std::nullopt).i); break;
+      case LogicalType::Float: {
+        double d = numeric_of(cv.logical_type, cv.canon, std::nullopt).d;
+        uint64_t bits;
+        std::memcpy(&bits, &d, 8);
+        put_u64(value, bits);
+        break;
+      }
+      case LogicalType::Text:
+      case LogicalType::Bytes: value = cv.canon; break;
+      case LogicalType::Uuid:
+        for (size_t i = 0; i < cv.canon.size(); i++) {
+          if (cv.canon[i] == '-') continue;
+          unsigned byte = 0;
+          std::from_chars(cv.canon.data() + i, cv.canon.data() + i + 2, byte, 16);
+          value.push_back((char)byte);
+          i++;
+        }
+        break;
+      case LogicalType::JsonReserved: throw std::runtime_error("type json is reserved in Felix v0.3");
+    }
+    if (it.field_name.size() > 0xFFFF) throw std::runtime_error("field name too long for the binary format");
+    body.push_back((char)type_tag_byte(TagMapVersion::FelixV03, cv.logical_type));
+    body.push_back((char)(with_hashes ? (kBinFieldHash | kBinValueHash) : 0));
+    put_u16(body, (uint16_t)it.field_name.size());
+    put_u32(body, (uint32_t)value.size());
+    body += it.field_name;
+    body += value;
+    if (with_hashes) {
+      if (!cv.hashed) throw std::runtime_error("append_binary_record: value is not hashed");
+      auto fh = canonical_field(it.field_name).second;
+      body.append(reinterpret_cast<const char*>(fh.data()), 32);
+      body.append(reinterpret_cast<const char*>(cv.hash.data()), 32);
+    }
+  }
+  put_u32(out, (uint32_t)body.size());
+  out += body;
+}
+
+// Converts an NDJSON file (or "-") into a binary fact log at out_path (or
+// stdout). Hashes, when requested, follow the store's tag map and hash
+// format. Lines that fail to parse are skipped and reported in skipped.
+static uint64_t ndjson_to_binary(const FactStore& store, const std::string& in_path, const std::string& out_path,
+                                 TemporalityMode default_mode, bool with_hashes,
+                                 std::vector<std::pair<uint64_t, std::string>>& skipped) {
+  NdjsonLineReader in(in_path);
+  const bool to_stdout = out_path == "-";
+  int fd = to_stdout ? STDOUT_FILENO : ::open(out_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) throw std::runtime_error("cannot create " + out_path);
+  struct FdCloser {
+    int fd;
+    ~FdCloser() { if (fd != STDOUT_FILENO) ::close(fd); }
+  } closer{fd};
+
+  std::string out(kBinaryMagic, sizeof(kBinaryMagic));
+  uint64_t n = 0;
+  NdjsonLineBlock block;
+  while (in.next_block(block, 4096)) {
+    auto arena = std::make_shared<IngestArena>();
+    for (const auto& [lineno, line] : block.lines) {
+      std::string_view trimmed = trim_view(line);
+      if (trimmed.empty()) continue;
+      try {
+        NdjsonRecord rec = parse_ndjson_line(trimmed, lineno, default_mode, arena);
+        if (with_hashes) hash_ingest_items(store.tag_map(), store.hash_format(), rec.items);
+        append_binary_record(out, rec, with_hashes);
+        n++;
+      } catch (const std::exception& e) {
+        skipped.emplace_back(lineno, e.what());
+      }
+    }
+    if (out.size() >= (4u << 20)) {
+      write_all(fd, out.data(), out.size(), out_path);
+      out.clear();
+    }
+  }
+  write_all(fd, out.data(), out.size(), out_path);
+  return n;
+}
+
+// ------------------------------------------------------------
+// current_facts rebuild: range at a time, resumable, verifiable
+//
+// Derived state for a record range is "latest fact per (record, field)",
+// computed with SQLite's bare-column MAX() in one pass over the facts
+// primary key. Each range is replaced in its own transaction together with
+// a checkpoint (meta.rebuild_current_next), so an interrupted rebuild
+// resumes where it stopped. With threads > 1, ranges are derived on
+// read-only connections in parallel; the writer reuses such a result only
+// if facts did not grow since it was read, otherwise it derives the range
+// again inside its own transaction. Either way the result equals what
+// incremental ingest produces.
+// ------------------------------------------------------------
+
+static std::vector<FactRow> read_fact_rows(sqlite3* db, sqlite3_stmt* s, const char* what) {
+  std::vector<FactRow> out;
+  for (;;) {
+    int rc = sqlite3_step(s);
+    if (rc == SQLITE_DONE) break;
+    check_sql(rc, db, what);
+    out.push_back(fact_row_at(s));
+  }
+  return out;
+}
+
+static std::vector<FactRow> derive_current_range(sqlite3* db, RecordRange r, const SealedFacts& sealed) {
+  Stmt st;
+  check_sql(sqlite3_prepare_v2(db,
+    "SELECT record_id, field_id, value_id, MAX(ts) "
+    "FROM facts WHERE record_id BETWEEN ? AND ? "
+    "GROUP BY record_id, field_id ORDER BY record_id, field_id;",
+    -1, &st.s, nullptr),
+    db, "prepare derive_current_range");
+  sqlite3_bind_int64(st.s, 1, (sqlite3_int64)r.lo);
+  sqlite3_bind_int64(st.s, 2, (sqlite3_int64)r.hi);
+  std::vector<FactRow> rows = read_fact_rows(db, st.s, "derive_current_range step");
+  if (sealed.empty()) return rows;
+
+  // Latest per (record, field) over the live rows and every sealed row.
+  sealed.range_rows(r, rows);
+  std::sort(rows.begin(), rows.end(), [](const FactRow& a, const FactRow& b) {
+    if (a.record_id != b.record_id) return (int64_t)a.record_id < (int64_t)b.record_id;
+    if (a.field_id != b.field_id) return a.field_id < b.field_id;
+    return a.ts_ms < b.ts_ms;
+  });
+  std::vector<FactRow> out;
+  for (size_t i = 0; i < rows.size(); i++) {
+    if (i + 1 < rows.size() && rows[i + 1].record_id == rows[i].record_id && rows[i + 1].field_id == rows[i].field_id) continue;
+    out.push_back(rows[i]);
+  }
+  return out;
+}
+
+static std::string stored_segments_rev(sqlite3* db) {
+  Stmt st;
+  check_sql(sqlite3_prepare_v2(db, "SELECT v FROM meta WHERE k=?;", -1, &st.s, nullptr), db, "prepare segments_rev");
+  sqlite3_bind_text(st.s, 1, kSegmentsRevKey, -1, SQLITE_STATIC);
+  int rc = sqlite3_step(st.s);
+  check_sql(rc, db, "segments_rev step");
+  return rc == SQLITE_ROW ? std::string(column_view(st.s, 0)) : std::string();
+}
+
+static std::vector<FactRow> stored_current_range(sqlite3* db, RecordRange r) {
+  Stmt st;
+  check_sql(sqlite3_prepare_v2(db,
+    "SELECT record_id, field_id, value_id, ts "
+    "FROM current_facts WHERE record_id BETWEEN ? AND ? ORDER BY record_id, field_id;",
+    -1, &st.s, nullptr),
+    db, "prepare stored_current_range");
+  sqlite3_bind_int64(st.s, 1, (sqlite3_int64)r.lo);
+  sqlite3_bind_int64(st.s, 2, (sqlite3_int64)r.hi);
+  return read_fact_rows(db, st.s, "stored_current_range step");
+}
+
+// facts is append-only, so its largest rowid changes whenever a fact is added.
+static int64_t facts_high_water(sqlite3* db) {
+  Stmt st;
+  check_sql(sqlite3_prepare_v2(db, "SELECT COALESCE(MAX(rowid), 0) FROM facts;", -1, &st.s, nullptr),
+            db, "prepare facts_high_water");
+  int rc = sqlite3_step(st.s);
+  check_sql(rc, db, "facts_high_water step");
+  return (int64_t)sqlite3_column_int64(st.s, 0);
+}
+
+// One (record, field) where current_facts disagrees with the facts log.
+struct CurrentDiff {
+  uint64_t record_id{};
+  uint32_t field_id{};
+  std::optional<FactRow> expected;  // derived from facts
+  std::optional<FactRow> actual;    // stored in current_facts
+};
+
+static std::vector<CurrentDiff> diff_current_rows(const std::vector<FactRow>& expected,
+                                                  const std::vector<FactRow>& actual) {
+  std::vector<CurrentDiff> out;
+  auto key_less = [](const FactRow& a, const FactRow& b) {
+    if ((int64_t)a.record_id != (int64_t)b.record_id) return (int64_t)a.record_id < (int64_t)b.record_id;
+    return a.field_id < b.field_id;
+  };
+  size_t i = 0, j = 0;
+  while (i < expected.size() || j < actual.size()) {
+    CurrentDiff d{};
+    if (j == actual.size() || (i < expected.size() && key_less(expected[i], actual[j]))) {
+      d.expected = expected[i++];
+    } else if (i == expected.size() || key_less(actual[j], expected[i])) {
+      d.actual = actual[j++];
+    } else {
+      if (expected[i].value_id == actual[j].value_id && expected[i].ts_ms == actual[j].ts_ms) {
+        i++; j++;
+        continue;
+      }
+      d.expected = expected[i++];
+      d.actual = actual[j++];
+    }
+    const FactRow& k = d.expected ? *d.expected : *d.actual;
+    d.record_id = k.record_id;
+    d.field_id = k.field_id;
+    out.push_back(std::move(d));
+  }
+  return out;
+}
+
+struct RebuildOptions {
+  uint64_t range_records{10000};  // records per range / transaction
+  unsigned threads{1};            // >1: derive ranges on parallel read-only connections
+  bool verify_only{false};        // diff against current_facts, write nothing
+  bool restart{false};            // ignore a saved checkpoint
+};
+
+struct RebuildResult {
+  uint64_t ranges{0};
+  uint64_t rows{0};        // derived current rows
+  uint64_t mismatches{0};  // verify_only
+  bool resumed{false};
+};
+
+static constexpr const char* kRebuildCheckpointKey = "rebuild_current_next";
+
+static RebuildResult rebuild_current(FelixSqlite& store,
+                                     const RebuildOptions& opt,
+                                     const std::function<void(const CurrentDiff&)>& on_diff = {}) {
+  struct RangeResult {
+    int64_t high_water{0};
+    std::vector<FactRow> rows;
+    std::vector<CurrentDiff> diffs;
+  };
+  // Segments as of the start; a seal while deriving is caught per range.
+  std::shared_ptr<const SealedFacts> sealed;
+  store.with_read_snapshot([&]{ sealed = store.sealed_facts(); });
+  // Runs on any connection; in verify mode both sides come from one read snapshot.
+  auto derive = [&](sqlite3* db, RecordRange r) {
+    RangeResult res{};
+    exec_sql(db, "BEGIN;");
+    try {
+      res.high_water = facts_high_water(db);
+      if (stored_segments_rev(db) != sealed->rev) {
+        throw std::runtime_error("facts were sealed during rebuild_current; run it again");
+      }
+      res.rows = derive_current_range(db, r, *sealed);
+      if (opt.verify_only) res.diffs = diff_current_rows(res.rows, stored_current_range(db, r));
+      exec_sql(db, "COMMIT;");
+    } catch (...) {
+      exec_sql(db, "ROLLBACK;");
+      throw;
+    }
+    return res;
+  };
+
+  RebuildResult result{};
+  int64_t from = std::numeric_limits<int64_t>::min();
+  if (!opt.verify_only) {
+    auto cp = store.meta_get(kRebuildCheckpointKey);
+    if (cp && !opt.restart) {
+      from = std::stoll(*cp);
+      result.resumed = true;
+    }
+  }
+  const std::vector<RecordRange> ranges = store.record_ranges(from, opt.range_records);
+
+  auto apply = [&](RecordRange r, RangeResult&& res, bool precomputed) {
+    result.ranges++;
+    if (opt.verify_only) {
+      result.rows += res.rows.size();
+      result.mismatches += res.diffs.size();
+      if (on_diff) for (const auto& d : res.diffs) on_diff(d);
+      return;
+    }
+    store.with_tx([&]{
+      if (!precomputed || facts_high_water(store.handle()) != res.high_water ||
+          store.sealed_facts()->rev != sealed->rev) {
+        res.rows = derive_current_range(store.handle(), r, *store.sealed_facts());
+      }
+      store.replace_current_range(r, res.rows);
+      if (r.hi == std::numeric_limits<int64_t>::max()) store.meta_delete(kRebuildCheckpointKey);
+      else store.meta_set(kRebuildCheckpointKey, std::to_string(r.hi + 1));
+    });
+    result.rows += res.rows.size();
+  };
+
+  if (opt.threads <= 1) {
+    for (const auto& r : ranges) {
+      apply(r, opt.verify_only ? derive(store.handle(), r) : RangeResult{}, false);
+    }
+    return result;
+  }
+
+  struct Task {
+    RecordRange r;
+    std::promise<RangeResult> p;
+  };
+  BoundedQueue<std::shared_ptr<Task>> work(ranges.size() + 1);
+  std::vector<std::thread> workers;
+  std::exception_ptr open_error;
+  std::mutex open_mu;
+  for (unsigned w = 0; w < opt.threads; w++) {
+    workers.emplace_back([&]{
+      SqliteConn conn;
+      try {
+        open_readonly(store.path(), conn);
+      } catch (...) {
+        std::lock_guard<std::mutex> lk(open_mu);
+        open_error = std::current_exception();
+      }
+      while (auto t = work.pop()) {
+        try {
+          if (!conn.db) std::rethrow_exception(open_error);
+          (*t)->p.set_value(derive(conn.db, (*t)->r));
+        } catch (...) {
+          (*t)->p.set_exception(std::current_exception());
+        }
+      }
+    });
+  }
+
+  // Keep a bounded window of ranges in flight and apply them in order, so the
+  // checkpoint always marks a fully rebuilt prefix.
+  std::deque<std::pair<std::shared_ptr<Task>, std::future<RangeResult>>> window;
+  size_t next = 0;
+  const size_t max_in_flight = (size_t)opt.threads * 2;
+  try {
+    while (next < ranges.size() || !window.empty()) {
+      while (next < ranges.size() && window.size() < max_in_flight) {
+        auto t = std::make_shared<Task>();
+        t->r = ranges[next++];
+        auto fut = t->p.get_future();
+        work.push(t);
+        window.emplace_back(t, std::move(fut));
+      }
+      auto [t, fut] = std::move(window.front());
+      window.pop_front();
+      apply(t->r, fut.get(), true);
+    }
+  } catch (...) {
+    work.close();
+    for (auto& th : workers) th.join();
+    throw;
+  }
+  work.close();
+  for (auto& th : workers) th.join();
+  return result;
+}
+
+// ------------------------------------------------------------
+// Sealing
+//
+// seal moves facts with ts < horizon out of SQLite into segment files, one
+// segment and one transaction per range of records, so a crash loses at most
+// the range in flight. A file written by an interrupted seal is never
+// registered and is removed by the next run. Space freed in the database
+// file is only returned to the filesystem by VACUUM.
+// ------------------------------------------------------------
+
+struct SealOptions {
+  int64_t horizon_ms{0};
+  uint64_t range_records{100000};
+  bool vacuum{false};
+};
+
+struct SealResult {
+  uint64_t segments{0};
+  uint64_t rows{0};
+  uint64_t bytes{0};
+};
+
+static SealResult seal_facts(FelixSqlite& store, const SealOptions& opt) {
+  namespace fs = std::filesystem;
+  SealResult result{};
+
+  store.with_tx([&]{
+    if (!fs::exists(store.segment_dir())) return;
+    std::vector<std::string> live = store.segment_files();
+    for (const auto& e : fs::directory_iterator(store.segment_dir())) {
+      const std::string name = e.path().filename().string();
+      if (name.rfind("seg-", 0) != 0) continue;
+      if (std::find(live.begin(), live.end(), name) == live.end()) fs::remove(e.path());
+    }
+  });
+
+  for (const auto& r : store.record_ranges(std::numeric_limits<int64_t>::min(), opt.range_records)) {
+    store.with_tx([&]{
+      if (auto info = store.seal_range(r, opt.horizon_ms)) {
+        result.segments++;
+        result.rows += info->rows;
+        result.bytes += info->bytes;
+      }
+    });
+  }
+
+  if (opt.vacuum) exec_sql(store.handle(), "VACUUM;");
+  return result;
+}
+
+struct BlobGcResult {
+  uint64_t files{0};
+  uint64_t bytes{0};
+};
+
+// Removes blob files no f_values row refers to: leftovers of rolled-back
+// transactions and interrupted writes. Runs inside a write transaction, so
+// no writer can be between storing a blob and inserting its row.
+static BlobGcResult gc_blobs(FelixSqlite& store) {
+  namespace fs = std::filesystem;
+  BlobGcResult result{};
+  store.with_tx([&]{
+    if (!fs::exists(store.blob_dir())) return;
+    Stmt st;
+    check_sql(sqlite3_prepare_v2(store.handle(), "SELECT 1 FROM f_values WHERE hash=? AND blob_size IS NOT NULL;", -1,
+                                 &st.s, nullptr),
+              store.handle(), "prepare blob gc");
+    for (const auto& e : fs::recursive_directory_iterator(store.blob_dir())) {
+      if (!e.is_regular_file()) continue;
+      const std::string hex = e.path().parent_path().filename().string() + e.path().filename().string();
+      std::array<uint8_t, 32> h{};
+      bool live = false;
+      if (hex.size() == 64 && hex.find_first_not_of("0123456789abcdef") == std::string::npos) {
+        for (size_t i = 0; i < h.size(); i++) h[i] = (uint8_t)std::stoi(hex.substr(i * 2, 2), nullptr, 16);
+        sqlite3_reset(st.s);
+        sqlite3_bind_blob(st.s, 1, h.data(), (int)h.size(), SQLITE_TRANSIENT);
+        int rc = sqlite3_step(st.s);
+        check_sql(rc, store.handle(), "blob gc step");
+        live = rc == SQLITE_ROW;
+      }
+      if (live) continue;
+      result.files++;
+      result.bytes += (uint64_t)e.file_size();
+      fs::remove(e.path());
+    }
+  });
+  return result;
+}
+
+// ------------------------------------------------------------
+// Format migration
+//
+// migrate_format rewrites a legacy database (v0.2 tag map, hashes without
+// the separator byte) to Felix v0.3: every f_values row gets its v0.3 type
+// tag and hash, and blob files are linked under their new names. Values are
+// read in value_id batches; worker threads hash one batch while the
+// previous one is written in its own transaction together with a checkpoint
+// (meta.format_migrate_next), so an interrupted run resumes where it
+// stopped. Until the run finishes the database serves no other command.
+// A final pass re-hashes every value under v0.3 before the format is
+// declared and the old blob names are collected.
+// ------------------------------------------------------------
+
+struct MigrateFormatOptions {
+  uint64_t batch_values{10000};  // values per batch / transaction
+  unsigned threads{0};           // hashing threads; 0: one per core
+  bool verify_only{false};       // check every hash under the declared format, write nothing
+};
+
+struct MigrateFormatResult {
+  uint64_t values{0};      // values rewritten
+  uint64_t batches{0};
+  uint64_t verified{0};    // values checked by the verification pass
+  uint64_t mismatches{0};
+  uint64_t blob_files{0};  // old blob names removed
+  bool resumed{false};
+  bool already_current{false};
+};
+
+struct ValueMismatch {
+  uint64_t value_id{0};
+  std::string error;
+};
+
+// Inline bytes one batch may hold besides its batch_values limit.
+static constexpr size_t kMigrateBatchBytes = 64u << 20;
+
+// Hashes vals under (tagmap, hfmt) on up to threads threads. A value whose
+// bytes cannot be read gets an error instead of a hash.
+static void hash_stored_values(const std::vector<StoredValue>& vals, TagMapVersion tagmap, HashFormatVersion hfmt,
+                               unsigned threads, std::vector<std::array<uint8_t, 32>>& hashes,
+                               std::vector<std::string>& errors) {
+  hashes.assign(vals.size(), {});
+  errors.assign(vals.size(), {});
+  auto work = [&](size_t lo, size_t hi) {
+    for (size_t i = lo; i < hi; i++) {
+      try {
+        const std::string_view b = vals[i].bytes();
+        hashes[i] = sha256_typed(tagmap, hfmt, vals[i].type, reinterpret_cast<const uint8_t*>(b.data()), b.size());
+      } catch (const std::exception& e) {
+        errors[i] = e.what();
+      }
+    }
+  };
+  const size_t n = std::max<size_t>(1, std::min<size_t>(threads, vals.size() / 256));
+  const size_t per = (vals.size() + n - 1) / n;
+  std::vector<std::thread> workers;
+  for (size_t t = 1; t < n; t++) workers.emplace_back(work, t * per, std::min(vals.size(), (t + 1) * per));
+  work(0, std::min(vals.size(), per));
+  for (auto& th : workers) th.join();
+}
+
+// Checks every stored hash against its value under (tagmap, hfmt).
+static uint64_t verify_value_hashes(FelixSqlite& store, TagMapVersion tagmap, HashFormatVersion hfmt,
+                                    const MigrateFormatOptions& opt,
+                                    const std::function<void(const ValueMismatch&)>& on_mismatch,
+                                    uint64_t& mismatches) {
+  uint64_t checked = 0;
+  uint64_t from = 0;
+  std::vector<std::array<uint8_t, 32>> hashes;
+  std::vector<std::string> errors;
+  for (;;) {
+    std::vector<StoredValue> vals;
+    store.with_read_snapshot([&]{ vals = store.stored_values(from, opt.batch_values, kMigrateBatchBytes, tagmap); });
+    if (vals.empty()) break;
+    hash_stored_values(vals, tagmap, hfmt, opt.threads, hashes, errors);
+    for (size_t i = 0; i < vals.size(); i++) {
+      ValueMismatch m{vals[i].value_id, errors[i]};
+      if (m.error.empty() && hashes[i] != vals[i].hash) m.error = "stored hash differs from the value";
+      if (m.error.empty()) continue;
+      mismatches++;
+      if (on_mismatch) on_mismatch(m);
+    }
+    checked += vals.size();
+    from = vals.back().value_id + 1;
+  }
+  return checked;
+}
+
+static MigrateFormatResult migrate_format(FelixSqlite& store, MigrateFormatOptions opt,
+                                          const std::function<void(const ValueMismatch&)>& on_mismatch = {}) {
+  if (opt.threads == 0) opt.threads = std::max(1u, std::thread::hardware_concurrency());
+  opt.batch_values = std::max<uint64_t>(1, opt.batch_values);
+  MigrateFormatResult result{};
+  constexpr TagMapVersion kTagMap = TagMapVersion::FelixV03;
+  constexpr HashFormatVersion kHashFormat = HashFormatVersion::FelixV03Sep;
+
+  if (opt.verify_only) {
+    store.open_schema();
+    result.verified = verify_value_hashes(store, store.tag_map(), store.hash_format(), opt, on_mismatch,
+                                          result.mismatches);
+    return result;
+  }
+
+  struct Migrating {
+    FelixSqlite& store;
+    explicit Migrating(FelixSqlite& s) : store(s) { store.set_migrating(true); }
+    ~Migrating() { store.set_migrating(false); }
+  } migrating{store};
+
+  // The declared format stays the source format until the very end.
+  uint64_t from = 0;
+  if (auto cp = store.meta_get(kFormatMigrateKey)) {
+    from = std::stoull(*cp);
+    result.resumed = true;
+  } else {
+    store.open_schema();
+    if (store.tag_map() == kTagMap && store.hash_format() == kHashFormat) {
+      result.already_current = true;
+      return result;
+    }
+  }
+  const TagMapVersion src_tagmap = store.tag_map();
+
+  struct Batch {
+    std::vector<StoredValue> vals;
+    std::vector<std::array<uint8_t, 32>> hashes;
+    std::vector<std::string> errors;
+  };
+  auto write = [&](const Batch& b) {
+    store.with_tx([&]{
+      for (size_t i = 0; i < b.vals.size(); i++) {
+        if (!b.errors[i].empty()) {
+          throw std::runtime_error("value " + std::to_string(b.vals[i].value_id) + ": " + b.errors[i]);
+        }
+        store.rehash_value(b.vals[i], type_tag_byte(kTagMap, b.vals[i].type), b.hashes[i]);
+      }
+      store.meta_set(kFormatMigrateKey, std::to_string(b.vals.back().value_id + 1));
+    });
+    result.values += b.vals.size();
+    result.batches++;
+  };
+
+  // Hash batch k on the workers while batch k-1 is written.
+  std::optional<Batch> ready;
+  for (;;) {
+    auto next = std::make_shared<Batch>();
+    next->vals = store.stored_values(from, opt.batch_values, kMigrateBatchBytes, src_tagmap);
+    if (!next->vals.empty()) from = next->vals.back().value_id + 1;
+    auto hashed = std::async(std::launch::async, [&, next]{
+      hash_stored_values(next->vals, kTagMap, kHashFormat, opt.threads, next->hashes, next->errors);
+    });
+    try {
+      if (ready) write(*ready);
+    } catch (...) {
+      hashed.wait();
+      throw;
+    }
+    hashed.get();
+    if (next->vals.empty()) break;
+    ready = std::move(*next);
+  }
+
+  result.verified = verify_value_hashes(store, kTagMap, kHashFormat, opt, on_mismatch, result.mismatches);
+  if (result.mismatches > 0) return result;
+  store.with_tx([&]{
+    store.declare_felix_v03();
+    store.meta_delete(kFormatMigrateKey);
+  });
+  result.blob_files = gc_blobs(store).files;
+  return result;
+}
+
+// ------------------------------------------------------------
+// State checkpoints: build and verify
+//
+// Checkpoints sit on multiples of the interval. Building walks each record's
+// facts after its newest checkpoint in ts order and writes the folded state
+// just before the walk crosses into a later interval, but only once at least
+// min_facts facts have accumulated since the previous checkpoint, so short
+// histories never get one. Re-running only extends existing checkpoints.
+// ------------------------------------------------------------
+
+struct CheckpointOptions {
+  int64_t interval_ms{24 * 60 * 60 * 1000};
+  uint64_t min_facts{1000};
+  uint64_t range_records{1000};  // records per build transaction
+};
+
+struct CheckpointResult {
+  uint64_t records{0};
+  uint64_t checkpoints{0};
+  uint64_t mismatches{0};  // verify only
+};
+
+static inline int64_t floor_multiple(int64_t x, int64_t m) {
+  int64_t q = x / m;
+  if ((x % m) != 0 && ((x < 0) != (m < 0))) q--;
+  return q * m;
+}
+
+static void build_record_checkpoints(FelixSqlite& store, uint64_t record_id,
+                                     const CheckpointOptions& opt, CheckpointResult& result) {
+  std::vector<FactRow> state;
+  std::unordered_map<uint32_t, size_t> at;
+  int64_t last_cp = std::numeric_limits<int64_t>::min();
+  if (auto cp = store.latest_checkpoint(record_id, std::numeric_limits<int64_t>::max())) {
+    last_cp = *cp;
+    state = store.checkpoint_rows(record_id, last_cp);
+    for (size_t i = 0; i < state.size(); i++) at.emplace(state[i].field_id, i);
+  }
+
+  std::vector<std::pair<int64_t, std::vector<FactRow>>> pending;
+  uint64_t since_cp = 0;
+  int64_t last_ts = last_cp;
+  store.facts_between(record_id, last_cp, std::numeric_limits<int64_t>::max(), [&](const FactRow& f) {
+    // Largest checkpoint time strictly before this fact that still covers
+    // every fact applied so far.
+    int64_t cp = floor_multiple(f.ts_ms - 1, opt.interval_ms);
+    if (since_cp >= opt.min_facts && cp >= last_ts && cp > last_cp) {
+      pending.emplace_back(cp, state);
+      last_cp = cp;
+      since_cp = 0;
+    }
+    auto [it, inserted] = at.emplace(f.field_id, state.size());
+    if (inserted) state.push_back(f);
+    else state[it->second] = f;
+    since_cp++;
+    last_ts = f.ts_ms;
+  });
+
+  for (const auto& [cp, rows] : pending) store.write_checkpoint(record_id, cp, rows);
+  result.checkpoints += pending.size();
+}
+
+static std::vector<uint64_t> record_ids_in_range(FelixSqlite& store, RecordRange r) {
+  Stmt st;
+  check_sql(sqlite3_prepare_v2(store.handle(), "SELECT record_id FROM records WHERE record_id BETWEEN ? AND ? ORDER BY record_id;",
+                               -1, &st.s, nullptr),
+            store.handle(), "prepare record_ids_in_range");
+  sqlite3_bind_int64(st.s, 1, (sqlite3_int64)r.lo);
+  sqlite3_bind_int64(st.s, 2, (sqlite3_int64)r.hi);
+  std::vector<uint64_t> out;
+  for (;;) {
+    int rc = sqlite3_step(st.s);
+    if (rc == SQLITE_DONE) break;
+    check_sql(rc, store.handle(), "record_ids_in_range step");
+    out.push_back((uint64_t)sqlite3_column_int64(st.s, 0));
+  }
+  return out;
+}
+
+static CheckpointResult build_checkpoints(FelixSqlite& store, const CheckpointOptions& opt) {
+  auto existing = store.checkpoint_interval();
+  if (existing && *existing != opt.interval_ms) {
+    throw std::runtime_error("checkpoints already exist with interval " + std::to_string(*existing) +
+                             " ms; run checkpoint_drop first to change it");
+  }
+  if (!existing) store.enable_checkpoints(opt.interval_ms);
+  store.meta_set(kCheckpointMinFactsKey, std::to_string(opt.min_facts));
+
+  CheckpointResult result{};
+  for (const auto& r : store.record_ranges(std::numeric_limits<int64_t>::min(), opt.range_records)) {
+    store.with_tx([&]{
+      for (uint64_t rid : record_ids_in_range(store, r)) {
+        build_record_checkpoints(store, rid, opt, result);
+        result.records++;
+      }
+    });
+  }
+  return result;
+}
+
+// Recomputes every checkpoint from facts alone and reports the ones that differ.
+static CheckpointResult verify_checkpoints(FelixSqlite& store,
+                                           const std::function<void(uint64_t, int64_t)>& on_mismatch = {}) {
+  CheckpointResult result{};
+  if (!store.checkpoints_enabled()) return result;
+  auto same = [](const std::vector<FactRow>& a, const std::vector<FactRow>& b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++) {
+      if (a[i].field_id != b[i].field_id || a[i].value_id != b[i].value_id || a[i].ts_ms != b[i].ts_ms) return false;
+    }
+    return true;
+  };
+  for (const auto& r : store.record_ranges(std::numeric_limits<int64_t>::min(), 1000)) {
+    for (uint64_t rid : record_ids_in_range(store, r)) {
+      result.records++;
+      for (int64_t cp : store.checkpoint_times(rid)) {
+        result.checkpoints++;
+        std::vector<FactRow> expected = store.snapshot_from_facts(rid, cp);
+        std::sort(expected.begin(), expected.end(), [](const FactRow& a, const FactRow& b) { return a.field_id < b.field_id; });
+        if (!same(expected, store.checkpoint_rows(rid, cp))) {
+          result.mismatches++;
+          if (on_mismatch) on_mismatch(rid, cp);
+        }
+      }
+    }
+  }
+  return result;
+}
+
+// ------------------------------------------------------------
+// Output helpers (NDJSON / JSON)
+// ------------------------------------------------------------
+
+static json fact_to_json(const FactView& v) {
+  return json{
+    {"record_id", v.fact.record_id},
+    {"field_id", v.fact.field_id},
+    {"field_name", v.field_name},
+    {"value_id", v.fact.value_id},
+    {"type", type_to_string(v.type)},
+    {"canon", v.canon},
+    {"ts_ms", v.fact.ts_ms}
+  };
+}
+
+// Memoizing field/value metadata lookups for output. Snapshot and history
+// output repeats the same few field names and low-cardinality values, so each
+// id is read from SQLite once per decoder instead of once per row.
+class FactDecoder {
+public:
+  explicit FactDecoder(FactStore& store) : store_(store) {}
+
+  const FieldRow& field(uint32_t field_id) {
+    auto it = fields_.find(field_id);
+    if (it == fields_.end()) it = fields_.emplace(field_id, store_.get_field(field_id)).first;
+    return it->second;
+  }
+
+  const ValueRow& value(uint64_t value_id) {
+    auto it = values_.find(value_id);
+    if (it != values_.end()) return it->second;
+    if (values_.size() >= kValueCapacity) values_.clear();
+    return values_.emplace(value_id, store_.get_value(value_id)).first->second;
+  }
+
+private:
+  static constexpr size_t kValueCapacity = 65536;
+  FactStore& store_;
+  std::unordered_map<uint32_t, FieldRow> fields_;
+  std::unordered_map<uint64_t, ValueRow> values_;
+};
+
+static json snapshot_to_json(FactDecoder& dec, uint64_t record_id, int64_t t, const std::vector<FactRow>& rows) {
+  json out;
+  out["record_id"] = record_id;
+  out["ts_ms"] = t;
+  json fields = json::object();
+
+  for (const auto& f : rows) {
+    const FieldRow& fr = dec.field(f.field_id);
+    const ValueRow& vr = dec.value(f.value_id);
+    fields[fr.name_canon] = json{
+      {"field_id", f.field_id},
+      {"value_id", f.value_id},
+      {"type", type_to_string(vr.type)},
+      {"canon", vr.canon()},
+      {"fact_ts_ms", f.ts_ms}
+    };
+  }
+
+  out["fields"] = fields;
+  return out;
+}
+
+// Record selection for snapshot_many: "all", "<lo>..<hi>", a comma-separated
+// id list, or "-" to read one id per line from stdin.
+static void snapshot_many(FactStore& store, int64_t t, std::string_view selector, std::ostream& out) {
+  FactDecoder dec(store);
+  auto emit = [&](uint64_t rid, const std::vector<FactRow>& rows) {
+    out << snapshot_to_json(dec, rid, t, rows).dump() << "\n";
+  };
+
+  if (selector == "all") {
+    store.snapshot_range({std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max()}, t, emit);
+    return;
+  }
+
+  auto dots = selector.find("..");
+  if (dots != std::string_view::npos) {
+    RecordRange r{};
+    r.lo = (int64_t)std::stoull(std::string(selector.substr(0, dots)));
+    r.hi = (int64_t)std::stoull(std::string(selector.substr(dots + 2)));
+    store.snapshot_range(r, t, emit);
+    return;
+  }
+
+  auto one = [&](std::string_view tok) {
+    std::string id = trim_copy(tok);
+    if (id.empty()) return;
+    uint64_t rid = std::stoull(id);
+    emit(rid, store.snapshot_at(rid, t));
+  };
+
+  if (selector == "-") {
+    std::string line;
+    while (std::getline(std::cin, line)) one(line);
+    return;
+  }
+
+  size_t pos = 0;
+  while (pos <= selector.size()) {
+    size_t comma = selector.find(',', pos);
+    if (comma == std::string_view::npos) comma = selector.size();
+    one(selector.substr(pos, comma - pos));
+    pos = comma + 1;
+  }
+}
+
+// History of one record restricted to the named fields (all fields when
+// none are named). Names that do not exist match nothing.
+static void record_history(FactStore& store, HistoryQuery q, const std::vector<std::string>& field_names,
+                           const std::function<bool(const FactView&)>& fn) {
+  for (const auto& name : field_names) {
+    if (auto fid = store.find_field_id(name)) q.field_ids.push_back(*fid);
+  }
+  if (!field_names.empty() && q.field_ids.empty()) return;
+  std::sort(q.field_ids.begin(), q.field_ids.end());
+  q.field_ids.erase(std::unique(q.field_ids.begin(), q.field_ids.end()), q.field_ids.end());
+  store.query_history(q, fn);
+}
+
+// ------------------------------------------------------------
+// Windowed aggregates
+//
+// Per (record, field) and per fixed bucket of a window, computed in one pass
+// over query_facts_window (ts order, sealed rows included). Each record's
+// state just before the window comes from one snapshot_at, so change counts
+// and dwell times account for the value carried into the window. Buckets
+// without facts for a key are not reported; their dwell is all the value
+// current at their start.
+// ------------------------------------------------------------
+
+struct AggregateQuery {
+  int64_t t1{};
+  int64_t t2{};                          // inclusive, as in facts_window
+  std::optional<uint64_t> record_id;
+  std::optional<std::string> field;
+  int64_t bucket_ms{0};                  // 0: the whole window is one bucket
+};
+
+struct AggregateValueStat {
+  uint64_t value_id{};
+  uint64_t facts{0};
+  int64_t dwell_ms{0};
+};
+
+struct AggregateBucket {
+  int64_t start{};
+  int64_t end{};                         // exclusive
+  uint64_t facts{0};
+  uint64_t changes{0};                   // facts whose value differs from the previous one
+  FactRow first{};
+  FactRow last{};
+  std::vector<AggregateValueStat> values;  // first-seen order, incl. the value carried in
+  std::unordered_map<uint64_t, size_t> value_index;
+  uint64_t numeric{0};
+  bool all_int{true};
+  int64_t imin{0}, imax{0};
+  double dmin{0}, dmax{0}, sum{0};
+};
+
+struct AggregateKeyState {
+  std::optional<uint64_t> value;         // current value, if the key has one
+  int64_t since{};                       // where its dwell in the open bucket starts
+  std::optional<AggregateBucket> open;
+};
+
+static AggregateValueStat& value_stat(AggregateBucket& b, uint64_t value_id) {
+  auto [it, added] = b.value_index.emplace(value_id, b.values.size());
+  if (added) b.values.push_back(AggregateValueStat{value_id, 0, 0});
+  return b.values[it->second];
+}
+
+static json aggregate_value_json(FactDecoder& dec, uint64_t value_id) {
+  const ValueRow& vr = dec.value(value_id);
+  return json{{"value_id", value_id}, {"type", type_to_string(vr.type)}, {"canon", vr.canon()}};
+}
+
+static json aggregate_bucket_json(FactDecoder& dec, uint64_t record_id, uint32_t field_id, const AggregateBucket& b) {
+  json first = aggregate_value_json(dec, b.first.value_id);
+  first["ts_ms"] = b.first.ts_ms;
+  json last = aggregate_value_json(dec, b.last.value_id);
+  last["ts_ms"] = b.last.ts_ms;
+
+  // Longest dwell first.
+  std::vector<AggregateValueStat> values = b.values;
+  std::stable_sort(values.begin(), values.end(), [](const auto& x, const auto& y) { return x.dwell_ms > y.dwell_ms; });
+  json dwell = json::array();
+  uint64_t distinct = 0;
+  for (const auto& vs : values) {
+    if (vs.facts > 0) distinct++;
+    if (vs.dwell_ms == 0) continue;
+    json e = aggregate_value_json(dec, vs.value_id);
+    e["ms"] = vs.dwell_ms;
+    e["facts"] = vs.facts;
+    dwell.push_back(std::move(e));
+  }
+
+  json out{
+    {"record_id", record_id},
+    {"field_id", field_id},
+    {"field_name", dec.field(field_id).name_canon},
+    {"start_ms", b.start},
+    {"end_ms", b.end},
+    {"facts", b.facts},
+    {"changes", b.changes},
+    {"distinct_values", distinct},
+    {"first", first},
+    {"last", last},
+    {"dwell", dwell}
+  };
+  if (b.numeric > 0) {
+    out["numeric"] = json{
+      {"count", b.numeric},
+      {"min", b.all_int ? json(b.imin) : json(b.dmin)},
+      {"max", b.all_int ? json(b.imax) : json(b.dmax)},
+      {"mean", b.sum / (double)b.numeric}
+    };
+  }
+  return out;
+}
+
+// Calls emit once per reported bucket, ordered by record_id, field_id and
+// bucket start. Results are collected before emitting, so emit may use the
+// store.
+static void aggregate_window(FactStore& store, const AggregateQuery& q, const std::function<void(const json&)>& emit) {
+  if (q.t2 < q.t1) throw std::runtime_error("aggregate: t2 must not be before t1");
+  if (q.bucket_ms < 0) throw std::runtime_error("aggregate: bucket size must be positive");
+  FactDecoder dec(store);
+  std::optional<uint32_t> field_id;
+  if (q.field) {
+    field_id = store.find_field_id(*q.field);
+    if (!field_id) return;
+  }
+
+  const int64_t window_end = q.t2 == std::numeric_limits<int64_t>::max() ? q.t2 : q.t2 + 1;
+  auto bucket_of = [&](int64_t ts) {
+    AggregateBucket b{};
+    if (q.bucket_ms == 0) {
+      b.start = q.t1;
+      b.end = window_end;
+    } else {
+      const int64_t n = (int64_t)(((uint64_t)ts - (uint64_t)q.t1) / (uint64_t)q.bucket_ms);
+      b.start = q.t1 + n * q.bucket_ms;
+      b.end = window_end - b.start > q.bucket_ms ? b.start + q.bucket_ms : window_end;
+    }
+    return b;
+  };
+
+  using Key = std::pair<uint64_t, uint32_t>;
+  std::map<Key, AggregateKeyState> keys;
+  std::unordered_map<uint64_t, bool> seeded;
+  std::vector<std::pair<Key, AggregateBucket>> done;
+
+  auto close = [&](const Key& k, AggregateKeyState& s) {
+    AggregateBucket& b = *s.open;
+    if (s.value) value_stat(b, *s.value).dwell_ms += b.end - s.since;
+    done.emplace_back(k, std::move(b));
+    s.open.reset();
+  };
+
+  FactsWindowQuery wq{};
+  wq.t1 = q.t1;
+  wq.t2 = q.t2;
+  wq.record_id = q.record_id;
+  store.query_facts_window(wq, [&](const FactView& v) {
+    const FactRow& f = v.fact;
+    if (field_id && f.field_id != *field_id) return true;
+    const Key k{f.record_id, f.field_id};
+
+    if (!seeded[f.record_id]) {
+      seeded[f.record_id] = true;
+      if (q.t1 > std::numeric_limits<int64_t>::min()) {
+        for (const FactRow& p : store.snapshot_at(f.record_id, q.t1 - 1)) {
+          if (field_id && p.field_id != *field_id) continue;
+          keys[{p.record_id, p.field_id}].value = p.value_id;
+        }
+      }
+    }
+
+    AggregateKeyState& s = keys[k];
+    if (s.open && f.ts_ms >= s.open->end) close(k, s);
+    if (!s.open) {
+      s.open = bucket_of(f.ts_ms);
+      s.since = s.open->start;
+      s.open->first = f;
+    }
+    AggregateBucket& b = *s.open;
+    if (s.value && f.ts_ms > s.since) value_stat(b, *s.value).dwell_ms += f.ts_ms - s.since;
+    if (!s.value || *s.value != f.value_id) b.changes++;
+    b.facts++;
+    b.last = f;
+    value_stat(b, f.value_id).facts++;
+    s.value = f.value_id;
+    s.since = f.ts_ms;
+
+    if (v.type == LogicalType::Int || v.type == LogicalType::Float) {
+      double d;
+      if (v.type == LogicalType::Int) {
+        int64_t i = 0;
+        if (v.num) i = v.num->i;
+        else std::from_chars(v.canon.data(), v.canon.data() + v.canon.size(), i);
+        if (b.all_int) {
+          b.imin = b.numeric ? std::min(b.imin, i) : i;
+          b.imax = b.numeric ? std::max(b.imax, i) : i;
+        }
+        d = (double)i;
+      } else {
+        d = v.num ? v.num->d : std::strtod(std::string(v.canon).c_str(), nullptr);  // also reads "inf" / "-inf"
+        b.all_int = false;
+      }
+      b.dmin = b.numeric ? std::min(b.dmin, d) : d;
+      b.dmax = b.numeric ? std::max(b.dmax, d) : d;
+      b.sum += d;
+      b.numeric++;
+    }
+    return true;
+  });
+
+  for (auto& [k, s] : keys) {
+    if (s.open) close(k, s);
+  }
+  // record_id in SQLite integer order, like every other record listing.
+  std::stable_sort(done.begin(), done.end(), [](const auto& a, const auto& b) {
+    const int64_t ra = (int64_t)a.first.first, rb = (int64_t)b.first.first;
+    if (ra != rb) return ra < rb;
+    if (a.first.second != b.first.second) return a.first.second < b.first.second;
+    return a.second.start < b.second.start;
+  });
+  for (const auto& [k, b] : done) emit(aggregate_bucket_json(dec, k.first, k.second, b));
+}
+
+// ------------------------------------------------------------
+// Benchmark
+//
+// Generates a reproducible synthetic workload into a fresh store and times
+// the main engine paths on it. The workload is a function of the options
+// alone (fixed RNG, no wall clock), so two builds given the same options
+// ingest byte-identical data and their reports can be compared directly.
+// ------------------------------------------------------------
+
+// Allocation counting for the benchmark (opt-in, FELIX_ALLOCATION_COUNTER):
+// operator new is replaced by a malloc wrapper that counts calls while the
+// benchmark runs. Allocations SQLite, ICU and OpenSSL make through malloc
+// directly are not included. Other builds keep the default operator new and
+// the report leaves the counts out.
+static std::atomic<bool> g_count_allocations{false};
+static std::atomic<uint64_t> g_allocations{0};
+
+#ifdef FELIX_ALLOCATION_COUNTER
+static constexpr bool kAllocationCounter = true;
+
+void* operator new(std::size_t n) {
+  if (g_count_allocations.load(std::memory_order_relaxed)) g_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (n == 0) n = 1;
+  for (;;) {
+    if (void* p = std::malloc(n)) return p;
+    std::new_handler h = std::get_new_handler();
+    if (!h) throw std::bad_alloc();
+    h();
+  }
+}
+void* operator new[](std::size_t n) { return ::operator new(n); }
+// GCC pairs the inlined malloc and free across the replacement and flags
+// them as mismatched; they are the matching pair here.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* p) noexcept { std::free(p); }
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+void operator delete(void* p, std::size_t) noexcept { ::operator delete(p); }
+void operator delete[](void* p) noexcept { ::operator delete(p); }
+void operator delete[](void* p, std::size_t) noexcept { ::operator delete(p); }
+#else
+static constexpr bool kAllocationCounter = false;
+#endif
+
+static inline uint64_t allocation_count() { return g_allocations.load(std::memory_order_relaxed); }
+
+struct BenchOptions {
+  uint64_t records{10000};
+  uint32_t fields{8};              // fields set by every update
+  uint64_t updates{4};             // updates per record
+  uint64_t cardinality{16};        // distinct values per field
+  double observe_ratio{0.0};       // share of updates ingested in observe mode
+  double out_of_order{0.0};        // share of updates that arrive late
+  uint64_t queries{1000};          // per query phase
+  int64_t window_ms{0};            // facts_window width (0 = 1/1000 of the span)
+  size_t batch_lines{1000};        // ingest_ndjson_file batch size
+  uint64_t seed{1};
+  std::vector<std::string> pragmas;  // sqlite only, "name=value"
+};
+
+struct BenchOp {
+  uint64_t record_id;
+  int64_t ts_ms;
+  TemporalityMode mode;
+  std::vector<uint64_t> values;  // value index per field
+};
+
+static constexpr int64_t kBenchBaseTs = 1700000000000;
+static constexpr int64_t kBenchStepMs = 10;
+
+class BenchRng {
+public:
+  explicit BenchRng(uint64_t seed) : gen_(seed) {}
+  uint64_t below(uint64_t n) { return n ? gen_() % n : 0; }
+  double unit() { return (double)(gen_() >> 11) * 0x1.0p-53; }
+
+private:
+  std::mt19937_64 gen_;
+};
+
+// Updates in timestamp order (round by round over all records), then late
+// arrivals swapped forward by up to four rounds.
+static std::vector<BenchOp> bench_workload(const BenchOptions& opt) {
+  BenchRng rng(opt.seed);
+  std::vector<BenchOp> ops;
+  ops.reserve(opt.records * opt.updates);
+  for (uint64_t r = 0; r < opt.updates; r++) {
+    for (uint64_t k = 0; k < opt.records; k++) {
+      BenchOp op{};
+      op.record_id = k + 1;
+      op.ts_ms = kBenchBaseTs + (int64_t)ops.size() * kBenchStepMs;
+      op.mode = rng.unit() < opt.observe_ratio ? TemporalityMode::ObservationDriven : TemporalityMode::EventDriven;
+      op.values.resize(opt.fields);
+      for (auto& v : op.values) v = rng.below(opt.cardinality);
+      ops.push_back(std::move(op));
+    }
+  }
+  const uint64_t reach = 4 * opt.records;
+  for (size_t i = 0; i + 1 < ops.size(); i++) {
+    if (rng.unit() >= opt.out_of_order) continue;
+    size_t j = std::min(ops.size() - 1, i + 1 + (size_t)rng.below(reach));
+    std::swap(ops[i], ops[j]);
+  }
+  return ops;
+}
+
+static std::string bench_field_name(uint32_t f) { return "f" + std::to_string(f); }
+
+// Even fields hold text, odd fields ints.
+static json bench_field_json(uint32_t f, uint64_t v) {
+  if (f % 2 == 0) return json{{"t", "text"}, {"v", "v" + std::to_string(v)}};
+  return json{{"t", "int"}, {"v", v}};
+}
+
+static CanonValue bench_canon_value(uint32_t f, uint64_t v) {
+  if (f % 2 == 0) return canonicalize_typed_value(LogicalType::Text, json("v" + std::to_string(v)));
+  return canonicalize_typed_value(LogicalType::Int, json(v));
+}
+
+static uint64_t path_bytes(const std::string& p) {
+  namespace fs = std::filesystem;
+  std::error_code ec;
+  if (fs::is_regular_file(p, ec)) return fs::file_size(p, ec);
+  if (!fs::is_directory(p, ec)) return 0;
+  uint64_t n = 0;
+  for (const auto& e : fs::recursive_directory_iterator(p, ec)) {
+    if (e.is_regular_file(ec)) n += e.file_size(ec);
+  }
+  return n;
+}
+
+class BenchTimer {
+public:
+  template <class F>
+  void sample(F&& f) {
+    const uint64_t a0 = allocation_count();
+    auto t0 = std::chrono::steady_clock::now();
+    f();
+    auto d = std::chrono::steady_clock::now() - t0;
+    allocations_ += allocation_count() - a0;
+    samples_.push_back(std::chrono::duration<double, std::micro>(d).count());
+  }
+
+  // Whole-phase time and allocations for phases timed as one call.
+  void total(double seconds, uint64_t allocations) {
+    total_s_ = seconds;
+    allocations_ = allocations;
+  }
+
+  json report() const {
+    double seconds = total_s_;
+    if (!samples_.empty()) {
+      seconds = 0;
+      for (double s : samples_) seconds += s;
+      seconds /= 1e6;
+    }
+    json j{{"ops", ops_ ? ops_ : samples_.size()}, {"seconds", seconds}};
+    j["ops_per_s"] = seconds > 0 ? (double)j["ops"].get<uint64_t>() / seconds : 0.0;
+    if (kAllocationCounter) {
+      j["allocations"] = allocations_;
+      j["allocations_per_op"] = j["ops"].get<uint64_t>() ? (double)allocations_ / (double)j["ops"].get<uint64_t>() : 0.0;
+    }
+    if (!samples_.empty()) {
+      std::vector<double> s = samples_;
+      std::sort(s.begin(), s.end());
+      auto pct = [&](double p) { return s[std::min(s.size() - 1, (size_t)(p * (double)s.size()))]; };
+      j["p50_us"] = pct(0.50);
+      j["p99_us"] = pct(0.99);
+    }
+    return j;
+  }
+
+  void ops(uint64_t n) { ops_ = n; }
+
+private:
+  std::vector<double> samples_;
+  double total_s_{0};
+  uint64_t ops_{0};
+  uint64_t allocations_{0};
+};
+
+// Runs every phase against a freshly initialized store. The first round of
+// arrivals goes through ingest_items (one transaction each), the rest
+// through ingest_ndjson_file via a scratch file next to the store.
+// rebuild_current runs only when sqlite is set.
+static json run_benchmark(FactStore& store, FelixSqlite* sqlite, const std::string& store_path,
+                          const BenchOptions& opt) {
+  if (opt.records == 0 || opt.updates == 0 || opt.fields == 0 || opt.cardinality == 0) {
+    throw std::runtime_error("bench: records, updates, fields and cardinality must be positive");
+  }
+  if (opt.fields > 256) throw std::runtime_error("bench: fields exceeds 256");
+  struct CountAllocations {
+    CountAllocations() { g_count_allocations.store(true, std::memory_order_relaxed); }
+    ~CountAllocations() { g_count_allocations.store(false, std::memory_order_relaxed); }
+  } counting;
+
+  const std::vector<BenchOp> ops = bench_workload(opt);
+  const size_t direct = std::min<size_t>(ops.size(), opt.records);
+  json phases = json::object();
+
+  auto items_of = [&](const BenchOp& op, IngestArena& arena) {
+    std::vector<IngestItem> items;
+    items.reserve(op.values.size());
+    for (uint32_t f = 0; f < op.values.size(); f++) {
+      items.push_back({arena.copy(bench_field_name(f)), arena.copy(bench_canon_value(f, op.values[f]))});
+    }
+    return items;
+  };
+
+  {
+    BenchTimer t;
+    for (size_t i = 0; i < direct; i++) {
+      IngestArena arena;
+      auto items = items_of(ops[i], arena);
+      t.sample([&] { ingest_items(store, ops[i].record_id, ops[i].ts_ms, ops[i].mode, items); });
+    }
+    phases["ingest_items"] = t.report();
+  }
+
+  {
+    const std::string scratch = store_path + ".bench.ndjson";
+    {
+      std::ofstream out(scratch, std::ios::trunc);
+      if (!out) throw std::runtime_error("bench: failed to create " + scratch);
+      for (size_t i = direct; i < ops.size(); i++) {
+        const BenchOp& op = ops[i];
+        json fields = json::object();
+        for (uint32_t f = 0; f < op.values.size(); f++) fields[bench_field_name(f)] = bench_field_json(f, op.values[f]);
+        out << json{{"record_id", op.record_id},
+                    {"ts_ms", op.ts_ms},
+                    {"mode", op.mode == TemporalityMode::EventDriven ? "event" : "observe"},
+                    {"fields", fields}}.dump() << "\n";
+      }
+      if (!out) throw std::runtime_error("bench: failed to write " + scratch);
+    }
+    NdjsonImportOptions io{};
+    io.batch_lines = opt.batch_lines;
+    BenchTimer t;
+    const uint64_t a0 = allocation_count();
+    auto t0 = std::chrono::steady_clock::now();
+    NdjsonImportResult res = ingest_ndjson_file(store, scratch, io);
+    t.total(std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count(), allocation_count() - a0);
+    std::filesystem::remove(scratch);
+    t.ops(res.ingested);
+    phases["ingest_ndjson_file"] = t.report();
+  }
+
+  // Queries draw from their own stream so changing the query count does not
+  // change the data.
+  BenchRng rng(opt.seed ^ 0x9e3779b97f4a7c15ull);
+  const int64_t span = (int64_t)ops.size() * kBenchStepMs;
+  const int64_t width = opt.window_ms > 0 ? opt.window_ms : std::max<int64_t>(kBenchStepMs, span / 1000);
+
+  {
+    BenchTimer t;
+    for (uint64_t q = 0; q < opt.queries; q++) {
+      uint64_t rid = 1 + rng.below(opt.records);
+      int64_t at = kBenchBaseTs + (int64_t)rng.below((uint64_t)span);
+      t.sample([&] { store.snapshot_at(rid, at); });
+    }
+    phases["snapshot_at"] = t.report();
+  }
+
+  {
+    BenchTimer t;
+    uint64_t rows = 0;
+    for (uint64_t q = 0; q < opt.queries; q++) {
+      FactsWindowQuery wq{};
+      wq.t1 = kBenchBaseTs + (int64_t)rng.below((uint64_t)span);
+      wq.t2 = wq.t1 + width;
+      t.sample([&] { store.query_facts_window(wq, [&](const FactView&) { rows++; return true; }); });
+    }
+    json j = t.report();
+    j["rows"] = rows;
+    phases["query_facts_window"] = j;
+  }
+
+  {
+    BenchTimer t;
+    uint64_t rows = 0;
+    for (uint64_t q = 0; q < opt.queries; q++) {
+      uint32_t f = (uint32_t)rng.below(opt.fields);
+      CanonValue cv = bench_canon_value(f, rng.below(opt.cardinality));
+      t.sample([&] { rows += query_eq(store, EqScope::Current, bench_field_name(f), cv).size(); });
+    }
+    json j = t.report();
+    j["rows"] = rows;
+    phases["query_current_eq"] = j;
+  }
+
+  if (sqlite) {
+    RebuildOptions ro{};
+    ro.restart = true;
+    BenchTimer t;
+    RebuildResult res{};
+    t.sample([&] { res = rebuild_current(*sqlite, ro); });
+    json j = t.report();
+    j["rows"] = res.rows;
+    phases["rebuild_current_facts"] = j;
+  }
+
+  uint64_t bytes = path_bytes(store_path);
+  if (sqlite) bytes += path_bytes(store_path + "-wal") + path_bytes(sqlite->segment_dir()) + path_bytes(sqlite->blob_dir());
+
+  return json{
+    {"backend", sqlite ? "sqlite" : "lsm"},
+    {"config", {
+      {"records", opt.records},
+      {"fields", opt.fields},
+      {"updates", opt.updates},
+      {"cardinality", opt.cardinality},
+      {"observe_ratio", opt.observe_ratio},
+      {"out_of_order", opt.out_of_order},
+      {"queries", opt.queries},
+      {"window_ms", width},
+      {"batch_lines", opt.batch_lines},
+      {"seed", opt.seed},
+      {"pragmas", opt.pragmas}
+    }},
+    {"phases", phases},
+    {"db_bytes", bytes}
+  };
+}
+
+// ------------------------------------------------------------
+// Sharded deployment
+//
+// "shards:<dir>" spreads records over N SQLite databases, dir/shard-000.db
+// and on, by a hash of record_id. Each shard is a complete Felix database
+// with its own writer. Field and value identities are content hashes, and
+// every shard must use the same tag map and hash format, so one value has
+// one identity everywhere; field_id and value_id are per shard, which is why
+// sharded output also names the shard. Ingest routes every line to its
+// shard's writer thread. Queries run on one read-only connection per shard
+// in parallel and merge in a fixed order.
+// ------------------------------------------------------------
+
+static constexpr const char* kShardIndexKey = "shard_index";
+static constexpr const char* kShardCountKey = "shard_count";
+
+// FNV-1a over the big-endian id: stable across platforms and releases.
+static uint32_t shard_of(uint64_t record_id, uint32_t shards) {
+  uint8_t b[8];
+  for (int i = 0; i < 8; i++) b[i] = (uint8_t)(record_id >> (56 - 8 * i));
+  return (uint32_t)(fnv1a64(b, sizeof(b)) % shards);
+}
+
+class ShardSet {
+public:
+  // Creates n empty shards in dir; refuses a directory that already has any.
+  static void create(const std::string& dir, uint32_t n) {
+    if (n == 0) throw std::runtime_error("a sharded database needs at least one shard");
+    std::filesystem::create_directories(dir);
+    if (!list(dir).empty()) throw std::runtime_error("shard directory already holds shards: " + dir);
+    for (uint32_t i = 0; i < n; i++) {
+      FelixSqlite s(shard_path(dir, i));
+      s.init_schema();
+      s.meta_set(kShardIndexKey, std::to_string(i));
+      s.meta_set(kShardCountKey, std::to_string(n));
+    }
+  }
+
+  // Checks that the shard files form one complete set in one format.
+  explicit ShardSet(std::string dir) : dir_(std::move(dir)) {
+    const auto files = list(dir_);
+    if (files.empty()) throw std::runtime_error("no shards in " + dir_ + " (run init --shards N)");
+    count_ = (uint32_t)files.size();
+    std::optional<std::pair<TagMapVersion, HashFormatVersion>> format;
+    for (uint32_t i = 0; i < count_; i++) {
+      const std::string file = shard_path(dir_, i);
+      if (!std::filesystem::exists(file)) throw std::runtime_error("missing shard " + file);
+      FelixSqlite s(file, FelixSqlite::OpenMode::ReadOnly);
+      if (s.meta_get(kShardIndexKey) != std::to_string(i) || s.meta_get(kShardCountKey) != std::to_string(count_)) {
+        throw std::runtime_error("shard " + file + " does not belong to a set of " + std::to_string(count_));
+      }
+      std::pair<TagMapVersion, HashFormatVersion> f{s.tag_map(), s.hash_format()};
+      if (format && *format != f) throw std::runtime_error("shard " + file + " uses a different value format");
+      format = f;
+    }
+  }
+
+  uint32_t size() const { return count_; }
+  std::string path(uint32_t i) const { return shard_path(dir_, i); }
+  uint32_t owner(uint64_t record_id) const { return shard_of(record_id, count_); }
+
+  // Runs fn(i) for every shard on its own thread; rethrows the first failure.
+  void parallel(const std::function<void(uint32_t)>& fn) const {
+    std::vector<std::exception_ptr> errs(count_);
+    std::vector<std::thread> threads;
+    threads.reserve(count_);
+    for (uint32_t i = 0; i < count_; i++) {
+      threads.emplace_back([&, i]{
+        try {
+          fn(i);
+        } catch (...) {
+          errs[i] = std::current_exception();
+        }
+      });
+    }
+    for (auto& t : threads) t.join();
+    for (auto& e : errs) {
+      if (e) std::rethrow_exception(e);
+    }
+  }
+
+private:
+  std::string dir_;
+  uint32_t count_{0};
+
+  static std::string shard_path(const std::string& dir, uint32_t i) {
+    std::string num = std::to_string(i);
+    if (num.size() < 3) num.insert(0, 3 - num.size(), '0');
+    return (std::filesystem::path(dir) / ("shard-" + num + ".db")).string();
+  }
+
+  static std::vector<std::string> list(const std::string& dir) {
+    std::vector<std::string> out;
+    if (!std::filesystem::is_directory(dir)) return out;
+    for (const auto& e : std::filesystem::directory_iterator(dir)) {
+      const std::string name = e.path().filename().string();
+      if (name.rfind("shard-", 0) == 0 && name.size() > 9 && name.compare(name.size() - 3, 3, ".db") == 0) {
+        out.push_back(e.path().string());
+      }
+    }
+    return out;
+  }
+};
+
+// Routes NDJSON lines to per-shard writers. The calling thread reads and
+// parses; each shard thread hashes, batches and commits with the same
+// NdjsonBatcher as a single database, so batch_lines, batch_ms and on_error
+// apply per shard. Lines that fail to parse are rejected (bisect) or end
+// the import (reject) as usual.
+static NdjsonImportResult ingest_ndjson_sharded(const ShardSet& shards, const std::string& path,
+                                                const NdjsonImportOptions& opt) {
+  using Chunk = std::vector<NdjsonRecord>;
+  const uint32_t n = shards.size();
+  std::vector<std::unique_ptr<BoundedQueue<Chunk>>> queues;
+  for (uint32_t i = 0; i < n; i++) queues.push_back(std::make_unique<BoundedQueue<Chunk>>(4));
+  std::vector<NdjsonImportResult> results(n);
+  std::vector<std::exception_ptr> errs(n);
+
+  std::vector<std::thread> writers;
+  for (uint32_t i = 0; i < n; i++) {
+    writers.emplace_back([&, i]{
+      try {
+        FelixSqlite store(shards.path(i));
+        store.open_schema();
+        NdjsonBatcher batcher(store, opt);
+        while (auto chunk = queues[i]->pop()) {
+          for (auto& rec : *chunk) {
+            std::string err;
+            try {
+              hash_ingest_items(store.tag_map(), store.hash_format(), rec.items);
+            } catch (const std::exception& e) {
+              err = e.what();
+            }
+            if (err.empty()) batcher.add(std::move(rec));
+            else batcher.reject(rec.lineno, err);
+          }
+        }
+        results[i] = batcher.finish();
+      } catch (...) {
+        errs[i] = std::current_exception();
+      }
+      queues[i]->close();  // a failed shard stops the router
+    });
+  }
+
+  NdjsonImportResult total{};
+  std::exception_ptr router_err;
+  try {
+    NdjsonLineReader in(path);
+    NdjsonLineBlock block;
+    std::vector<Chunk> routed(n);
+    bool open = true;
+    while (open && in.next_block(block, 4096)) {
+      auto arena = std::make_shared<IngestArena>();
+      for (const auto& [lineno, line] : block.lines) {
+        std::string_view trimmed = trim_view(line);
+        if (trimmed.empty()) continue;
+        try {
+          NdjsonRecord rec = parse_ndjson_line(trimmed, lineno, opt.default_mode, arena);
+          routed[shards.owner(rec.record_id)].push_back(std::move(rec));
+        } catch (const std::exception& e) {
+          if (opt.on_error != BatchErrorPolicy::Bisect) throw;
+          total.lines++;
+          total.rejected.emplace_back(lineno, e.what());
+        }
+      }
+      for (uint32_t i = 0; i < n && open; i++) {
+        if (routed[i].empty()) continue;
+        open = queues[i]->push(std::move(routed[i]));
+        routed[i].clear();
+      }
+    }
+  } catch (...) {
+    router_err = std::current_exception();
+  }
+  for (auto& q : queues) q->close();
+  for (auto& t : writers) t.join();
+  if (router_err) std::rethrow_exception(router_err);
+  for (auto& e : errs) {
+    if (e) std::rethrow_exception(e);
+  }
+
+  for (auto& r : results) {
+    total.lines += r.lines;
+    total.ingested += r.ingested;
+    total.batches += r.batches;
+    total.rejected.insert(total.rejected.end(), r.rejected.begin(), r.rejected.end());
+  }
+  std::sort(total.rejected.begin(), total.rejected.end());
+  return total;
+}
+
+// Runs fn against every shard (read-only) and returns the union of the
+// record ids, sorted. Shards hold disjoint records, so nothing repeats.
+static std::vector<uint64_t> gather_records(const ShardSet& shards,
+                                            const std::function<std::vector<uint64_t>(FactStore&)>& fn) {
+  std::vector<std::vector<uint64_t>> parts(shards.size());
+  shards.parallel([&](uint32_t i) {
+    FelixSqlite store(shards.path(i), FelixSqlite::OpenMode::ReadOnly);
+    store.open_schema();
+    parts[i] = fn(store);
+  });
+  std::vector<uint64_t> out;
+  for (auto& p : parts) out.insert(out.end(), p.begin(), p.end());
+  std::sort(out.begin(), out.end(), [](uint64_t a, uint64_t b) { return (int64_t)a < (int64_t)b; });
+  return out;
+}
+
+// facts_window over every shard: each shard streams its window on its own
+// thread, and the caller merges by (ts, record_id). A record lives on one
+// shard, so rows with equal (ts, record_id) come from one stream, still in
+// field_id order; the cursor's field_id is only compared on that shard.
+// limit bounds the merged output.
+static void sharded_facts_window(const ShardSet& shards, const FactsWindowQuery& q,
+                                 const std::function<bool(uint32_t, const FactView&)>& fn) {
+  struct OwnedFact {
+    FactRow fact;
+    std::string field_name;
+    LogicalType type;
+    std::string canon;
+    std::optional<NumericValue> num;
+  };
+  using Batch = std::vector<OwnedFact>;
+  constexpr size_t kBatch = 256;
+  const uint32_t n = shards.size();
+
+  std::vector<std::unique_ptr<BoundedQueue<Batch>>> queues;
+  for (uint32_t i = 0; i < n; i++) queues.push_back(std::make_unique<BoundedQueue<Batch>>(4));
+  std::vector<std::exception_ptr> errs(n);
+  std::vector<std::thread> producers;
+  for (uint32_t i = 0; i < n; i++) {
+    producers.emplace_back([&, i]{
+      try {
+        FelixSqlite store(shards.path(i), FelixSqlite::OpenMode::ReadOnly);
+        store.open_schema();
+        Batch batch;
+        bool open = true;
+        store.query_facts_window(q, [&](const FactView& v) {
+          batch.push_back(OwnedFact{v.fact, std::string(v.field_name), v.type, std::string(v.canon), v.num});
+          if (batch.size() < kBatch) return true;
+          open = queues[i]->push(std::move(batch));
+          batch.clear();
+          return open;
+        });
+        if (open && !batch.empty()) queues[i]->push(std::move(batch));
+      } catch (...) {
+        errs[i] = std::current_exception();
+      }
+      queues[i]->close();
+    });
+  }
+
+  auto stop = [&]{
+    for (auto& qu : queues) qu->close();
+    for (auto& t : producers) t.join();
+  };
+  try {
+    std::vector<Batch> heads(n);
+    std::vector<size_t> pos(n, 0);
+    // Moves shard i to its next row; false once it is exhausted.
+    auto advance = [&](uint32_t i, bool first) {
+      if (!first && ++pos[i] < heads[i].size()) return true;
+      auto b = queues[i]->pop();
+      if (!b || b->empty()) return false;
+      heads[i] = std::move(*b);
+      pos[i] = 0;
+      return true;
+    };
+    auto later = [&](uint32_t a, uint32_t b) {
+      const FactRow& x = heads[a][pos[a]].fact;
+      const FactRow& y = heads[b][pos[b]].fact;
+      if (x.ts_ms != y.ts_ms) return x.ts_ms > y.ts_ms;
+      if (x.record_id != y.record_id) return (int64_t)x.record_id > (int64_t)y.record_id;
+      return a > b;
+    };
+    std::priority_queue<uint32_t, std::vector<uint32_t>, decltype(later)> ready(later);
+    for (uint32_t i = 0; i < n; i++) {
+      if (advance(i, true)) ready.push(i);
+    }
+    uint64_t left = q.limit ? *q.limit : std::numeric_limits<uint64_t>::max();
+    while (!ready.empty() && left > 0) {
+      uint32_t i = ready.top();
+      ready.pop();
+      const OwnedFact& f = heads[i][pos[i]];
+      left--;
+      if (!fn(i, FactView{f.fact, f.field_name, f.type, f.canon, f.num})) break;
+      if (advance(i, false)) ready.push(i);
+    }
+  } catch (...) {
+    stop();
+    throw;
+  }
+  stop();
+  for (auto& e : errs) {
+    if (e) std::rethrow_exception(e);
+  }
+}
+
+// ------------------------------------------------------------
+// CLI
+// ------------------------------------------------------------
+
+static void usage() {
+  std::cerr <<
+    "felixctl <db.sqlite | lsm:dir | shards:dir> <command> [args]\n\n"
+    "Commands:\n"
+    "  init\n"
+    "  ingest <record_id> <ts_ms> <mode:event|observe> Field=type:value [Field=type:value ...] [stats]\n"
+    "  ingest_ndjson <file.ndjson|-> [default_mode:event|observe]   (gzip/zstd input is detected)\n"
+    "                [--batch-lines N] [--batch-ms M] [--on-error reject|bisect] [--threads N]\n"
+    "                [--bulk-load] [stats]\n"
+    "      stats: [--stats] [--stats-interval-ms N] [--stats-format json|prometheus]   (to stderr)\n"
+    "  ingest_binary <file.flxbin|-> [default_mode:event|observe] [--trusted]\n"
+    "                [--batch-lines N] [--batch-ms M] [--on-error reject|bisect] [stats]\n"
+    "  ndjson_to_binary <in.ndjson|-> <out.flxbin|-> [default_mode:event|observe] [--with-hashes]\n"
+    "  stats\n"
+    "  current_eq <field_name> <type:value>\n"
+    "  ever_eq <field_name> <type:value>\n"
+    "  current_range <field_name> [--gt|--ge type:value] [--lt|--le type:value]\n"
+    "  ever_range <field_name> [--gt|--ge type:value] [--lt|--le type:value]\n"
+    "          (int/float bounds match int and float values; text bounds match text)\n"
+    "  facts_window <t1_ms> <t2_ms> [record_id] [--limit N] [--after ts_ms,record_id,field_id]\n"
+    "  history <record_id> [--field name ...] [--from t_ms] [--to t_ms] [--limit N] [--reverse]\n"
+    "          (--limit is per field; --reverse lists newest first)\n"
+    "  aggregate <t1_ms> <t2_ms> [record_id] [--field name] [--bucket-ms N]\n"
+    "  feed [--after seq|head] [--limit N] [--follow [--poll-ms N]]   (facts in ingest order)\n"
+    "  snapshot <record_id> <t_ms>\n"
+    "  snapshot_many <t_ms> <all|lo..hi|id,id,...|->\n"
+    "  rebuild_current [--range-records N] [--threads N] [--verify] [--restart]\n"
+    "  migrate_format [--batch-values N] [--threads N] [--verify]   (legacy v0.2 -> Felix v0.3, resumable)\n"
+    "  checkpoint_build [--interval-ms N] [--min-facts N] [--verify]\n"
+    "  checkpoint_drop\n"
+    "  seal <horizon_ms> [--range-records N] [--vacuum]\n"
+    "  blob_threshold [bytes]   (0 keeps every value inline)\n"
+    "  blob_gc\n"
+    "  bulk_finish\n"
+    "  (shards:dir: init --shards N; ingest_ndjson, ingest, snapshot, history, current_eq, ever_eq,\n"
+    "   current_range, ever_range, facts_window, rebuild_current and stats run across the shards)\n"
+    "  serve [--readers N] [--mode event|observe] [--feed-poll-ms N] [--stats]   (NDJSON requests on stdin)\n"
+    "  bench [--records N] [--fields N] [--updates N] [--cardinality N]\n"
+    "        [--observe-ratio F] [--out-of-order F] [--queries N] [--window-ms N]\n"
+    "        [--batch-lines N] [--seed N] [--pragma name=value ...]   (db path must not exist)\n\n"
+    "Strict typing:\n"
+    "  - CLI values MUST be provided as type:value\n"
+    "  - Types: text|int|float|bool|null|json\n\n"
+    "NDJSON format (per line):\n"
+    "  {\"record_id\":5001,\"ts_ms\":1739539200000,\"mode\":\"event\",\"fields\":{\n"
+    "     \"Age\":{\"t\":\"int\",\"v\":6},\n"
+    "     \"Last Name\":{\"t\":\"text\",\"v\":\"Cat\"},\n"
+    "     \"DeletedField\":{\"t\":\"null\"}\n"
+    "  }}\n";
+}
+
+static CanonValue parse_cli_type_value(std::string_view tv) {
+  auto [type_s, value_s] = split_once(tv, ':');
+  LogicalType t = parse_type(type_s);
+  return canonicalize_typed_value(t, value_s);
+}
+
+// Sets one range bound from gt/ge/lt/le and a type:value; false if op is
+// not one of those.
+static bool set_range_bound(ValueRange& r, std::string_view op, std::string_view typed_value) {
+  if (op != "gt" && op != "ge" && op != "lt" && op != "le") return false;
+  auto& b = (op == "gt" || op == "ge") ? r.lo : r.hi;
+  b = ValueBound{parse_cli_type_value(typed_value), op == "ge" || op == "le"};
+  return true;
+}
+
+// facts_window <t1_ms> <t2_ms> [record_id] [--limit N] [--after ts,rid,fid]
+static bool parse_facts_window_args(int argc, char** argv, FactsWindowQuery& q) {
+  if (argc < 5) return false;
+  q.t1 = std::stoll(argv[3]);
+  q.t2 = std::stoll(argv[4]);
+  int i = 5;
+  if (i < argc && std::string_view(argv[i]).rfind("--", 0) != 0) q.record_id = std::stoull(argv[i++]);
+  for (; i < argc; i++) {
+    std::string_view a = argv[i];
+    if (i + 1 >= argc) return false;
+    if (a == "--limit") {
+      q.limit = std::stoull(argv[++i]);
+    } else if (a == "--after") {
+      // ts_ms,record_id,field_id of the last row already seen
+      std::string_view c = argv[++i];
+      auto c1 = c.find(','), c2 = c.rfind(',');
+      if (c1 == std::string_view::npos || c1 == c2) return false;
+      FactsWindowCursor cur{};
+      cur.ts_ms = std::stoll(std::string(c.substr(0, c1)));
+      cur.record_id = (int64_t)std::stoull(std::string(c.substr(c1 + 1, c2 - c1 - 1)));
+      cur.field_id = (uint32_t)std::stoul(std::string(c.substr(c2 + 1)));
+      q.after = cur;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+// CLI switches shared by the ingest commands.
+struct StatsOptions {
+  bool enabled{false};
+  int64_t interval_ms{0};  // periodic dump while the command runs (0 = final dump only)
+  bool prometheus{false};
+};
+
+// Consumes one stats switch at argv[i]; false if argv[i] is not one.
+static bool parse_stats_flag(int argc, char** argv, int& i, StatsOptions& opt) {
+  std::string_view a = argv[i];
+  if (a == "--stats") {
+    opt.enabled = true;
+    return true;
+  }
+  if (i + 1 >= argc) return false;
+  if (a == "--stats-interval-ms") {
+    opt.enabled = true;
+    opt.interval_ms = std::stoll(argv[++i]);
+    return true;
+  }
+  if (a == "--stats-format") {
+    std::string_view f = argv[++i];
+    if (f != "json" && f != "prometheus") throw std::runtime_error("stats format must be 'json' or 'prometheus'");
+    opt.prometheus = f == "prometheus";
+    return true;
+  }
+  return false;
+}
+
+// <current|ever>_range <field> [--gt|--ge v] [--lt|--le v]
+static bool parse_range_args(int argc, char** argv, ValueRange& r) {
+  if (argc < 4) return false;
+  for (int i = 4; i < argc; i++) {
+    std::string_view a = argv[i];
+    if (i + 1 >= argc || a.substr(0, 2) != "--" || !set_range_bound(r, a.substr(2), argv[i + 1])) return false;
+    i++;
+  }
+  return true;
+}
+
+// rebuild_current [--range-records N] [--threads N] [--verify] [--restart]
+static bool parse_rebuild_args(int argc, char** argv, RebuildOptions& opt) {
+  for (int i = 3; i < argc; i++) {
+    std::string_view a = argv[i];
+    if (a == "--verify") opt.verify_only = true;
+    else if (a == "--restart") opt.restart = true;
+    else if (a == "--range-records" && i + 1 < argc) opt.range_records = std::stoull(argv[++i]);
+    else if (a == "--threads" && i + 1 < argc) opt.threads = (unsigned)std::stoul(argv[++i]);
+    else return false;
+  }
+  return true;
+}
+
+static json current_diff_json(const CurrentDiff& d) {
+  auto row_json = [](const std::optional<FactRow>& f) {
+    if (!f) return json(nullptr);
+    return json{{"value_id", f->value_id}, {"ts_ms", f->ts_ms}};
+  };
+  return json{
+    {"record_id", d.record_id},
+    {"field_id", d.field_id},
+    {"expected", row_json(d.expected)},
+    {"actual", row_json(d.actual)}
+  };
+}
+
+// ingest_ndjson <file> [default_mode] [--batch-lines N] [--batch-ms M]
+// [--on-error P] [--threads N] [--bulk-load] [stats switches]
+static bool parse_ndjson_import_args(int argc, char** argv, NdjsonImportOptions& opt, StatsOptions& stats, bool& bulk) {
+  int i = 4;
+  if (i < argc && std::string_view(argv[i]).rfind("--", 0) != 0) opt.default_mode = parse_mode(argv[i++]);
+  for (; i < argc; i++) {
+    std::string_view a = argv[i];
+    if (a == "--bulk-load") { bulk = true; continue; }
+    if (parse_stats_flag(argc, argv, i, stats)) continue;
+    if (i + 1 >= argc) return false;
+    if (a == "--batch-lines") opt.batch_lines = (size_t)std::stoull(argv[++i]);
+    else if (a == "--batch-ms") opt.batch_ms = std::stoll(argv[++i]);
+    else if (a == "--on-error") opt.on_error = parse_batch_error_policy(argv[++i]);
+    else if (a == "--threads") opt.threads = (unsigned)std::stoul(argv[++i]);
+    else return false;
+  }
+  return true;
+}
+
+static void write_ingest_stats(std::ostream& out, bool prometheus, int64_t elapsed_ms) {
+  if (prometheus) {
+    out << ingest_stats_prometheus() << "\n" << std::flush;
+    return;
+  }
+  json j = ingest_stats_json();
+  j["elapsed_ms"] = elapsed_ms;
+  out << j.dump() << "\n" << std::flush;
+}
+
+// Turns the counters on for one command and dumps them to out every
+// interval_ms from a background thread, plus once more from finish().
+class StatsReporter {
+public:
+  StatsReporter(const StatsOptions& opt, std::ostream& out) : opt_(opt), out_(out) {
+    if (!opt_.enabled) return;
+    g_ingest_stats.enabled.store(true, std::memory_order_relaxed);
+    if (opt_.interval_ms > 0) thread_ = std::thread([this] { loop(); });
+  }
+
+  ~StatsReporter() { stop(); }
+
+  StatsReporter(const StatsReporter&) = delete;
+  StatsReporter& operator=(const StatsReporter&) = delete;
+
+  void finish() {
+    if (!opt_.enabled) return;
+    stop();
+    write_ingest_stats(out_, opt_.prometheus, elapsed_ms());
+  }
+
+private:
+  void loop() {
+    std::unique_lock<std::mutex> lk(mu_);
+    while (!cv_.wait_for(lk, std::chrono::milliseconds(opt_.interval_ms), [this] { return stop_; })) {
+      write_ingest_stats(out_, opt_.prometheus, elapsed_ms());
+    }
+  }
+
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lk(mu_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    if (thread_.joinable()) thread_.join();
+  }
+
+  int64_t elapsed_ms() const {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0_).count();
+  }
+
+  StatsOptions opt_;
+  std::ostream& out_;
+  std::chrono::steady_clock::time_point t0_{std::chrono::steady_clock::now()};
+  std::mutex mu_;
+  std::condition_variable cv_;
+  bool stop_{false};
+  std::thread thread_;
+};
+
+static constexpr const char* kLastIngestStatsKey = "last_ingest_stats";
+
+static int64_t sql_scalar(sqlite3* db, const char* sql) {
+  Stmt st;
+  check_sql(sqlite3_prepare_v2(db, sql, -1, &st.s, nullptr), db, "prepare stats query");
+  int rc = sqlite3_step(st.s);
+  check_sql(rc, db, "stats query step");
+  return rc == SQLITE_ROW ? sqlite3_column_int64(st.s, 0) : 0;
+}
+
+// Table sizes, on-disk size and the counters saved by the last instrumented
+// ingest on this database.
+static json database_stats(FelixSqlite& store) {
+  sqlite3* db = store.handle();
+  json j{
+    {"records", sql_scalar(db, "SELECT COUNT(*) FROM records;")},
+    {"fields", sql_scalar(db, "SELECT COUNT(*) FROM fields;")},
+    {"values", sql_scalar(db, "SELECT COUNT(*) FROM f_values;")},
+    {"live_facts", sql_scalar(db, "SELECT COUNT(*) FROM facts;")},
+    {"sealed_facts", sql_scalar(db, "SELECT COALESCE(SUM(rows), 0) FROM fact_segments;")},
+    {"current_facts", sql_scalar(db, "SELECT COUNT(*) FROM current_facts;")},
+    {"segments", sql_scalar(db, "SELECT COUNT(*) FROM fact_segments;")},
+    {"blob_values", store.has_blob_column() ? sql_scalar(db, "SELECT COUNT(blob_size) FROM f_values;") : 0},
+    {"blob_bytes", store.has_blob_column() ? sql_scalar(db, "SELECT COALESCE(SUM(blob_size), 0) FROM f_values;") : 0},
+    {"db_bytes", path_bytes(store.path()) + path_bytes(store.path() + "-wal") + path_bytes(store.segment_dir()) +
+                 path_bytes(store.blob_dir())},
+    {"feed_seq", store.has_seq_column() ? store.feed_head() : 0}
+  };
+  auto last = store.meta_get(kLastIngestStatsKey);
+  j["last_ingest"] = last ? json::parse(*last) : json(nullptr);
+  return j;
+}
+
+// ------------------------------------------------------------
+// Server mode
+//
+// One JSON request per stdin line, one JSON response per stdout line:
+//   {"id":7,"op":"snapshot","record_id":5001,"ts_ms":2000000000000}
+//   {"id":7,"ok":true,"result":{...}}
+// The process keeps one warm writer connection (statement and identity
+// caches survive across requests) plus a pool of read-only connections.
+// Writes run in arrival order on the writer. Reads run concurrently on the
+// pool and may answer out of order, but a read never starts before every
+// write received ahead of it has committed. Responses echo "id".
+//
+// "subscribe" tails the change feed: every fact past the given seq is pushed
+// as {"id":<subscribe id>,"feed":{...,"seq":N}}, in seq order, right after
+// the write that committed it. Facts written by other processes are picked
+// up every feed_poll_ms.
+// ------------------------------------------------------------
+
+struct ServerOptions {
+  unsigned readers{4};
+  TemporalityMode default_mode{TemporalityMode::EventDriven};
+  int64_t feed_poll_ms{100};
+};
+
+class FelixServer {
+public:
+  FelixServer(FelixSqlite& writer, const ServerOptions& opt, std::ostream& out)
+    : writer_(writer), opt_(opt), out_(out),
+      write_q_(1024), read_q_(std::max(1u, opt.readers) * 64u) {}
+
+  void run(std::istream& in) {
+    std::vector<std::thread> threads;
+    threads.emplace_back([&]{ writer_loop(); });
+    for (unsigned i = 0; i < std::max(1u, opt_.readers); i++) {
+      threads.emplace_back([&]{ reader_loop(); });
+    }
+
+    std::string line;
+    while (std::getline(in, line)) {
+      std::string trimmed = trim_copy(line);
+      if (trimmed.empty()) continue;
+      json req;
+      try {
+        req = json::parse(trimmed);
+        if (!req.is_object() || !req.contains("op")) throw std::runtime_error("request must be an object with \"op\"");
+      } catch (const std::exception& e) {
+        respond(error(json::object(), e.what()));
+        continue;
+      }
+
+      if (is_write_op(req.at("op").get<std::string>())) {
+        {
+          std::lock_guard<std::mutex> lk(mu_);
+          writes_submitted_++;
+        }
+        write_q_.push(std::move(req));
+      } else {
+        uint64_t after;
+        {
+          std::lock_guard<std::mutex> lk(mu_);
+          after = writes_submitted_;
+        }
+        read_q_.push({std::move(req), after});
+      }
+    }
+
+    write_q_.close();
+    read_q_.close();
+    for (auto& t : threads) t.join();
+  }
+
+private:
+  struct ReadJob {
+    json req;
+    uint64_t after_writes{0};
+  };
+
+  struct Subscription {
+    json id;
+    int64_t after{0};  // last seq pushed
+  };
+
+  static constexpr uint64_t kFeedPage = 1024;
+
+  FelixSqlite& writer_;
+  const ServerOptions& opt_;
+  std::ostream& out_;
+  BoundedQueue<json> write_q_;
+  BoundedQueue<ReadJob> read_q_;
+  std::mutex mu_;
+  std::condition_variable writes_cv_;
+  uint64_t writes_submitted_{0};
+  uint64_t writes_done_{0};
+  std::mutex out_mu_;
+  std::vector<Subscription> subs_;  // writer thread only
+
+  // Subscriptions live on the writer so pushes follow writes in order.
+  static bool is_write_op(const std::string& op) {
+    return op == "ingest" || op == "ingest_ndjson" || op == "ingest_binary" || op == "rebuild_current" ||
+           op == "subscribe" || op == "unsubscribe";
+  }
+
+  static json ok(const json& req, json result) {
+    json r{{"ok", true}, {"result", std::move(result)}};
+    if (req.contains("id")) r["id"] = req.at("id");
+    return r;
+  }
 
-private:
-  sqlite3* db_{nullptr};
-  TagMapVersion tagmap_{TagMapVersion::LegacyV02};
-  HashFormatVersion hashfmt_{HashFormatVersion::LegacyNoSep};
-  uint64_t null_value_id_{0};
+  static json error(const json& req, const std::string& what) {
+    json r{{"ok", false}, {"error", what}};
+    if (req.contains("id")) r["id"] = req.at("id");
+    return r;
+  }
 
-  void ensure_meta_table() {
-    exec_sql(db_, "CREATE TABLE IF NOT EXISTS meta (k TEXT PRIMARY KEY, v TEXT NOT NULL);");
+  void respond(const json& r) {
+    std::string line = r.dump();
+    std::lock_guard<std::mutex> lk(out_mu_);
+    out_ << line << "\n" << std::flush;
   }
 
-  std::optional<std::string> meta_get(std::string_view k) {
-    Stmt st;
-    check_sql(sqlite3_prepare_v2(db_, "SELECT v FROM meta WHERE k=?;", -1, &st.s, nullptr), db_, "prepare meta_get");
-    sqlite3_bind_text(st.s, 1, std::string(k).c_str(), -1, SQLITE_TRANSIENT);
-    int rc = sqlite3_step(st.s);
-    if (rc == SQLITE_ROW) {
-      const unsigned char* t = sqlite3_column_text(st.s, 0);
-      return t ? std::optional<std::string>((const char*)t) : std::optional<std::string>("");
+  void writer_loop() {
+    FactDecoder dec(writer_);
+    for (;;) {
+      std::optional<json> req = subs_.empty() || opt_.feed_poll_ms <= 0
+                                  ? write_q_.pop()
+                                  : write_q_.pop_for(std::chrono::milliseconds(opt_.feed_poll_ms));
+      if (!req) {
+        if (write_q_.done()) break;
+        pump_feeds();
+        continue;
+      }
+      try {
+        const std::string op = req->at("op").get<std::string>();
+        respond(ok(*req, op == "subscribe" || op == "unsubscribe" ? handle_subscription(*req) : handle(writer_, dec, *req)));
+      } catch (const std::exception& e) {
+        respond(error(*req, e.what()));
+      }
+      {
+        std::lock_guard<std::mutex> lk(mu_);
+        writes_done_++;
+        writes_cv_.notify_all();
+      }
+      pump_feeds();
     }
-    check_sql(rc, db_, "meta_get step");
-    return std::nullopt;
   }
 
-  void meta_set(std::string_view k, std::string_view v) {
-    Stmt st;
-    check_sql(sqlite3_prepare_v2(db_,
-                                "INSERT INTO meta(k,v) VALUES(?,?) ON CONFLICT(k) DO UPDATE SET v=excluded.v;",
-                                -1, &st.s, nullptr),
-              db_, "prepare meta_set");
-    sqlite3_bind_text(st.s, 1, std::string(k).c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(st.s, 2, std::string(v).c_str(), -1, SQLITE_TRANSIENT);
-    check_sql(sqlite3_step(st.s), db_, "meta_set step");
+  json handle_subscription(const json& req) {
+    if (req.at("op").get<std::string>() == "unsubscribe") {
+      const json id = req.at("subscription");
+      auto n = subs_.size();
+      subs_.erase(std::remove_if(subs_.begin(), subs_.end(), [&](const Subscription& s) { return s.id == id; }),
+                  subs_.end());
+      return json{{"removed", n != subs_.size()}};
+    }
+    if (!req.contains("id")) throw std::runtime_error("subscribe needs an \"id\" to tag pushed facts with");
+    Subscription sub{req.at("id"), req.contains("after") ? req.at("after").get<int64_t>() : writer_.feed_head()};
+    writer_.read_feed(sub.after, 0, [](int64_t, const FactView&) { return true; });  // rejects sealed positions
+    for (const auto& s : subs_) {
+      if (s.id == sub.id) throw std::runtime_error("subscription id is already in use");
+    }
+    subs_.push_back(sub);
+    return json{{"subscription", sub.id}, {"after", sub.after}};
   }
 
-  void load_format_defaults() {
-    auto hv = meta_get("hash_format");
-    auto tv = meta_get("tag_map");
-    if (!hv.has_value() || !tv.has_value()) {
-      tagmap_ = TagMapVersion::LegacyV02;
-      hashfmt_ = HashFormatVersion::LegacyNoSep;
-      return;
+  // Pushes everything committed since each subscription's position. A
+  // subscription that fails is ended with an error tagged with its id.
+  void pump_feeds() {
+    for (auto it = subs_.begin(); it != subs_.end();) {
+      try {
+        for (;;) {
+          uint64_t n = 0;
+          it->after = writer_.read_feed(it->after, kFeedPage, [&](int64_t seq, const FactView& v) {
+            json f = fact_to_json(v);
+            f["seq"] = seq;
+            respond(json{{"id", it->id}, {"feed", std::move(f)}});
+            n++;
+            return true;
+          });
+          if (n < kFeedPage) break;
+        }
+        ++it;
+      } catch (const std::exception& e) {
+        respond(error(json{{"id", it->id}}, e.what()));
+        it = subs_.erase(it);
+      }
     }
-    tagmap_ = (*tv == "felix_v03") ? TagMapVersion::FelixV03 : TagMapVersion::LegacyV02;
-    hashfmt_ = (*hv == "felix_v03_sep") ? HashFormatVersion::FelixV03Sep : HashFormatVersion::LegacyNoSep;
   }
 
-  void ensure_null_value() {
-    CanonValue cv{};
-    cv.logical_type = LogicalType::Null;
-    cv.canon_text = "null";
-    null_value_id_ = get_or_create_value(cv);
-  }
-};
+  void reader_loop() {
+    std::unique_ptr<FelixSqlite> conn;
+    std::string open_error;
+    try {
+      conn = std::make_unique<FelixSqlite>(writer_.path(), FelixSqlite::OpenMode::ReadOnly);
+      conn->open_schema();
+    } catch (const std::exception& e) {
+      open_error = e.what();
+    }
+    std::unique_ptr<FactDecoder> dec;
+    if (conn) dec = std::make_unique<FactDecoder>(*conn);
 
-// ------------------------------------------------------------
-// Engine: temporality policy + ingest
-// ------------------------------------------------------------
+    while (auto job = read_q_.pop()) {
+      {
+        std::unique_lock<std::mutex> lk(mu_);
+        writes_cv_.wait(lk, [&]{ return writes_done_ >= job->after_writes; });
+      }
+      try {
+        if (!conn) throw std::runtime_error(open_error);
+        respond(ok(job->req, handle(*conn, *dec, job->req)));
+      } catch (const std::exception& e) {
+        respond(error(job->req, e.what()));
+      }
+    }
+  }
 
-enum class TemporalityMode { EventDriven, ObservationDriven };
+  json handle(FelixSqlite& store, FactDecoder& dec, const json& req) {
+    const std::string op = req.at("op").get<std::string>();
 
-static inline TemporalityMode parse_mode(std::string_view s) {
-  if (s == "event") return TemporalityMode::EventDriven;
-  if (s == "observe") return TemporalityMode::ObservationDriven;
-  throw std::runtime_error("mode must be 'event' or 'observe'");
-}
+    if (op == "ping") return "pong";
 
-struct IngestItem {
-  std::string field_name;
-  CanonValue value;
-};
+    if (op == "ingest") {
+      NdjsonRecord rec = record_from_json(req, 0, opt_.default_mode, std::make_shared<IngestArena>());
+      hash_ingest_items(store.tag_map(), store.hash_format(), rec.items);
+      ingest_items(store, rec.record_id, rec.ts_ms, rec.mode, rec.items);
+      return json{{"record_id", rec.record_id}};
+    }
 
-static inline std::pair<std::string, std::string> split_once(std::string_view s, char c) {
-  auto pos = s.find(c);
-  if (pos == std::string_view::npos) return {std::string(s), ""};
-  return {std::string(s.substr(0, pos)), std::string(s.substr(pos + 1))};
-}
+    if (op == "ingest_ndjson") {
+      NdjsonImportOptions o{};
+      o.default_mode = opt_.default_mode;
+      if (req.contains("mode")) o.default_mode = parse_mode(req.at("mode").get<std::string>());
+      if (req.contains("batch_lines")) o.batch_lines = req.at("batch_lines").get<size_t>();
+      if (req.contains("batch_ms")) o.batch_ms = req.at("batch_ms").get<int64_t>();
+      if (req.contains("on_error")) o.on_error = parse_batch_error_policy(req.at("on_error").get<std::string>());
+      if (req.contains("threads")) o.threads = req.at("threads").get<unsigned>();
+      const std::string path = req.at("path").get<std::string>();
+      if (path == "-") throw std::runtime_error("ingest_ndjson: stdin carries the request stream; pass a file path");
+      NdjsonImportResult res = ingest_ndjson_file(store, path, o);
+      json rejected = json::array();
+      for (const auto& [ln, err] : res.rejected) rejected.push_back(json{{"line", ln}, {"error", err}});
+      return json{{"lines", res.lines}, {"ingested", res.ingested}, {"transactions", res.batches}, {"rejected", rejected}};
+    }
 
-static inline IngestItem parse_typed_kv(std::string_view token) {
-  // token: FieldName=type:value
-  auto eq = token.find('=');
-  if (eq == std::string_view::npos) throw std::runtime_error("expected Field=type:value");
-  std::string field = trim_copy(token.substr(0, eq));
-  std::string rhs = std::string(token.substr(eq + 1));
+    if (op == "ingest_binary") {
+      NdjsonImportOptions o{};
+      o.default_mode = opt_.default_mode;
+      if (req.contains("mode")) o.default_mode = parse_mode(req.at("mode").get<std::string>());
+      if (req.contains("batch_lines")) o.batch_lines = req.at("batch_lines").get<size_t>();
+      if (req.contains("batch_ms")) o.batch_ms = req.at("batch_ms").get<int64_t>();
+      if (req.contains("on_error")) o.on_error = parse_batch_error_policy(req.at("on_error").get<std::string>());
+      const bool trusted = req.value("trusted", false);
+      const std::string path = req.at("path").get<std::string>();
+      if (path == "-") throw std::runtime_error("ingest_binary: stdin carries the request stream; pass a file path");
+      NdjsonImportResult res = ingest_binary_file(store, path, o, trusted);
+      json rejected = json::array();
+      for (const auto& [n, err] : res.rejected) rejected.push_back(json{{"record", n}, {"error", err}});
+      return json{{"records", res.lines}, {"ingested", res.ingested}, {"transactions", res.batches}, {"rejected", rejected}};
+    }
 
-  auto [type_s, value_s] = split_once(rhs, ':');
-  LogicalType t = parse_type(trim_copy(type_s));
-  CanonValue cv = canonicalize_typed_value(t, std::string_view(value_s));
-  return {field, cv};
-}
+    if (op == "rebuild_current") {
+      RebuildOptions o{};
+      if (req.contains("range_records")) o.range_records = req.at("range_records").get<uint64_t>();
+      if (req.contains("threads")) o.threads = req.at("threads").get<unsigned>();
+      if (req.contains("restart")) o.restart = req.at("restart").get<bool>();
+      RebuildResult res = rebuild_current(store, o);
+      return json{{"ranges", res.ranges}, {"rows", res.rows}, {"resumed", res.resumed}};
+    }
 
-static void ingest_items(FelixSqlite& store,
-                         uint64_t record_id,
-                         int64_t ts_ms,
-                         TemporalityMode mode,
-                         const std::vector<IngestItem>& items) {
-  store.with_tx([&]{
-    store.ensure_record(record_id, ts_ms);
+    if (op == "snapshot") {
+      uint64_t rid = req.at("record_id").get<uint64_t>();
+      int64_t t = req.at("ts_ms").get<int64_t>();
+      return snapshot_to_json(dec, rid, t, store.snapshot_at(rid, t));
+    }
 
-    if (items.size() > 256) throw std::runtime_error("fields per ingest exceeds 256");
-    for (const auto& it : items) {
-      uint32_t fid = store.get_or_create_field(it.field_name);
-      uint64_t vid = store.get_or_create_value(it.value);
+    if (op == "snapshot_many") {
+      int64_t t = req.at("ts_ms").get<int64_t>();
+      json out = json::array();
+      auto emit = [&](uint64_t rid, const std::vector<FactRow>& rows) {
+        out.push_back(snapshot_to_json(dec, rid, t, rows));
+      };
+      if (req.contains("records")) {
+        for (const auto& r : req.at("records")) {
+          uint64_t rid = r.get<uint64_t>();
+          emit(rid, store.snapshot_at(rid, t));
+        }
+      } else if (req.contains("range")) {
+        const json& r = req.at("range");
+        store.snapshot_range({(int64_t)r.at(0).get<uint64_t>(), (int64_t)r.at(1).get<uint64_t>()}, t, emit);
+      } else {
+        store.snapshot_range({std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max()}, t, emit);
+      }
+      return out;
+    }
 
-      if (mode == TemporalityMode::EventDriven) {
-        auto cur = store.get_current(record_id, fid);
-        if (cur && cur->first == vid) continue; // unchanged => no fact
+    if (op == "facts_window") {
+      FactsWindowQuery q{};
+      q.t1 = req.at("t1_ms").get<int64_t>();
+      q.t2 = req.at("t2_ms").get<int64_t>();
+      if (req.contains("record_id")) q.record_id = req.at("record_id").get<uint64_t>();
+      if (req.contains("limit")) q.limit = req.at("limit").get<uint64_t>();
+      if (req.contains("after")) {
+        const json& a = req.at("after");
+        q.after = FactsWindowCursor{a.at("ts_ms").get<int64_t>(), (int64_t)a.at("record_id").get<uint64_t>(),
+                                    a.at("field_id").get<uint32_t>()};
       }
+      json out = json::array();
+      store.query_facts_window(q, [&](const FactView& v) {
+        out.push_back(fact_to_json(v));
+        return true;
+      });
+      return out;
+    }
 
-      FactRow f{};
-      f.record_id = record_id;
-      f.field_id = fid;
-      f.value_id = vid;
-      f.ts_ms = ts_ms;
+    if (op == "history") {
+      HistoryQuery q{};
+      q.record_id = req.at("record_id").get<uint64_t>();
+      if (req.contains("t1_ms")) q.t1 = req.at("t1_ms").get<int64_t>();
+      if (req.contains("t2_ms")) q.t2 = req.at("t2_ms").get<int64_t>();
+      if (req.contains("limit")) q.limit = req.at("limit").get<uint64_t>();
+      if (req.contains("reverse")) q.reverse = req.at("reverse").get<bool>();
+      std::vector<std::string> fields;
+      if (req.contains("fields")) fields = req.at("fields").get<std::vector<std::string>>();
+      json out = json::array();
+      record_history(store, q, fields, [&](const FactView& v) {
+        out.push_back(fact_to_json(v));
+        return true;
+      });
+      return out;
+    }
 
-      store.insert_fact(f);
-      store.upsert_current_if_newer(f);
+    if (op == "aggregate") {
+      AggregateQuery q{};
+      q.t1 = req.at("t1_ms").get<int64_t>();
+      q.t2 = req.at("t2_ms").get<int64_t>();
+      if (req.contains("record_id")) q.record_id = req.at("record_id").get<uint64_t>();
+      if (req.contains("field")) q.field = req.at("field").get<std::string>();
+      if (req.contains("bucket_ms")) q.bucket_ms = req.at("bucket_ms").get<int64_t>();
+      json out = json::array();
+      aggregate_window(store, q, [&](const json& g) { out.push_back(g); });
+      return out;
     }
-  });
-}
 
-// ------------------------------------------------------------
-// NDJSON ingestion format (strictly typed)
-// Each line is one record update:
-// {
-//   "record_id": 5001,
-//   "ts_ms": 1739539200000,
-//   "mode": "event",               // optional, default provided by CLI
-//   "fields": {
-//     "First Name": {"t":"text", "v":"Luke"},
-//     "Age": {"t":"int", "v":6},
-//     "Favorite Animal": {"t":"text", "v":"Sheep Dog"},
-//     "DeletedField": {"t":"null"}
-//   }
-// }
-// ------------------------------------------------------------
+    if (op == "current_eq" || op == "ever_eq") {
+      return query_eq(store, op == "current_eq" ? EqScope::Current : EqScope::Ever,
+                      req.at("field").get<std::string>(), parse_cli_type_value(req.at("value").get<std::string>()));
+    }
 
-static IngestItem item_from_field_json(const std::string& field_name, const json& j) {
-  if (!j.is_object()) throw std::runtime_error("fields.<name> must be an object {t, v}");
-  if (!j.contains("t")) throw std::runtime_error("fields.<name>.t missing");
-  LogicalType t = parse_type(j.at("t").get<std::string>());
+    if (op == "current_range" || op == "ever_range") {
+      ValueRange r;
+      for (const char* k : {"gt", "ge", "lt", "le"}) {
+        if (req.contains(k)) set_range_bound(r, k, req.at(k).get<std::string>());
+      }
+      return query_range(store, op == "current_range" ? EqScope::Current : EqScope::Ever,
+                         req.at("field").get<std::string>(), r);
+    }
 
-  json v = json(nullptr);
-  if (t != LogicalType::Null) {
-    if (!j.contains("v")) throw std::runtime_error("fields.<name>.v missing for non-null");
-    v = j.at("v");
+    if (op == "stats") {
+      json stmts = json::array();
+      for (const auto& st : store.statement_stats()) {
+        stmts.push_back(json{{"sql", st.sql}, {"prepares", st.prepares}, {"steps", st.steps}});
+      }
+      return json{
+        {"statements", stmts},
+        {"field_cache", {{"size", store.field_cache().size()}, {"hits", store.field_cache().hits()},
+                         {"misses", store.field_cache().misses()}}},
+        {"value_cache", {{"size", store.value_cache().size()}, {"hits", store.value_cache().hits()},
+                         {"misses", store.value_cache().misses()}}},
+        {"ingest", ingest_stats_json()}
+      };
+    }
+
+    throw std::runtime_error("unknown op: " + op);
   }
+};
 
-  CanonValue cv = canonicalize_typed_value(t, v);
-  return {field_name, cv};
-}
+namespace felix {
+
+// Commands that only need the FactStore interface, shared by both backends.
+// sqlite is set when the store is a FelixSqlite (for --bulk-load). Returns
+// nullopt if cmd is not one of them.
+static std::optional<int> run_store_command(FactStore& store, FelixSqlite* sqlite,
+                                            const std::string& cmd, int argc, char** argv) {
+  if (cmd == "ingest") {
+    if (argc < 7) { usage(); return 2; }
+    uint64_t record_id = std::stoull(argv[3]);
+    int64_t ts_ms = std::stoll(argv[4]);
+    TemporalityMode mode = parse_mode(argv[5]);
+
+    IngestArena arena;
+    std::vector<IngestItem> items;
+    StatsOptions stats{};
+    for (int i = 6; i < argc; i++) {
+      if (std::string_view(argv[i]).rfind("--", 0) == 0) {
+        if (!parse_stats_flag(argc, argv, i, stats)) { usage(); return 2; }
+        continue;
+      }
+      items.push_back(parse_typed_kv(argv[i], arena));
+    }
 
-static void ingest_ndjson_file(FelixSqlite& store, const std::string& path, TemporalityMode default_mode) {
-  std::ifstream in(path);
-  if (!in) throw std::runtime_error("failed to open ndjson file: " + path);
+    StatsReporter reporter(stats, std::cerr);
+    ingest_items(store, record_id, ts_ms, mode, items);
+    reporter.finish();
+    if (stats.enabled && sqlite) sqlite->meta_set(kLastIngestStatsKey, ingest_stats_json().dump());
+    std::cout << "ok: ingested record " << record_id << "\n";
+    return 0;
+  }
 
-  std::string line;
-  uint64_t lineno = 0;
+  if (cmd == "ingest_ndjson") {
+    if (argc < 4) { usage(); return 2; }
+    std::string file = argv[3];
+    NdjsonImportOptions opt{};
+    StatsOptions stats{};
+    bool bulk = false;
+    if (!parse_ndjson_import_args(argc, argv, opt, stats, bulk)) { usage(); return 2; }
+
+    if (bulk && !sqlite) throw std::runtime_error("--bulk-load needs the sqlite backend");
+    if (sqlite && sqlite->bulk_load_pending() && !bulk) {
+      throw std::runtime_error("database has an unfinished bulk load; continue it with --bulk-load or run bulk_finish");
+    }
+    if (bulk && !sqlite->bulk_load_pending()) sqlite->begin_bulk_load();
+    StatsReporter reporter(stats, std::cerr);
+    NdjsonImportResult res = ingest_ndjson_file(store, file, opt);
+    for (const auto& [ln, err] : res.rejected) {
+      std::cerr << "rejected: line " << ln << ": " << err << "\n";
+    }
+    if (bulk) sqlite->finish_bulk_load();
+    reporter.finish();
+    if (stats.enabled && sqlite) sqlite->meta_set(kLastIngestStatsKey, ingest_stats_json().dump());
+    std::cout << "ok: ingested ndjson " << file << " (" << res.ingested << " lines, "
+              << res.batches << " transactions, " << res.rejected.size() << " rejected)\n";
+    return res.rejected.empty() ? 0 : 1;
+  }
 
-  while (std::getline(in, line)) {
-    if (line.size() > (2u * 1024u * 1024u)) throw std::runtime_error("NDJSON line exceeds 2 MiB");
-    lineno++;
-    std::string trimmed = trim_copy(line);
-    if (trimmed.empty()) continue;
+  if (cmd == "ingest_binary") {
+    if (argc < 4) { usage(); return 2; }
+    std::string file = argv[3];
+    NdjsonImportOptions opt{};
+    StatsOptions stats{};
+    bool trusted = false;
+    int i = 4;
+    if (i < argc && std::string_view(argv[i]).rfind("--", 0) != 0) opt.default_mode = parse_mode(argv[i++]);
+    for (; i < argc; i++) {
+      std::string_view a = argv[i];
+      if (a == "--trusted") { trusted = true; continue; }
+      if (parse_stats_flag(argc, argv, i, stats)) continue;
+      if (i + 1 >= argc) { usage(); return 2; }
+      if (a == "--batch-lines") opt.batch_lines = (size_t)std::stoull(argv[++i]);
+      else if (a == "--batch-ms") opt.batch_ms = std::stoll(argv[++i]);
+      else if (a == "--on-error") opt.on_error = parse_batch_error_policy(argv[++i]);
+      else { usage(); return 2; }
+    }
 
-    json j;
-    try {
-      j = json::parse(trimmed);
-    } catch (const std::exception& e) {
-      throw std::runtime_error("NDJSON parse error at line " + std::to_string(lineno) + ": " + e.what());
+    StatsReporter reporter(stats, std::cerr);
+    NdjsonImportResult res = ingest_binary_file(store, file, opt, trusted);
+    for (const auto& [n, err] : res.rejected) {
+      std::cerr << "rejected: record " << n << ": " << err << "\n";
     }
+    reporter.finish();
+    if (stats.enabled && sqlite) sqlite->meta_set(kLastIngestStatsKey, ingest_stats_json().dump());
+    std::cout << "ok: ingested binary " << file << " (" << res.ingested << " records, "
+              << res.batches << " transactions, " << res.rejected.size() << " rejected)\n";
+    return res.rejected.empty() ? 0 : 1;
+  }
 
-    if (!j.contains("record_id") || !j.contains("ts_ms") || !j.contains("fields")) {
-      throw std::runtime_error("NDJSON line " + std::to_string(lineno) + " must contain record_id, ts_ms, fields");
+  if (cmd == "ndjson_to_binary") {
+    if (argc < 5) { usage(); return 2; }
+    TemporalityMode default_mode = TemporalityMode::EventDriven;
+    bool with_hashes = false;
+    for (int i = 5; i < argc; i++) {
+      std::string_view a = argv[i];
+      if (a == "--with-hashes") with_hashes = true;
+      else if (a.rfind("--", 0) != 0) default_mode = parse_mode(a);
+      else { usage(); return 2; }
     }
+    std::vector<std::pair<uint64_t, std::string>> skipped;
+    uint64_t n = ndjson_to_binary(store, argv[3], argv[4], default_mode, with_hashes, skipped);
+    for (const auto& [ln, err] : skipped) std::cerr << "skipped: line " << ln << ": " << err << "\n";
+    std::cerr << "ok: wrote " << n << " records to " << argv[4] << " (" << skipped.size() << " skipped)\n";
+    return skipped.empty() ? 0 : 1;
+  }
 
-    uint64_t record_id = j.at("record_id").get<uint64_t>();
-    int64_t ts_ms = j.at("ts_ms").get<int64_t>();
-    TemporalityMode mode = default_mode;
-    if (j.contains("mode")) mode = parse_mode(j.at("mode").get<std::string>());
+  if (cmd == "current_eq" || cmd == "ever_eq") {
+    if (argc < 5) { usage(); return 2; }
+    std::string field = argv[3];
+    std::string typed_value = argv[4];
 
-    const json& fields = j.at("fields");
-    if (!fields.is_object()) throw std::runtime_error("fields must be an object at line " + std::to_string(lineno));
+    auto rows = query_eq(store, cmd == "current_eq" ? EqScope::Current : EqScope::Ever,
+                         field, parse_cli_type_value(typed_value));
 
-    std::vector<IngestItem> items;
-    items.reserve(fields.size());
-    for (auto it = fields.begin(); it != fields.end(); ++it) {
-      items.push_back(item_from_field_json(it.key(), it.value()));
+    for (auto rid : rows) std::cout << rid << "\n";
+    return 0;
+  }
+
+  if (cmd == "current_range" || cmd == "ever_range") {
+    ValueRange r;
+    if (!parse_range_args(argc, argv, r)) { usage(); return 2; }
+    auto rows = query_range(store, cmd == "current_range" ? EqScope::Current : EqScope::Ever, argv[3], r);
+    for (auto rid : rows) std::cout << rid << "\n";
+    return 0;
+  }
+
+  if (cmd == "facts_window") {
+    FactsWindowQuery q{};
+    if (!parse_facts_window_args(argc, argv, q)) { usage(); return 2; }
+
+    store.query_facts_window(q, [](const FactView& v) {
+      std::cout << fact_to_json(v).dump() << "\n";
+      return true;
+    });
+    return 0;
+  }
+
+  if (cmd == "history") {
+    if (argc < 4) { usage(); return 2; }
+    HistoryQuery q{};
+    q.record_id = std::stoull(argv[3]);
+    std::vector<std::string> fields;
+    for (int i = 4; i < argc; i++) {
+      std::string_view a = argv[i];
+      if (a == "--reverse") { q.reverse = true; continue; }
+      if (i + 1 >= argc) { usage(); return 2; }
+      if (a == "--field") fields.push_back(argv[++i]);
+      else if (a == "--from") q.t1 = std::stoll(argv[++i]);
+      else if (a == "--to") q.t2 = std::stoll(argv[++i]);
+      else if (a == "--limit") q.limit = std::stoull(argv[++i]);
+      else { usage(); return 2; }
     }
+    record_history(store, q, fields, [](const FactView& v) {
+      std::cout << fact_to_json(v).dump() << "\n";
+      return true;
+    });
+    return 0;
+  }
 
-    ingest_items(store, record_id, ts_ms, mode, items);
+  if (cmd == "aggregate") {
+    if (argc < 5) { usage(); return 2; }
+    AggregateQuery q{};
+    q.t1 = std::stoll(argv[3]);
+    q.t2 = std::stoll(argv[4]);
+    int i = 5;
+    if (i < argc && std::string_view(argv[i]).rfind("--", 0) != 0) q.record_id = std::stoull(argv[i++]);
+    for (; i < argc; i++) {
+      std::string_view a = argv[i];
+      if (i + 1 >= argc) { usage(); return 2; }
+      if (a == "--field") q.field = argv[++i];
+      else if (a == "--bucket-ms") q.bucket_ms = std::stoll(argv[++i]);
+      else { usage(); return 2; }
+    }
+    aggregate_window(store, q, [](const json& g) { std::cout << g.dump() << "\n"; });
+    return 0;
+  }
+
+  if (cmd == "snapshot") {
+    if (argc < 5) { usage(); return 2; }
+    uint64_t rid = std::stoull(argv[3]);
+    int64_t t = std::stoll(argv[4]);
+    auto rows = store.snapshot_at(rid, t);
+    FactDecoder dec(store);
+    std::cout << snapshot_to_json(dec, rid, t, rows).dump(2) << "\n";
+    return 0;
+  }
+
+  if (cmd == "snapshot_many") {
+    if (argc < 5) { usage(); return 2; }
+    int64_t t = std::stoll(argv[3]);
+    snapshot_many(store, t, argv[4], std::cout);
+    return 0;
   }
+
+  return std::nullopt;
 }
 
-// ------------------------------------------------------------
-// Output helpers (NDJSON / JSON)
-// ------------------------------------------------------------
+// bench creates its own store, so it runs before the normal open path.
+static int run_bench_command(const std::string& dbpath, int argc, char** argv) {
+  BenchOptions opt{};
+  for (int i = 3; i < argc; i++) {
+    std::string_view a = argv[i];
+    if (i + 1 >= argc) { usage(); return 2; }
+    if (a == "--records") opt.records = std::stoull(argv[++i]);
+    else if (a == "--fields") opt.fields = (uint32_t)std::stoul(argv[++i]);
+    else if (a == "--updates") opt.updates = std::stoull(argv[++i]);
+    else if (a == "--cardinality") opt.cardinality = std::stoull(argv[++i]);
+    else if (a == "--observe-ratio") opt.observe_ratio = std::stod(argv[++i]);
+    else if (a == "--out-of-order") opt.out_of_order = std::stod(argv[++i]);
+    else if (a == "--queries") opt.queries = std::stoull(argv[++i]);
+    else if (a == "--window-ms") opt.window_ms = std::stoll(argv[++i]);
+    else if (a == "--batch-lines") opt.batch_lines = (size_t)std::stoull(argv[++i]);
+    else if (a == "--seed") opt.seed = std::stoull(argv[++i]);
+    else if (a == "--pragma") opt.pragmas.push_back(argv[++i]);
+    else { usage(); return 2; }
+  }
 
-static json fact_to_json(FelixSqlite& store, const FactRow& f) {
-  FieldRow fr = store.get_field(f.field_id);
-  ValueRow vr = store.get_value(f.value_id);
-  return json{
-    {"record_id", f.record_id},
-    {"field_id", f.field_id},
-    {"field_name", fr.name_canon},
-    {"value_id", f.value_id},
-    {"type", type_to_string(vr.type)},
-    {"canon", vr.canon_text},
-    {"ts_ms", f.ts_ms}
-  };
+  const bool lsm = dbpath.rfind("lsm:", 0) == 0;
+  const std::string path = lsm ? dbpath.substr(4) : dbpath;
+  if (std::filesystem::exists(path)) throw std::runtime_error("bench needs a fresh database path: " + path + " exists");
+
+  json report;
+  if (lsm) {
+    if (!opt.pragmas.empty()) throw std::runtime_error("--pragma needs the sqlite backend");
+    FelixLsm store(path, true);
+    store.init_schema();
+    report = run_benchmark(store, nullptr, path, opt);
+  } else {
+    FelixSqlite store(path);
+    for (const auto& p : opt.pragmas) exec_sql(store.handle(), ("PRAGMA " + p + ";").c_str());
+    store.init_schema();
+    report = run_benchmark(store, &store, path, opt);
+  }
+  std::cout << report.dump(2) << "\n";
+  return 0;
 }
 
-static json snapshot_to_json(FelixSqlite& store, uint64_t record_id, int64_t t, const std::vector<FactRow>& rows) {
-  json out;
-  out["record_id"] = record_id;
-  out["ts_ms"] = t;
-  json fields = json::object();
+// Commands on "shards:<dir>". Record-scoped commands go to the owning
+// shard; the rest fan out to every shard in parallel.
+static int run_sharded_command(const std::string& dir, const std::string& cmd, int argc, char** argv) {
+  if (cmd == "init") {
+    if (argc != 5 || std::string_view(argv[3]) != "--shards") { usage(); return 2; }
+    const uint32_t n = (uint32_t)std::stoul(argv[4]);
+    ShardSet::create(dir, n);
+    std::cout << "ok: initialized " << n << " shards\n";
+    return 0;
+  }
 
-  for (const auto& f : rows) {
-    FieldRow fr = store.get_field(f.field_id);
-    ValueRow vr = store.get_value(f.value_id);
-    fields[fr.name_canon] = json{
-      {"field_id", f.field_id},
-      {"value_id", f.value_id},
-      {"type", type_to_string(vr.type)},
-      {"canon", vr.canon_text},
-      {"fact_ts_ms", f.ts_ms}
-    };
+  ShardSet shards(dir);
+
+  if (cmd == "ingest" || cmd == "snapshot" || cmd == "history") {
+    if (argc < 4) { usage(); return 2; }
+    const bool write = cmd == "ingest";
+    FelixSqlite store(shards.path(shards.owner(std::stoull(argv[3]))),
+                      write ? FelixSqlite::OpenMode::ReadWrite : FelixSqlite::OpenMode::ReadOnly);
+    store.open_schema();
+    if (auto rc = run_store_command(store, &store, cmd, argc, argv)) return *rc;
+    usage();
+    return 2;
   }
 
-  out["fields"] = fields;
-  return out;
-}
+  if (cmd == "ingest_ndjson") {
+    if (argc < 4) { usage(); return 2; }
+    std::string file = argv[3];
+    NdjsonImportOptions opt{};
+    StatsOptions stats{};
+    bool bulk = false;
+    if (!parse_ndjson_import_args(argc, argv, opt, stats, bulk)) { usage(); return 2; }
+    if (bulk) throw std::runtime_error("--bulk-load needs a single database");
+    if (opt.threads > 1) throw std::runtime_error("--threads is not used with shards: every shard has its own writer");
+    StatsReporter reporter(stats, std::cerr);
+    NdjsonImportResult res = ingest_ndjson_sharded(shards, file, opt);
+    for (const auto& [ln, err] : res.rejected) {
+      std::cerr << "rejected: line " << ln << ": " << err << "\n";
+    }
+    reporter.finish();
+    std::cout << "ok: ingested ndjson " << file << " (" << res.ingested << " lines, "
+              << res.batches << " transactions, " << res.rejected.size() << " rejected, "
+              << shards.size() << " shards)\n";
+    return res.rejected.empty() ? 0 : 1;
+  }
 
-// ------------------------------------------------------------
-// CLI
-// ------------------------------------------------------------
+  if (cmd == "current_eq" || cmd == "ever_eq") {
+    if (argc < 5) { usage(); return 2; }
+    const std::string field = argv[3];
+    const CanonValue cv = parse_cli_type_value(argv[4]);
+    const EqScope scope = cmd == "current_eq" ? EqScope::Current : EqScope::Ever;
+    for (auto rid : gather_records(shards, [&](FactStore& s) { return query_eq(s, scope, field, cv); })) {
+      std::cout << rid << "\n";
+    }
+    return 0;
+  }
 
-static void usage() {
-  std::cerr <<
-    "felixctl <db.sqlite> <command> [args]\n\n"
-    "Commands:\n"
-    "  init\n"
-    "  ingest <record_id> <ts_ms> <mode:event|observe> Field=type:value [Field=type:value ...]\n"
-    "  ingest_ndjson <file.ndjson> [default_mode:event|observe]\n"
-    "  current_eq <field_name> <type:value>\n"
-    "  ever_eq <field_name> <type:value>\n"
-    "  facts_window <t1_ms> <t2_ms> [record_id]\n"
-    "  snapshot <record_id> <t_ms>\n"
-    "  rebuild_current\n\n"
-    "Strict typing:\n"
-    "  - CLI values MUST be provided as type:value\n"
-    "  - Types: text|int|float|bool|null|json\n\n"
-    "NDJSON format (per line):\n"
-    "  {\"record_id\":5001,\"ts_ms\":1739539200000,\"mode\":\"event\",\"fields\":{\n"
-    "     \"Age\":{\"t\":\"int\",\"v\":6},\n"
-    "     \"Last Name\":{\"t\":\"text\",\"v\":\"Cat\"},\n"
-    "     \"DeletedField\":{\"t\":\"null\"}\n"
-    "  }}\n";
-}
+  if (cmd == "current_range" || cmd == "ever_range") {
+    ValueRange r;
+    if (!parse_range_args(argc, argv, r)) { usage(); return 2; }
+    const std::string field = argv[3];
+    const EqScope scope = cmd == "current_range" ? EqScope::Current : EqScope::Ever;
+    for (auto rid : gather_records(shards, [&](FactStore& s) { return query_range(s, scope, field, r); })) {
+      std::cout << rid << "\n";
+    }
+    return 0;
+  }
 
-static CanonValue parse_cli_type_value(std::string_view tv) {
-  auto [type_s, value_s] = split_once(tv, ':');
-  LogicalType t = parse_type(trim_copy(type_s));
-  return canonicalize_typed_value(t, std::string_view(value_s));
-}
+  if (cmd == "facts_window") {
+    FactsWindowQuery q{};
+    if (!parse_facts_window_args(argc, argv, q)) { usage(); return 2; }
+    sharded_facts_window(shards, q, [](uint32_t shard, const FactView& v) {
+      json j = fact_to_json(v);
+      j["shard"] = shard;
+      std::cout << j.dump() << "\n";
+      return true;
+    });
+    return 0;
+  }
 
-namespace felix {
+  if (cmd == "rebuild_current") {
+    RebuildOptions opt{};
+    if (!parse_rebuild_args(argc, argv, opt)) { usage(); return 2; }
+    std::vector<RebuildResult> results(shards.size());
+    std::mutex out_mu;
+    shards.parallel([&](uint32_t i) {
+      FelixSqlite store(shards.path(i));
+      store.open_schema();
+      results[i] = rebuild_current(store, opt, [&](const CurrentDiff& d) {
+        json j = current_diff_json(d);
+        j["shard"] = i;
+        std::lock_guard<std::mutex> lk(out_mu);
+        std::cout << j.dump() << "\n";
+      });
+    });
+    RebuildResult total{};
+    for (const auto& r : results) {
+      total.ranges += r.ranges;
+      total.rows += r.rows;
+      total.mismatches += r.mismatches;
+      total.resumed = total.resumed || r.resumed;
+    }
+    if (opt.verify_only) {
+      std::cout << "ok: verified current_facts (" << shards.size() << " shards, " << total.ranges << " ranges, "
+                << total.mismatches << " mismatches)\n";
+      return total.mismatches == 0 ? 0 : 1;
+    }
+    std::cout << "ok: rebuilt current_facts (" << shards.size() << " shards, " << total.ranges << " ranges, "
+              << total.rows << " rows" << (total.resumed ? ", resumed" : "") << ")\n";
+    return 0;
+  }
+
+  if (cmd == "stats") {
+    json out = json::array();
+    std::vector<json> per(shards.size());
+    shards.parallel([&](uint32_t i) {
+      FelixSqlite store(shards.path(i), FelixSqlite::OpenMode::ReadOnly);
+      store.open_schema();
+      per[i] = database_stats(store);
+      per[i]["shard"] = i;
+    });
+    for (auto& j : per) out.push_back(std::move(j));
+    std::cout << out.dump(2) << "\n";
+    return 0;
+  }
+
+  throw std::runtime_error("command '" + cmd + "' is not supported on shards");
+}
 
 int run_felix(int argc, char** argv) {
   try {
@@ -1196,7 +9236,29 @@ int run_felix(int argc, char** argv) {
     std::string dbpath = argv[1];
     std::string cmd = argv[2];
 
-    FelixSqlite store(dbpath);
+    if (cmd == "bench") return run_bench_command(dbpath, argc, argv);
+
+    if (dbpath.rfind("shards:", 0) == 0) return run_sharded_command(dbpath.substr(7), cmd, argc, argv);
+
+    // "lsm:<dir>" selects the LSM backend.
+    if (dbpath.rfind("lsm:", 0) == 0) {
+      FelixLsm store(dbpath.substr(4), cmd == "init");
+      if (cmd == "init") {
+        store.init_schema();
+        std::cout << "ok: initialized schema\n";
+        return 0;
+      }
+      store.open_schema();
+      if (auto rc = run_store_command(store, nullptr, cmd, argc, argv)) return *rc;
+      throw std::runtime_error("command '" + cmd + "' is not supported by the lsm backend");
+    }
+
+    // Pure queries run on a read-only connection so they never take the
+    // write lock and can run next to a WAL writer.
+    const bool query_only = cmd == "snapshot" || cmd == "snapshot_many" || cmd == "facts_window" ||
+                            cmd == "history" || cmd == "aggregate" || cmd == "current_eq" || cmd == "ever_eq" ||
+                            cmd == "current_range" || cmd == "ever_range" || cmd == "feed" || cmd == "stats";
+    FelixSqlite store(dbpath, query_only ? FelixSqlite::OpenMode::ReadOnly : FelixSqlite::OpenMode::ReadWrite);
 
     if (cmd == "init") {
       store.init_schema();
@@ -1204,77 +9266,188 @@ int run_felix(int argc, char** argv) {
       return 0;
     }
 
-    store.init_schema();
+    // Runs before open_schema: a database halfway through a migration opens
+    // for nothing else.
+    if (cmd == "migrate_format") {
+      MigrateFormatOptions opt{};
+      for (int i = 3; i < argc; i++) {
+        std::string_view a = argv[i];
+        if (a == "--verify") opt.verify_only = true;
+        else if (a == "--batch-values" && i + 1 < argc) opt.batch_values = std::stoull(argv[++i]);
+        else if (a == "--threads" && i + 1 < argc) opt.threads = (unsigned)std::stoul(argv[++i]);
+        else { usage(); return 2; }
+      }
+      if (store.bulk_load_pending()) {
+        throw std::runtime_error("database has an unfinished bulk load; run bulk_finish first");
+      }
 
-    if (cmd == "ingest") {
-      if (argc < 7) { usage(); return 2; }
-      uint64_t record_id = std::stoull(argv[3]);
-      int64_t ts_ms = std::stoll(argv[4]);
-      TemporalityMode mode = parse_mode(argv[5]);
+      MigrateFormatResult res = migrate_format(store, opt, [](const ValueMismatch& m) {
+        std::cout << json{{"value_id", m.value_id}, {"error", m.error}}.dump() << "\n";
+      });
 
-      std::vector<IngestItem> items;
-      for (int i = 6; i < argc; i++) {
-        items.push_back(parse_typed_kv(argv[i]));
+      if (res.already_current) {
+        std::cout << "ok: database is already in Felix v0.3 format\n";
+        return 0;
       }
-
-      ingest_items(store, record_id, ts_ms, mode, items);
-      std::cout << "ok: ingested record " << record_id << "\n";
+      if (opt.verify_only || res.mismatches > 0) {
+        std::cout << (res.mismatches == 0 ? "ok" : "error") << ": verified " << res.verified << " value hashes ("
+                  << res.mismatches << " mismatches)\n";
+        return res.mismatches == 0 ? 0 : 1;
+      }
+      std::cout << "ok: migrated " << res.values << " values to Felix v0.3 (" << res.batches << " batches"
+                << (res.resumed ? ", resumed" : "") << "), verified " << res.verified << " value hashes, removed "
+                << res.blob_files << " old blob files\n";
       return 0;
     }
 
-    if (cmd == "ingest_ndjson") {
-      if (argc < 4) { usage(); return 2; }
-      std::string file = argv[3];
-      TemporalityMode def = TemporalityMode::EventDriven;
-      if (argc >= 5) def = parse_mode(argv[4]);
-      ingest_ndjson_file(store, file, def);
-      std::cout << "ok: ingested ndjson " << file << "\n";
+    store.open_schema();
+
+    if (cmd == "bulk_finish") {
+      if (!store.bulk_load_pending()) {
+        std::cout << "ok: no bulk load pending\n";
+        return 0;
+      }
+      store.finish_bulk_load();
+      std::cout << "ok: rebuilt indexes and verified integrity\n";
       return 0;
     }
 
-    if (cmd == "current_eq" || cmd == "ever_eq") {
-      if (argc < 5) { usage(); return 2; }
-      std::string field = argv[3];
-      std::string typed_value = argv[4];
+    if (cmd != "ingest_ndjson" && cmd != "stats" && store.bulk_load_pending()) {
+      throw std::runtime_error("database has an unfinished bulk load; run bulk_finish first");
+    }
+
+    if (cmd == "serve") {
+      ServerOptions opt{};
+      for (int i = 3; i < argc; i++) {
+        std::string_view a = argv[i];
+        if (a == "--readers" && i + 1 < argc) opt.readers = (unsigned)std::stoul(argv[++i]);
+        else if (a == "--mode" && i + 1 < argc) opt.default_mode = parse_mode(argv[++i]);
+        else if (a == "--feed-poll-ms" && i + 1 < argc) opt.feed_poll_ms = std::stoll(argv[++i]);
+        else if (a == "--stats") g_ingest_stats.enabled.store(true, std::memory_order_relaxed);
+        else { usage(); return 2; }
+      }
+      FelixServer server(store, opt, std::cout);
+      server.run(std::cin);
+      return 0;
+    }
 
-      uint32_t fid = store.get_or_create_field(field);
-      CanonValue cv = parse_cli_type_value(typed_value);
-      uint64_t vid = store.get_or_create_value(cv);
+    if (auto rc = run_store_command(store, &store, cmd, argc, argv)) return *rc;
 
-      auto rows = (cmd == "current_eq")
-        ? store.query_current_eq(fid, vid)
-        : store.query_ever_eq(fid, vid);
+    if (cmd == "stats") {
+      std::cout << database_stats(store).dump(2) << "\n";
+      return 0;
+    }
 
-      for (auto rid : rows) std::cout << rid << "\n";
+    if (cmd == "feed") {
+      int64_t after = 0;
+      uint64_t left = std::numeric_limits<uint64_t>::max();
+      bool follow = false;
+      int64_t poll_ms = 200;
+      for (int i = 3; i < argc; i++) {
+        std::string_view a = argv[i];
+        if (a == "--follow") follow = true;
+        else if (a == "--after" && i + 1 < argc) {
+          std::string_view v = argv[++i];
+          after = v == "head" ? store.feed_head() : std::stoll(std::string(v));
+        }
+        else if (a == "--limit" && i + 1 < argc) left = std::stoull(argv[++i]);
+        else if (a == "--poll-ms" && i + 1 < argc) poll_ms = std::stoll(argv[++i]);
+        else { usage(); return 2; }
+      }
+      constexpr uint64_t kPage = 1024;
+      while (left > 0) {
+        const uint64_t page = std::min(left, kPage);
+        uint64_t n = 0;
+        after = store.read_feed(after, page, [&](int64_t seq, const FactView& v) {
+          json j = fact_to_json(v);
+          j["seq"] = seq;
+          std::cout << j.dump() << "\n";
+          n++;
+          return true;
+        });
+        std::cout.flush();
+        left -= n;
+        if (n < page) {  // caught up
+          if (!follow) break;
+          std::this_thread::sleep_for(std::chrono::milliseconds(poll_ms));
+        }
+      }
       return 0;
     }
 
-    if (cmd == "facts_window") {
-      if (argc < 5) { usage(); return 2; }
-      int64_t t1 = std::stoll(argv[3]);
-      int64_t t2 = std::stoll(argv[4]);
-      std::optional<uint64_t> rid{};
-      if (argc >= 6) rid = std::stoull(argv[5]);
+    if (cmd == "checkpoint_build") {
+      CheckpointOptions opt{};
+      if (auto iv = store.checkpoint_interval()) opt.interval_ms = *iv;
+      if (auto mf = store.checkpoint_min_facts()) opt.min_facts = *mf;
+      bool verify = false;
+      for (int i = 3; i < argc; i++) {
+        std::string_view a = argv[i];
+        if (a == "--verify") verify = true;
+        else if (a == "--interval-ms" && i + 1 < argc) opt.interval_ms = std::stoll(argv[++i]);
+        else if (a == "--min-facts" && i + 1 < argc) opt.min_facts = std::stoull(argv[++i]);
+        else { usage(); return 2; }
+      }
+
+      CheckpointResult built = build_checkpoints(store, opt);
+      std::cout << "ok: built " << built.checkpoints << " checkpoints over " << built.records << " records\n";
+      if (!verify) return 0;
 
-      auto facts = store.query_facts_window(t1, t2, rid);
-      for (const auto& f : facts) {
-        std::cout << fact_to_json(store, f).dump() << "\n";
+      CheckpointResult res = verify_checkpoints(store, [](uint64_t rid, int64_t cp) {
+        std::cout << json{{"record_id", rid}, {"cp_ts_ms", cp}, {"error", "checkpoint differs from facts"}}.dump() << "\n";
+      });
+      std::cout << "ok: verified " << res.checkpoints << " checkpoints (" << res.mismatches << " mismatches)\n";
+      return res.mismatches == 0 ? 0 : 1;
+    }
+
+    if (cmd == "seal") {
+      if (argc < 4) { usage(); return 2; }
+      SealOptions opt{};
+      opt.horizon_ms = std::stoll(argv[3]);
+      for (int i = 4; i < argc; i++) {
+        std::string_view a = argv[i];
+        if (a == "--vacuum") opt.vacuum = true;
+        else if (a == "--range-records" && i + 1 < argc) opt.range_records = std::stoull(argv[++i]);
+        else { usage(); return 2; }
       }
+      SealResult res = seal_facts(store, opt);
+      std::cout << "ok: sealed " << res.rows << " facts into " << res.segments << " segments ("
+                << res.bytes << " bytes)\n";
+      return 0;
+    }
+
+    if (cmd == "blob_threshold") {
+      if (argc >= 4) store.set_blob_threshold(std::stoull(argv[3]));
+      std::cout << "blob threshold: " << store.blob_threshold() << " bytes\n";
+      return 0;
+    }
+
+    if (cmd == "blob_gc") {
+      BlobGcResult res = gc_blobs(store);
+      std::cout << "ok: removed " << res.files << " unreferenced blobs (" << res.bytes << " bytes)\n";
       return 0;
     }
 
-    if (cmd == "snapshot") {
-      if (argc < 5) { usage(); return 2; }
-      uint64_t rid = std::stoull(argv[3]);
-      int64_t t = std::stoll(argv[4]);
-      auto rows = store.snapshot_at(rid, t);
-      std::cout << snapshot_to_json(store, rid, t, rows).dump(2) << "\n";
+    if (cmd == "checkpoint_drop") {
+      store.drop_checkpoints();
+      std::cout << "ok: dropped state checkpoints\n";
       return 0;
     }
 
     if (cmd == "rebuild_current") {
-      store.rebuild_current_facts();
-      std::cout << "ok: rebuilt current_facts\n";
+      RebuildOptions opt{};
+      if (!parse_rebuild_args(argc, argv, opt)) { usage(); return 2; }
+
+      RebuildResult res = rebuild_current(store, opt, [&](const CurrentDiff& d) {
+        std::cout << current_diff_json(d).dump() << "\n";
+      });
+
+      if (opt.verify_only) {
+        std::cout << "ok: verified current_facts (" << res.ranges << " ranges, "
+                  << res.mismatches << " mismatches)\n";
+        return res.mismatches == 0 ? 0 : 1;
+      }
+      std::cout << "ok: rebuilt current_facts (" << res.ranges << " ranges, " << res.rows << " rows"
+                << (res.resumed ? ", resumed" : "") << ")\n";
       return 0;
     }
 
@@ -0,0 +1,34 @@
+# Shared helpers for the tests/*.sh scripts. Each test runs in its own
+# scratch directory against the binary in $FELIX.
+
+set -euo pipefail
+
+FELIX=$(realpath -m "${FELIX:-./felix}")
+TESTS_DIR=$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)
+
+WORK=$(mktemp -d "${TMPDIR:-/tmp}/felix-test.XXXXXX")
+trap 'rm -rf "$WORK"' EXIT
+cd "$WORK"
+
+fail() {
+  echo "FAIL: $*" >&2
+  exit 1
+}
+
+# expect_same <a> <b> <what>: the two files must be byte-identical.
+expect_same() {
+  cmp -s "$1" "$2" || { diff "$1" "$2" | head -20 >&2; fail "$3"; }
+}
+
+# expect_grep <pattern> <file> <what>
+expect_grep() {
+  grep -q -- "$1" "$2" || { head -20 "$2" >&2; fail "$3"; }
+}
+
+# build_harness <name>: compiles tests/<name>.cpp, which includes felix.cpp
+# to reach its internals, into ./<name>. CXX and FELIX_CXXFLAGS override the
+# compiler and its flags.
+build_harness() {
+  "${CXX:-g++}" -std=c++20 -O1 -pipe -pthread -Wno-deprecated-declarations ${FELIX_CXXFLAGS:-} -I"$TESTS_DIR/.." \
+    "$TESTS_DIR/$1.cpp" -o "$1" -lsqlite3 -lssl -lcrypto -licui18n -licuuc
+}
@@ -0,0 +1,81 @@
+// Fuzzes NdjsonLineScanner against the json::parse path it falls back to:
+// every line the scanner accepts must yield the same record as the DOM.
+// Lines are mutations of a fixed set of well-formed ones, so the run is
+// deterministic. Writes the lines to argv[1] for the CLI side of the test.
+//   ndjson_scanner_fuzz <out.ndjson> [iterations]
+
+namespace felix { int run_felix(int argc, char** argv); }
+#include "felix.cpp"
+
+static bool same_record(const NdjsonRecord& a, const NdjsonRecord& b) {
+  if (a.record_id != b.record_id || a.ts_ms != b.ts_ms || a.mode != b.mode || a.items.size() != b.items.size()) return false;
+  for (size_t i = 0; i < a.items.size(); i++) {
+    const IngestItem& x = a.items.begin()[i];
+    const IngestItem& y = b.items.begin()[i];
+    if (x.field_name != y.field_name || x.value.logical_type != y.value.logical_type || x.value.canon != y.value.canon) return false;
+  }
+  return true;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) return 2;
+  const int iterations = argc > 2 ? std::atoi(argv[2]) : 100000;
+  const std::vector<std::string> seeds = {
+    R"({"record_id":1,"ts_ms":1000,"fields":{"Age":{"t":"int","v":6},"Name":{"t":"text","v":"Cat"}}})",
+    R"({"record_id":2,"ts_ms":1001,"mode":"observe","fields":{"Score":{"t":"float","v":1.5},"Ok":{"t":"bool","v":true}}})",
+    R"({"record_id":3,"ts_ms":1002,"mode":"event","fields":{"Gone":{"t":"null"},"Id":{"t":"uuid","v":"123e4567-e89b-12d3-a456-426614174000"}}})",
+    R"({"record_id":4,"ts_ms":-5,"fields":{"Blob":{"t":"bytes","v":"aGVsbG8="},"Café":{"t":"text","v":"é \"q\" \\ \n"}}})",
+    R"({"fields":{"N":{"v":-12,"t":"int"},"F":{"t":"float","v":-0.0}},"ts_ms":7,"record_id":9007199254740993})",
+    R"( {"record_id":5,"ts_ms":3,"fields":{"T":{"t":"text","v":"Ünïcödé 😀"},"E":{"t":"float","v":2e3}}} )",
+  };
+  const std::string alphabet = "{}[]\",:\\u0123456789abcdefEe+-. \t\xc3\xa9\x80\xff";
+
+  std::ofstream out(argv[1], std::ios::binary);
+  std::mt19937_64 rng(42);
+  uint64_t scanned = 0, fallback = 0, mismatches = 0;
+  for (int it = 0; it < iterations; it++) {
+    std::string line = seeds[rng() % seeds.size()];
+    const int muts = (int)(rng() % 4);
+    for (int m = 0; m < muts; m++) {
+      const size_t pos = rng() % (line.size() + 1);
+      const char c = alphabet[rng() % alphabet.size()];
+      switch (rng() % 3) {
+        case 0: if (pos < line.size()) line[pos] = c; break;
+        case 1: line.insert(line.begin() + (std::ptrdiff_t)pos, c); break;
+        default: if (pos < line.size()) line.erase(pos, 1); break;
+      }
+    }
+    if (line.find('\n') != std::string::npos) continue;
+    out << line << '\n';
+
+    const std::string_view trimmed = trim_view(line);
+    auto arena = std::make_shared<IngestArena>();
+    std::optional<NdjsonRecord> dom;
+    try {
+      dom = record_from_json(json::parse(trimmed), 1, TemporalityMode::EventDriven, arena);
+    } catch (const std::exception&) {
+    }
+    std::optional<NdjsonRecord> fast;
+    try {
+      fast = NdjsonLineScanner::local().parse(trimmed, 1, TemporalityMode::EventDriven, arena);
+    } catch (const std::exception&) {
+      // The scanner may reject a line outright only when the DOM rejects it too.
+      if (dom) {
+        mismatches++;
+        std::cerr << "scanner rejected a line the DOM accepts: " << line << "\n";
+      }
+      continue;
+    }
+    if (!fast) {
+      fallback++;
+      continue;
+    }
+    scanned++;
+    if (!dom || !same_record(*dom, *fast)) {
+      mismatches++;
+      std::cerr << "mismatch: " << line << "\n";
+    }
+  }
+  std::cout << "scanned " << scanned << " fallback " << fallback << " mismatches " << mismatches << "\n";
+  return mismatches == 0 && scanned > 0 && fallback > 0 ? 0 : 1;
+}
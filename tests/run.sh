@@ -0,0 +1,23 @@
+#!/bin/bash
+# Runs every tests/test_*.sh against one felix binary:
+#   FELIX=/path/to/felix tests/run.sh [test_name ...]
+
+FELIX=$(realpath -m "${FELIX:-$(dirname "$0")/../felix}")
+export FELIX
+[ -x "$FELIX" ] || { echo "no felix binary at $FELIX (set FELIX)" >&2; exit 2; }
+cd "$(dirname "$0")"
+
+tests=("$@")
+[ ${#tests[@]} -gt 0 ] || tests=(test_*.sh)
+logs=${TMPDIR:-/tmp}
+failed=0
+for t in "${tests[@]}"; do
+  t=${t%.sh}
+  if bash "$t.sh" > "$logs/felix-$t.log" 2>&1; then
+    echo "ok   $t"
+  else
+    echo "FAIL $t (log: $logs/felix-$t.log)"
+    failed=$((failed + 1))
+  fi
+done
+[ $failed -eq 0 ] || { echo "$failed test(s) failed"; exit 1; }
@@ -0,0 +1,100 @@
+// SQLite and LSM backends fed the same input must hold the same facts, down
+// to the payload of every bytes value.
+//   store_equivalence gen <out.ndjson> <records>
+//   store_equivalence compare <db.sqlite> <lsm_dir> <records>
+
+namespace felix { int run_felix(int argc, char** argv); }
+#include "felix.cpp"
+
+static const char kB64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static std::string base64(const std::string& in) {
+  std::string out;
+  size_t i = 0;
+  for (; i + 2 < in.size(); i += 3) {
+    const uint32_t n = (uint8_t)in[i] << 16 | (uint8_t)in[i + 1] << 8 | (uint8_t)in[i + 2];
+    for (int s : {18, 12, 6, 0}) out.push_back(kB64[(n >> s) & 63]);
+  }
+  if (i + 1 == in.size()) {
+    const uint32_t n = (uint8_t)in[i] << 16;
+    out += {kB64[(n >> 18) & 63], kB64[(n >> 12) & 63], '=', '='};
+  } else if (i + 2 == in.size()) {
+    const uint32_t n = (uint8_t)in[i] << 16 | (uint8_t)in[i + 1] << 8;
+    out += {kB64[(n >> 18) & 63], kB64[(n >> 12) & 63], kB64[(n >> 6) & 63], '='};
+  }
+  return out;
+}
+
+static int gen(const char* path, uint64_t records) {
+  std::ofstream out(path);
+  std::mt19937_64 rng(15);
+  for (uint64_t n = 0; n < records * 8; n++) {
+    json fields = json::object();
+    for (int f = 0; f < 4; f++) {
+      const std::string name = "F" + std::to_string(rng() % 8);
+      switch (rng() % 8) {
+        case 0: fields[name] = {{"t", "int"}, {"v", (int64_t)(rng() % 2000) - 1000}}; break;
+        case 1: fields[name] = {{"t", "float"}, {"v", (double)(rng() % 1000) / 8.0}}; break;
+        case 2: fields[name] = {{"t", "bool"}, {"v", rng() % 2 == 0}}; break;
+        case 3: fields[name] = {{"t", "null"}}; break;
+        case 4: fields[name] = {{"t", "text"}, {"v", "t" + std::to_string(rng() % 50) + (rng() % 4 ? "" : " café")}}; break;
+        default: {
+          // Mostly small payloads, some past the SQLite blob threshold.
+          std::string b((size_t)(rng() % 3 ? rng() % 40 : 100 + rng() % 5000), '\0');
+          for (auto& c : b) c = (char)(rng() % (rng() % 2 ? 4 : 256));
+          fields[name] = {{"t", "bytes"}, {"v", base64(b)}};
+        }
+      }
+    }
+    json line = {{"record_id", 1 + rng() % records}, {"ts_ms", (int64_t)(rng() % 100000)},
+                 {"mode", rng() % 3 ? "event" : "observe"}, {"fields", fields}};
+    out << line.dump() << "\n";
+  }
+  return 0;
+}
+
+// One record's history as comparable lines.
+static std::vector<std::string> history(FactStore& store, uint64_t rid) {
+  std::vector<std::string> out;
+  HistoryQuery q{};
+  q.record_id = rid;
+  store.query_history(q, [&](const FactView& v) {
+    std::string line = std::string(v.field_name) + " " + std::to_string(v.fact.ts_ms) + " " +
+                       type_to_string(v.type) + " " + std::string(v.canon);
+    if (v.type == LogicalType::Bytes) {
+      const ValueRow vr = store.get_value(v.fact.value_id);
+      const std::string_view b = vr.bytes();
+      const auto h = sha256_bytes(reinterpret_cast<const uint8_t*>(b.data()), b.size());
+      line += " bytes:" + std::to_string(b.size()) + ":" + hex_lower(h.data(), h.size());
+    }
+    out.push_back(std::move(line));
+    return true;
+  });
+  return out;
+}
+
+static int compare(const char* db, const char* lsm, uint64_t records) {
+  FelixSqlite a(db, FelixSqlite::OpenMode::ReadOnly);
+  FelixLsm b(lsm, false);
+  uint64_t facts = 0, payloads = 0, bad = 0;
+  for (uint64_t rid = 1; rid <= records; rid++) {
+    const auto ha = history(a, rid), hb = history(b, rid);
+    if (ha != hb) {
+      if (bad++ < 5) std::cerr << "record " << rid << " differs (" << ha.size() << " vs " << hb.size() << " facts)\n";
+      continue;
+    }
+    facts += ha.size();
+    for (const auto& l : ha) {
+      if (l.find(" bytes:") != std::string::npos && l.find(" bytes:0:") == std::string::npos) payloads++;
+    }
+  }
+  std::cout << "facts " << facts << " non-empty bytes values " << payloads << " differing records " << bad << "\n";
+  return bad == 0 && facts > 0 && payloads > 0 ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+  if (argc == 4 && std::string(argv[1]) == "gen") return gen(argv[2], std::stoull(argv[3]));
+  if (argc == 5 && std::string(argv[1]) == "compare") return compare(argv[2], argv[3], std::stoull(argv[4]));
+  std::cerr << "usage: store_equivalence gen <out.ndjson> <records> | compare <db> <lsm_dir> <records>\n";
+  return 2;
+}
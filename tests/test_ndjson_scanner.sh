@@ -0,0 +1,21 @@
+#!/bin/bash
+# The NDJSON scanner agrees with the json::parse path on fuzzed lines, and
+# serial and pipelined imports of the same lines commit and reject the same.
+source "$(dirname "$0")/lib.sh"
+
+build_harness ndjson_scanner_fuzz
+./ndjson_scanner_fuzz fuzz.ndjson "${FUZZ_ITERATIONS:-100000}"
+
+import() {
+  "$FELIX" "$1.db" init > /dev/null
+  "$FELIX" "$1.db" ingest_ndjson fuzz.ndjson --batch-lines 64 --on-error bisect "${@:2}" > "$1.out" 2>&1 || true
+  grep '^rejected:' "$1.out" | sort > "$1.rejected" || true
+  "$FELIX" "$1.db" facts_window -9223372036854775807 9223372036854775807 > "$1.facts"
+  "$FELIX" "$1.db" snapshot_many 9223372036854775807 all > "$1.snap"
+}
+import serial
+import piped --threads 4
+expect_same serial.rejected piped.rejected "serial and pipelined imports reject different lines"
+expect_same serial.facts piped.facts "serial and pipelined imports commit different facts"
+expect_same serial.snap piped.snap "serial and pipelined imports end in different state"
+[ -s serial.facts ] || fail "nothing was imported"